@@ -6,8 +6,12 @@
 #include "camera.h"
 #include "shader.h"
 #include "mesh.h"
-
-#include <sys/stat.h>
+#include "parallel.h"
+
+#include <sys/stat.h>
+
+//bones per chunk in the parallel loops, a bone is a few dozens of flops
+#define BONES_GRAIN_SIZE 32
 
 Skeleton::Skeleton()
 {
@@ -22,14 +26,13 @@ Skeleton::Bone* Skeleton::getBone(const char* name)
 	return &bones[it->second];
 }
 
-Matrix44& Skeleton::getBoneMatrix(const char* name, bool local )
+Matrix44 Skeleton::getBoneMatrix(const char* name, bool local )
 {
-	static Matrix44 none;
 	auto it = bones_by_name.find(name);
 	if (it == bones_by_name.end())
-		return none;
+		return Matrix44();
 	if (local)
-		return bones[ it->second ].model;
+		return bones[ it->second ].model.toMatrix();
 	return global_bone_matrices[ it->second ];
 }
 
@@ -40,12 +43,13 @@ void Skeleton::computeFinalBoneMatrices( std::vector<Matrix44>& bone_matrices, M
 	updateGlobalMatrices();
 
 	bone_matrices.resize(mesh->bones_info.size());
-	#pragma omp for  
-	for (int i = 0; i < mesh->bones_info.size(); ++i)
-	{
-		BoneInfo& bone_info = mesh->bones_info[i];
-		bone_matrices[i] = mesh->bind_matrix * bone_info.bind_pose * getBoneMatrix( bone_info.name, false ); //use globals
-	}
+	parallelFor(0, (int)mesh->bones_info.size(), [&](int start, int end) {
+		for (int i = start; i < end; ++i)
+		{
+			BoneInfo& bone_info = mesh->bones_info[i];
+			bone_matrices[i] = mesh->bind_matrix * bone_info.bind_pose * getBoneMatrix(bone_info.name, false); //use globals
+		}
+	}, BONES_GRAIN_SIZE);
 }
 
 void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 layer)
@@ -79,21 +83,20 @@ void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 la
 	}
 
 	//blend bones locally
-	#pragma omp for  
-	for (int i = 0; i < result->num_bones; ++i)
-	{
-		Skeleton::Bone& bone = result->bones[i];
-		Skeleton::Bone& boneA = a->bones[i];
-		Skeleton::Bone& boneB = b->bones[i];
-		if ( layer != 0xFF && !(bone.layer & layer) ) //not in the same layer
-			continue;
-		#pragma omp for  
-		for (int j = 0; j < 16; ++j)
-			bone.model.m[j] = lerp( boneA.model.m[j], boneB.model.m[j], w);
-	}
+	parallelFor(0, result->num_bones, [&](int start, int end) {
+		for (int i = start; i < end; ++i)
+		{
+			Skeleton::Bone& bone = result->bones[i];
+			Skeleton::Bone& boneA = a->bones[i];
+			Skeleton::Bone& boneB = b->bones[i];
+			if (layer != 0xFF && !(bone.layer & layer)) //not in the same layer
+				continue;
+			bone.model = lerp(boneA.model, boneB.model, w);
+		}
+	}, BONES_GRAIN_SIZE);
 }
 
-void Skeleton::renderSkeleton(Camera* camera, Matrix44 model, Vector4 color, bool render_points)
+void Skeleton::renderSkeleton(Camera* camera, const Matrix44& model, const Vector4& color, bool render_points)
 {
 	Mesh m;
 
@@ -126,23 +129,23 @@ void Skeleton::renderSkeleton(Camera* camera, Matrix44 model, Vector4 color, boo
 	shader->disable();
 }
 
-void Skeleton::applyTransformToBones(const char* root, Matrix44 transform)
+void Skeleton::applyTransformToBones(const char* root, const Matrix44& transform)
 {
 	Bone* bone = getBone(root);
 	if (!bone)
 		return;
-	bone->model = bone->model * transform;
+	bone->model.fromMatrix(bone->model.toMatrix() * transform);
 }
 
 void Skeleton::updateGlobalMatrices()
 {
 	//compute global matrices
-	global_bone_matrices[0] = bones[0].model;
+	bones[0].model.toMatrix(global_bone_matrices[0]);
 	//order dependant
 	for (int i = 1; i < num_bones; ++i)
 	{
 		Skeleton::Bone& bone = bones[i];
-		global_bone_matrices[i] = bone.model * global_bone_matrices[ bone.parent ];
+		global_bone_matrices[i] = bone.model.toMatrix() * global_bone_matrices[ bone.parent ];
 	}
 }
 
@@ -194,20 +197,20 @@ void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
 		index2 = 0;
 	float f = v - floor(v);
 
-	Matrix44* k = keyframes + index * num_animated_bones;
-	Matrix44* k2 = keyframes + index2 * num_animated_bones;
+	Transform* k = keyframes + index * num_animated_bones;
+	Transform* k2 = keyframes + index2 * num_animated_bones;
 
 	//compute local bones
-	#pragma omp for  
-	for (int i = 0; i < num_animated_bones; ++i)
-	{
-		int bone_index = bones_map[i];
-		Skeleton::Bone& bone = skeleton.bones[bone_index];
-		if (layers != 0xFF && !(bone.layer & layers))
-			continue;
-		for (int j = 0; j < 16; ++j)
-			bone.model.m[j] = lerp(k[i].m[j], k2[i].m[j], f);
-	}
+	parallelFor(0, num_animated_bones, [&](int start, int end) {
+		for (int i = start; i < end; ++i)
+		{
+			int bone_index = bones_map[i];
+			Skeleton::Bone& bone = skeleton.bones[bone_index];
+			if (layers != 0xFF && !(bone.layer & layers))
+				continue;
+			bone.model = lerp(k[i], k2[i], f);
+		}
+	}, BONES_GRAIN_SIZE);
 
 	skeleton.updateGlobalMatrices();
 }
@@ -299,7 +302,7 @@ bool Animation::writeABIN(const char* filename)
 	fwrite((void*)skeleton.bones, sizeof(skeleton.bones), 1, f);
 
 	//write keyframes
-	fwrite((void*)keyframes, sizeof(Matrix44) * num_keyframes * num_animated_bones, 1, f);
+	fwrite((void*)keyframes, sizeof(Transform) * num_keyframes * num_animated_bones, 1, f);
 
 	fclose(f);
 	return true;
@@ -354,9 +357,9 @@ bool Animation::loadABIN(const char* filename)
 
 	//extract keyframes
 	assert(keyframes == NULL);
-	keyframes = new Matrix44[num_keyframes * num_animated_bones];
-	memcpy( keyframes, pos, sizeof(Matrix44)*num_keyframes * num_animated_bones );
-	pos += sizeof(Matrix44) * num_keyframes * num_animated_bones;
+	keyframes = new Transform[num_keyframes * num_animated_bones];
+	memcpy( keyframes, pos, sizeof(Transform)*num_keyframes * num_animated_bones );
+	pos += sizeof(Transform) * num_keyframes * num_animated_bones;
 
 	//compute bone names map
 	for (int i = 0; i < skeleton.num_bones; ++i)
@@ -423,7 +426,9 @@ bool Animation::loadSKANIM(const char* filename)
 				parent_bone.children[parent_bone.num_children++] = index;
 			}
 
-			pos = fetchMatrix44(pos, bone.model);
+			Matrix44 model;
+			pos = fetchMatrix44(pos, model);
+			bone.model.fromMatrix(model);
 		}
 		else if (type == '@')
 		{
@@ -433,16 +438,20 @@ bool Animation::loadSKANIM(const char* filename)
 				bones_map[j] = bones_map_info[j];
 			num_animated_bones = (int)bones_map_info.size();
 			assert(keyframes == NULL);
-			keyframes = new Matrix44[num_animated_bones * num_keyframes];
+			keyframes = new Transform[num_animated_bones * num_keyframes];
 		}
 		else if (type == 'K')
 		{
 			pos = fetchWord(pos, word);
 			//float time = atof(word);
-			Matrix44* k = keyframes + current_keyframe * num_animated_bones;
+			Transform* k = keyframes + current_keyframe * num_animated_bones;
 			current_keyframe++;
+			Matrix44 model;
 			for (int j = 0; j < num_animated_bones; ++j)
-				pos = fetchMatrix44(pos, *(k + j));
+			{
+				pos = fetchMatrix44(pos, model);
+				k[j].fromMatrix(model);
+			}
 		}
 		else
 			break; //end of file probably
@@ -9,7 +9,7 @@
 
 class Camera;
 
-#define ANIM_BIN_VERSION 3
+#define ANIM_BIN_VERSION 5 //bones and keyframes store a Transform instead of a Matrix44
 
 //defined layers for every body
 enum BODY_LAYERS {
@@ -34,7 +34,7 @@ public:
 	struct Bone {
 		int8 parent;	//id of the parent bone
 		char name[32];	//fixed size bone name
-		Matrix44 model; //local transformation (according to its parent bone)
+		Transform model; //local transformation (according to its parent bone)
 		uint8 layer;	//which layers are assigned to this bone (UPPER_BODY, RIGHT_ARM, etc)
 		uint8 num_children;	//how many child bones
 		int8 children[16]; //list of child bone ids (max 16 children )
@@ -48,11 +48,11 @@ public:
 	Skeleton();
 
 	Bone* getBone(const char* name); //returns the bone pointer
-	Matrix44& getBoneMatrix(const char* name, bool local = true); //returns the local matrix of a bone
-	void applyTransformToBones(const char* root, Matrix44 transform); //given a bone name and matrix, it multiplies the matrix to the bone
+	Matrix44 getBoneMatrix(const char* name, bool local = true); //returns the local matrix of a bone
+	void applyTransformToBones(const char* root, const Matrix44& transform); //given a bone name and matrix, it multiplies the matrix to the bone
 	void updateGlobalMatrices(); //updates the list of global matrices according to the local matrices
 
-	void renderSkeleton(Camera* camera, Matrix44 model, Vector4 color = Vector4(0.5, 0, 0.5, 1), bool render_points = false); //renders the skeleton with lines
+	void renderSkeleton(Camera* camera, const Matrix44& model, const Vector4& color = Vector4(0.5, 0, 0.5, 1), bool render_points = false); //renders the skeleton with lines
 	void computeFinalBoneMatrices(std::vector<Matrix44>& bones, Mesh* mesh); //fills the std::vector with the bones ready for the shader
 	void assignLayer(Bone* bone, uint8 layer); //assigns a layer to a node and all its children
 };
@@ -72,7 +72,7 @@ public:
 	int num_keyframes;
 	int8 bones_map[128]; //maps from keyframe data index to bone
 
-	Matrix44* keyframes;
+	Transform* keyframes; //num_animated_bones per keyframe, interpolated like Transform lerp
 
 	Animation();
 	~Animation();	//we need the dtor to remove the keyframes memory
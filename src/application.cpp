@@ -2,6 +2,8 @@
 #include "utils.h"
 #include "mesh.h"
 #include "texture.h"
+#include "texture_uploader.h"
+#include "texture_atlas.h"
 
 #include "fbo.h"
 #include "shader.h"
@@ -10,17 +12,22 @@
 #include "prefab.h"
 #include "gltf_loader.h"
 #include "renderer.h"
+#include "task.h"
+#include "world_streamer.h"
 
 #include <cmath>
 #include <string>
 #include <cstdio>
+#include <algorithm>
 
 Application* Application::instance = nullptr;
+std::string Application::world_filename;
 
 Camera* camera = nullptr;
 GTR::Scene* scene = nullptr;
 GTR::Prefab* prefab = nullptr;
 GTR::Renderer* renderer = nullptr;
+GTR::WorldStreamer* streamer = nullptr;
 GTR::BaseEntity* selected_entity = nullptr;
 FBO* fbo = nullptr;
 Texture* texture = nullptr;
@@ -55,6 +62,7 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 	if(!Shader::LoadAtlas(shader_atlas_filename))
         exit(1);
     checkGLErrors();
+	Shader::s_fallback = Shader::Get("flat"); //drawn while a program compiles
 
 
 	// Create camera
@@ -66,7 +74,18 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 	//prefab = GTR::Prefab::Get("data/prefabs/gmc/scene.gltf");
 
 	scene = new GTR::Scene();
-	if (!scene->load("data/scene.json"))
+	long load_start = SDL_GetTicks();
+	if (world_filename.size())
+	{
+		streamer = new GTR::WorldStreamer(scene);
+		if (!streamer->open(world_filename.c_str()))
+			exit(1);
+	}
+	else if (!scene->load("data/scene.json", [load_start](GTR::Scene* scene) {
+			std::cout << " + Scene loaded: " << scene->num_entities_loaded << " entities in " << (SDL_GetTicks() - load_start) << "ms" << std::endl;
+			if (renderer)
+				renderer->warmShaders(); //the variants of its materials
+		}))
 		exit(1);
 
 	camera->lookAt(scene->main_camera.eye, scene->main_camera.center, Vector3(0, 1, 0));
@@ -74,6 +93,7 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 
 	//This class will be the one in charge of rendering all 
 	renderer = new GTR::Renderer(); //here so we have opengl ready in constructor
+	renderer->warmShaders();
 
 	//hide the cursor
 	SDL_ShowCursor(!mouse_locked); //hide or show the mouse
@@ -154,6 +174,16 @@ void Application::update(double seconds_elapsed)
 	if (Input::isKeyPressed(SDL_SCANCODE_Q)) camera->moveGlobal(Vector3(0.0f, -1.0f, 0.0f) * speed);
 	if (Input::isKeyPressed(SDL_SCANCODE_E)) camera->moveGlobal(Vector3(0.0f, 1.0f, 0.0f) * speed);
 
+	//load the cells of the world around the camera, the selected entity may be released with its cell
+	if (streamer)
+	{
+		long released = streamer->total_cells_released;
+		streamer->update(camera->eye);
+		if (selected_entity && released != streamer->total_cells_released &&
+			std::find(scene->entities.begin(), scene->entities.end(), selected_entity) == scene->entities.end())
+			selected_entity = nullptr;
+	}
+
 	//to navigate with the mouse fixed in the middle
 	SDL_ShowCursor(!mouse_locked);
 	#ifndef SKIP_IMGUI
@@ -171,10 +201,9 @@ void Application::renderDebugGizmo()
 	if (!selected_entity || !render_debug)
 		return;
 
-	//example of matrix we want to edit, change this to the matrix of your entity
-	Matrix44& matrix = selected_entity->model;
-
 	#ifndef SKIP_IMGUI
+	//a copy of the model, written back with setModel so the entity is flagged as moved
+	Matrix44 matrix = selected_entity->getModel();
 
 	static ImGuizmo::OPERATION mCurrentGizmoOperation(ImGuizmo::TRANSLATE);
 	static ImGuizmo::MODE mCurrentGizmoMode(ImGuizmo::WORLD);
@@ -194,10 +223,11 @@ void Application::renderDebugGizmo()
 		mCurrentGizmoOperation = ImGuizmo::SCALE;
 	float matrixTranslation[3], matrixRotation[3], matrixScale[3];
 	ImGuizmo::DecomposeMatrixToComponents(matrix.m, matrixTranslation, matrixRotation, matrixScale);
-	ImGui::InputFloat3("Tr", matrixTranslation, 3);
-	ImGui::InputFloat3("Rt", matrixRotation, 3);
-	ImGui::InputFloat3("Sc", matrixScale, 3);
-	ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, matrix.m);
+	bool edited = ImGui::InputFloat3("Tr", matrixTranslation, 3);
+	edited |= ImGui::InputFloat3("Rt", matrixRotation, 3);
+	edited |= ImGui::InputFloat3("Sc", matrixScale, 3);
+	if (edited) //like ImGuiMatrix44, recomposing it changes the last bits
+		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, matrix.m);
 
 	if (mCurrentGizmoOperation != ImGuizmo::SCALE)
 	{
@@ -231,6 +261,7 @@ void Application::renderDebugGizmo()
 	ImGuiIO& io = ImGui::GetIO();
 	ImGuizmo::SetRect(0, 0, io.DisplaySize.x, io.DisplaySize.y);
 	ImGuizmo::Manipulate(camera->view_matrix.m, camera->projection_matrix.m, mCurrentGizmoOperation, mCurrentGizmoMode, matrix.m, NULL, useSnap ? &snap.x : NULL);
+	selected_entity->setModel(matrix);
 	#endif
 }
 
@@ -242,8 +273,17 @@ void Application::renderDebugGUI(void)
 
 	//System stats
 	ImGui::Text(getGPUStats().c_str());					   // Display some text (you can use a format strings too)
+	TaskManager::sStats& task_stats = TaskManager::foreground.stats;
+	ImGui::Text("Tasks: %d executed, %d deferred, %.2fms", task_stats.executed, task_stats.deferred, task_stats.time_ms);
+	if (scene->isLoading())
+		ImGui::ProgressBar(scene->getLoadProgress(), ImVec2(-1, 0), "Loading scene");
 
 	ImGui::Checkbox("Wireframe", &render_wireframe);
+	ImGui::Checkbox("Static batching", &renderer->use_static_batching);
+	ImGui::SameLine();
+	if (ImGui::Button("Rebake"))
+		scene->static_batch.build(scene);
+	ImGui::Text("Static batch: %d entities, %d nodes in %d chunks", scene->static_batch.num_entities, scene->static_batch.num_nodes, scene->static_batch.num_chunks);
 	ImGui::ColorEdit3("BG color", scene->background_color.v);
 	ImGui::ColorEdit3("Ambient Light", scene->ambient_light.v);
 
@@ -253,6 +293,52 @@ void Application::renderDebugGUI(void)
 		ImGui::TreePop();
 	}
 
+	//world streaming
+	if (streamer && ImGui::TreeNode(streamer, "World streaming")) {
+		ImGui::SliderFloat("Load radius", &streamer->load_radius, streamer->cell_size, 10000.0f);
+		ImGui::SliderFloat("Unload radius", &streamer->unload_radius, streamer->load_radius, 10000.0f);
+		int budget_mb = int(streamer->memory_budget / (1024 * 1024));
+		if (ImGui::SliderInt("Memory Budget (MB)", &budget_mb, 0, 8192))
+			streamer->memory_budget = (size_t)budget_mb * 1024 * 1024;
+		ImGui::Text("Cells: %d loaded, %d loading of %d", streamer->num_loaded_cells, streamer->num_loading_cells, (int)streamer->cells.size());
+		ImGui::Text("Entities: %d  Prefabs: %d (%.1f MBs)%s", streamer->num_entities, (int)GTR::Prefab::sPrefabsLoaded.size(),
+			GTR::Prefab::sMemoryUsed / (1024.0 * 1024.0), streamer->over_budget ? " OVER BUDGET" : "");
+		ImGui::Text("Total: %ld cells loaded, %ld released, %ld prefabs unloaded", streamer->total_cells_loaded, streamer->total_cells_released, streamer->total_prefabs_unloaded);
+		ImGui::TreePop();
+	}
+
+	//shader atlas of the last load or reload
+	if (ImGui::TreeNode(&Shader::s_atlas_stats, "Shaders")) {
+		Shader::sAtlasStats& stats = Shader::s_atlas_stats;
+		ImGui::Checkbox("Use program cache", &Shader::use_binary_cache);
+		if (!Shader::s_binary_supported)
+			ImGui::Text("The driver has no program binary formats");
+		ImGui::Text("Atlas: %d programs, %d from cache, %d compiled, %d rejected in %ld ms", stats.num_programs, stats.from_cache, stats.compiled, stats.rejected, stats.time);
+		ImGui::TreePop();
+	}
+
+	//texture residency
+	if (ImGui::TreeNode(&Texture::sStats, "Textures")) {
+		Texture::sResidencyStats& stats = Texture::sStats;
+		int budget_mb = int(Texture::sVRAMBudget / (1024 * 1024));
+		if (ImGui::SliderInt("VRAM Budget (MB)", &budget_mb, 0, 4096))
+			Texture::sVRAMBudget = (size_t)budget_mb * 1024 * 1024;
+		ImGui::SliderInt("Cancel loads unused for (frames)", &Texture::sStreamingCancelFrames, 0, 1000);
+		ImGui::Checkbox("Use cache", &Texture::use_cache);
+		ImGui::SameLine();
+		ImGui::Checkbox("Compress (BCn)", &Texture::use_compression);
+		ImGui::Text("VRAM: %.1f MBs", stats.vram_used / (1024.0 * 1024.0));
+		ImGui::Text("Textures: %d Degraded: %d Evicted: %d Restreaming: %d", stats.num_textures, stats.num_degraded, stats.num_evicted, stats.num_restreaming);
+		ImGui::Text("Last frame: %d mips dropped, %d evicted. Restreams: %ld", stats.dropped_last_frame, stats.evicted_last_frame, stats.total_restreams);
+		ImGui::Text("Streaming: %d jobs, %d KBs last frame", TextureUploader::num_pending_jobs, int(TextureUploader::bytes_uploaded_last_frame / 1024));
+		ImGui::Checkbox("Pack in atlases when loaded", &TextureAtlas::pack_when_loaded);
+		ImGui::SameLine();
+		if (ImGui::Button("Pack now"))
+			TextureAtlas::PackMaterials();
+		ImGui::Text("Atlases: %d", (int)TextureAtlas::sAtlases.size());
+		ImGui::TreePop();
+	}
+
 	ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.75f, 0.75f, 0.75f, 1.0f));
 
 	//example to show prefab info: first param must be unique!
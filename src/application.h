@@ -13,6 +13,7 @@ class Application
 {
 public:
 	static Application* instance;
+	static std::string world_filename; //streams this world (main --world <scene>) instead of loading data/scene.json
 
 	//window
 	SDL_Window* window;
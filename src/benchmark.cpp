@@ -0,0 +1,1110 @@
+#include "benchmark.h"
+#include "image_kernels.h"
+#include "texture_compressor.h"
+#include "task.h"
+#include "thread_pool.h"
+#include "parallel.h"
+#include "scene.h"
+#include "prefab.h"
+#include "camera.h"
+#include "mesh.h"
+#include "material.h"
+#include "world_streamer.h"
+#include "gltf_loader.h"
+#include "transform_kernels.h"
+#include "renderer.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <atomic>
+#include <thread>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <sstream>
+
+int Benchmark::num_failures = 0;
+
+double Benchmark::measure(const std::function<void()>& func, double min_ms)
+{
+	func(); //warm up caches and lazy tables
+	int iterations = 0;
+	double elapsed = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	do {
+		func();
+		iterations++;
+		elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	} while (elapsed < min_ms);
+	return elapsed / iterations;
+}
+
+void Benchmark::report(const char* name, double ms, double bytes, double items)
+{
+	char line[256];
+	int len = snprintf(line, sizeof(line), "  %-32s %10.3f ms", name, ms);
+	if (bytes)
+		len += snprintf(line + len, sizeof(line) - len, " %10.1f MB/s", bytes / (ms * 0.001) / (1024.0 * 1024.0));
+	if (items)
+		snprintf(line + len, sizeof(line) - len, " %10.2f M/s", items / (ms * 0.001) * 1e-6);
+	std::cout << line << std::endl;
+}
+
+bool Benchmark::reportError(const char* name, double error, double threshold)
+{
+	bool ok = error <= threshold; //NaN fails too
+	if (!ok)
+		num_failures++;
+	char line[256];
+	snprintf(line, sizeof(line), "  %-32s %10.2e %s", name, error, ok ? "OK" : "FAIL");
+	std::cout << line << std::endl;
+	return ok;
+}
+
+//*********************
+
+//runs func with only the given cpu features and with none, returns the largest difference of the outputs (a NaN only matches a NaN)
+template<typename T> static double compareKernelPaths(int features, const std::vector<T>& out, const std::function<void()>& func)
+{
+	int saved = ImageKernels::cpu_features;
+	ImageKernels::cpu_features = 0;
+	func();
+	std::vector<T> reference = out;
+	ImageKernels::cpu_features = features;
+	func();
+	ImageKernels::cpu_features = saved;
+	double error = 0;
+	for (size_t i = 0; i < out.size(); ++i)
+	{
+		double a = out[i], b = reference[i];
+		if (a != b && !(std::isnan(a) && std::isnan(b)))
+			error = std::max(error, std::isnan(a) || std::isnan(b) ? 1.0 : std::fabs(a - b));
+	}
+	return error;
+}
+
+static void checkImageKernelPaths()
+{
+	//odd sizes so the vector loops leave tails for the scalar ones
+	const int width = 1001, height = 67;
+	const size_t count = 100003;
+	std::mt19937 rng(2);
+	std::vector<uint8> rgba(width * height * 4), rgb(count * 3), bytes(count), half_size((width / 2) * (height / 2) * 4), expanded(count * 4);
+	std::vector<float> unit_floats(count), floats(count), wide_floats(count);
+	std::vector<uint16> halfs(count), random_halfs(count);
+	std::uniform_real_distribution<float> unit(-0.5f, 1.5f);
+	std::uniform_real_distribution<float> mantissa(-1.0f, 1.0f);
+	for (auto& v : rgba) v = (uint8)rng();
+	for (auto& v : rgb) v = (uint8)rng();
+	for (auto& v : unit_floats) v = unit(rng);
+	for (auto& v : wide_floats) v = std::ldexp(mantissa(rng), (int)(rng() % 48) - 30); //half denormals to overflow
+	for (auto& v : random_halfs) v = (uint16)rng(); //with infs and NaNs
+
+	//each path only against the kernels it changes, the SSE2 ones are also under the others
+	const int all = ImageKernels::cpu_features;
+	struct sPath { const char* name; int feature; } paths[] = {
+		{ "SSE2", ImageKernels::CPU_SSE2 },
+		{ "SSSE3", ImageKernels::CPU_SSSE3 },
+		{ "AVX2", ImageKernels::CPU_AVX2 },
+		{ "F16C", ImageKernels::CPU_F16C },
+	};
+	for (auto& path : paths)
+	{
+		if (!(all & path.feature))
+		{
+			std::cout << "  " << path.name << " not supported by the CPU, not checked" << std::endl;
+			continue;
+		}
+		int features = ImageKernels::CPU_SSE2 | path.feature;
+		std::string prefix = std::string(path.name) + " vs scalar ";
+		if (path.feature == ImageKernels::CPU_SSE2)
+		{
+			Benchmark::reportError((prefix + "downsampleBox").c_str(), compareKernelPaths(features, half_size, [&]() {
+				ImageKernels::downsampleBox(&rgba[0], width, height, 4, &half_size[0]); }), 0);
+			Benchmark::reportError((prefix + "floatToBytes").c_str(), compareKernelPaths(features, bytes, [&]() {
+				ImageKernels::floatToBytes(&unit_floats[0], count, &bytes[0]); }), 0);
+		}
+		if (path.feature == ImageKernels::CPU_SSSE3)
+			Benchmark::reportError((prefix + "expandRGBtoRGBA").c_str(), compareKernelPaths(features, expanded, [&]() {
+				ImageKernels::expandRGBtoRGBA(&rgb[0], count, &expanded[0]); }), 0);
+		if (path.feature == ImageKernels::CPU_SSE2 || path.feature == ImageKernels::CPU_AVX2)
+			Benchmark::reportError((prefix + "bytesToFloat").c_str(), compareKernelPaths(features, floats, [&]() {
+				ImageKernels::bytesToFloat(&rgb[0], count, &floats[0]); }), 0);
+		if (path.feature == ImageKernels::CPU_F16C)
+		{
+			Benchmark::reportError((prefix + "floatToHalf").c_str(), compareKernelPaths(features, halfs, [&]() {
+				ImageKernels::floatToHalf(&wide_floats[0], count, &halfs[0]); }), 0);
+			Benchmark::reportError((prefix + "halfToFloat").c_str(), compareKernelPaths(features, floats, [&]() {
+				ImageKernels::halfToFloat(&random_halfs[0], count, &floats[0]); }), 0);
+		}
+	}
+}
+
+static void benchImageKernels()
+{
+	const int width = 2048, height = 2048;
+	size_t num_pixels = (size_t)width * height;
+	std::vector<uint8> rgba(num_pixels * 4), rgb(num_pixels * 3), half_size(num_pixels);
+	std::vector<float> floats(num_pixels * 4);
+	std::vector<uint16> halfs(num_pixels * 4);
+	std::mt19937 rng(1);
+	for (auto& v : rgba) v = (uint8)rng();
+	for (auto& v : rgb) v = (uint8)rng();
+
+	int saved_threads = ImageKernels::num_threads;
+	for (int threads : { 1, 0 })
+	{
+		ImageKernels::num_threads = threads;
+		std::cout << (threads == 1 ? " 1 thread:" : " all threads:") << std::endl;
+		double bytes = (double)rgba.size();
+		Benchmark::report("downsampleBox RGBA", Benchmark::measure([&]() { ImageKernels::downsampleBox(&rgba[0], width, height, 4, &half_size[0]); }), bytes, (double)num_pixels);
+		Benchmark::report("downsampleBox RGBA sRGB", Benchmark::measure([&]() { ImageKernels::downsampleBox(&rgba[0], width, height, 4, &half_size[0], true); }), bytes, (double)num_pixels);
+		Benchmark::report("downsampleKaiser RGBA", Benchmark::measure([&]() { ImageKernels::downsampleKaiser(&rgba[0], width, height, 4, &half_size[0]); }), bytes, (double)num_pixels);
+		Benchmark::report("downsampleKaiser RGBA sRGB", Benchmark::measure([&]() { ImageKernels::downsampleKaiser(&rgba[0], width, height, 4, &half_size[0], true); }), bytes, (double)num_pixels);
+		Benchmark::report("expandRGBtoRGBA", Benchmark::measure([&]() { ImageKernels::expandRGBtoRGBA(&rgb[0], num_pixels, &rgba[0]); }), (double)rgb.size(), (double)num_pixels);
+		int map[4] = { 2, 1, 0, ImageKernels::SWIZZLE_ONE };
+		Benchmark::report("swizzle BGR to RGBA", Benchmark::measure([&]() { ImageKernels::swizzle(&rgb[0], num_pixels, 3, &rgba[0], 4, map); }), (double)rgb.size(), (double)num_pixels);
+		Benchmark::report("bytesToFloat", Benchmark::measure([&]() { ImageKernels::bytesToFloat(&rgba[0], rgba.size(), &floats[0]); }), bytes);
+		Benchmark::report("floatToBytes", Benchmark::measure([&]() { ImageKernels::floatToBytes(&floats[0], floats.size(), &rgba[0]); }), bytes * 4);
+		Benchmark::report("floatToHalf", Benchmark::measure([&]() { ImageKernels::floatToHalf(&floats[0], floats.size(), &halfs[0]); }), bytes * 4);
+		Benchmark::report("halfToFloat", Benchmark::measure([&]() { ImageKernels::halfToFloat(&halfs[0], halfs.size(), &floats[0]); }), bytes * 2);
+		Benchmark::report("flipRows", Benchmark::measure([&]() { ImageKernels::flipRows(&rgba[0], height, width * 4); }), bytes);
+	}
+	ImageKernels::num_threads = saved_threads;
+
+	checkImageKernelPaths();
+}
+
+//*********************
+
+//encodes an image with gradients, edges and noise in every format, then decodes the blocks to measure the error
+static void benchTextureCompression()
+{
+	const int width = 512, height = 512;
+	std::vector<uint8> rgba((size_t)width * height * 4);
+	std::mt19937 rng(3);
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+		{
+			uint8* p = &rgba[((size_t)y * width + x) * 4];
+			int noise = (int)(rng() % 17) - 8;
+			bool edge = ((x / 32) + (y / 32)) & 1;
+			p[0] = (uint8)clamp(x / 2 + noise, 0, 255);
+			p[1] = (uint8)clamp(y / 2 + (edge ? 60 : 0) + noise, 0, 255);
+			p[2] = (uint8)clamp(edge ? 200 - x / 4 : 40 + noise, 0, 255);
+			p[3] = (uint8)clamp((x + y) / 4 + noise, 0, 255);
+		}
+
+	//max_rmse is a bit above the error of the current encoder, to catch regressions
+	struct sFormat { const char* name; unsigned int format; int num_components; double max_rmse; } formats[] = {
+		{ "BC1", GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 3, 2.5 },
+		{ "BC3", GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 4, 2.2 },
+		{ "BC4", GL_COMPRESSED_RED_RGTC1, 1, 0.85 },
+		{ "BC5", GL_COMPRESSED_RG_RGTC2, 2, 0.85 },
+		{ "BC7", GL_COMPRESSED_RGBA_BPTC_UNORM, 4, 0.75 },
+	};
+	double bytes = (double)rgba.size();
+	for (auto& f : formats)
+	{
+		std::vector<uint8> compressed(TextureCompressor::getCompressedSize(f.format, width, height));
+		std::string name = std::string("encode ") + f.name;
+		Benchmark::report(name.c_str(), Benchmark::measure([&]() { TextureCompressor::compress(f.format, &rgba[0], width, height, 4, &compressed[0], 1); }), bytes);
+		name += " (all threads)";
+		Benchmark::report(name.c_str(), Benchmark::measure([&]() { TextureCompressor::compress(f.format, &rgba[0], width, height, 4, &compressed[0]); }), bytes);
+
+		int block_bytes = TextureCompressor::getBlockBytes(f.format);
+		double error = 0;
+		uint8 decoded[64];
+		for (int by = 0; by < height / 4; ++by)
+			for (int bx = 0; bx < width / 4; ++bx)
+			{
+				TextureCompressor::decompressBlock(f.format, &compressed[((size_t)by * (width / 4) + bx) * block_bytes], decoded);
+				for (int i = 0; i < 16; ++i)
+				{
+					const uint8* src = &rgba[((size_t)(by * 4 + i / 4) * width + bx * 4 + i % 4) * 4];
+					for (int c = 0; c < f.num_components; ++c)
+						error += (decoded[i * 4 + c] - src[c]) * (decoded[i * 4 + c] - src[c]);
+				}
+			}
+		name = std::string(f.name) + " RMSE";
+		Benchmark::reportError(name.c_str(), sqrt(error / ((double)width * height * f.num_components)), f.max_rmse);
+	}
+}
+
+//*********************
+
+//producers add tasks to a manager drained by this thread, like the main thread does with the foreground one
+static void benchProducers(const char* name, int num_producers, int tasks_per_producer)
+{
+	TaskManager manager;
+	manager.time_budget_ms = 1000;
+	std::atomic<int> counter(0);
+	int total = num_producers * tasks_per_producer;
+	double ms = Benchmark::measure([&]() {
+		counter = 0;
+		std::vector<std::thread> producers;
+		for (int i = 0; i < num_producers; ++i)
+			producers.push_back(std::thread([&]() {
+				for (int j = 0; j < tasks_per_producer; ++j)
+					manager.addTask(new Task([&counter]() { counter.fetch_add(1, std::memory_order_relaxed); }));
+			}));
+		while (counter.load() < total)
+			manager.drainTasks();
+		for (auto& producer : producers)
+			producer.join();
+	});
+	Benchmark::report(name, ms, 0, (double)total);
+}
+
+static void benchTasks()
+{
+	const int num_tasks = 100000;
+	const int batch = 256; //tasks alive at the same time
+	int a = 0, b = 0, c = 0;
+	std::vector<Task*> tasks(batch);
+	Benchmark::report("Task new/delete (pooled)", Benchmark::measure([&]() {
+		for (int i = 0; i < num_tasks; i += batch)
+		{
+			for (auto& task : tasks)
+				task = new Task([&a, &b, &c]() { a++; b++; c++; });
+			for (auto task : tasks)
+				delete task;
+		}
+	}), 0, num_tasks);
+	//what a task cost before: heap block plus the capture of the std::function in the heap
+	std::vector<std::pair<void*, std::function<void()>*>> old_tasks(batch);
+	Benchmark::report("heap + std::function", Benchmark::measure([&]() {
+		for (int i = 0; i < num_tasks; i += batch)
+		{
+			for (auto& task : old_tasks)
+				task = std::make_pair(::operator new(sizeof(Task)), new std::function<void()>([&a, &b, &c]() { a++; b++; c++; }));
+			for (auto& task : old_tasks)
+			{
+				::operator delete(task.first);
+				delete task.second;
+			}
+		}
+	}), 0, num_tasks);
+
+	benchProducers("MPSC 1 producer", 1, num_tasks);
+	benchProducers("MPSC 4 producers", 4, num_tasks / 4);
+	benchProducers("MPSC 16 producers", 16, num_tasks / 16);
+
+	//tasks spawning tasks in the pool, they go to the deques of the workers
+	TaskManager workers;
+	workers.startThread();
+	std::atomic<int> counter(0);
+	Benchmark::report("pool spawn 1000x100", Benchmark::measure([&]() {
+		counter = 0;
+		for (int i = 0; i < 1000; ++i)
+			workers.addTask(new Task([&]() {
+				for (int j = 0; j < 100; ++j)
+					workers.addTask(new Task([&counter]() { counter.fetch_add(1, std::memory_order_relaxed); }));
+			}));
+		while (counter.load() < 1000 * 100)
+			std::this_thread::yield();
+	}), 0, 1000 * 100);
+	workers.pool->stop();
+	std::cout << "  task slabs allocated: " << TaskAllocator::getNumSlabs() << std::endl;
+}
+
+static void benchParallel()
+{
+	const int count = 1 << 22;
+	std::vector<float> values(count), results(count);
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+	for (auto& v : values) v = dist(rng);
+
+	//its own pool, so the thread counts dont depend on the cores of the machine
+	TaskManager workers;
+	workers.startThread(8);
+	TaskManager* saved_manager = Parallel::manager;
+	int saved_threads = Parallel::max_threads;
+	Parallel::manager = &workers;
+	for (int threads : { 1, 2, 4, 8 })
+	{
+		Parallel::max_threads = threads;
+		std::cout << " " << threads << " threads:" << std::endl;
+		//compute bound
+		Benchmark::report("parallelFor sqrt+sin", Benchmark::measure([&]() {
+			parallelFor(0, count, [&](int start, int end) {
+				for (int i = start; i < end; ++i)
+					results[i] = sqrtf(values[i]) * sinf(values[i] * 10.0f);
+			}, 4096);
+		}), 0, (double)count);
+		//memory bound
+		Benchmark::report("parallelReduce sum", Benchmark::measure([&]() {
+			volatile double sum = parallelReduce(0, count, 0.0, [&](int start, int end) {
+				double partial = 0;
+				for (int i = start; i < end; ++i)
+					partial += values[i];
+				return partial;
+			}, [](double a, double b) { return a + b; }, 16384);
+		}), (double)count * sizeof(float), (double)count);
+		//too small chunks, the cost of taking them shows
+		Benchmark::report("parallelFor grain 16", Benchmark::measure([&]() {
+			parallelFor(0, count / 16, [&](int start, int end) {
+				for (int i = start; i < end; ++i)
+					results[i] = values[i] * 2.0f;
+			}, 16);
+		}), 0, (double)count / 16);
+	}
+	Parallel::manager = saved_manager;
+	Parallel::max_threads = saved_threads;
+	workers.pool->stop();
+}
+
+//synthetic scene, entities reuse 100 prefab files
+static void writeBenchScene(const char* filename, int num_entities)
+{
+	FILE* f = fopen(filename, "wb");
+	fprintf(f, "{\n\"background_color\": [0.1,0.1,0.1],\n\"camera_position\": [0,10,50],\n\"entities\": [\n");
+	for (int i = 0; i < num_entities; ++i)
+		fprintf(f, "{\"name\": \"entity%d\", \"type\": \"EMPTY\", \"filename\": \"prefabs/asset%d/scene.gltf\", \"position\": [%d,0,%d], \"angle\": %d, \"scale\": [1,2,1]}%s\n",
+			i, i % 100, i % 1000, i / 1000, i % 360, i + 1 < num_entities ? "," : "");
+	fprintf(f, "]\n}\n");
+	fclose(f);
+}
+
+static void benchScene()
+{
+	//EMPTY entities have no prefab to load, so only the scene itself is measured
+	for (int num_entities : { 10000, 100000 })
+	{
+		std::cout << " " << num_entities << " entities:" << std::endl;
+		const char* json_filename = "bench_scene.json";
+		const char* bin_filename = "bench_scene.json.sbin";
+		writeBenchScene(json_filename, num_entities);
+
+		GTR::SceneBin bin;
+		Benchmark::report("SceneBin::fromJSON", Benchmark::measure([&]() { bin.fromJSON(json_filename); }, 500), 0, num_entities);
+		bin.save(bin_filename, json_filename);
+		Benchmark::report("SceneBin::load (mmap)", Benchmark::measure([&]() {
+			GTR::SceneBin mapped;
+			mapped.load(bin_filename, json_filename);
+			//touch the entities, mapping alone doesnt read the pages
+			float sum = 0;
+			for (int i = 0; i < mapped.info.num_entities; ++i)
+				sum += mapped.entities[i].model.m[12];
+			volatile float result = sum;
+		}), 0, num_entities);
+		GTR::Scene* scene = new GTR::Scene();
+		Benchmark::report("Scene::load from sbin", Benchmark::measure([&]() {
+			scene->clear();
+			scene->load(json_filename);
+		}), 0, num_entities);
+		TaskManager::foreground.drainTasks();
+		scene->clear();
+		delete scene;
+		remove(json_filename);
+		remove(bin_filename);
+	}
+
+	//culling 100k entities: dense arrays of the storage against heap objects visited through pointers
+	const int num_entities = 100000;
+	GTR::Prefab prefab;
+	Mesh mesh;
+	mesh.box = BoundingBox(Vector3(0, 1, 0), Vector3(1, 1, 1));
+	prefab.root.mesh = &mesh;
+	prefab.updateBounding();
+	Camera camera;
+	camera.lookAt(Vector3(0, 50, 500), Vector3(0, 0, 0), Vector3(0, 1, 0));
+	camera.setPerspective(45.0f, 1.0f, 1.0f, 10000.0f);
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> dist(-1000.0f, 1000.0f);
+
+	GTR::EntityStorage storage;
+	struct sHeapEntity {
+		std::string name;
+		Matrix44 model;
+		bool visible;
+		GTR::Prefab* prefab;
+		BoundingBox bounds;
+	};
+	std::vector<sHeapEntity*> heap_entities;
+	for (int i = 0; i < num_entities; ++i)
+	{
+		Matrix44 model;
+		model.setTranslation(dist(rng), 0, dist(rng));
+		int index = storage.getIndex(storage.create(NULL));
+		storage.models[index] = model;
+		storage.prefabs[index] = &prefab;
+		sHeapEntity* ent = new sHeapEntity();
+		ent->name = "entity" + std::to_string(i);
+		ent->model = model;
+		ent->visible = true;
+		ent->prefab = &prefab;
+		heap_entities.push_back(ent);
+	}
+	std::shuffle(heap_entities.begin(), heap_entities.end(), rng); //allocations of a real scene are scattered
+
+	std::vector<uint8> visible(num_entities);
+	Benchmark::report("cull 100k (heap entities)", Benchmark::measure([&]() {
+		for (int i = 0; i < num_entities; ++i)
+		{
+			sHeapEntity* ent = heap_entities[i];
+			if (!ent->visible || !ent->prefab)
+				continue;
+			ent->bounds = transformBoundingBox(ent->model, ent->prefab->bounding);
+			visible[i] = camera.testBoxInFrustum(ent->bounds.center, ent->bounds.halfsize) != CLIP_OUTSIDE;
+		}
+	}), 0, num_entities);
+	Benchmark::report("cull 100k (storage, moving)", Benchmark::measure([&]() {
+		for (auto& flags : storage.flags)
+			flags |= GTR::ENTITY_MOVED;
+		storage.updateBounds(0, storage.size());
+		for (int i = 0; i < storage.size(); ++i)
+			visible[i] = (storage.flags[i] & GTR::ENTITY_VISIBLE) && storage.prefabs[i] &&
+				camera.testBoxInFrustum(storage.bounds[i].center, storage.bounds[i].halfsize) != CLIP_OUTSIDE;
+	}), 0, num_entities);
+	//bounds cached, nothing moved
+	Benchmark::report("cull 100k (storage, static)", Benchmark::measure([&]() {
+		storage.updateBounds(0, storage.size());
+		for (int i = 0; i < storage.size(); ++i)
+			visible[i] = (storage.flags[i] & GTR::ENTITY_VISIBLE) && storage.prefabs[i] &&
+				camera.testBoxInFrustum(storage.bounds[i].center, storage.bounds[i].halfsize) != CLIP_OUTSIDE;
+	}), 0, num_entities);
+	for (auto ent : heap_entities)
+		delete ent;
+
+	//transforms of a prefab of 4096 nodes (8 children per node): recursion every frame against the flat arrays
+	GTR::Prefab tree;
+	std::vector<GTR::Node*> parents = { &tree.root };
+	for (int i = 1; i < 4096; ++i)
+	{
+		GTR::Node* node = new GTR::Node();
+		node->transform = Transform(Vector3(1, 0, 0), Quaternion(Vector3(0, 1, 0), 0.1f));
+		parents[(i - 1) / 8]->addChild(node);
+		parents.push_back(node);
+	}
+	std::function<void(GTR::Node*)> recurse = [&](GTR::Node* node) {
+		node->getGlobalMatrix(true);
+		for (auto child : node->children)
+			recurse(child);
+	};
+	Benchmark::report("prefab 4k nodes recursive", Benchmark::measure([&]() { recurse(&tree.root); }), 0, 4096);
+	tree.updateTransforms();
+	Benchmark::report("prefab 4k nodes flat, static", Benchmark::measure([&]() { tree.updateTransforms(); }), 0, 4096);
+	Benchmark::report("prefab 4k nodes flat, root moved", Benchmark::measure([&]() { tree.root.markDirty(); tree.updateTransforms(); }), 0, 4096);
+	Benchmark::report("prefab 4k nodes flat, leaf moved", Benchmark::measure([&]() { parents.back()->markDirty(); tree.updateTransforms(); }), 0, 4096);
+
+	//culling the nodes of the 4k tree by subtrees must give the same render calls than testing every node
+	GTR::Material tree_material;
+	for (auto node : parents)
+	{
+		node->mesh = &mesh;
+		node->material = &tree_material;
+	}
+	tree.updateTransforms();
+	GTR::EntityStorage tree_storage;
+	std::uniform_real_distribution<float> near_dist(-20.0f, 20.0f);
+	for (int i = 0; i < 16; ++i)
+	{
+		int index = tree_storage.getIndex(tree_storage.create(NULL));
+		tree_storage.models[index].setTranslation(near_dist(rng), near_dist(rng), near_dist(rng));
+		tree_storage.prefabs[index] = &tree;
+	}
+	tree_storage.updateBounds(0, tree_storage.size());
+	GTR::Renderer renderer;
+	std::vector<Matrix44> flat_models;
+	int mismatches = 0;
+	for (int c = 0; c < 100; ++c)
+	{
+		camera.lookAt(Vector3(near_dist(rng), near_dist(rng), near_dist(rng)), Vector3(near_dist(rng), near_dist(rng), near_dist(rng)), Vector3(0, 1, 0));
+		camera.setPerspective(30.0f + (c % 4) * 15.0f, 1.0f, 0.1f, 10.0f + c);
+		for (int i = 0; i < tree_storage.size(); ++i)
+		{
+			const GTR::sInstanceBounds& bounds = tree_storage.instance_bounds[i];
+			renderer.render_calls.clear();
+			renderer.gatherVisibleNodes(tree_storage.models[i], &tree, bounds, &camera, false);
+			flat_models.clear();
+			for (int j = 0; j < (int)tree.flat_nodes.size(); ++j)
+				if (camera.testBoxInFrustum(bounds.nodes[j].center, bounds.nodes[j].halfsize) != CLIP_OUTSIDE)
+					flat_models.push_back(tree.flat_globals[j] * tree_storage.models[i]);
+			bool same = renderer.render_calls.size() == flat_models.size();
+			for (int j = 0; same && j < (int)flat_models.size(); ++j)
+				same = memcmp(renderer.render_calls[j].model.m, flat_models[j].m, sizeof(Matrix44)) == 0;
+			mismatches += !same;
+		}
+	}
+	Benchmark::reportError("gatherVisibleNodes vs every node (100 cameras)", (double)mismatches, 0);
+	camera.lookAt(Vector3(0, 0, 30), Vector3(0, 0, 0), Vector3(0, 1, 0));
+	camera.setPerspective(45.0f, 1.0f, 0.1f, 100.0f);
+	const GTR::sInstanceBounds& tree_bounds = tree_storage.instance_bounds[0];
+	Benchmark::report("gather 4k nodes by subtrees", Benchmark::measure([&]() {
+		renderer.render_calls.clear();
+		renderer.gatherVisibleNodes(tree_storage.models[0], &tree, tree_bounds, &camera, false);
+	}), 0, 4096);
+	Benchmark::report("gather 4k nodes one by one", Benchmark::measure([&]() {
+		flat_models.clear();
+		for (int j = 0; j < (int)tree.flat_nodes.size(); ++j)
+			if (camera.testBoxInFrustum(tree_bounds.nodes[j].center, tree_bounds.nodes[j].halfsize) != CLIP_OUTSIDE)
+				flat_models.push_back(tree.flat_globals[j] * tree_storage.models[0]);
+	}), 0, 4096);
+
+	//static batch of 10k entities of a prefab with 4 cubes and 2 materials, only the bake (the upload needs the GPU)
+	GTR::Prefab house;
+	Mesh cube;
+	cube.createCube(Vector3(2, 2, 2));
+	GTR::Material* materials[2] = { new GTR::Material(), new GTR::Material() };
+	house.root.mesh = &cube;
+	house.root.material = materials[0];
+	for (int i = 0; i < 3; ++i)
+	{
+		GTR::Node* node = new GTR::Node();
+		node->transform.translation.set(0, 2.0f * (i + 1), 0);
+		node->mesh = &cube;
+		node->material = materials[i % 2];
+		house.root.addChild(node);
+	}
+	house.updateBounding();
+	GTR::Scene* scene = new GTR::Scene();
+	for (int i = 0; i < 10000; ++i)
+	{
+		GTR::PrefabEntity* ent = (GTR::PrefabEntity*)scene->createEntity(GTR::PREFAB);
+		ent->setPrefab(&house);
+		Matrix44 model;
+		model.setTranslation((i % 100) * 10.0f, 0, (i / 100) * 10.0f);
+		ent->setModel(model);
+		scene->storage.flags[scene->storage.getIndex(ent->id)] |= GTR::ENTITY_STATIC;
+		scene->addEntity(ent);
+	}
+	GTR::StaticBatch& batch = scene->static_batch;
+	Benchmark::report("static batch bake 10k entities", Benchmark::measure([&]() { batch.bake(scene); }, 500), 0, 10000);
+	std::cout << "  draw calls: " << batch.num_nodes << " nodes -> " << batch.num_chunks << " chunks" << std::endl;
+	Benchmark::report("static batch update 10k, static", Benchmark::measure([&]() { scene->updateBounds(); }), 0, 10000);
+	scene->clear();
+	delete scene;
+	delete materials[0];
+	delete materials[1];
+}
+
+static std::string toBase64(const unsigned char* data, size_t size)
+{
+	const char* table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string result;
+	for (size_t i = 0; i < size; i += 3)
+	{
+		unsigned int v = data[i] << 16;
+		if (i + 1 < size) v |= data[i + 1] << 8;
+		if (i + 2 < size) v |= data[i + 2];
+		result += table[(v >> 18) & 63];
+		result += table[(v >> 12) & 63];
+		result += i + 1 < size ? table[(v >> 6) & 63] : '=';
+		result += i + 2 < size ? table[v & 63] : '=';
+	}
+	return result;
+}
+
+//a box with 24 vertices and 36 indices, the buffer embedded in the file
+static void writeBenchPrefab(const char* filename)
+{
+	std::vector<float> positions, normals;
+	std::vector<unsigned short> indices;
+	for (int axis = 0; axis < 3; ++axis)
+		for (int side = -1; side <= 1; side += 2)
+		{
+			unsigned short first = (unsigned short)(positions.size() / 3);
+			for (int corner = 0; corner < 4; ++corner)
+			{
+				float p[3];
+				p[axis] = (float)side;
+				p[(axis + 1) % 3] = corner & 1 ? 1.0f : -1.0f;
+				p[(axis + 2) % 3] = corner & 2 ? 1.0f : -1.0f;
+				for (int k = 0; k < 3; ++k)
+				{
+					positions.push_back(p[k]);
+					normals.push_back(k == axis ? (float)side : 0.0f);
+				}
+			}
+			unsigned short quad[6] = { 0, 1, 3, 0, 3, 2 };
+			for (int k = 0; k < 6; ++k)
+				indices.push_back(first + quad[side > 0 ? k : 5 - k]);
+		}
+	std::vector<unsigned char> buffer;
+	buffer.insert(buffer.end(), (unsigned char*)&positions[0], (unsigned char*)&positions[0] + positions.size() * 4);
+	buffer.insert(buffer.end(), (unsigned char*)&normals[0], (unsigned char*)&normals[0] + normals.size() * 4);
+	buffer.insert(buffer.end(), (unsigned char*)&indices[0], (unsigned char*)&indices[0] + indices.size() * 2);
+
+	FILE* f = fopen(filename, "wb");
+	fprintf(f, "{\"asset\": {\"version\": \"2.0\"}, \"scene\": 0, \"scenes\": [{\"nodes\": [0]}],\n"
+		"\"nodes\": [{\"name\": \"box\", \"mesh\": 0}],\n"
+		"\"meshes\": [{\"primitives\": [{\"attributes\": {\"POSITION\": 0, \"NORMAL\": 1}, \"indices\": 2, \"material\": 0}]}],\n"
+		"\"materials\": [{\"name\": \"box\"}],\n"
+		"\"buffers\": [{\"byteLength\": %d, \"uri\": \"data:application/octet-stream;base64,%s\"}],\n"
+		"\"bufferViews\": [{\"buffer\": 0, \"byteOffset\": 0, \"byteLength\": 288}, {\"buffer\": 0, \"byteOffset\": 288, \"byteLength\": 288}, {\"buffer\": 0, \"byteOffset\": 576, \"byteLength\": 72}],\n"
+		"\"accessors\": [{\"bufferView\": 0, \"componentType\": 5126, \"count\": 24, \"type\": \"VEC3\", \"min\": [-1,-1,-1], \"max\": [1,1,1]},"
+		" {\"bufferView\": 1, \"componentType\": 5126, \"count\": 24, \"type\": \"VEC3\"}, {\"bufferView\": 2, \"componentType\": 5123, \"count\": 36, \"type\": \"SCALAR\"}]}\n",
+		(int)buffer.size(), toBase64(&buffer[0], buffer.size()).c_str());
+	fclose(f);
+}
+
+//a world of 20x20 km with 100k entities, every area of 500x500 uses other prefabs, walked by a camera
+static void benchStreaming()
+{
+	const int num_assets = 256;
+	const int num_entities = 100000;
+	const float world_size = 20000.0f;
+	for (int i = 0; i < num_assets; ++i)
+		writeBenchPrefab(("bench_stream_asset" + std::to_string(i) + ".gltf").c_str());
+	const char* json_filename = "bench_world.json";
+	FILE* f = fopen(json_filename, "wb");
+	fprintf(f, "{\n\"camera_position\": [0,10,50],\n\"entities\": [\n");
+	int side = (int)sqrt((double)num_entities);
+	float spacing = world_size / side;
+	for (int i = 0; i < num_entities; ++i)
+	{
+		float x = (i % side) * spacing - world_size * 0.5f;
+		float z = (i / side) * spacing - world_size * 0.5f;
+		int area = (int)((x + world_size * 0.5f) / 500.0f) + (int)((z + world_size * 0.5f) / 500.0f) * 40;
+		fprintf(f, "{\"type\": \"PREFAB\", \"filename\": \"bench_stream_asset%d.gltf\", \"position\": [%.1f,0,%.1f]}%s\n",
+			area % num_assets, x, z, i + 1 < num_entities ? "," : "");
+	}
+	fprintf(f, "]\n}\n");
+	fclose(f);
+
+	//no GPU
+	bool upload = Mesh::auto_upload_to_vram;
+	bool textures = load_textures;
+	Mesh::auto_upload_to_vram = false;
+	load_textures = false;
+
+	GTR::Scene* scene = new GTR::Scene();
+	scene->assets_folder = "./";
+	scene->bake_static_batch = false;
+	GTR::WorldStreamer* streamer = new GTR::WorldStreamer(scene);
+	streamer->open(json_filename);
+	streamer->memory_budget = 16 * 1024;
+
+	//the loaders log every file
+	std::stringstream log;
+	std::streambuf* cout_buffer = std::cout.rdbuf(log.rdbuf());
+
+	//diagonal across the world, 10 meters per frame
+	const int num_frames = 2500;
+	double total_ms = 0, max_ms = 0;
+	int max_entities = 0;
+	size_t max_memory = 0;
+	for (int frame = 0; frame < num_frames; ++frame)
+	{
+		float t = frame / (float)(num_frames - 1);
+		Vector3 position(-world_size * 0.45f + t * world_size * 0.9f, 10.0f, -world_size * 0.45f + t * world_size * 0.9f);
+		auto start = std::chrono::high_resolution_clock::now();
+		streamer->update(position);
+		TaskManager::foreground.drainTasks();
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		total_ms += ms;
+		max_ms = std::max(max_ms, ms);
+		max_entities = std::max(max_entities, streamer->num_entities);
+		max_memory = std::max(max_memory, GTR::Prefab::sMemoryUsed);
+	}
+	long cells_loaded = streamer->total_cells_loaded;
+	long cells_released = streamer->total_cells_released;
+	long prefabs_unloaded = streamer->total_prefabs_unloaded;
+
+	//reopening the world while the cells of the start are loading, their tasks must finish before the cells are cleared
+	streamer->update(Vector3(-world_size * 0.45f, 10.0f, -world_size * 0.45f));
+	int loading_cells = streamer->num_loading_cells;
+	streamer->open(json_filename);
+	TaskManager::foreground.drainTasks();
+	size_t reopened_entities = scene->entities.size();
+	delete streamer; //releases the cells
+	std::cout.rdbuf(cout_buffer);
+
+	int refs = 0;
+	for (auto& it : GTR::Prefab::sPrefabsLoaded)
+		refs += it.second->ref_count;
+	Benchmark::report("streaming update + loads, per frame", total_ms / num_frames, 0, 0);
+	std::cout << "  max frame " << max_ms << " ms in " << num_frames << " frames, cells: " << cells_loaded << " loaded " << cells_released << " released, prefabs unloaded: " << prefabs_unloaded << std::endl;
+	std::cout << "  entities in the scene: max " << max_entities << " of " << num_entities << ", now " << scene->entities.size() << " (storage " << scene->storage.size() << ", prefab refs " << refs << ")" << std::endl;
+	std::cout << "  prefab memory: max " << max_memory / 1024 << " KBs, budget 16 KBs, prefabs loaded " << GTR::Prefab::sPrefabsLoaded.size() << std::endl;
+	std::cout << "  reopened with " << loading_cells << " cells loading" << std::endl;
+	Benchmark::reportError("entities after reopening", (double)reopened_entities, 0);
+
+	GTR::Prefab::UnloadUnused(0);
+	delete scene;
+	Mesh::auto_upload_to_vram = upload;
+	load_textures = textures;
+	remove(json_filename);
+	remove((std::string(json_filename) + ".sbin").c_str());
+	for (int i = 0; i < num_assets; ++i)
+		remove(("bench_stream_asset" + std::to_string(i) + ".gltf").c_str());
+}
+
+//*********************
+
+//references in double precision to check the accuracy of the math classes
+static void refMultiply(const Matrix44& a, const Matrix44& b, double* r)
+{
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+		{
+			double sum = 0;
+			for (int k = 0; k < 4; ++k)
+				sum += (double)a.M[i][k] * b.M[k][j];
+			r[i * 4 + j] = sum;
+		}
+}
+
+static bool refInverse(const Matrix44& a, double* r)
+{
+	double t[4][8];
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 8; ++j)
+			t[i][j] = j < 4 ? a.M[i][j] : (j - 4 == i ? 1.0 : 0.0);
+	for (int i = 0; i < 4; ++i)
+	{
+		int pivot = i;
+		for (int j = i + 1; j < 4; ++j)
+			if (fabs(t[j][i]) > fabs(t[pivot][i]))
+				pivot = j;
+		for (int k = 0; k < 8; ++k)
+			std::swap(t[i][k], t[pivot][k]);
+		if (t[i][i] == 0.0)
+			return false;
+		double f = 1.0 / t[i][i];
+		for (int k = 0; k < 8; ++k)
+			t[i][k] *= f;
+		for (int j = 0; j < 4; ++j)
+			if (j != i)
+			{
+				double g = t[j][i];
+				for (int k = 0; k < 8; ++k)
+					t[j][k] -= t[i][k] * g;
+			}
+	}
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+			r[i * 4 + j] = t[i][j + 4];
+	return true;
+}
+
+//relative to the magnitude of the values, so big translations dont hide errors in the rotations
+static double maxError(const float* values, const double* reference, int count)
+{
+	double max_reference = 1.0;
+	for (int i = 0; i < count; ++i)
+		max_reference = std::max(max_reference, fabs(reference[i]));
+	double error = 0;
+	for (int i = 0; i < count; ++i)
+		error = std::max(error, fabs(values[i] - reference[i]) / max_reference);
+	return error;
+}
+
+static Matrix44 randomTRS(std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	Matrix44 m;
+	m.setTranslation(unit(rng) * 1000.0f, unit(rng) * 1000.0f, unit(rng) * 1000.0f);
+	Vector3 axis(unit(rng), unit(rng), unit(rng));
+	m.rotate(unit(rng) * (float)PI, axis.x || axis.y || axis.z ? axis.normalize() : Vector3(0, 1, 0));
+	m.scale(0.1f + (unit(rng) + 1.0f) * 5.0f, 0.1f + (unit(rng) + 1.0f) * 5.0f, 0.1f + (unit(rng) + 1.0f) * 5.0f);
+	return m;
+}
+
+static void benchMath()
+{
+	const int count = 4096;
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<Matrix44> models(count), projections(count), results(count);
+	std::vector<Vector3> points(count), points_out(count);
+	std::vector<Vector4> vectors(count), vectors_out(count);
+	std::vector<Quaternion> quats(count), quats_out(count);
+	std::vector<Transform> transforms(count), transforms_out(count), next_keyframes(count);
+	for (int i = 0; i < count; ++i)
+	{
+		models[i] = randomTRS(rng);
+		transforms[i].fromMatrix(models[i]);
+		next_keyframes[i] = transforms[i] * Transform(Vector3(unit(rng), 0, 0), Quaternion(Vector3(0, 1, 0), unit(rng) * 0.1f));
+		Camera camera;
+		camera.lookAt(Vector3(unit(rng), unit(rng), unit(rng)) * 100.0f, Vector3(0, 0, 0), Vector3(0, 1, 0));
+		camera.setPerspective(30.0f + (unit(rng) + 1.0f) * 30.0f, 1.5f, 0.1f, 10000.0f);
+		projections[i] = camera.viewprojection_matrix;
+		points[i].set(unit(rng) * 100.0f, unit(rng) * 100.0f, unit(rng) * 100.0f);
+		vectors[i].set(unit(rng), unit(rng), unit(rng), 1.0f);
+		quats[i] = Quaternion(Vector3(unit(rng), unit(rng), 1.0f).normalize(), unit(rng) * (float)PI);
+	}
+
+	std::cout << " accuracy (max relative error):" << std::endl;
+	double error_multiply = 0, error_inverse = 0, error_inverse_affine = 0, error_transform = 0, error_quat = 0, error_quat_matrix = 0;
+	double error_trs_matrix = 0, error_trs_product = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		double reference[16];
+		const Matrix44& b = models[(i + 1) % count];
+		Matrix44 product = models[i] * b;
+		refMultiply(models[i], b, reference);
+		error_multiply = std::max(error_multiply, maxError(product.m, reference, 16));
+
+		Matrix44 inverse = models[i];
+		if (refInverse(models[i], reference) && inverse.inverse())
+			error_inverse_affine = std::max(error_inverse_affine, maxError(inverse.m, reference, 16));
+		inverse = projections[i];
+		if (refInverse(projections[i], reference) && inverse.inverse())
+			error_inverse = std::max(error_inverse, maxError(inverse.m, reference, 16));
+
+		const Matrix44& m = models[i];
+		const Vector3& p = points[i];
+		Vector3 transformed = m * p;
+		double reference_point[3];
+		for (int j = 0; j < 3; ++j)
+			reference_point[j] = (double)m.m[j] * p.x + (double)m.m[4 + j] * p.y + (double)m.m[8 + j] * p.z + m.m[12 + j];
+		error_transform = std::max(error_transform, maxError(transformed.v, reference_point, 3));
+
+		//the product of quaternions must rotate like the product of their matrices (qa * qb applies qa after qb)
+		const Quaternion& qb = quats[(i + 1) % count];
+		Quaternion q = quats[i] * qb;
+		Matrix44 qa_matrix, qb_matrix, q_matrix;
+		quats[i].toMatrix(qa_matrix);
+		qb.toMatrix(qb_matrix);
+		q.toMatrix(q_matrix);
+		refMultiply(qb_matrix, qa_matrix, reference);
+		error_quat_matrix = std::max(error_quat_matrix, maxError(q_matrix.m, reference, 16));
+		error_quat = std::max(error_quat, fabs(q.length() - 1.0));
+
+		//a Transform must give back the matrix it comes from, and compose like the matrices (parents with uniform scale)
+		Matrix44 trs_matrix = transforms[i].toMatrix();
+		for (int j = 0; j < 16; ++j)
+			reference[j] = models[i].m[j];
+		error_trs_matrix = std::max(error_trs_matrix, maxError(trs_matrix.m, reference, 16));
+		Transform parent = transforms[(i + 1) % count];
+		parent.scale.set(parent.scale.y, parent.scale.y, parent.scale.y);
+		Matrix44 trs_product = (transforms[i] * parent).toMatrix();
+		refMultiply(trs_matrix, parent.toMatrix(), reference);
+		error_trs_product = std::max(error_trs_product, maxError(trs_product.m, reference, 16));
+	}
+	Benchmark::reportError("Matrix44 * Matrix44", error_multiply, 1e-6);
+	Benchmark::reportError("Matrix44::inverse (affine)", error_inverse_affine, 1e-5);
+	Benchmark::reportError("Matrix44::inverse (projection)", error_inverse, 1e-3); //ill conditioned (near 0.1, far 10000)
+	Benchmark::reportError("Matrix44 * Vector3", error_transform, 1e-6);
+	Benchmark::reportError("Quaternion * Quaternion", error_quat_matrix, 1e-5);
+	Benchmark::reportError("Quaternion length", error_quat, 1e-5);
+	Benchmark::reportError("Transform from/to Matrix44", error_trs_matrix, 1e-5);
+	Benchmark::reportError("Transform * Transform", error_trs_product, 1e-5);
+
+	std::cout << " speed:" << std::endl;
+	Benchmark::report("Matrix44 * Matrix44", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+			results[i] = models[i] * projections[i];
+	}), 0, count);
+	Benchmark::report("Matrix44::inverse (affine)", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+		{
+			results[i] = models[i];
+			results[i].inverse();
+		}
+	}), 0, count);
+	Benchmark::report("Matrix44::inverse (projection)", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+		{
+			results[i] = projections[i];
+			results[i].inverse();
+		}
+	}), 0, count);
+	Benchmark::report("Matrix44 * Vector3", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+			points_out[i] = models[i & 63] * points[i];
+	}), 0, count);
+	Benchmark::report("Matrix44 * Vector4", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+			vectors_out[i] = projections[i & 63] * vectors[i];
+	}), 0, count);
+	Benchmark::report("Vector3::length", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+			points_out[i].x = points[i].length();
+	}), 0, count);
+	Benchmark::report("Quaternion * Quaternion", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+			quats_out[i] = quats[i] * quats[(i + 1) & (count - 1)];
+	}), 0, count);
+	Benchmark::report("Qlerp", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+			quats_out[i] = Qlerp(quats[i], quats[(i + 1) & (count - 1)], 0.3f);
+	}), 0, count);
+
+	//what the hierarchies and the animations do per node and per bone
+	Benchmark::report("Transform * Transform", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+			transforms_out[i] = transforms[i] * transforms[(i + 1) & (count - 1)];
+	}), 0, count);
+	Benchmark::report("Transform::toMatrix", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+			transforms[i].toMatrix(results[i]);
+	}), 0, count);
+	//consecutive keyframes of a bone are near, like in the animations
+	for (int i = 0; i < count; ++i)
+		next_keyframes[i].toMatrix(projections[i]);
+	Benchmark::report("Matrix44 lerp (16 floats)", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+		{
+			const Matrix44& a = models[i];
+			const Matrix44& b = projections[i];
+			for (int j = 0; j < 16; ++j)
+				results[i].m[j] = lerp(a.m[j], b.m[j], 0.3f);
+		}
+	}), 0, count);
+	Benchmark::report("Transform lerp", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+			transforms_out[i] = lerp(transforms[i], next_keyframes[i], 0.3f);
+	}), 0, count);
+}
+
+//bulk transforms of TransformKernels against one call per element
+static void benchTransformKernels()
+{
+	const int count = 1 << 20, num_boxes = 1 << 16;
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<Vector3> points(count), points_out(count);
+	std::vector<Mesh::tInterleaved> vertices(count);
+	for (int i = 0; i < count; ++i)
+	{
+		points[i].set(unit(rng) * 100.0f, unit(rng) * 100.0f, unit(rng) * 100.0f);
+		vertices[i].vertex = points[i];
+		vertices[i].normal = Vector3(unit(rng), unit(rng), 1.0f).normalize();
+	}
+	std::vector<Matrix44> models(num_boxes);
+	std::vector<BoundingBox> boxes(num_boxes), boxes_out(num_boxes);
+	for (int i = 0; i < num_boxes; ++i)
+	{
+		models[i] = randomTRS(rng);
+		boxes[i] = BoundingBox(points[i], Vector3(fabsf(unit(rng)), fabsf(unit(rng)), fabsf(unit(rng))) * 10.0f);
+	}
+	const Matrix44& m = models[0];
+
+	std::cout << " accuracy (max relative error):" << std::endl;
+	TransformKernels::transformPoints(m, &points[0], count, &points_out[0]);
+	double error_points = 0;
+	for (int i = 0; i < count; i += 97)
+	{
+		double reference[3];
+		for (int j = 0; j < 3; ++j)
+			reference[j] = (double)m.m[j] * points[i].x + (double)m.m[4 + j] * points[i].y + (double)m.m[8 + j] * points[i].z + m.m[12 + j];
+		error_points = std::max(error_points, maxError(points_out[i].v, reference, 3));
+	}
+	Benchmark::reportError("transformPoints", error_points, 1e-6);
+
+	//the eight corners, the box Arvo's method must give
+	TransformKernels::transformBoxes(&models[0], &boxes[0], num_boxes, &boxes_out[0]);
+	double error_boxes = 0;
+	for (int i = 0; i < num_boxes; i += 7)
+	{
+		const Matrix44& model = models[i];
+		double box_min[3] = { 1e30, 1e30, 1e30 }, box_max[3] = { -1e30, -1e30, -1e30 };
+		for (int k = 0; k < 8; ++k)
+		{
+			double corner[3] = { boxes[i].center.x + (k & 1 ? 1 : -1) * (double)boxes[i].halfsize.x, boxes[i].center.y + (k & 2 ? 1 : -1) * (double)boxes[i].halfsize.y, boxes[i].center.z + (k & 4 ? 1 : -1) * (double)boxes[i].halfsize.z };
+			for (int j = 0; j < 3; ++j)
+			{
+				double v = model.m[j] * corner[0] + model.m[4 + j] * corner[1] + model.m[8 + j] * corner[2] + model.m[12 + j];
+				box_min[j] = std::min(box_min[j], v);
+				box_max[j] = std::max(box_max[j], v);
+			}
+		}
+		double reference[6];
+		for (int j = 0; j < 3; ++j)
+		{
+			reference[j] = (box_min[j] + box_max[j]) * 0.5;
+			reference[3 + j] = (box_max[j] - box_min[j]) * 0.5;
+		}
+		error_boxes = std::max(error_boxes, maxError(boxes_out[i].center.v, reference, 6)); //center and halfsize are consecutive
+	}
+	Benchmark::reportError("transformBoxes", error_boxes, 1e-6);
+
+	Vector3 box_min, box_max, reference_min = points[0], reference_max = points[0];
+	for (int i = 1; i < count - 3; ++i)
+	{
+		reference_min.setMin(points[i]);
+		reference_max.setMax(points[i]);
+	}
+	TransformKernels::computeMinMax(&points[0], count - 3, box_min, box_max); //not a multiple of 4
+	bool minmax_ok = !memcmp(box_min.v, reference_min.v, sizeof(Vector3)) && !memcmp(box_max.v, reference_max.v, sizeof(Vector3));
+	TransformKernels::computeMinMax(&vertices[0].vertex, count - 3, box_min, box_max, sizeof(Mesh::tInterleaved));
+	minmax_ok = minmax_ok && !memcmp(box_min.v, reference_min.v, sizeof(Vector3)) && !memcmp(box_max.v, reference_max.v, sizeof(Vector3));
+	Benchmark::reportError("computeMinMax", minmax_ok ? 0.0 : 1.0, 0.0);
+
+	std::cout << " speed:" << std::endl;
+	Benchmark::report("Matrix44 * Vector3 loop", Benchmark::measure([&]() {
+		for (int i = 0; i < count; ++i)
+			points_out[i] = m * points[i];
+	}), count * sizeof(Vector3), count);
+	Benchmark::report("transformPoints", Benchmark::measure([&]() {
+		TransformKernels::transformPoints(m, &points[0], count, &points_out[0]);
+	}), count * sizeof(Vector3), count);
+	Benchmark::report("transformPoints interleaved", Benchmark::measure([&]() {
+		TransformKernels::transformPoints(m, &vertices[0].vertex, count, &vertices[0].vertex, sizeof(Mesh::tInterleaved), sizeof(Mesh::tInterleaved));
+	}), count * sizeof(Mesh::tInterleaved), count);
+	Benchmark::report("transformNormals normalized", Benchmark::measure([&]() {
+		TransformKernels::transformNormals(m, &vertices[0].normal, count, &points_out[0], sizeof(Mesh::tInterleaved), 0, true);
+	}), count * sizeof(Vector3), count);
+	Benchmark::report("setMin/setMax loop", Benchmark::measure([&]() {
+		box_min = box_max = points[0];
+		for (int i = 1; i < count; ++i)
+		{
+			box_min.setMin(points[i]);
+			box_max.setMax(points[i]);
+		}
+	}), count * sizeof(Vector3), count);
+	Benchmark::report("computeMinMax", Benchmark::measure([&]() {
+		TransformKernels::computeMinMax(&points[0], count, box_min, box_max);
+	}), count * sizeof(Vector3), count);
+	Benchmark::report("computeMinMax interleaved", Benchmark::measure([&]() {
+		TransformKernels::computeMinMax(&vertices[0].vertex, count, box_min, box_max, sizeof(Mesh::tInterleaved));
+	}), count * sizeof(Mesh::tInterleaved), count);
+	Benchmark::report("transformBoxes", Benchmark::measure([&]() {
+		TransformKernels::transformBoxes(&models[0], &boxes[0], num_boxes, &boxes_out[0]);
+	}), 0, num_boxes);
+	Benchmark::report("transformBoxes one matrix", Benchmark::measure([&]() {
+		TransformKernels::transformBoxes(m, &boxes[0], num_boxes, &boxes_out[0]);
+	}), 0, num_boxes);
+}
+
+//*********************
+
+struct sBenchmarkSuite {
+	const char* name;
+	Benchmark::tSuite func;
+};
+
+static sBenchmarkSuite suites[] = {
+	{ "image", benchImageKernels },
+	{ "compression", benchTextureCompression },
+	{ "tasks", benchTasks },
+	{ "parallel", benchParallel },
+	{ "scene", benchScene },
+	{ "streaming", benchStreaming },
+	{ "math", benchMath },
+	{ "transforms", benchTransformKernels },
+};
+
+int Benchmark::run(const char* name)
+{
+	//the app has not started the workers yet, the parallel kernels need them
+	if (!TaskManager::background.pool)
+		TaskManager::background.startThread();
+	bool found = false;
+	for (auto& suite : suites)
+	{
+		if (strcmp(name, "all") != 0 && strcmp(name, suite.name) != 0)
+			continue;
+		std::cout << "Benchmark: " << suite.name << std::endl;
+		suite.func();
+		found = true;
+	}
+	if (found && num_failures)
+		std::cout << num_failures << " checks failed" << std::endl;
+	if (found)
+		return num_failures ? 2 : 0;
+
+	std::cout << "Unknown benchmark: " << name << ". Available: all";
+	for (auto& suite : suites)
+		std::cout << ", " << suite.name;
+	std::cout << std::endl;
+	return 1;
+}
@@ -0,0 +1,25 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <functional>
+
+//Benchmark
+//CPU benchmarks that run from the command line without opening the window: main --bench <suite|all>
+//Every suite prints one line per kernel with the time per call and the throughput, and one per accuracy check.
+
+class Benchmark {
+public:
+	typedef void(*tSuite)();
+
+	static int run(const char* name); //returns the exit code of the app, not 0 if a check failed
+
+	//repeats func until it takes at least min_ms, returns the ms per call
+	static double measure(const std::function<void()>& func, double min_ms = 200.0);
+	//prints the time and the throughput (bytes and items are skipped if 0)
+	static void report(const char* name, double ms, double bytes, double items = 0);
+	//prints the error of a result against its reference, it fails if it is bigger than threshold
+	static bool reportError(const char* name, double error, double threshold);
+	static int num_failures;
+};
+
+#endif
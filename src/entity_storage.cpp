@@ -0,0 +1,114 @@
+#include "entity_storage.h"
+#include "prefab.h"
+#include "mesh.h"
+
+#include <cassert>
+
+using namespace GTR;
+
+EntityID EntityStorage::create(BaseEntity* owner)
+{
+	uint32 index;
+	if (free_indices.size())
+	{
+		index = free_indices.back();
+		free_indices.pop_back();
+	}
+	else
+	{
+		index = (uint32)sparse.size();
+		assert(index <= INDEX_MASK && "too many entities");
+		sparse.push_back(0);
+		generations.push_back(0);
+	}
+	EntityID id = index | ((uint32)generations[index] << INDEX_BITS);
+	sparse[index] = (uint32)ids.size();
+
+	models.push_back(Matrix44());
+	bounds.push_back(BoundingBox(Vector3(), Vector3()));
+	instance_bounds.push_back(sInstanceBounds());
+	flags.push_back(ENTITY_VISIBLE | ENTITY_MOVED);
+	prefabs.push_back(NULL);
+	owners.push_back(owner);
+	ids.push_back(id);
+	return id;
+}
+
+void EntityStorage::destroy(EntityID id)
+{
+	if (!isValid(id))
+		return;
+	uint32 index = id & INDEX_MASK;
+	int dense = (int)sparse[index];
+	int last = size() - 1;
+
+	//the last one fills the hole
+	if (dense != last)
+	{
+		models[dense] = models[last];
+		bounds[dense] = bounds[last];
+		instance_bounds[dense] = std::move(instance_bounds[last]);
+		flags[dense] = flags[last];
+		prefabs[dense] = prefabs[last];
+		owners[dense] = owners[last];
+		ids[dense] = ids[last];
+		sparse[ids[dense] & INDEX_MASK] = dense;
+	}
+	models.pop_back();
+	bounds.pop_back();
+	instance_bounds.pop_back();
+	flags.pop_back();
+	prefabs.pop_back();
+	owners.pop_back();
+	ids.pop_back();
+
+	generations[index]++;
+	free_indices.push_back(index);
+}
+
+void EntityStorage::clear()
+{
+	while (size())
+		destroy(ids.back());
+}
+
+bool EntityStorage::isValid(EntityID id) const
+{
+	uint32 index = id & INDEX_MASK;
+	return id != INVALID_ENTITY_ID && index < sparse.size() && generations[index] == (uint8)(id >> INDEX_BITS);
+}
+
+void EntityStorage::updateBounds(int start, int end)
+{
+	const BoundingBox empty(Vector3(), Vector3(-1, -1, -1));
+	for (int i = start; i < end; ++i)
+	{
+		Prefab* prefab = prefabs[i];
+		sInstanceBounds& instance = instance_bounds[i];
+		if (!prefab || (!(flags[i] & ENTITY_MOVED) && instance.prefab_version == prefab->transforms_version))
+			continue;
+		flags[i] &= ~ENTITY_MOVED;
+		instance.prefab_version = prefab->transforms_version;
+
+		int num_nodes = (int)prefab->flat_nodes.size();
+		instance.nodes.resize(num_nodes);
+		instance.subtrees.resize(num_nodes);
+		for (int j = 0; j < num_nodes; ++j)
+		{
+			Mesh* mesh = prefab->flat_nodes[j]->mesh;
+			instance.nodes[j] = mesh ? transformBoundingBox(prefab->flat_globals[j] * models[i], mesh->box) : empty;
+			instance.subtrees[j] = instance.nodes[j];
+		}
+
+		//children come after their parents, so going backwards every subtree is complete before it is merged upwards
+		for (int j = num_nodes - 1; j > 0; --j)
+		{
+			const BoundingBox& subtree = instance.subtrees[j];
+			BoundingBox& parent = instance.subtrees[prefab->flat_parents[j]];
+			if (sInstanceBounds::isEmpty(subtree))
+				continue;
+			parent = sInstanceBounds::isEmpty(parent) ? subtree : mergeBoundingBoxes(parent, subtree);
+		}
+		bounds[i] = !num_nodes || sInstanceBounds::isEmpty(instance.subtrees[0]) ? BoundingBox(models[i].getTranslation(), Vector3()) : instance.subtrees[0];
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef ENTITY_STORAGE_H
+#define ENTITY_STORAGE_H
+
+#include "framework.h"
+#include <vector>
+
+namespace GTR {
+
+	class BaseEntity;
+	class Prefab;
+
+	//stable handle of an entity: index in the sparse table and generation, so handles of destroyed entities are detected
+	typedef uint32 EntityID;
+	#define INVALID_ENTITY_ID 0xFFFFFFFF
+
+	enum eEntityFlags {
+		ENTITY_VISIBLE = 1,
+		ENTITY_LOADING = 2, //created but not added to the scene yet
+		ENTITY_MOVED = 4, //model or prefab changed, its bounds must be recomputed
+		ENTITY_STATIC = 8, //not expected to move, it can be baked in the static batch of the scene
+		ENTITY_BATCHED = 16, //its nodes are rendered by the static batch
+	};
+
+	//world bounds of the nodes of the prefab of an entity (indexed like the flat arrays of the prefab).
+	//They are only recomputed when the entity moves or the transforms of the prefab change
+	struct sInstanceBounds {
+		int prefab_version;					//transforms_version of the prefab when computed, -1 if never
+		std::vector<BoundingBox> nodes;		//of the mesh of the node
+		std::vector<BoundingBox> subtrees;	//of the meshes of the node and its descendants
+		sInstanceBounds() { prefab_version = -1; }
+		//nodes and subtrees without meshes
+		static bool isEmpty(const BoundingBox& box) { return box.halfsize.x < 0.0f; }
+	};
+
+	//EntityStorage
+	//the per frame data of the entities of a scene in dense arrays (structure of arrays), index i is the same entity in all
+	//of them, so the passes that go through all the entities read contiguous memory. Destroying an entity moves the last
+	//one to its place, the EntityID remains valid and gives the current index.
+
+	class EntityStorage
+	{
+	public:
+		std::vector<Matrix44> models;
+		std::vector<BoundingBox> bounds;	//in world space, see updateBounds
+		std::vector<sInstanceBounds> instance_bounds;
+		std::vector<uint8> flags;			//eEntityFlags
+		std::vector<Prefab*> prefabs;		//what to render, NULL if nothing
+		std::vector<BaseEntity*> owners;	//the object that represents it
+		std::vector<EntityID> ids;
+
+		EntityID create(BaseEntity* owner);
+		void destroy(EntityID id);
+		void clear(); //destroys all, the current ids become invalid
+		bool isValid(EntityID id) const;
+		int getIndex(EntityID id) const { return (int)sparse[id & INDEX_MASK]; } //the id must be valid
+		int size() const { return (int)ids.size(); }
+
+		//world bounds of the entities in [start,end) and of the nodes of their prefabs, only the moved ones are computed.
+		//The transforms of the prefabs must be updated
+		void updateBounds(int start, int end);
+
+	private:
+		enum { INDEX_BITS = 24, INDEX_MASK = (1 << INDEX_BITS) - 1 };
+		std::vector<uint32> sparse;			//dense index of every id index
+		std::vector<uint8> generations;		//of every id index, incremented when destroyed
+		std::vector<uint32> free_indices;
+	};
+
+};
+
+#endif
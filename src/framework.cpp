@@ -1,4 +1,5 @@
 #include "framework.h"
+#include "transform_kernels.h"
 
 //#include "includes.h"
 
@@ -72,29 +73,25 @@ Vector2 operator - (const Vector2& a, const Vector2& b) { return Vector2(a.x - b
 
 // **************************************
 
-double Vector3::length() 
+float Vector3::length() const
 {
-	return sqrt(x*x + y*y + z*z);
-}
-
-double Vector3::length() const
-{
-	return sqrt(x*x + y*y + z*z);
+	return sqrtf(x*x + y*y + z*z);
 }
 
 Vector3& Vector3::normalize()
 {
-	double len = length();
-	assert(len > 0.00000000001 && "Cannot normalize a vector with module 0");
-	x = (float)(x / len);
-	y = (float)(y / len);
-	z = (float)(z / len);
+	float len = length();
+	assert(len > 0.0f && "Cannot normalize a vector with module 0");
+	float inv = 1.0f / len;
+	x *= inv;
+	y *= inv;
+	z *= inv;
 	return *this;
 }
 
 float Vector3::distance(const Vector3& v) const
 {
-	return (float)(v - *this).length();
+	return (v - *this).length();
 }
 
 Vector3 Vector3::cross( const Vector3& b ) const
@@ -437,41 +434,48 @@ Vector3 Matrix44::project(const Vector3& v)
 
 
 //Multiply a matrix by another and returns the result
+//every row of the result is the rows of the second matrix weighted by the row of the first one
 Matrix44 Matrix44::operator*(const Matrix44& matrix) const
 {
 	Matrix44 ret;
-
-	unsigned int i,j,k;
-	for (i=0;i<4;i++) 	
+	simd::vec b0 = simd::load(matrix.m);
+	simd::vec b1 = simd::load(matrix.m + 4);
+	simd::vec b2 = simd::load(matrix.m + 8);
+	simd::vec b3 = simd::load(matrix.m + 12);
+	for (int i = 0; i < 4; ++i)
 	{
-		for (j=0;j<4;j++) 
-		{
-			ret.M[i][j]=0.0;
-			for (k=0;k<4;k++) 
-				ret.M[i][j] += M[i][k] * matrix.M[k][j];
-		}
+		const float* row = M[i];
+		simd::vec r = simd::mul(simd::splat(row[0]), b0);
+		r = simd::madd(simd::splat(row[1]), b1, r);
+		r = simd::madd(simd::splat(row[2]), b2, r);
+		r = simd::madd(simd::splat(row[3]), b3, r);
+		simd::store(ret.M[i], r);
 	}
-
 	return ret;
 }
 
 //Multiplies a vector by a matrix and returns the new vector
+//the products and sums are fused in the same chain of multiply-adds (one instruction each with FMA)
 Vector3 operator * (const Matrix44& matrix, const Vector3& v) 
-{   
-   float x = matrix.m[0] * v.x + matrix.m[4] * v.y + matrix.m[8] * v.z + matrix.m[12]; 
-   float y = matrix.m[1] * v.x + matrix.m[5] * v.y + matrix.m[9] * v.z + matrix.m[13]; 
-   float z = matrix.m[2] * v.x + matrix.m[6] * v.y + matrix.m[10] * v.z + matrix.m[14];
-   return Vector3(x,y,z);
+{
+	simd::vec r = simd::madd(simd::splat(v.x), simd::load(matrix.m), simd::load(matrix.m + 12));
+	r = simd::madd(simd::splat(v.y), simd::load(matrix.m + 4), r);
+	r = simd::madd(simd::splat(v.z), simd::load(matrix.m + 8), r);
+	Vector4 result;
+	simd::store(result.v, r);
+	return Vector3(result.x, result.y, result.z);
 }
 
 //Multiplies a vector by a matrix and returns the new vector
 Vector4 operator * (const Matrix44& matrix, const Vector4& v)
 {
-	float x = matrix.m[0] * v.x + matrix.m[4] * v.y + matrix.m[8] * v.z + v.w * matrix.m[12];
-	float y = matrix.m[1] * v.x + matrix.m[5] * v.y + matrix.m[9] * v.z + v.w * matrix.m[13];
-	float z = matrix.m[2] * v.x + matrix.m[6] * v.y + matrix.m[10] * v.z + v.w * matrix.m[14];
-	float w = matrix.m[3] * v.x + matrix.m[7] * v.y + matrix.m[11] * v.z + v.w * matrix.m[15];
-	return Vector4(x, y, z, w);
+	simd::vec r = simd::mul(simd::splat(v.x), simd::load(matrix.m));
+	r = simd::madd(simd::splat(v.y), simd::load(matrix.m + 4), r);
+	r = simd::madd(simd::splat(v.z), simd::load(matrix.m + 8), r);
+	r = simd::madd(simd::splat(v.w), simd::load(matrix.m + 12), r);
+	Vector4 result;
+	simd::store(result.v, r);
+	return result;
 }
 
 void Matrix44::setUpAndOrthonormalize(Vector3 up)
@@ -547,79 +551,96 @@ void Matrix44::setFrontAndOrthonormalize(Vector3 front)
 	
 }
 
+#define MATRIX_SINGULAR_THRESHOLD 0.00001 //change this if you experience problems with matrices
+
+//Gauss-Jordan elimination with partial pivoting, the operations on rows are SIMD
 bool Matrix44::inverse()
 {
-   unsigned int i, j, k, swap;
-   float t;
-   Matrix44 temp, final;
-   final.setIdentity();
-
-   temp = (*this);
-
-   unsigned int m,n;
-   m = n = 4;
-	
-   for (i = 0; i < m; i++)
-   {
-      // Look for largest element in column
-
-      swap = i;
-      for (j = i + 1; j < m; j++)// m or n
-	  {
-		 if ( fabs(temp.M[j][i]) > fabs( temp.M[swap][i]) )
-            swap = j;
-	  }
-   
-      if (swap != i)
-      {
-         // Swap rows.
-         for (k = 0; k < n; k++)
-         {
-			 std::swap( temp.M[i][k],temp.M[swap][k]);
-			 std::swap( final.M[i][k], final.M[swap][k]);
-         }
-      }
-
-      // No non-zero pivot.  The CMatrix is singular, which shouldn't
-      // happen.  This means the user gave us a bad CMatrix.
-
+	if (isAffine())
+		return inverseAffine();
 
-#define MATRIX_SINGULAR_THRESHOLD 0.00001 //change this if you experience problems with matrices
+	Matrix44 temp = *this;
+	Matrix44 final;
+	int rows[4] = { 0, 1, 2, 3 }; //swapping the indices is cheaper than swapping the rows
 
-      if ( fabsf(temp.M[i][i]) <= MATRIX_SINGULAR_THRESHOLD)
-	  {
-		  final.setIdentity();
-         return false;
-	  }
-#undef MATRIX_SINGULAR_THRESHOLD
+	for (int i = 0; i < 4; i++)
+	{
+		//look for largest element in column
+		int swap = i;
+		for (int j = i + 1; j < 4; j++)
+			if (fabsf(temp.M[rows[j]][i]) > fabsf(temp.M[rows[swap]][i]))
+				swap = j;
+		std::swap(rows[i], rows[swap]);
+		float* temp_row = temp.M[rows[i]];
+		float* final_row = final.M[rows[i]];
+
+		//no non-zero pivot, the matrix is singular
+		if (fabsf(temp_row[i]) <= MATRIX_SINGULAR_THRESHOLD)
+			return false;
+
+		simd::vec t = simd::splat(1.0f / temp_row[i]);
+		simd::vec temp_i = simd::mul(simd::load(temp_row), t);
+		simd::vec final_i = simd::mul(simd::load(final_row), t);
+		simd::store(temp_row, temp_i);
+		simd::store(final_row, final_i);
+
+		for (int j = 0; j < 4; j++)
+		{
+			if (j == i)
+				continue;
+			float* temp_j = temp.M[rows[j]];
+			float* final_j = final.M[rows[j]];
+			simd::vec f = simd::splat(-temp_j[i]);
+			simd::store(temp_j, simd::madd(temp_i, f, simd::load(temp_j)));
+			simd::store(final_j, simd::madd(final_i, f, simd::load(final_j)));
+		}
+	}
 
-      t = 1.0f/temp.M[i][i];
+	for (int i = 0; i < 4; i++)
+		simd::store(M[i], simd::load(final.M[rows[i]]));
+	return true;
+}
 
-      for (k = 0; k < n; k++)//m or n
-      {
-         temp.M[i][k] *= t;
-         final.M[i][k] *= t;
-      }
+//the rotation and scale part (3x3) is inverted with its adjugate, the translation is moved back by that inverse
+bool Matrix44::inverseAffine()
+{
+	assert(isAffine());
+	const float* a = m;
 
-      for (j = 0; j < m; j++) // m or n
-      {
-         if (j != i)
-         {
-            t = temp.M[j][i];
-            for (k = 0; k < n; k++)//m or n
-            {
-               temp.M[j][k] -= (temp.M[i][k] * t);
-               final.M[j][k] -= (final.M[i][k] * t);
-            }
-         }
-      }
-   }
+	//cofactors of the 3x3, by columns of the inverse
+	float c0 = a[5] * a[10] - a[6] * a[9];
+	float c1 = a[2] * a[9] - a[1] * a[10];
+	float c2 = a[1] * a[6] - a[2] * a[5];
+	float c3 = a[6] * a[8] - a[4] * a[10];
+	float c4 = a[0] * a[10] - a[2] * a[8];
+	float c5 = a[2] * a[4] - a[0] * a[6];
+	float c6 = a[4] * a[9] - a[5] * a[8];
+	float c7 = a[1] * a[8] - a[0] * a[9];
+	float c8 = a[0] * a[5] - a[1] * a[4];
+	float det = a[0] * c0 + a[1] * c3 + a[2] * c6;
 
-   *this = final;
+	//the threshold is relative to the size of the axes, so scaled matrices are not taken as singular
+	float axes = sqrtf((a[0] * a[0] + a[1] * a[1] + a[2] * a[2]) * (a[4] * a[4] + a[5] * a[5] + a[6] * a[6]) * (a[8] * a[8] + a[9] * a[9] + a[10] * a[10]));
+	if (fabsf(det) <= MATRIX_SINGULAR_THRESHOLD * axes || det == 0.0f)
+		return false;
 
-   return true;
+	simd::vec inv_det = simd::splat(1.0f / det);
+	simd::vec r0 = simd::mul(simd::set(c0, c1, c2, 0.0f), inv_det);
+	simd::vec r1 = simd::mul(simd::set(c3, c4, c5, 0.0f), inv_det);
+	simd::vec r2 = simd::mul(simd::set(c6, c7, c8, 0.0f), inv_det);
+	simd::vec t = simd::mul(simd::splat(-a[12]), r0);
+	t = simd::madd(simd::splat(-a[13]), r1, t);
+	t = simd::madd(simd::splat(-a[14]), r2, t);
+	simd::store(m, r0);
+	simd::store(m + 4, r1);
+	simd::store(m + 8, r2);
+	simd::store(m + 12, t);
+	m[15] = 1.0f;
+	return true;
 }
 
+#undef MATRIX_SINGULAR_THRESHOLD
+
 #ifdef FIXEDPIPELINE
 void Matrix44::multGL()
 {
@@ -637,10 +658,6 @@ Quaternion::Quaternion()
 {
 }
 
-Quaternion::Quaternion(const Quaternion& q) : x(q.x), y(q.y), z(q.z), w(q.w)
-{
-}
-
 Quaternion::Quaternion(const float X, const float Y, const float Z, const float W) : x(X), y(Y), z(Z), w(W)
 {
 }
@@ -723,20 +740,20 @@ void Quaternion::operator*=(const Vector3& v)
 
 void Quaternion::operator += (const Quaternion &q)
 {
-	x += q.x;
-	y += q.y;
-	z += q.z;
-	w += q.w;
+	simd::store(this->q, simd::add(simd::load(this->q), simd::load(q.q)));
 }
 
+//q2 weighted by every component of q1, with its components swapped and the signs of the products
 Quaternion operator * (const Quaternion& q1, const Quaternion& q2)
 {
 	Quaternion q;
-
-	q.x = q1.y*q2.z - q1.z*q2.y + q1.w*q2.x + q1.x*q2.w;
-	q.y = q1.z*q2.x - q1.x*q2.z + q1.w*q2.y + q1.y*q2.w;
-	q.z = q1.x*q2.y - q1.y*q2.x + q1.w*q2.z + q1.z*q2.w;
-	q.w = q1.w*q2.w - q1.x*q2.x - q1.y*q2.y - q1.z*q2.z;
+	simd::vec a = simd::load(q1.q);
+	simd::vec b = simd::load(q2.q);
+	simd::vec r = simd::mul(simd::lane<3>(a), b);
+	r = simd::madd(simd::mul(simd::lane<0>(a), simd::set(1.0f, -1.0f, 1.0f, -1.0f)), simd::shuffle<3, 2, 1, 0>(b), r);
+	r = simd::madd(simd::mul(simd::lane<1>(a), simd::set(1.0f, 1.0f, -1.0f, -1.0f)), simd::shuffle<2, 3, 0, 1>(b), r);
+	r = simd::madd(simd::mul(simd::lane<2>(a), simd::set(-1.0f, 1.0f, 1.0f, -1.0f)), simd::shuffle<1, 0, 3, 2>(b), r);
+	simd::store(q.q, r);
 	return q;
 }
 
@@ -765,41 +782,25 @@ Quaternion operator * (const Quaternion &q, const Vector3& v)
 
 void Quaternion::operator *= (float f)
 {
-	x *= f;
-	y *= f;
-	z *= f;
-	w *= f;
+	simd::store(q, simd::mul(simd::load(q), simd::splat(f)));
 }
 
 Quaternion operator * (const Quaternion &q, float f)
 {
 	Quaternion q1;
-	q1.x = q.x*f;
-	q1.y = q.y*f;
-	q1.z = q.z*f;
-	q1.w = q.w*f;
+	simd::store(q1.q, simd::mul(simd::load(q.q), simd::splat(f)));
 	return q1;
 }
 
 Quaternion operator * (float f, const Quaternion &q)
 {
-	Quaternion q1;
-	q1.x = q.x*f;
-	q1.y = q.y*f;
-	q1.z = q.z*f;
-	q1.w = q.w*f;
-	return q1;
+	return q * f;
 }
 
 void Quaternion::normalize()
 {
 	float len = length();
-	len = 1.0f / len;
-
-	x *= len;
-	y *= len;
-	z *= len;
-	w *= len;
+	*this *= 1.0f / len;
 }
 
 void Quaternion::computeMinimumRotation(const Vector3& rotateFrom, const Vector3& rotateTo)
@@ -874,12 +875,41 @@ Quaternion SimpleRotation(const Vector3 &a, const Vector3 &b)
 
 float Quaternion::length() const
 {
-	return sqrtf(w * w + x * x + y * y + z * z);
+	return sqrtf(squaredLength());
 }
 
 float Quaternion::squaredLength() const
 {
-	return w * w + x * x + y * y + z * z;
+	simd::vec v = simd::load(q);
+	return simd::dot(v, v);
+}
+
+//the inverse of toMatrix, from the biggest of w,x,y,z to keep the precision
+void Quaternion::fromMatrix(const Matrix44& matrix)
+{
+	const float* m = matrix.m;
+	float trace = m[0] + m[5] + m[10];
+	if (trace > 0.0f)
+	{
+		float s = sqrtf(trace + 1.0f) * 2.0f; //4w
+		set((m[6] - m[9]) / s, (m[8] - m[2]) / s, (m[1] - m[4]) / s, 0.25f * s);
+	}
+	else if (m[0] > m[5] && m[0] > m[10])
+	{
+		float s = sqrtf(1.0f + m[0] - m[5] - m[10]) * 2.0f; //4x
+		set(0.25f * s, (m[1] + m[4]) / s, (m[8] + m[2]) / s, (m[6] - m[9]) / s);
+	}
+	else if (m[5] > m[10])
+	{
+		float s = sqrtf(1.0f + m[5] - m[0] - m[10]) * 2.0f; //4y
+		set((m[1] + m[4]) / s, 0.25f * s, (m[6] + m[9]) / s, (m[8] - m[2]) / s);
+	}
+	else
+	{
+		float s = sqrtf(1.0f + m[10] - m[0] - m[5]) * 2.0f; //4z
+		set((m[8] + m[2]) / s, (m[6] + m[9]) / s, 0.25f * s, (m[1] - m[4]) / s);
+	}
+	normalize();
 }
 
 void Quaternion::toMatrix(Matrix44& matrix) const
@@ -1005,9 +1035,99 @@ Vector3 transformQuat(const Vector3& a, const Quaternion& q)
 	return out;
 }
 
+//*********************************
+
+//the scale is the length of the axes (negative in x if the matrix mirrors), the rotation what is left without it
+void Transform::fromMatrix(const Matrix44& m)
+{
+	translation.set(m.m[12], m.m[13], m.m[14]);
+	translation_w = scale_w = 0.0f;
+	Vector3 axes[3] = { Vector3(m.m[0], m.m[1], m.m[2]), Vector3(m.m[4], m.m[5], m.m[6]), Vector3(m.m[8], m.m[9], m.m[10]) };
+	scale.set(axes[0].length(), axes[1].length(), axes[2].length());
+	if (axes[0].cross(axes[1]).dot(axes[2]) < 0.0f)
+		scale.x = -scale.x;
+
+	Matrix44 R;
+	for (int i = 0; i < 3; ++i)
+		if (scale[i] != 0.0f)
+		{
+			Vector3 axis = axes[i] * (1.0f / scale[i]);
+			R.M[i][0] = axis.x;
+			R.M[i][1] = axis.y;
+			R.M[i][2] = axis.z;
+		}
+	rotation.fromMatrix(R);
+}
+
+//the rows of the rotation (like Quaternion::toMatrix) scaled, and the translation. Whole rows are stored, the matrices
+//are read right after as registers
+void Transform::toMatrix(Matrix44& m) const
+{
+	float x2 = rotation.x + rotation.x, y2 = rotation.y + rotation.y, z2 = rotation.z + rotation.z;
+	float xx = rotation.x * x2, yy = rotation.y * y2, zz = rotation.z * z2;
+	float xy = rotation.x * y2, xz = rotation.x * z2, yz = rotation.y * z2;
+	float wx = rotation.w * x2, wy = rotation.w * y2, wz = rotation.w * z2;
+	simd::store(m.m, simd::mul(simd::set(1.0f - yy - zz, xy + wz, xz - wy, 0.0f), simd::splat(scale.x)));
+	simd::store(m.m + 4, simd::mul(simd::set(xy - wz, 1.0f - xx - zz, yz + wx, 0.0f), simd::splat(scale.y)));
+	simd::store(m.m + 8, simd::mul(simd::set(xz + wy, yz - wx, 1.0f - xx - yy, 0.0f), simd::splat(scale.z)));
+	simd::store(m.m + 12, simd::add(simd::load(translation.v), simd::set(0.0f, 0.0f, 0.0f, 1.0f)));
+}
+
+//the w lane of the result is 0
+static inline simd::vec cross(simd::vec a, simd::vec b)
+{
+	return simd::sub(simd::mul(simd::shuffle<1, 2, 0, 3>(a), simd::shuffle<2, 0, 1, 3>(b)), simd::mul(simd::shuffle<2, 0, 1, 3>(a), simd::shuffle<1, 2, 0, 3>(b)));
+}
+
+//same as transformQuat: v + 2w(q x v) + 2q x (q x v)
+static inline simd::vec rotateByQuat(simd::vec q, simd::vec v)
+{
+	simd::vec t = cross(q, v);
+	t = simd::add(t, t);
+	return simd::add(v, simd::madd(simd::lane<3>(q), t, cross(q, t)));
+}
+
+Vector3 Transform::transformPoint(const Vector3& v) const
+{
+	Vector3 result;
+	simd::vec scaled = simd::mul(simd::load3(v.v), simd::load(scale.v));
+	simd::store3(result.v, simd::add(rotateByQuat(simd::load(rotation.q), scaled), simd::load(translation.v)));
+	return result;
+}
+
+Vector3 Transform::rotateVector(const Vector3& v) const
+{
+	Vector3 result;
+	simd::vec scaled = simd::mul(simd::load3(v.v), simd::load(scale.v));
+	simd::store3(result.v, rotateByQuat(simd::load(rotation.q), scaled));
+	return result;
+}
+
+//the result is stored as whole registers: a Transform built from scalars and then copied as 16 bytes blocks stalls
+//the loads (store forwarding)
+Transform operator * (const Transform& a, const Transform& b)
+{
+	Transform result;
+	simd::vec b_scale = simd::load(b.scale.v);
+	simd::vec translation = rotateByQuat(simd::load(b.rotation.q), simd::mul(simd::load(a.translation.v), b_scale));
+	simd::store(result.translation.v, simd::add(translation, simd::load(b.translation.v)));
+	simd::store(result.scale.v, simd::mul(simd::load(a.scale.v), b_scale));
+	result.rotation = b.rotation * a.rotation;
+	return result;
+}
+
+Transform lerp(const Transform& a, const Transform& b, float t)
+{
+	Transform result;
+	simd::store(result.translation.v, simd::lerp(simd::load(a.translation.v), simd::load(b.translation.v), t));
+	simd::store(result.scale.v, simd::lerp(simd::load(a.scale.v), simd::load(b.scale.v), t));
+	result.rotation = Qslerp(a.rotation, b.rotation, t);
+	return result;
+}
+
 float DotProduct(const Quaternion& q1, const Quaternion& q2)
 {
-	return q1.x * q2.x + q1.y * q2.y + q1.z * q2.z + q1.w * q2.w;
+	return simd::dot(simd::load(q1.q), simd::load(q2.q));
 }
 
 bool operator==(const Quaternion& q1, const Quaternion& q2)
@@ -1073,7 +1193,9 @@ Quaternion Qexp(const Quaternion &q)
 
 Quaternion operator + (const Quaternion &q1, const Quaternion& q2)
 {
-	return Quaternion(q1.x + q2.x, q1.y + q2.y, q1.z + q2.z, q1.w + q2.w);
+	Quaternion q;
+	simd::store(q.q, simd::add(simd::load(q1.q), simd::load(q2.q)));
+	return q;
 }
 
 /*
@@ -1306,25 +1428,11 @@ float signedDistanceToPlane( const Vector4& plane, const Vector3& point )
 	return dot(plane.xyz(), point) + plane.w;
 }
 
-const Vector3 corners[] = { {1,1,1},  {1,1,-1},  {1,-1,1},  {1,-1,-1},  {-1,1,1},  {-1,1,-1},  {-1,-1,1},  {-1,-1,-1} };
-
-BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box)
+BoundingBox transformBoundingBox(const Matrix44& m, const BoundingBox& box)
 {
-	Vector3 box_min(10000000.0f,1000000.0f, 1000000.0f);
-	Vector3 box_max(-10000000.0f, -1000000.0f, -1000000.0f);
-
-	for (int i = 0; i < 8; ++i)
-	{
-		Vector3 corner = corners[i];
-		corner = box.halfsize * corner;
-		corner = corner + box.center;
-		corner = m * corner;
-		box_min.setMin(corner);
-		box_max.setMax(corner);
-	}
-
-	Vector3 halfsize = (box_max - box_min) * 0.5;
-	return BoundingBox(box_max - halfsize, halfsize );
+	BoundingBox result;
+	TransformKernels::transformBoxes(m, &box, 1, &result);
+	return result;
 }
 
 BoundingBox mergeBoundingBoxes(const BoundingBox& a, const BoundingBox& b)
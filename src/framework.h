@@ -7,6 +7,7 @@
 
 #include <vector>
 #include <cmath>
+#include "math_simd.h"
 
 #ifndef PI
 	#define PI 3.14159265359
@@ -97,8 +98,7 @@ public:
 	Vector3(float v) { x = y = z = v; }
 	Vector3(float x, float y, float z) { this->x = x; this->y = y; this->z = z;	}
 
-	double length();
-	double length() const;
+	float length() const;
 
 	void set(float x, float y, float z) { this->x = x; this->y = y; this->z = z; }
 
@@ -137,7 +137,8 @@ inline Vector3 operator * (const Vector3& a, const Vector3& b) { return Vector3(
 inline Vector3 operator * (const Vector3& a, float v) { return Vector3(a.x * v, a.y * v, a.z * v); }
 inline Vector3 operator * (float v, const Vector3& a) { return Vector3(a.x * v, a.y * v, a.z * v); }
 
-class Vector4
+//16 bytes aligned, like Matrix44 and Quaternion, so the SIMD code loads them in one instruction
+class alignas(16) Vector4
 {
 public:
 	union
@@ -149,16 +150,17 @@ public:
 	Vector4() { x = y = z = w = 0.0; }
 	Vector4(float x, float y, float z, float w) { this->x = x; this->y = y; this->z = z; this->w = w; }
 	Vector4(const Vector3& v, float w) { x = v.x; y = v.y; z = v.z; this->w = w; }
-	Vector4(const float* v) { x = v[0]; x = v[1]; x = v[2]; x = v[3]; }
+	Vector4(const float* v) { x = v[0]; y = v[1]; z = v[2]; w = v[3]; }
 
 	Vector3 xyz() const { return Vector3(x, y, z); }
 	void set(float x, float y, float z, float w) { this->x = x; this->y = y; this->z = z; this->w = w; }
 	void operator = (float* v) { x = v[0]; y = v[1]; z = v[2]; w = v[3]; }
 };
 
-inline Vector4 operator * (const Vector4& a, float v) { return Vector4(a.x * v, a.y * v, a.z * v, a.w * v); }
-inline Vector4 operator + (const Vector4& a, const Vector4& b) { return Vector4(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w); }
-inline Vector4 lerp(const Vector4& a, const Vector4& b, float v) { return a*(1.0f - v) + b*v; }
+inline Vector4 operator * (const Vector4& a, float v) { Vector4 r; simd::store(r.v, simd::mul(simd::load(a.v), simd::splat(v))); return r; }
+inline Vector4 operator + (const Vector4& a, const Vector4& b) { Vector4 r; simd::store(r.v, simd::add(simd::load(a.v), simd::load(b.v))); return r; }
+inline Vector4 lerp(const Vector4& a, const Vector4& b, float v) { Vector4 r; simd::store(r.v, simd::lerp(simd::load(a.v), simd::load(b.v), v)); return r; }
+inline float dot(const Vector4& a, const Vector4& b) { return simd::dot(simd::load(a.v), simd::load(b.v)); }
 
 //can be used to store colors
 class Vector4ub
@@ -196,7 +198,7 @@ typedef Vector4ub Color;
 
 //****************************
 //Matrix44 class
-class Matrix44
+class alignas(16) Matrix44
 {
 	public:
 		static const Matrix44 IDENTITY;
@@ -229,7 +231,9 @@ class Matrix44
 		Vector3 topVector() { return Vector3(m[4],m[5],m[6]); }
 		Vector3 frontVector() { return Vector3(m[8],m[9],m[10]); }
 
-		bool inverse();
+		bool inverse(); //false if it is singular (then it is not modified)
+		bool inverseAffine(); //faster, only for matrices whose last column is 0,0,0,1 (inverse uses it when possible)
+		bool isAffine() const { return m[3] == 0.0f && m[7] == 0.0f && m[11] == 0.0f && m[15] == 1.0f; }
 		void setUpAndOrthonormalize(Vector3 up);
 		void setFrontAndOrthonormalize(Vector3 front);
 
@@ -275,7 +279,7 @@ Vector3 operator * (const Matrix44& matrix, const Vector3& v);
 Vector4 operator * (const Matrix44& matrix, const Vector4& v); 
 
 
-class Quaternion
+class alignas(16) Quaternion
 {
 public:
 
@@ -288,7 +292,6 @@ public:
 public:
 	Quaternion();
 	Quaternion(const float* q);
-	Quaternion(const Quaternion& q);
 	Quaternion(const float X, const float Y, const float Z, const float W);
 	Quaternion(const Vector3& axis, float angle);
 
@@ -336,6 +339,7 @@ public:
 	float squaredLength() const;
 	float length() const;
 	void toMatrix(Matrix44 &) const;
+	void fromMatrix(const Matrix44& m); //from the rotation of m, without scale
 
 	void toEulerAngles(Vector3 &euler) const;
 
@@ -354,6 +358,39 @@ Quaternion Qlog(const Quaternion &q);
 Quaternion SimpleRotation(const Vector3 &a, const Vector3 &b);
 Vector3 transformQuat(const Vector3& a, const Quaternion& q); //to euler
 
+//Transform
+//translation, rotation and scale: the compact version of a Matrix44 for hierarchies and animations (48 bytes against 64,
+//and a lerp that keeps the rotation rigid). Vertices are scaled, then rotated and then translated, the same as a
+//matrix built with translate, rotate and scale in that order. Convert it with toMatrix only when the matrix is needed.
+//Translation and scale fill 16 bytes each (the 4th float is 0), so the math works on whole SIMD registers
+class Transform
+{
+public:
+	Quaternion rotation;
+	Vector3 translation;
+	float translation_w;
+	Vector3 scale;
+	float scale_w;
+
+	Transform() : rotation(0.0f, 0.0f, 0.0f, 1.0f), translation_w(0.0f), scale(1.0f), scale_w(0.0f) {}
+	Transform(const Vector3& translation, const Quaternion& rotation, const Vector3& scale = Vector3(1.0f)) : rotation(rotation), translation(translation), translation_w(0.0f), scale(scale), scale_w(0.0f) {}
+	explicit Transform(const Matrix44& m) { fromMatrix(m); }
+
+	void setIdentity() { *this = Transform(); }
+	void fromMatrix(const Matrix44& m); //a matrix with shear loses it
+	void toMatrix(Matrix44& m) const;
+	Matrix44 toMatrix() const { Matrix44 m; toMatrix(m); return m; }
+
+	Vector3 transformPoint(const Vector3& v) const;
+	Vector3 rotateVector(const Vector3& v) const; //rotation and scale, no translation
+};
+
+//a and then b, like a.toMatrix() * b.toMatrix(). It is exact when b has the same scale in all axes, otherwise the
+//product of two matrices could have shear, which a Transform cannot hold
+Transform operator * (const Transform& a, const Transform& b);
+//linear for translation and scale, slerp for the rotation
+Transform lerp(const Transform& a, const Transform& b, float t);
+
 class BoundingBox
 {
 public:
@@ -373,7 +410,7 @@ public:
 
 //applies a transform to a AABB from object to world
 BoundingBox mergeBoundingBoxes(const BoundingBox& a, const BoundingBox& b);
-BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box);
+BoundingBox transformBoundingBox(const Matrix44& m, const BoundingBox& box);
 
 float signedDistanceToPlane(const Vector4& plane, const Vector3& point);
 int planeBoxOverlap( const Vector4& plane, const Vector3& center, const Vector3& halfsize );
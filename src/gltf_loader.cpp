@@ -213,7 +213,8 @@ std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata, const char* basename)
 			if (primitive->indices && primitive->indices->count)
 				parseGLTFBufferIndices(mesh->m_indices, primitive->indices);
 		}
-		mesh->uploadToVRAM();
+		if (Mesh::auto_upload_to_vram)
+			mesh->uploadToVRAM();
 		if (meshdata->name)
 			mesh->registerMesh(submesh_name);
 		result.push_back(mesh);
@@ -224,7 +225,7 @@ std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata, const char* basename)
 
 int GLTF_TEXTURE_LAST_ID = 1;
 
-Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
+Texture* parseGLTFTexture(cgltf_image* image, const char* filename, eTextureUsage usage = TEXTURE_UNKNOWN)
 {
 	if (!load_textures || !image )
 		return NULL;
@@ -232,7 +233,7 @@ Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
 	std::string fullpath = filename ? filename : "";
 
 	if (image->uri)
-		return Texture::GetAsync((std::string(base_folder) + "/" + image->uri).c_str());
+		return Texture::GetAsync((std::string(base_folder) + "/" + image->uri).c_str(), true, true, usage);
 	else
 	if (filename)
 	{
@@ -310,7 +311,7 @@ GTR::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 	//normalmap
 	if (matdata->normal_texture.texture)
 	{
-		material->normal_texture.texture = parseGLTFTexture( matdata->normal_texture.texture->image, matdata->normal_texture.texture->name);
+		material->normal_texture.texture = parseGLTFTexture( matdata->normal_texture.texture->image, matdata->normal_texture.texture->name, TEXTURE_NORMAL);
 		material->normal_texture.uv_channel = matdata->normal_texture.texcoord;
 	}
 
@@ -318,7 +319,7 @@ GTR::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 	material->emissive_factor = matdata->emissive_factor;
 	if (matdata->emissive_texture.texture)
 	{
-		material->emissive_texture.texture = parseGLTFTexture(matdata->emissive_texture.texture->image, matdata->emissive_texture.texture->name);
+		material->emissive_texture.texture = parseGLTFTexture(matdata->emissive_texture.texture->image, matdata->emissive_texture.texture->name, TEXTURE_COLOR);
 		material->emissive_texture.uv_channel = matdata->emissive_texture.texcoord;
 	}
 
@@ -327,7 +328,7 @@ GTR::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 	if (matdata->has_pbr_specular_glossiness)
 	{
 		if (matdata->pbr_specular_glossiness.diffuse_texture.texture)
-			material->color_texture.texture = parseGLTFTexture(matdata->pbr_specular_glossiness.diffuse_texture.texture->image, matdata->pbr_specular_glossiness.diffuse_texture.texture->name);
+			material->color_texture.texture = parseGLTFTexture(matdata->pbr_specular_glossiness.diffuse_texture.texture->image, matdata->pbr_specular_glossiness.diffuse_texture.texture->name, TEXTURE_COLOR);
 	}
 	if (matdata->has_pbr_metallic_roughness)
 	{
@@ -339,7 +340,7 @@ GTR::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 		{
 			if (matdata->pbr_metallic_roughness.base_color_texture.texture)
 			{
-				material->color_texture.texture = parseGLTFTexture(matdata->pbr_metallic_roughness.base_color_texture.texture->image, matdata->pbr_metallic_roughness.base_color_texture.texture->name);
+				material->color_texture.texture = parseGLTFTexture(matdata->pbr_metallic_roughness.base_color_texture.texture->image, matdata->pbr_metallic_roughness.base_color_texture.texture->name, TEXTURE_COLOR);
 				material->color_texture.uv_channel = matdata->pbr_metallic_roughness.base_color_texture.texcoord;
 			}
 			if (matdata->pbr_metallic_roughness.metallic_roughness_texture.texture)
@@ -359,24 +360,23 @@ GTR::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 	return material;
 }
 
-void parseGLTFTransform(cgltf_node* node, Matrix44 &model)
+void parseGLTFTransform(cgltf_node* node, Transform &transform)
 {
+	transform.setIdentity();
 	if (node->has_matrix)
-		memcpy(model.m, node->matrix, sizeof(node->matrix)); //transform
-	else {
-		if (node->has_translation)
-			model.translate(node->translation[0], node->translation[1], node->translation[2]);
-		if (node->has_rotation)
-		{
-			Quaternion q(node->rotation[0], node->rotation[1], node->rotation[2], node->rotation[3]);
-			Matrix44 R;
-			q.toMatrix(R);
-			//R.transpose();
-			model = R * model;
-		}
-		if (node->has_scale)
-			model.scale(node->scale[0], node->scale[1], node->scale[2]);
+	{
+		Matrix44 model;
+		memcpy(model.m, node->matrix, sizeof(node->matrix));
+		transform.fromMatrix(model);
+		return;
 	}
+	//GLTF stores the nodes as TRS already
+	if (node->has_translation)
+		transform.translation.set(node->translation[0], node->translation[1], node->translation[2]);
+	if (node->has_rotation)
+		transform.rotation.set(node->rotation[0], node->rotation[1], node->rotation[2], node->rotation[3]);
+	if (node->has_scale)
+		transform.scale.set(node->scale[0], node->scale[1], node->scale[2]);
 }
 
 //GLTF PARSING: you can pass the node or it will create it
@@ -391,7 +391,7 @@ GTR::Node* parseGLTFNode(cgltf_node* node, GTR::Node* scenenode = NULL, const ch
 
     stdlog("\t\t* prefab node: " + scenenode->name );
 
-	parseGLTFTransform(node, scenenode->model);
+	parseGLTFTransform(node, scenenode->transform);
 
     if (node->mesh)
 	{
@@ -464,10 +464,8 @@ cgltf_result internalOpenMemory(const struct cgltf_memory_options* memory_option
 	return cgltf_result_success;
 }
 
-GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& options)
+void buildGLTF(GTR::Prefab* prefab, const char* filename, cgltf_data* data)
 {
-	cgltf_result result;
-
 	if (data->scenes_count > 1)
 		std::cout << "[WARN] more than one scene, skipping the rest" << std::endl;
 
@@ -483,16 +481,6 @@ GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 	const char* basename_start = strrchr(filename, '/');
 	strcpy(basename, basename_start+1);
 
-	{
-		result = cgltf_load_buffers(&options, data, filename);
-		if (result != cgltf_result_success) {
-			stdlog(std::string("[BIN NOT FOUND]:") + filename);
-			return NULL;
-		}
-	}
-
-	GTR::Prefab* prefab = new GTR::Prefab();
-
 	{
 		if (scene->nodes_count > 1)
 		{
@@ -535,8 +523,19 @@ GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 	cgltf_free(data);
 
     stdlog( std::string(" - Loaded ") + filename );
+}
 
-    return prefab;
+GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& options)
+{
+	cgltf_result result = cgltf_load_buffers(&options, data, filename);
+	if (result != cgltf_result_success) {
+		stdlog(std::string("[BIN NOT FOUND]:") + filename);
+		return NULL;
+	}
+
+	GTR::Prefab* prefab = new GTR::Prefab();
+	buildGLTF(prefab, filename, data);
+	return prefab;
 }
 
 GTR::Prefab* loadGLTF(const std::vector<unsigned char>& dat, const std::string& path)
@@ -556,23 +555,37 @@ GTR::Prefab* loadGLTF(const std::vector<unsigned char>& dat, const std::string&
 	return loadGLTF(path.c_str(), data, options);
 }
 
-GTR::Prefab* loadGLTF(const char* filename)
+cgltf_data* readGLTF(const char* filename)
 {
 	stdlog(std::string("loading gltf... ") + filename);
 	cgltf_options options;
 	memset(&options, 0, sizeof(cgltf_options));
 	cgltf_data *data = NULL;
 
-	{
-		options.file.read = internalOpenFile;
-		cgltf_result result = cgltf_parse_file(&options, filename, &data);
+	options.file.read = internalOpenFile;
+	cgltf_result result = cgltf_parse_file(&options, filename, &data);
+	if (result != cgltf_result_success) {
+		std::cout << "[NOT FOUND]" << std::endl;
+		return NULL;
+	}
 
-		if (result != cgltf_result_success) {
-			std::cout << "[NOT FOUND]" << std::endl;
-			return NULL;
-		}
+	result = cgltf_load_buffers(&options, data, filename);
+	if (result != cgltf_result_success) {
+		stdlog(std::string("[BIN NOT FOUND]:") + filename);
+		cgltf_free(data);
+		return NULL;
 	}
+	return data;
+}
 
-	return loadGLTF(filename, data, options);
+GTR::Prefab* loadGLTF(const char* filename)
+{
+	cgltf_data* data = readGLTF(filename);
+	if (!data)
+		return NULL;
+
+	GTR::Prefab* prefab = new GTR::Prefab();
+	buildGLTF(prefab, filename, data);
+	return prefab;
 }
 
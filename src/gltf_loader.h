@@ -2,6 +2,12 @@
 
 #include "prefab.h"
 
+struct cgltf_data;
+
+extern bool load_textures; //false to skip the textures of the materials (tools without a GPU)
+
 GTR::Prefab* loadGLTF(const char* filename);
+cgltf_data* readGLTF(const char* filename); //parses the file and loads its buffers, it can be called from any thread
+void buildGLTF(GTR::Prefab* prefab, const char* filename, cgltf_data* data); //creates the nodes (main thread) and frees the data
 //GTR::Prefab* loadGLTF(const char* filename, cgltf_data* data, cgltf_options& options);
 GTR::Prefab* loadGLTF(const std::vector<unsigned char>& data, const std::string& path);
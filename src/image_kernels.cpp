@@ -0,0 +1,546 @@
+#include "image_kernels.h"
+#include "parallel.h"
+
+#include <cassert>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+//SSE2 is always there in x64, the SSSE3/AVX2/F16C functions are compiled for their instruction set
+//(with the target attribute in GCC, MSVC allows any intrinsic) and only called if the CPU has it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define USE_SSE2
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define TARGET(features)
+	#else
+		#include <cpuid.h>
+		#define TARGET(features) __attribute__((target(features)))
+	#endif
+#endif
+
+static int detectCPUFeatures()
+{
+	int features = 0;
+#ifdef USE_SSE2
+	features |= ImageKernels::CPU_SSE2;
+	#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		bool ssse3 = (info[2] & (1 << 9)) != 0;
+		bool f16c = (info[2] & (1 << 29)) != 0;
+		//AVX registers must be enabled by the OS too
+		bool avx = (info[2] & (1 << 28)) && (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		bool avx2 = avx && (info[1] & (1 << 5));
+	#else
+		__builtin_cpu_init();
+		bool ssse3 = __builtin_cpu_supports("ssse3");
+		bool avx = __builtin_cpu_supports("avx");
+		bool avx2 = __builtin_cpu_supports("avx2");
+		unsigned int eax, ebx, ecx = 0, edx;
+		bool f16c = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C);
+	#endif
+	if (ssse3)
+		features |= ImageKernels::CPU_SSSE3;
+	if (avx2)
+		features |= ImageKernels::CPU_AVX2;
+	if (avx && f16c)
+		features |= ImageKernels::CPU_F16C;
+#endif
+	return features;
+}
+
+int ImageKernels::num_threads = 0;
+int ImageKernels::cpu_features = detectCPUFeatures();
+
+//tables to convert between sRGB and linear without calling pow per texel
+struct sSRGBTables {
+	float to_linear[256];
+	uint8 to_srgb[4097]; //indexed by linear * 4096
+	sSRGBTables() {
+		for (int i = 0; i < 256; ++i)
+		{
+			double c = i / 255.0;
+			to_linear[i] = (float)(c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+		}
+		for (int i = 0; i <= 4096; ++i)
+		{
+			double l = i / 4096.0;
+			double s = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+			to_srgb[i] = (uint8)(s * 255.0 + 0.5);
+		}
+	}
+};
+
+static const sSRGBTables& getSRGBTables()
+{
+	static sSRGBTables tables;
+	return tables;
+}
+
+float ImageKernels::SRGBToLinear(uint8 v)
+{
+	return getSRGBTables().to_linear[v];
+}
+
+uint8 ImageKernels::linearToSRGB(float v)
+{
+	v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+	return getSRGBTables().to_srgb[(int)(v * 4096.0f + 0.5f)];
+}
+
+void ImageKernels::parallelRows(int rows, const std::function<void(int start, int end)>& func, int min_rows)
+{
+	if (num_threads == 1)
+	{
+		func(0, rows);
+		return;
+	}
+
+	//with num_threads set there are no more ranges than threads
+	int grain_size = std::max(1, min_rows);
+	if (num_threads > 1)
+		grain_size = std::max(grain_size, (rows + num_threads - 1) / num_threads);
+	parallelFor(0, rows, func, grain_size);
+}
+
+//*********************
+
+//sRGB applies to the color channels: RGB, or the luminance in grey images
+static inline bool isColorChannel(int c, int num_channels)
+{
+	return num_channels < 3 ? c == 0 : c < 3;
+}
+
+void ImageKernels::downsampleBox(const uint8* src, int width, int height, int num_channels, uint8* dst, bool srgb)
+{
+	assert(src && dst && width > 0 && height > 0);
+	int dw = std::max(1, width / 2);
+	int dh = std::max(1, height / 2);
+	size_t src_row = (size_t)width * num_channels;
+	int dx = width > 1 ? num_channels : 0; //1 texel wide images repeat the same texel
+	size_t dy = height > 1 ? src_row : 0;
+	const sSRGBTables& tables = getSRGBTables();
+
+	parallelRows(dh, [&](int start, int end) {
+		for (int y = start; y < end; ++y)
+		{
+			const uint8* row = src + (size_t)y * 2 * src_row;
+			uint8* out = dst + (size_t)y * dw * num_channels;
+			int x = 0;
+#ifdef USE_SSE2
+			//RGBA: 8 texels of two rows give 4 texels, sums in 16 bits
+			if (!srgb && num_channels == 4 && dx && dy && (cpu_features & CPU_SSE2))
+			{
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i two = _mm_set1_epi16(2);
+				for (; x + 4 <= dw; x += 4)
+				{
+					const uint8* a = row + x * 8;
+					const uint8* b = a + dy;
+					__m128i result[2];
+					for (int k = 0; k < 2; ++k)
+					{
+						__m128i va = _mm_loadu_si128((const __m128i*)(a + k * 16));
+						__m128i vb = _mm_loadu_si128((const __m128i*)(b + k * 16));
+						__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero)); //texels 0,1
+						__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero)); //texels 2,3
+						lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+						hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+						result[k] = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+					}
+					_mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(result[0], result[1]));
+				}
+			}
+#endif
+			for (; x < dw; ++x)
+			{
+				const uint8* p = row + (size_t)x * 2 * num_channels;
+				uint8* o = out + (size_t)x * num_channels;
+				for (int c = 0; c < num_channels; ++c)
+				{
+					if (srgb && isColorChannel(c, num_channels))
+					{
+						float sum = tables.to_linear[p[c]] + tables.to_linear[p[c + dx]] + tables.to_linear[p[c + dy]] + tables.to_linear[p[c + dx + dy]];
+						o[c] = linearToSRGB(sum * 0.25f);
+					}
+					else
+						o[c] = (uint8)((p[c] + p[c + dx] + p[c + dy] + p[c + dx + dy] + 2) >> 2);
+				}
+			}
+		}
+	});
+}
+
+void ImageKernels::downsampleBox(const float* src, int width, int height, int num_channels, float* dst)
+{
+	assert(src && dst && width > 0 && height > 0);
+	int dw = std::max(1, width / 2);
+	int dh = std::max(1, height / 2);
+	size_t src_row = (size_t)width * num_channels;
+	int dx = width > 1 ? num_channels : 0;
+	size_t dy = height > 1 ? src_row : 0;
+
+	parallelRows(dh, [&](int start, int end) {
+		for (int y = start; y < end; ++y)
+		{
+			const float* row = src + (size_t)y * 2 * src_row;
+			float* out = dst + (size_t)y * dw * num_channels;
+			for (int x = 0; x < dw; ++x)
+			{
+				const float* p = row + (size_t)x * 2 * num_channels;
+				for (int c = 0; c < num_channels; ++c)
+					out[x * num_channels + c] = (p[c] + p[c + dx] + p[c + dy] + p[c + dx + dy]) * 0.25f;
+			}
+		}
+	});
+}
+
+static double besselI0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 25; ++k)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+//8 taps around the center of the output texel (between source texels 2x and 2x+1)
+#define KAISER_TAPS 8
+static void computeKaiserWeights(float* weights)
+{
+	const double alpha = 4.0;
+	const double radius = 2.0; //in output texels
+	double total = 0;
+	for (int k = 0; k < KAISER_TAPS; ++k)
+	{
+		double t = (k - KAISER_TAPS / 2 + 0.5) * 0.5; //distance in output texels
+		double sinc = t == 0 ? 1.0 : sin(PI * t) / (PI * t);
+		double r = t / radius;
+		double window = fabs(r) < 1.0 ? besselI0(alpha * sqrt(1.0 - r * r)) / besselI0(alpha) : 0.0;
+		weights[k] = (float)(sinc * window);
+		total += weights[k];
+	}
+	for (int k = 0; k < KAISER_TAPS; ++k)
+		weights[k] = (float)(weights[k] / total);
+}
+
+void ImageKernels::downsampleKaiser(const uint8* src, int width, int height, int num_channels, uint8* dst, bool srgb)
+{
+	assert(src && dst && width > 0 && height > 0);
+	int dw = std::max(1, width / 2);
+	int dh = std::max(1, height / 2);
+	float weights[KAISER_TAPS];
+	computeKaiserWeights(weights);
+	const sSRGBTables& tables = getSRGBTables();
+
+	//the filter is separable: horizontal pass to floats (linear), then vertical pass
+	const int pad = KAISER_TAPS / 2;
+	std::vector<float> temp((size_t)height * dw * num_channels);
+	parallelRows(height, [&](int start, int end) {
+		//the row converted to floats with the border repeated, so the taps dont need clamping
+		std::vector<float> line((size_t)(width + pad * 2) * num_channels);
+		for (int y = start; y < end; ++y)
+		{
+			const uint8* row = src + (size_t)y * width * num_channels;
+			for (int x = -pad; x < width + pad; ++x)
+			{
+				const uint8* p = row + std::min(std::max(x, 0), width - 1) * num_channels;
+				float* l = &line[(size_t)(x + pad) * num_channels];
+				for (int c = 0; c < num_channels; ++c)
+					l[c] = srgb && isColorChannel(c, num_channels) ? tables.to_linear[p[c]] : p[c] * (1.0f / 255.0f);
+			}
+			float* out = &temp[(size_t)y * dw * num_channels];
+			for (int x = 0; x < dw; ++x)
+			{
+				//first tap is the source texel 2x - pad + 1
+				const float* l = &line[(size_t)(x * 2 + 1) * num_channels];
+				for (int c = 0; c < num_channels; ++c)
+				{
+					float sum = 0;
+					for (int k = 0; k < KAISER_TAPS; ++k)
+						sum += weights[k] * l[k * num_channels + c];
+					out[x * num_channels + c] = sum;
+				}
+			}
+		}
+	});
+
+	parallelRows(dh, [&](int start, int end) {
+		size_t temp_row = (size_t)dw * num_channels;
+		std::vector<float> sum(temp_row);
+		for (int y = start; y < end; ++y)
+		{
+			//accumulate whole rows, the inner loop is vectorized by the compiler
+			std::fill(sum.begin(), sum.end(), 0.0f);
+			for (int k = 0; k < KAISER_TAPS; ++k)
+			{
+				int sy = std::min(std::max(y * 2 + k - pad + 1, 0), height - 1);
+				const float* t = &temp[sy * temp_row];
+				float w = weights[k];
+				for (size_t i = 0; i < temp_row; ++i)
+					sum[i] += w * t[i];
+			}
+			uint8* out = dst + (size_t)y * temp_row;
+			for (size_t i = 0; i < temp_row; ++i)
+			{
+				int c = (int)(i % num_channels);
+				if (srgb && isColorChannel(c, num_channels))
+					out[i] = linearToSRGB(sum[i]);
+				else
+					out[i] = (uint8)(std::min(std::max(sum[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+			}
+		}
+	});
+}
+
+//*********************
+
+void ImageKernels::swizzle(const uint8* src, size_t num_pixels, int src_channels, uint8* dst, int dst_channels, const int* map)
+{
+	assert(src && dst && map && src != dst);
+	const int block = 4096;
+	parallelRows((int)((num_pixels + block - 1) / block), [&](int start, int end) {
+		size_t last = std::min(num_pixels, (size_t)end * block);
+		for (size_t i = (size_t)start * block; i < last; ++i)
+		{
+			const uint8* p = src + i * src_channels;
+			uint8* o = dst + i * dst_channels;
+			for (int c = 0; c < dst_channels; ++c)
+				o[c] = map[c] >= 0 ? p[map[c]] : (map[c] == SWIZZLE_ONE ? 255 : 0);
+		}
+	}, 16);
+}
+
+#ifdef USE_SSE2
+//4 texels per iteration, it reads 16 bytes so the last ones are left for the scalar loop. Returns where it stopped
+TARGET("ssse3") static size_t expandRGBtoRGBA_SSSE3(const uint8* src, size_t i, size_t last, uint8* dst)
+{
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32(0xFF000000);
+	for (; i + 6 <= last; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i * 3));
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha));
+	}
+	return i;
+}
+
+TARGET("avx2") static size_t bytesToFloat_AVX2(const uint8* src, size_t i, size_t last, float* dst)
+{
+	const __m256 vscale = _mm256_set1_ps(1.0f / 255.0f);
+	for (; i + 8 <= last; i += 8)
+	{
+		__m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), vscale));
+	}
+	return i;
+}
+
+TARGET("avx,f16c") static size_t floatToHalf_F16C(const float* src, size_t i, size_t last, uint16* dst)
+{
+	for (; i + 8 <= last; i += 8)
+		_mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), 0));
+	return i;
+}
+
+TARGET("avx,f16c") static size_t halfToFloat_F16C(const uint16* src, size_t i, size_t last, float* dst)
+{
+	for (; i + 8 <= last; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+	return i;
+}
+#endif
+
+void ImageKernels::expandRGBtoRGBA(const uint8* src, size_t num_pixels, uint8* dst)
+{
+	assert(src && dst && src != dst);
+	const int block = 4096;
+	parallelRows((int)((num_pixels + block - 1) / block), [&](int start, int end) {
+		size_t i = (size_t)start * block;
+		size_t last = std::min(num_pixels, (size_t)end * block);
+#ifdef USE_SSE2
+		if (cpu_features & CPU_SSSE3)
+			i = expandRGBtoRGBA_SSSE3(src, i, last, dst);
+#endif
+		for (; i < last; ++i)
+		{
+			dst[i * 4] = src[i * 3];
+			dst[i * 4 + 1] = src[i * 3 + 1];
+			dst[i * 4 + 2] = src[i * 3 + 2];
+			dst[i * 4 + 3] = 255;
+		}
+	}, 16);
+}
+
+void ImageKernels::bytesToFloat(const uint8* src, size_t count, float* dst)
+{
+	const int block = 16384;
+	parallelRows((int)((count + block - 1) / block), [&](int start, int end) {
+		size_t i = (size_t)start * block;
+		size_t last = std::min(count, (size_t)end * block);
+		const float scale = 1.0f / 255.0f;
+#ifdef USE_SSE2
+		if (cpu_features & CPU_AVX2)
+			i = bytesToFloat_AVX2(src, i, last, dst);
+		const __m128 vscale = _mm_set1_ps(scale);
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 16 <= last && (cpu_features & CPU_SSE2); i += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), vscale));
+			_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), vscale));
+			_mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), vscale));
+			_mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), vscale));
+		}
+#endif
+		for (; i < last; ++i)
+			dst[i] = src[i] * scale;
+	}, 4);
+}
+
+void ImageKernels::floatToBytes(const float* src, size_t count, uint8* dst)
+{
+	const int block = 16384;
+	parallelRows((int)((count + block - 1) / block), [&](int start, int end) {
+		size_t i = (size_t)start * block;
+		size_t last = std::min(count, (size_t)end * block);
+#ifdef USE_SSE2
+		const __m128 vmax = _mm_set1_ps(255.0f);
+		const __m128 vzero = _mm_setzero_ps();
+		for (; i + 16 <= last && (cpu_features & CPU_SSE2); i += 16)
+		{
+			__m128i v[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				__m128 f = _mm_mul_ps(_mm_loadu_ps(src + i + k * 4), vmax);
+				v[k] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(f, vzero), vmax));
+			}
+			__m128i lo = _mm_packs_epi32(v[0], v[1]);
+			__m128i hi = _mm_packs_epi32(v[2], v[3]);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+		}
+#endif
+		for (; i < last; ++i)
+		{
+			float v = src[i] < 0.0f ? 0.0f : (src[i] > 1.0f ? 1.0f : src[i]);
+			dst[i] = (uint8)(v * 255.0f + 0.5f);
+		}
+	}, 4);
+}
+
+uint16 ImageKernels::toHalf(float v)
+{
+	uint32 x;
+	memcpy(&x, &v, 4);
+	uint32 sign = (x >> 16) & 0x8000;
+	uint32 exp32 = (x >> 23) & 0xFF;
+	uint32 mant = x & 0x7FFFFF;
+	if (exp32 == 0xFF) //inf or nan
+		return (uint16)(sign | 0x7C00 | (mant ? 0x200 : 0));
+	int exp = (int)exp32 - 127 + 15;
+	if (exp >= 31) //overflow
+		return (uint16)(sign | 0x7C00);
+	if (exp <= 0)
+	{
+		//denormal, or zero if too small
+		if (exp < -10)
+			return (uint16)sign;
+		mant |= 0x800000;
+		int shift = 14 - exp;
+		uint32 half = mant >> shift;
+		uint32 rem = mant & ((1u << shift) - 1);
+		uint32 halfway = 1u << (shift - 1);
+		if (rem > halfway || (rem == halfway && (half & 1)))
+			half++;
+		return (uint16)(sign | half);
+	}
+	//round to nearest even, the carry can reach the exponent (and become inf)
+	uint32 half = ((uint32)exp << 10) | (mant >> 13);
+	uint32 rem = mant & 0x1FFF;
+	if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+		half++;
+	return (uint16)(sign | half);
+}
+
+float ImageKernels::fromHalf(uint16 h)
+{
+	uint32 sign = (uint32)(h & 0x8000) << 16;
+	uint32 exp = (h >> 10) & 0x1F;
+	uint32 mant = h & 0x3FF;
+	uint32 x;
+	if (exp == 0)
+	{
+		if (mant == 0)
+			x = sign;
+		else
+		{
+			//denormal, normalize it
+			exp = 127 - 15 + 1;
+			while (!(mant & 0x400))
+			{
+				mant <<= 1;
+				exp--;
+			}
+			x = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+		}
+	}
+	else if (exp == 31)
+		x = sign | 0x7F800000 | (mant << 13);
+	else
+		x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+	float v;
+	memcpy(&v, &x, 4);
+	return v;
+}
+
+void ImageKernels::floatToHalf(const float* src, size_t count, uint16* dst)
+{
+	const int block = 16384;
+	parallelRows((int)((count + block - 1) / block), [&](int start, int end) {
+		size_t i = (size_t)start * block;
+		size_t last = std::min(count, (size_t)end * block);
+#ifdef USE_SSE2
+		if (cpu_features & CPU_F16C)
+			i = floatToHalf_F16C(src, i, last, dst);
+#endif
+		for (; i < last; ++i)
+			dst[i] = toHalf(src[i]);
+	}, 4);
+}
+
+void ImageKernels::halfToFloat(const uint16* src, size_t count, float* dst)
+{
+	const int block = 16384;
+	parallelRows((int)((count + block - 1) / block), [&](int start, int end) {
+		size_t i = (size_t)start * block;
+		size_t last = std::min(count, (size_t)end * block);
+#ifdef USE_SSE2
+		if (cpu_features & CPU_F16C)
+			i = halfToFloat_F16C(src, i, last, dst);
+#endif
+		for (; i < last; ++i)
+			dst[i] = fromHalf(src[i]);
+	}, 4);
+}
+
+void ImageKernels::flipRows(void* data, int rows, size_t row_bytes)
+{
+	assert(data);
+	uint8* bytes = (uint8*)data;
+	parallelRows(rows / 2, [&](int start, int end) {
+		for (int y = start; y < end; ++y)
+		{
+			uint8* a = bytes + (size_t)y * row_bytes;
+			uint8* b = bytes + (size_t)(rows - y - 1) * row_bytes;
+			std::swap_ranges(a, a + row_bytes, b);
+		}
+	}, 64);
+}
@@ -0,0 +1,47 @@
+#ifndef IMAGE_KERNELS_H
+#define IMAGE_KERNELS_H
+
+#include "framework.h"
+#include <cstddef>
+#include <functional>
+
+//ImageKernels
+//CPU functions to process the pixels of tImage buffers. They use SSE2, and SSSE3/AVX2/F16C when the CPU
+//has them (scalar code otherwise), and split the work by rows with parallelFor.
+
+class ImageKernels {
+public:
+	enum { SWIZZLE_ZERO = -1, SWIZZLE_ONE = -2 };
+	enum { CPU_SSE2 = 1, CPU_SSSE3 = 2, CPU_AVX2 = 4, CPU_F16C = 8 };
+
+	static int num_threads; //0 means as many as Parallel allows, 1 runs everything in the calling thread
+	static int cpu_features; //detected at startup, clearing flags forces the other paths (0 is scalar only)
+
+	//splits [0,rows) in ranges processed in parallel, ranges smaller than min_rows are not worth a thread
+	static void parallelRows(int rows, const std::function<void(int start, int end)>& func, int min_rows = 32);
+
+	//2:1 downsampling, the output is max(1,width/2) x max(1,height/2).
+	//With srgb the color channels are filtered in linear space (alpha is always linear)
+	static void downsampleBox(const uint8* src, int width, int height, int num_channels, uint8* dst, bool srgb = false);
+	static void downsampleBox(const float* src, int width, int height, int num_channels, float* dst);
+	//Kaiser windowed sinc, sharper than the box filter
+	static void downsampleKaiser(const uint8* src, int width, int height, int num_channels, uint8* dst, bool srgb = false);
+
+	//dst channel i is src channel map[i], or SWIZZLE_ZERO/SWIZZLE_ONE
+	static void swizzle(const uint8* src, size_t num_pixels, int src_channels, uint8* dst, int dst_channels, const int* map);
+	static void expandRGBtoRGBA(const uint8* src, size_t num_pixels, uint8* dst); //alpha is 255
+
+	static void bytesToFloat(const uint8* src, size_t count, float* dst); //0..255 to 0..1
+	static void floatToBytes(const float* src, size_t count, uint8* dst); //0..1 to 0..255, clamped
+	static void floatToHalf(const float* src, size_t count, uint16* dst);
+	static void halfToFloat(const uint16* src, size_t count, float* dst);
+
+	static void flipRows(void* data, int rows, size_t row_bytes); //in place
+
+	static float SRGBToLinear(uint8 v);
+	static uint8 linearToSRGB(float v);
+	static uint16 toHalf(float v);
+	static float fromHalf(uint16 v);
+};
+
+#endif
@@ -15,7 +15,13 @@
 #include "utils.h"
 #include "input.h"
 #include "application.h"
+#include "texture.h"
+#include "texture_uploader.h"
+#include "texture_atlas.h"
+#include "shader.h"
 #include "task.h"
+#include "benchmark.h"
+#include "scene.h"
 
 #include <iostream> //to output
 
@@ -201,8 +207,20 @@ void mainLoop(SDL_Window* window)
 		//update app logic
 		app->update(elapsed_time);
 
-		//execute a task in the main task manager (blocking)
-		TaskManager::foreground.fetchTask();
+		//replace the programs whose compilation finished
+		Shader::UpdatePending();
+
+		//execute tasks in the main task manager till the frame budget is used (blocking)
+		TaskManager::foreground.drainTasks();
+
+		//stream pending texture rows through the PBOs
+		TextureUploader::update();
+
+		//pack the small textures of the new materials
+		TextureAtlas::Update();
+
+		//keep textures under the VRAM budget
+		Texture::UpdateResidency();
 
 		//check errors in opengl only when working in debug
 		#ifdef _DEBUG
@@ -215,6 +233,25 @@ void mainLoop(SDL_Window* window)
 
 int main(int argc, char **argv)
 {
+	//run a CPU benchmark instead of the app: main --bench <suite|all>
+	if (argc > 2 && strcmp(argv[1], "--bench") == 0)
+		return Benchmark::run(argv[2]);
+
+	//convert a scene JSON to the binary format: main --convert-scene <scene.json> [output.sbin]
+	if (argc > 2 && strcmp(argv[1], "--convert-scene") == 0)
+	{
+		GTR::SceneBin bin;
+		std::string output = argc > 3 ? argv[3] : std::string(argv[2]) + ".sbin";
+		if (!bin.fromJSON(argv[2]) || !bin.save(output.c_str(), argv[2]))
+			return 1;
+		std::cout << " + Scene saved: " << output << " (" << bin.info.num_entities << " entities, " << bin.info.num_assets << " assets)" << std::endl;
+		return 0;
+	}
+
+	//stream a world bigger than memory: main --world <scene.json|scene.sbin>
+	if (argc > 2 && strcmp(argv[1], "--world") == 0)
+		Application::world_filename = argv[2];
+
 	std::cout << "Initiating app..." << std::endl;
 
 	//prepare SDL
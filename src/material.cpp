@@ -7,6 +7,7 @@
 using namespace GTR;
 
 std::map<std::string, Material*> Material::sMaterials;
+unsigned int Material::sVersion = 0;
 
 Material* Material::Get(const char* name)
 {
@@ -21,6 +22,7 @@ void Material::registerMaterial(const char* name)
 {
 	this->name = name;
 	sMaterials[name] = this;
+	sVersion++;
 
 	// Ugly Hack for clouds sorting problem
 	if (!strcmp(name, "Clouds"))
@@ -35,8 +37,11 @@ Material::~Material()
 	if (name.size())
 	{
 		auto it = sMaterials.find(name);
-		if (it != sMaterials.end())
+		if (it != sMaterials.end() && it->second == this)
+		{
 			sMaterials.erase(it);
+			sVersion++;
+		}
 	}
 }
 
@@ -57,6 +62,22 @@ void Material::Release()
 	sMaterials.clear();
 }
 
+unsigned int Material::getShaderFeatures()
+{
+	unsigned int features = 0;
+	if (normal_texture.texture)
+		features |= FEATURE_NORMALMAP;
+	if (emissive_factor.x > 0.0f || emissive_factor.y > 0.0f || emissive_factor.z > 0.0f)
+		features |= FEATURE_EMISSIVE;
+	if (alpha_mode == MASK)
+		features |= FEATURE_ALPHA_MASK;
+	if (occlusion_texture.texture)
+		features |= FEATURE_OCCLUSION;
+	//only the textures the shader reads
+	if (color_texture.isInAtlas() || ((features & FEATURE_EMISSIVE) && emissive_texture.isInAtlas()) || ((features & FEATURE_OCCLUSION) && occlusion_texture.isInAtlas()))
+		features |= FEATURE_ATLAS;
+	return features;
+}
 
 void Material::renderInMenu()
 {
@@ -27,11 +27,26 @@ namespace GTR {
 		DISPLACEMENT
 	};
 
+	//features of a material that need code in its shader, each one is a #define of the uber-shader (see ShaderVariants)
+	enum eMaterialFeature {
+		FEATURE_NORMALMAP = 1 << 0,
+		FEATURE_EMISSIVE = 1 << 1,
+		FEATURE_ALPHA_MASK = 1 << 2,
+		FEATURE_OCCLUSION = 1 << 3,
+		FEATURE_ATLAS = 1 << 4,		//some of its textures are in a TextureAtlas (the uvs are wrapped inside their rect)
+		//these depend on the draw call, not on the material, the renderer adds them
+		FEATURE_SKINNING = 1 << 5,
+		FEATURE_INSTANCING = 1 << 6,
+		NUM_MATERIAL_FEATURES = 7
+	};
+
 	struct Sampler {
 		Texture* texture;
 		int uv_channel;
+		Vector4 uv_transform;	//scale (xy) and offset (zw) of the uvs, used when the texture is in an atlas
 
-		Sampler() { texture = NULL; uv_channel = 0; }
+		Sampler() { texture = NULL; uv_channel = 0; uv_transform.set(1, 1, 0, 0); }
+		bool isInAtlas() const { return texture && (uv_transform.x != 1 || uv_transform.y != 1 || uv_transform.z != 0 || uv_transform.w != 0); }
 	};
 
 	//this class contains all info relevant of how something must be rendered
@@ -39,6 +54,7 @@ namespace GTR {
 	public:
 		//static manager to reuse materials
 		static std::map<std::string, Material*> sMaterials;
+		static unsigned int sVersion; //incremented when a material is registered or unregistered, to detect changes of sMaterials
 		static Material* Get(const char* name);
 		std::string name;
 		void registerMaterial(const char* name);
@@ -73,6 +89,8 @@ namespace GTR {
 
 		static void Release();
 
+		unsigned int getShaderFeatures(); //eMaterialFeature flags, changes if the material is edited
+
 		void renderInMenu();
 	};
 };
\ No newline at end of file
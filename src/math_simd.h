@@ -0,0 +1,104 @@
+#ifndef MATH_SIMD_H
+#define MATH_SIMD_H
+
+//SIMD helpers for 4 floats, used by the math classes of framework.h and TransformKernels. SSE2 (FMA when the compiler targets it), NEON,
+//or plain scalar code when none is available or MATH_NO_SIMD is defined.
+//Loads and stores are unaligned: the math types are 16 bytes aligned, but arrays of them may not be (mapped files,
+//allocators of 32 bits MSVC), and on aligned addresses they cost the same.
+
+#if !defined(MATH_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define MATH_SSE
+	#include <emmintrin.h>
+	#if defined(__FMA__)
+		#include <immintrin.h>
+	#endif
+#elif !defined(MATH_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+	#define MATH_NEON
+	#include <arm_neon.h>
+#endif
+
+#include <cmath>
+
+namespace simd {
+
+#if defined(MATH_SSE)
+	typedef __m128 vec;
+
+	inline vec load(const float* p) { return _mm_loadu_ps(p); }
+	inline void store(float* p, vec a) { _mm_storeu_ps(p, a); }
+	inline vec load3(const float* p) { return _mm_movelh_ps(_mm_castpd_ps(_mm_load_sd((const double*)p)), _mm_load_ss(p + 2)); } //w is 0
+	inline void store3(float* p, vec a) { _mm_store_sd((double*)p, _mm_castps_pd(a)); _mm_store_ss(p + 2, _mm_movehl_ps(a, a)); }
+	inline vec set(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+	inline vec splat(float v) { return _mm_set1_ps(v); }
+	inline vec add(vec a, vec b) { return _mm_add_ps(a, b); }
+	inline vec sub(vec a, vec b) { return _mm_sub_ps(a, b); }
+	inline vec mul(vec a, vec b) { return _mm_mul_ps(a, b); }
+	inline vec min(vec a, vec b) { return _mm_min_ps(a, b); }
+	inline vec max(vec a, vec b) { return _mm_max_ps(a, b); }
+	inline vec abs(vec a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+	#if defined(__FMA__)
+	inline vec madd(vec a, vec b, vec c) { return _mm_fmadd_ps(a, b, c); } //a*b+c
+	#else
+	inline vec madd(vec a, vec b, vec c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+	#endif
+	template<int i> inline vec lane(vec a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(i, i, i, i)); } //broadcast
+	template<int x, int y, int z, int w> inline vec shuffle(vec a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(w, z, y, x)); }
+	inline float sum(vec a)
+	{
+		vec t = _mm_add_ps(a, _mm_movehl_ps(a, a));
+		return _mm_cvtss_f32(_mm_add_ss(t, _mm_shuffle_ps(t, t, 1)));
+	}
+
+#elif defined(MATH_NEON)
+	typedef float32x4_t vec;
+
+	inline vec load(const float* p) { return vld1q_f32(p); }
+	inline void store(float* p, vec a) { vst1q_f32(p, a); }
+	inline vec load3(const float* p) { return vcombine_f32(vld1_f32(p), vset_lane_f32(p[2], vdup_n_f32(0.0f), 0)); }
+	inline void store3(float* p, vec a) { vst1_f32(p, vget_low_f32(a)); vst1q_lane_f32(p + 2, a, 2); }
+	inline vec set(float x, float y, float z, float w) { float v[4] = { x, y, z, w }; return vld1q_f32(v); }
+	inline vec splat(float v) { return vdupq_n_f32(v); }
+	inline vec add(vec a, vec b) { return vaddq_f32(a, b); }
+	inline vec sub(vec a, vec b) { return vsubq_f32(a, b); }
+	inline vec mul(vec a, vec b) { return vmulq_f32(a, b); }
+	inline vec min(vec a, vec b) { return vminq_f32(a, b); }
+	inline vec max(vec a, vec b) { return vmaxq_f32(a, b); }
+	inline vec abs(vec a) { return vabsq_f32(a); }
+	inline vec madd(vec a, vec b, vec c) { return vmlaq_f32(c, a, b); }
+	template<int i> inline vec lane(vec a) { return vdupq_n_f32(vgetq_lane_f32(a, i)); }
+	template<int x, int y, int z, int w> inline vec shuffle(vec a)
+	{
+		return set(vgetq_lane_f32(a, x), vgetq_lane_f32(a, y), vgetq_lane_f32(a, z), vgetq_lane_f32(a, w));
+	}
+	inline float sum(vec a)
+	{
+		float32x2_t t = vadd_f32(vget_low_f32(a), vget_high_f32(a));
+		return vget_lane_f32(vpadd_f32(t, t), 0);
+	}
+
+#else
+	struct vec { float v[4]; };
+
+	inline vec load(const float* p) { vec r = { { p[0], p[1], p[2], p[3] } }; return r; }
+	inline void store(float* p, vec a) { p[0] = a.v[0]; p[1] = a.v[1]; p[2] = a.v[2]; p[3] = a.v[3]; }
+	inline vec load3(const float* p) { vec r = { { p[0], p[1], p[2], 0.0f } }; return r; }
+	inline void store3(float* p, vec a) { p[0] = a.v[0]; p[1] = a.v[1]; p[2] = a.v[2]; }
+	inline vec set(float x, float y, float z, float w) { vec r = { { x, y, z, w } }; return r; }
+	inline vec splat(float v) { return set(v, v, v, v); }
+	inline vec add(vec a, vec b) { return set(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]); }
+	inline vec sub(vec a, vec b) { return set(a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]); }
+	inline vec mul(vec a, vec b) { return set(a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]); }
+	inline vec min(vec a, vec b) { return set(fminf(a.v[0], b.v[0]), fminf(a.v[1], b.v[1]), fminf(a.v[2], b.v[2]), fminf(a.v[3], b.v[3])); }
+	inline vec max(vec a, vec b) { return set(fmaxf(a.v[0], b.v[0]), fmaxf(a.v[1], b.v[1]), fmaxf(a.v[2], b.v[2]), fmaxf(a.v[3], b.v[3])); }
+	inline vec abs(vec a) { return set(fabsf(a.v[0]), fabsf(a.v[1]), fabsf(a.v[2]), fabsf(a.v[3])); }
+	inline vec madd(vec a, vec b, vec c) { return add(mul(a, b), c); }
+	template<int i> inline vec lane(vec a) { return splat(a.v[i]); }
+	template<int x, int y, int z, int w> inline vec shuffle(vec a) { return set(a.v[x], a.v[y], a.v[z], a.v[w]); }
+	inline float sum(vec a) { return (a.v[0] + a.v[1]) + (a.v[2] + a.v[3]); }
+#endif
+
+	inline float dot(vec a, vec b) { return sum(mul(a, b)); }
+	inline vec lerp(vec a, vec b, float t) { return madd(sub(b, a), splat(t), a); }
+};
+
+#endif
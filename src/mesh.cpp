@@ -4,6 +4,7 @@
 #include "shader.h"
 #include "includes.h"
 #include "framework.h"
+#include "transform_kernels.h"
 
 #include <cassert>
 #include <iostream>
@@ -345,6 +346,22 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 	num_meshes_rendered++;
 }
 
+void Mesh::drawRange(unsigned int primitive, int start, int count)
+{
+	if (m_indices.size())
+	{
+		assert(indices_vbo_id && "indices must be uploaded to the GPU");
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+		glDrawElements(primitive, count, GL_UNSIGNED_INT, (void*)(start * sizeof(unsigned int)));
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	else
+		glDrawArrays(primitive, start, count);
+
+	num_triangles_rendered += count / 3;
+	num_meshes_rendered++;
+}
+
 void Mesh::disableBuffers(Shader* shader)
 {
 	if (vertex_location != -1) glDisableVertexAttribArray(vertex_location);
@@ -593,6 +610,28 @@ void Mesh::uploadToVRAM()
 	//clear buffers to save memory
 }
 
+size_t Mesh::getMemoryBytes()
+{
+	size_t bytes = vertices.size() * sizeof(Vector3) + normals.size() * sizeof(Vector3) + uvs.size() * sizeof(Vector2) + m_uvs1.size() * sizeof(Vector2) +
+		colors.size() * sizeof(Vector4) + interleaved.size() * sizeof(tInterleaved) + m_indices.size() * sizeof(unsigned int) +
+		bones.size() * sizeof(Vector4ub) + weights.size() * sizeof(Vector4);
+	if (vertices_vbo_id || interleaved_vbo_id)
+		bytes *= 2;
+	return bytes;
+}
+
+void Mesh::uploadIndicesToVRAM(int start, int count)
+{
+	assert(indices_vbo_id && "indices must be uploaded to the GPU");
+	assert(start >= 0 && start + count <= (int)m_indices.size());
+	if (!count)
+		return;
+	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, start * sizeof(unsigned int), count * sizeof(unsigned int), &m_indices[start]);
+	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
+	checkGLErrors();
+}
+
 bool Mesh::createCollisionModel(bool is_static)
 {
 	if (collision_model)
@@ -654,7 +693,7 @@ bool Mesh::createCollisionModel(bool is_static)
 }
 
 //help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
-bool Mesh::testRayCollision(Matrix44 model, Vector3 start, Vector3 front, Vector3& collision, Vector3& normal, float max_ray_dist, bool in_object_space )
+bool Mesh::testRayCollision(const Matrix44& model, Vector3 start, Vector3 front, Vector3& collision, Vector3& normal, float max_ray_dist, bool in_object_space )
 {
 	if (!this->collision_model)
 		if (!createCollisionModel())
@@ -663,7 +702,7 @@ bool Mesh::testRayCollision(Matrix44 model, Vector3 start, Vector3 front, Vector
 	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
 	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
 
-	collision_model->setTransform( model.m );
+	collision_model->setTransform( (float*)model.m ); //it is copied
 	if (collision_model->rayCollision( start.v , front.v, true,0.0, max_ray_dist) == false)
 		return false;
 
@@ -683,7 +722,7 @@ bool Mesh::testRayCollision(Matrix44 model, Vector3 start, Vector3 front, Vector
 	return true;
 }
 
-bool Mesh::testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal)
+bool Mesh::testSphereCollision(const Matrix44& model, Vector3 center, float radius, Vector3& collision, Vector3& normal)
 {
 	if (!this->collision_model)
 		if (!createCollisionModel())
@@ -692,7 +731,7 @@ bool Mesh::testSphereCollision(Matrix44 model, Vector3 center, float radius, Vec
 	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
 	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
 
-	collision_model->setTransform(model.m);
+	collision_model->setTransform((float*)model.m);
 	if (collision_model->sphereCollision(center.v, radius) == false)
 		return false;
 
@@ -1486,23 +1525,9 @@ void Mesh::createGrid(float dist)
 void Mesh::updateBoundingBox()
 {
 	if (vertices.size())
-	{
-		aabb_max = aabb_min = vertices[0];
-		for (int i = 1; i < vertices.size(); ++i)
-		{
-			aabb_min.setMin(vertices[i]);
-			aabb_max.setMax(vertices[i]);
-		}
-	}
+		TransformKernels::computeMinMax(&vertices[0], (int)vertices.size(), aabb_min, aabb_max);
 	else if (interleaved.size())
-	{
-		aabb_max = aabb_min = interleaved[0].vertex;
-		for (int i = 1; i < vertices.size(); ++i)
-		{
-			aabb_min.setMin(interleaved[i].vertex);
-			aabb_max.setMax(interleaved[i].vertex);
-		}
-	}
+		TransformKernels::computeMinMax(&interleaved[0].vertex, (int)interleaved.size(), aabb_min, aabb_max, sizeof(tInterleaved));
 	box.center = (aabb_max + aabb_min) * 0.5f;
 	box.halfsize = aabb_max - box.center;
 }
@@ -13,7 +13,7 @@ class Image; //for displace
 class Skeleton; //for skinned meshes
 
 //version from 11/5/2020
-#define MESH_BIN_VERSION 11 //this is used to regenerate bins if the format changes
+#define MESH_BIN_VERSION 12 //this is used to regenerate bins if the format changes
 
 struct BoneInfo {
 	char name[32]; //max 32 chars per bone name
@@ -95,19 +95,21 @@ public:
 	void enableBuffers(Shader* shader);
 	void drawCall(unsigned int primitive, int submesh_id, int num_instances);
 	void disableBuffers(Shader* shader);
+	void drawRange(unsigned int primitive, int start, int count); //count indices (or vertices) from start, the buffers must be enabled
 
 	bool readBin(const char* filename, bool bFromNetwork);
 	bool writeBin(const char* filename);
 
 	unsigned int getNumSubmeshes() { return (unsigned int)submeshes.size(); }
+	size_t getMemoryBytes(); //of its arrays, twice if they are also in VRAM
 	unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
 
 	//collision testing
 	void* collision_model;
 	bool createCollisionModel(bool is_static = false); //is_static sets if the inv matrix should be computed after setTransform (true) or before rayCollision (false)
 	//help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
-	bool testRayCollision( Matrix44 model, Vector3 ray_origin, Vector3 ray_direction, Vector3& collision, Vector3& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false );
-	bool testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal);
+	bool testRayCollision( const Matrix44& model, Vector3 ray_origin, Vector3 ray_direction, Vector3& collision, Vector3& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false );
+	bool testSphereCollision(const Matrix44& model, Vector3 center, float radius, Vector3& collision, Vector3& normal);
 
 	//loader
 	static Mesh* Get(const char* filename, bool bFromNetwork = false, bool skip_load = false);
@@ -128,6 +130,7 @@ public:
 
 	//optimize meshes
 	void uploadToVRAM();
+	void uploadIndicesToVRAM(int start, int count); //after changing a range of m_indices of an uploaded mesh
 	bool interleaveBuffers();
 
 private:
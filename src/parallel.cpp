@@ -0,0 +1,83 @@
+#include "parallel.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+int Parallel::max_threads = 0;
+TaskManager* Parallel::manager = NULL;
+
+//shared by the caller and the helpers, helpers that start late may still touch it after the loop returned
+struct sParallelLoop {
+	std::atomic<int> next_chunk;
+	std::atomic<int> chunks_done;
+	int num_chunks;
+	int begin;
+	int end;
+	int grain_size;
+	const std::function<void(int, int)>* func; //only used while chunks remain, the caller is still waiting then
+
+	//takes chunks till there are no more, returns false if it couldnt take any
+	bool work() {
+		bool worked = false;
+		while (true)
+		{
+			int chunk = next_chunk.fetch_add(1);
+			if (chunk >= num_chunks)
+				return worked;
+			int start = begin + chunk * grain_size;
+			(*func)(start, std::min(start + grain_size, end));
+			chunks_done.fetch_add(1, std::memory_order_release);
+			worked = true;
+		}
+	}
+};
+
+int Parallel::getNumThreads()
+{
+	TaskManager* target = manager ? manager : &TaskManager::background;
+	int threads = 1;
+	if (target->pool)
+	{
+		//a worker calling it is already one of the pool
+		threads = target->pool->getNumThreads();
+		if (ThreadPool::getWorkerIndex() == -1)
+			threads++;
+	}
+	if (max_threads > 0)
+		threads = std::min(threads, max_threads);
+	return threads;
+}
+
+void parallelFor(int begin, int end, const std::function<void(int start, int end)>& func, int grain_size)
+{
+	if (end <= begin)
+		return;
+	grain_size = std::max(1, grain_size);
+	int num_chunks = (end - begin + grain_size - 1) / grain_size;
+	int num_helpers = std::min(Parallel::getNumThreads(), num_chunks) - 1;
+	if (num_helpers <= 0)
+	{
+		func(begin, end);
+		return;
+	}
+
+	std::shared_ptr<sParallelLoop> loop = std::make_shared<sParallelLoop>();
+	loop->next_chunk = 0;
+	loop->chunks_done = 0;
+	loop->num_chunks = num_chunks;
+	loop->begin = begin;
+	loop->end = end;
+	loop->grain_size = grain_size;
+	loop->func = &func;
+
+	TaskManager* target = Parallel::manager ? Parallel::manager : &TaskManager::background;
+	for (int i = 0; i < num_helpers; ++i)
+		target->addTask(new Task([loop]() { loop->work(); }));
+
+	//take chunks too, then wait for the ones that other threads are finishing
+	loop->work();
+	while (loop->chunks_done.load(std::memory_order_acquire) < num_chunks)
+		std::this_thread::yield();
+}
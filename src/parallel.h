@@ -0,0 +1,46 @@
+#pragma once
+
+#include "task.h"
+#include <functional>
+#include <vector>
+
+//parallelFor / parallelReduce
+//split [begin,end) in chunks of grain_size items. Some tasks in the pool of Parallel::manager take chunks and so does
+//the calling thread, which returns once all of them finished. As the caller does not wait idle, they can be called
+//from a task (even nested). Without pool, or with a single chunk, everything runs in the calling thread.
+//Choose grain_size so a chunk is worth a task (thousands of cycles), cheap items need big chunks.
+
+class Parallel {
+public:
+	static int max_threads;			//threads working in a loop counting the caller, 0 means all the workers plus the caller
+	static TaskManager* manager;	//whose pool runs the chunks, TaskManager::background if NULL
+	static int getNumThreads();		//the ones a loop started now would use
+};
+
+//func(start, end) for every chunk
+void parallelFor(int begin, int end, const std::function<void(int start, int end)>& func, int grain_size = 1);
+
+//func(start, end) returns the value of a chunk, and reduce(a, b) combines two values.
+//The values are combined in the order of the chunks, so the result doesnt depend on the threads
+template <typename T, typename F, typename R>
+T parallelReduce(int begin, int end, T identity, F func, R reduce, int grain_size = 1)
+{
+	if (end <= begin)
+		return identity;
+	grain_size = grain_size < 1 ? 1 : grain_size;
+	int num_chunks = (end - begin + grain_size - 1) / grain_size;
+	std::vector<T> values(num_chunks, identity);
+	parallelFor(0, num_chunks, [&](int start, int finish) {
+		for (int i = start; i < finish; ++i)
+		{
+			int chunk_begin = begin + i * grain_size;
+			int chunk_end = chunk_begin + grain_size < end ? chunk_begin + grain_size : end;
+			values[i] = func(chunk_begin, chunk_end);
+		}
+	});
+
+	T result = identity;
+	for (auto& value : values)
+		result = reduce(result, value);
+	return result;
+}
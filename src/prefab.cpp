@@ -13,12 +13,13 @@
 #include "application.h"
 
 #include <iostream>
+#include <algorithm>
 
 using namespace GTR;
 
 int Node::s_NodeID = 0;
 
-Node::Node() : parent(NULL), mesh(NULL), material(NULL), visible(true), layers(0xFF)
+Node::Node() : parent(NULL), mesh(NULL), material(NULL), visible(true), layers(0xFF), prefab(NULL), flat_index(-1)
 {
 	m_Id = s_NodeID++;
 }
@@ -35,8 +36,20 @@ Node::~Node()
 	material = nullptr;
 }
 
+//the node and its children no longer belong to a flattened prefab
+static void detachFromPrefab(Node* node)
+{
+	node->prefab = NULL;
+	node->flat_index = -1;
+	for (int i = 0; i < node->children.size(); ++i)
+		detachFromPrefab(node->children[i]);
+}
+
 void Node::clear()
 {
+	if (prefab && children.size())
+		prefab->invalidateHierarchy();
+
 	//delete children
 	for (int i = 0; i < children.size(); ++i)
 	{
@@ -54,12 +67,24 @@ BoundingBox Node::getBoundingBox()
 		aabb = mesh->box;
 	for (int i = 0; i < children.size(); ++i)
 		aabb = mergeBoundingBoxes( children[i]->getBoundingBox(), aabb );
-	return transformBoundingBox(model, aabb);
+	return transformBoundingBox(transform.toMatrix(), aabb);
+}
+
+void Node::addChild(Node* child)
+{
+	assert(child->parent == NULL);
+	children.push_back(child);
+	child->parent = this;
+	if (prefab)
+		prefab->invalidateHierarchy();
 }
 
 void Node::removeChild(Node* child)
 {
 	assert(child->parent == this);
+	if (prefab)
+		prefab->invalidateHierarchy();
+	detachFromPrefab(child);
 	for (int i = 0; i < children.size(); ++i)
 	{
 		Node* node = children[i];
@@ -121,6 +146,12 @@ bool Node::testRay(const Ray& ray, Vector3& result, int layers, float max_dist)
 	return collided;
 }
 
+void Node::markDirty()
+{
+	if (prefab)
+		prefab->markDirty(this);
+}
+
 void Node::operator = (const Node& node)
 {
 	Node* old_parent = parent;
@@ -131,7 +162,7 @@ void Node::operator = (const Node& node)
 	name = node.name;
 	visible = node.visible;
 	layers = node.layers;
-	model = node.model;
+	transform = node.transform;
 	aabb = node.aabb;
 
 	//clone children
@@ -154,7 +185,11 @@ void Node::renderInMenu()
 	ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.75f, 0.75f, 0.75f, 1.0f));
 
 	//Model edit
+	Matrix44 model = transform.toMatrix();
+	Matrix44 old_model = model;
 	ImGuiMatrix44(model, "Model");
+	if (memcmp(&old_model, &model, sizeof(Matrix44)) != 0)
+		setModel(model);
 
 	//Material
 	if (material && ImGui::TreeNode(material, "Material"))
@@ -181,10 +216,19 @@ void Node::renderInMenu()
 
 Prefab::Prefab()
 {
+	flat_valid = false;
+	transforms_dirty = false;
+	transforms_version = 0;
+	ref_count = 0;
+	memory_bytes = 0;
+	release_stamp = 0;
 }
 
 Prefab::~Prefab()
 {
+	assert(ref_count == 0 && "prefab still used by some entity");
+	sMemoryUsed -= memory_bytes;
+	detachFromPrefab(&root);
 	if (name.size())
 	{
 		auto it = sPrefabsLoaded.find(name);
@@ -195,10 +239,89 @@ Prefab::~Prefab()
 
 void Prefab::updateBounding()
 {
-	bounding = root.getBoundingBox();
+	flat_valid = false;
+	updateTransforms();
+}
+
+void Prefab::markDirty(Node* node)
+{
+	//if the hierarchy changed, the next flatten marks everything
+	if (!flat_valid)
+		return;
+	assert(flat_nodes[node->flat_index] == node);
+	flat_dirty[node->flat_index] = 1;
+	transforms_dirty = true;
+}
+
+void Prefab::flatten()
+{
+	flat_nodes.clear();
+	flat_parents.clear();
+	flat_subtree_ends.clear();
+	flattenNode(&root, -1);
+
+	int num_nodes = (int)flat_nodes.size();
+	flat_globals.resize(num_nodes);
+	flat_bounds.resize(num_nodes);
+	flat_dirty.assign(num_nodes, 1);
+	transforms_dirty = true;
+	flat_valid = true;
+}
+
+void Prefab::flattenNode(Node* node, int parent)
+{
+	int index = (int)flat_nodes.size();
+	node->prefab = this;
+	node->flat_index = index;
+	flat_nodes.push_back(node);
+	flat_parents.push_back(parent);
+	flat_subtree_ends.push_back(0);
+	for (int i = 0; i < node->children.size(); ++i)
+		flattenNode(node->children[i], index);
+	flat_subtree_ends[index] = (int)flat_nodes.size();
+}
+
+bool Prefab::updateTransforms()
+{
+	if (!flat_valid)
+		flatten();
+	if (!transforms_dirty)
+		return false;
+
+	//parents come first, so a dirty parent has already passed its flag when the children are reached
+	bool has_bounds = false;
+	for (int i = 0; i < flat_nodes.size(); ++i)
+	{
+		Node* node = flat_nodes[i];
+		int parent = flat_parents[i];
+		if (parent != -1 && flat_dirty[parent])
+			flat_dirty[i] = 1;
+		if (flat_dirty[i])
+		{
+			Matrix44 model = node->transform.toMatrix();
+			flat_globals[i] = parent == -1 ? model : model * flat_globals[parent];
+			node->global_model = flat_globals[i];
+			if (node->mesh)
+				flat_bounds[i] = transformBoundingBox(flat_globals[i], node->mesh->box);
+		}
+		if (node->mesh)
+		{
+			bounding = has_bounds ? mergeBoundingBoxes(bounding, flat_bounds[i]) : flat_bounds[i];
+			has_bounds = true;
+		}
+	}
+	if (!has_bounds)
+		bounding = BoundingBox(Vector3(), Vector3());
+
+	memset(&flat_dirty[0], 0, flat_dirty.size());
+	transforms_dirty = false;
+	transforms_version++;
+	return true;
 }
 
 std::map<std::string, Prefab*> Prefab::sPrefabsLoaded;
+size_t Prefab::sMemoryUsed = 0;
+long Prefab::sReleaseCount = 0;
 
 Prefab* Prefab::Get(const char* filename)
 {
@@ -220,9 +343,120 @@ Prefab* Prefab::Get(const char* filename)
 	std::string name = filename;
 	prefab->registerPrefab(name);
 	prefab->updateBounding();
+	prefab->computeMemory();
 	return prefab;
 }
 
+Prefab* Prefab::GetAsync(const char* filename)
+{
+	assert(filename);
+	std::map<std::string, Prefab*>::iterator it = sPrefabsLoaded.find(filename);
+	if (it != sPrefabsLoaded.end())
+		return it->second;
+
+	Prefab* prefab = new Prefab();
+	std::string name = filename;
+	prefab->registerPrefab(name);
+
+	//read and parse in a worker, then create the nodes in the main thread as meshes are uploaded to GPU
+	TaskFuture<cgltf_data*> data = TaskManager::background.async([name]() { return readGLTF(name.c_str()); });
+	prefab->loaded = TaskManager::foreground.run([prefab, name, data]() {
+		if (!data.get()) {
+			std::cout << "[ERROR]: Prefab not found" << std::endl;
+			return;
+		}
+		buildGLTF(prefab, name.c_str(), data.get());
+		prefab->updateBounding();
+		prefab->computeMemory();
+	}, { data.event });
+	return prefab;
+}
+
+void Prefab::UpdateAll()
+{
+	for (auto& it : sPrefabsLoaded)
+		it.second->updateTransforms();
+}
+
+void Prefab::release()
+{
+	assert(ref_count > 0);
+	if (--ref_count == 0)
+		release_stamp = ++sReleaseCount;
+}
+
+//the meshes and materials of a file are registered with its name as prefix, or not registered at all
+static bool isAssetOf(const std::string& asset_name, const std::string& prefab_name)
+{
+	return asset_name.empty() || asset_name.compare(0, prefab_name.size() + 2, prefab_name + "::") == 0;
+}
+
+static void gatherAssets(Node* node, std::vector<Mesh*>& meshes, std::vector<Material*>& materials)
+{
+	if (node->mesh && std::find(meshes.begin(), meshes.end(), node->mesh) == meshes.end())
+		meshes.push_back(node->mesh);
+	if (node->material && std::find(materials.begin(), materials.end(), node->material) == materials.end())
+		materials.push_back(node->material);
+	for (int i = 0; i < node->children.size(); ++i)
+		gatherAssets(node->children[i], meshes, materials);
+}
+
+void Prefab::computeMemory()
+{
+	std::vector<Mesh*> meshes;
+	std::vector<Material*> materials;
+	gatherAssets(&root, meshes, materials);
+	sMemoryUsed -= memory_bytes;
+	memory_bytes = 0;
+	for (auto mesh : meshes)
+		if (isAssetOf(mesh->name, name))
+			memory_bytes += mesh->getMemoryBytes();
+	sMemoryUsed += memory_bytes;
+}
+
+void Prefab::deleteAssets()
+{
+	std::vector<Mesh*> meshes;
+	std::vector<Material*> materials;
+	gatherAssets(&root, meshes, materials);
+	root.clear();
+	for (auto mesh : meshes)
+	{
+		if (!isAssetOf(mesh->name, name))
+			continue;
+		auto it = Mesh::sMeshesLoaded.find(mesh->name);
+		if (it != Mesh::sMeshesLoaded.end() && it->second == mesh)
+			Mesh::sMeshesLoaded.erase(it);
+		delete mesh;
+	}
+	for (auto material : materials)
+		if (isAssetOf(material->name, name))
+			delete material; //it unregisters itself
+}
+
+int Prefab::UnloadUnused(size_t budget)
+{
+	if (sMemoryUsed <= budget)
+		return 0;
+
+	std::vector<Prefab*> unused;
+	for (auto& it : sPrefabsLoaded)
+		if (it.second->ref_count == 0 && it.second->isLoaded())
+			unused.push_back(it.second);
+	std::sort(unused.begin(), unused.end(), [](Prefab* a, Prefab* b) { return a->release_stamp < b->release_stamp; });
+
+	int num_unloaded = 0;
+	for (auto prefab : unused)
+	{
+		if (sMemoryUsed <= budget)
+			break;
+		prefab->deleteAssets();
+		delete prefab;
+		num_unloaded++;
+	}
+	return num_unloaded;
+}
+
 void Prefab::registerPrefab(std::string name)
 {
 	this->name = name;
@@ -7,6 +7,7 @@
 
 #include "material.h"
 #include "scene.h"
+#include "task.h"
 
 //forward declaration
 class Mesh;
@@ -15,6 +16,8 @@ class Camera;
 
 namespace GTR {
 
+	class Prefab;
+
 	class Primitive {
 	public:
 		Material* material;
@@ -41,7 +44,7 @@ namespace GTR {
 		//std::vector<Primitive*> primitives;
 		Material* material;
 
-		Matrix44 model;	//the matrix that defines where is the object (in relation to its parent)
+		Transform transform;	//where is the object in relation to its parent, as translation, rotation and scale
 		Matrix44 global_model;	//the matrix that defines where is the object (in relation to the world)
 
 		BoundingBox aabb; //node bounding box in world space
@@ -50,6 +53,10 @@ namespace GTR {
 		Node* parent;
 		std::vector<Node*> children;
 
+		//set when its prefab flattens the tree, to tell it about changes
+		Prefab* prefab;
+		int flat_index;
+
 		//ctor
 		Node();
 
@@ -65,20 +72,21 @@ namespace GTR {
 		Node* findNode(const char* name);
 
 		//add node to children list
-		void addChild(Node* child)
-		{
-			assert(child->parent == NULL);
-			children.push_back(child);
-			child->parent = this;
-		}
+		void addChild(Node* child);
 		void removeChild(Node* child);
 
+		//call markDirty after changing transform, so the prefab recomputes the transforms of this subtree
+		void setTransform(const Transform& transform) { this->transform = transform; markDirty(); }
+		void setModel(const Matrix44& model) { transform.fromMatrix(model); markDirty(); } //without shear
+		Matrix44 getModel() const { return transform.toMatrix(); }
+		void markDirty();
+
 		//compute the global matrix taking into account its parent
 		Matrix44 getGlobalMatrix(bool fast = false) { 
 			if (parent)
-				global_model = model * (fast ? parent->global_model : parent->getGlobalMatrix());
+				global_model = transform.toMatrix() * (fast ? parent->global_model : parent->getGlobalMatrix());
 			else
-				global_model = model;
+				global_model = transform.toMatrix();
 			return global_model;
 		}
 
@@ -100,12 +108,34 @@ namespace GTR {
 
 		//root node which contains the tree
 		Node root;
-		BoundingBox bounding;
+		BoundingBox bounding; //of the meshes in prefab space
+		TaskEventRef loaded; //signaled when the nodes were created by GetAsync, NULL if loaded synchronously
+		bool isLoaded() { return !loaded || loaded->isFinished(); }
+
+		//entities using it (see PrefabEntity::setPrefab), the unused ones can be unloaded by UnloadUnused
+		int ref_count;
+		void addRef() { ref_count++; }
+		void release();
+		size_t memory_bytes; //of the meshes of its file, once loaded
 
 		//dtor
 		Prefab();
 		~Prefab();
 
+		//the tree in flat arrays, parents before their children, so traversing it is a linear scan
+		std::vector<Node*> flat_nodes;
+		std::vector<int> flat_parents;			//-1 for the root
+		std::vector<int> flat_subtree_ends;		//index after the last descendant, to skip hidden subtrees
+		std::vector<Matrix44> flat_globals;		//in prefab space
+		std::vector<BoundingBox> flat_bounds;	//of the mesh of the node in prefab space
+		std::vector<uint8> flat_dirty;			//model changed since the last update
+
+		void flatten(); //rebuilds the arrays, it is done by updateTransforms after the hierarchy changes
+		void invalidateHierarchy() { flat_valid = false; }
+		void markDirty(Node* node);
+		bool updateTransforms(); //recomputes the dirty subtrees and the bounding, false if nothing changed
+		int transforms_version; //incremented every time the transforms change, so instances know when to update
+
 		void updateBounding();
 		void updateNodesByName();
 		Node* getNodeByName(const char* name);
@@ -113,7 +143,22 @@ namespace GTR {
 				//Manager to cache loaded prefabs
 		static std::map<std::string, Prefab*> sPrefabsLoaded;
 		static Prefab* Get(const char* filename);
+		static Prefab* GetAsync(const char* filename); //empty till the file is read in a worker and its nodes are created in the main thread
+		static void UpdateAll(); //updates the transforms of the loaded prefabs that changed
+		static size_t sMemoryUsed; //memory_bytes of all the loaded prefabs
+		//deletes the unused prefabs (the ones released longer ago first), with the meshes and materials of their files,
+		//till sMemoryUsed is under the budget. Returns how many were deleted
+		static int UnloadUnused(size_t budget);
 		void registerPrefab(std::string name);
+
+	private:
+		bool flat_valid;
+		bool transforms_dirty;
+		long release_stamp; //order in which the prefabs became unused
+		static long sReleaseCount;
+		void flattenNode(Node* node, int parent);
+		void computeMemory();
+		void deleteAssets();
 	};
 
 };
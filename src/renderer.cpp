@@ -8,11 +8,28 @@
 #include "material.h"
 #include "utils.h"
 #include "scene.h"
+#include "parallel.h"
 #include "extra/hdre.h"
 
 
 using namespace GTR;
 
+Renderer::Renderer()
+{
+	use_static_batching = true;
+
+	//same order than eMaterialFeature
+	material_shaders = new ShaderVariants("material.vs", "material.fs", { "NORMALMAP", "EMISSIVE", "ALPHA_MASK", "OCCLUSION", "ATLAS", "SKINNING", "INSTANCING" });
+	assert(material_shaders->macros.size() == NUM_MATERIAL_FEATURES);
+}
+
+void Renderer::warmShaders()
+{
+	material_shaders->warm(0);
+	for (auto& it : Material::sMaterials)
+		material_shaders->warm(it.second->getShaderFeatures());
+}
+
 void Renderer::renderScene(GTR::Scene* scene, Camera* camera)
 {
 	//set the clear color (the background color)
@@ -22,21 +39,30 @@ void Renderer::renderScene(GTR::Scene* scene, Camera* camera)
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	checkGLErrors();
 
-	//render entities
-	for (int i = 0; i < scene->entities.size(); ++i)
-	{
-		BaseEntity* ent = scene->entities[i];
-		if (!ent->visible)
-			continue;
-
-		//is a prefab!
-		if (ent->entity_type == PREFAB)
+	//cull the entities in parallel going through the arrays of the storage, their bounds are cached
+	EntityStorage& storage = scene->storage;
+	scene->updateBounds();
+	entity_clips.resize(storage.size());
+	uint8 skip_flags = ENTITY_LOADING | (use_static_batching ? ENTITY_BATCHED : 0); //the batched ones are in the chunks
+	parallelFor(0, storage.size(), [&](int start, int end) {
+		for (int i = start; i < end; ++i)
 		{
-			PrefabEntity* pent = (GTR::PrefabEntity*)ent;
-			if(pent->prefab)
-				renderPrefab(ent->model, pent->prefab, camera);
+			BoundingBox& box = storage.bounds[i];
+			bool candidate = (storage.flags[i] & (ENTITY_VISIBLE | skip_flags)) == ENTITY_VISIBLE && storage.prefabs[i];
+			entity_clips[i] = candidate ? camera->testBoxInFrustum(box.center, box.halfsize) : CLIP_OUTSIDE;
 		}
-	}
+	}, 1024);
+
+	//gather the meshes of the visible ones, culling their subtrees with the cached bounds
+	render_calls.clear();
+	for (int i = 0; i < storage.size(); ++i)
+		if (entity_clips[i] != CLIP_OUTSIDE)
+			gatherVisibleNodes(storage.models[i], storage.prefabs[i], storage.instance_bounds[i], camera, entity_clips[i] == CLIP_INSIDE);
+
+	renderCalls(camera, false);
+
+	if (use_static_batching)
+		renderStaticBatch(&scene->static_batch, camera);
 }
 
 //renders all the prefab
@@ -49,41 +75,205 @@ void Renderer::renderPrefab(const Matrix44& model, GTR::Prefab* prefab, Camera*
 
 //renders a node of the prefab and its children
 void Renderer::renderNode(const Matrix44& prefab_model, GTR::Node* node, Camera* camera)
+{
+	render_calls.clear();
+	if (node->prefab)
+	{
+		//the subtree of the node is a range of the flat arrays
+		node->prefab->updateTransforms();
+		gatherNodes(prefab_model, node->prefab, node->flat_index, node->prefab->flat_subtree_ends[node->flat_index]);
+	}
+	else
+		gatherNode(prefab_model, node);
+	renderCalls(camera);
+}
+
+void Renderer::gatherNodes(const Matrix44& prefab_model, GTR::Prefab* prefab, int start, int end)
+{
+	for (int i = start; i < end;)
+	{
+		Node* node = prefab->flat_nodes[i];
+		//a hidden node hides its subtree
+		if (!node->visible)
+		{
+			i = prefab->flat_subtree_ends[i];
+			continue;
+		}
+
+		if (node->mesh && node->material)
+		{
+			sRenderCall call;
+			call.model = prefab->flat_globals[i] * prefab_model;
+			call.mesh = node->mesh;
+			call.material = node->material;
+			call.visible = false;
+			render_calls.push_back(call);
+		}
+		++i;
+	}
+}
+
+void Renderer::gatherVisibleNodes(const Matrix44& prefab_model, GTR::Prefab* prefab, const sInstanceBounds& bounds, Camera* camera, bool inside)
+{
+	int num_nodes = (int)prefab->flat_nodes.size();
+	int inside_end = inside ? num_nodes : 0; //the nodes before it are known to be inside the frustum
+	for (int i = 0; i < num_nodes;)
+	{
+		Node* node = prefab->flat_nodes[i];
+		int subtree_end = prefab->flat_subtree_ends[i];
+		if (!node->visible || sInstanceBounds::isEmpty(bounds.subtrees[i]))
+		{
+			i = subtree_end;
+			continue;
+		}
+
+		//one test for the whole subtree, if it is inside its nodes dont need more tests
+		if (i >= inside_end)
+		{
+			const BoundingBox& box = bounds.subtrees[i];
+			char clip = camera->testBoxInFrustum(box.center, box.halfsize);
+			if (clip == CLIP_OUTSIDE)
+			{
+				i = subtree_end;
+				continue;
+			}
+			if (clip == CLIP_INSIDE)
+				inside_end = subtree_end;
+		}
+
+		if (node->mesh && node->material)
+		{
+			//a leaf was already tested, its subtree is its mesh
+			const BoundingBox& box = bounds.nodes[i];
+			if (i < inside_end || subtree_end == i + 1 || camera->testBoxInFrustum(box.center, box.halfsize) != CLIP_OUTSIDE)
+			{
+				sRenderCall call;
+				call.model = prefab->flat_globals[i] * prefab_model;
+				call.mesh = node->mesh;
+				call.material = node->material;
+				call.visible = true;
+				render_calls.push_back(call);
+			}
+		}
+		++i;
+	}
+}
+
+void Renderer::gatherNode(const Matrix44& prefab_model, GTR::Node* node)
 {
 	if (!node->visible)
 		return;
 
-	//compute global matrix
+	//compute global matrix (it updates the node, so it is not done in parallel)
 	Matrix44 node_model = node->getGlobalMatrix(true) * prefab_model;
 
 	//does this node have a mesh? then we must render it
 	if (node->mesh && node->material)
 	{
-		//compute the bounding box of the object in world space (by using the mesh bounding box transformed to world space)
-		BoundingBox world_bounding = transformBoundingBox(node_model,node->mesh->box);
-		
-		//if bounding box is inside the camera frustum then the object is probably visible
-		if (camera->testBoxInFrustum(world_bounding.center, world_bounding.halfsize) )
-		{
-			//render node mesh
-			renderMeshWithMaterial( node_model, node->mesh, node->material, camera );
-			//node->mesh->renderBounding(node_model, true);
-		}
+		sRenderCall call;
+		call.model = node_model;
+		call.mesh = node->mesh;
+		call.material = node->material;
+		call.visible = false;
+		render_calls.push_back(call);
 	}
 
 	//iterate recursively with children
 	for (int i = 0; i < node->children.size(); ++i)
-		renderNode(prefab_model, node->children[i], camera);
+		gatherNode(prefab_model, node->children[i]);
+}
+
+void Renderer::renderCalls(Camera* camera, bool cull)
+{
+	//the culling of every call is independent, a test is cheap so chunks are big
+	if (cull)
+		parallelFor(0, (int)render_calls.size(), [&](int start, int end) {
+			for (int i = start; i < end; ++i)
+			{
+				sRenderCall& call = render_calls[i];
+				//compute the bounding box of the object in world space (by using the mesh bounding box transformed to world space)
+				BoundingBox world_bounding = transformBoundingBox(call.model, call.mesh->box);
+				//if bounding box is inside the camera frustum then the object is probably visible
+				call.visible = camera->testBoxInFrustum(world_bounding.center, world_bounding.halfsize) != CLIP_OUTSIDE;
+			}
+		}, 128);
+
+	//GL calls only from this thread
+	for (auto& call : render_calls)
+		if (call.visible)
+		{
+			renderMeshWithMaterial(call.model, call.mesh, call.material, camera);
+			//call.mesh->renderBounding(call.model, true);
+		}
+}
+
+void Renderer::renderStaticBatch(GTR::StaticBatch* static_batch, Camera* camera)
+{
+	for (auto& batch : static_batch->batches)
+	{
+		Mesh* mesh = batch.mesh;
+		if (!mesh->indices_vbo_id)
+			continue; //not uploaded yet
+
+		int num_chunks = (int)batch.chunks.size();
+		int num_visible = 0;
+		batch.chunk_visible.resize(num_chunks);
+		Texture* texture = batch.material->color_texture.texture;
+		for (int i = 0; i < num_chunks; ++i)
+		{
+			sStaticChunk& chunk = batch.chunks[i];
+			batch.chunk_visible[i] = chunk.count && camera->testBoxInFrustum(chunk.box.center, chunk.box.halfsize) != CLIP_OUTSIDE;
+			if (!batch.chunk_visible[i])
+				continue;
+			num_visible++;
+			//the textures that look bigger are streamed first
+			if (texture && texture->loading)
+				texture->setScreenSize(camera->getProjectedScale(chunk.box.center, chunk.box.halfsize.length()));
+		}
+		if (!num_visible)
+			continue;
+
+		//the vertices are in world space
+		Shader* shader = enableMaterial(Matrix44(), batch.material, camera);
+		if (!shader)
+			continue;
+		mesh->enableBuffers(shader);
+		for (int i = 0; i < num_chunks; ++i)
+			if (batch.chunk_visible[i])
+				mesh->drawRange(GL_TRIANGLES, batch.chunks[i].start, batch.chunks[i].count);
+		mesh->disableBuffers(shader);
+		disableMaterial(shader);
+	}
 }
 
 //renders a mesh given its transform and material
-void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera)
+void Renderer::renderMeshWithMaterial(const Matrix44& model, Mesh* mesh, GTR::Material* material, Camera* camera)
 {
 	//in case there is nothing to do
 	if (!mesh || !mesh->getNumVertices() || !material )
 		return;
     assert(glGetError() == GL_NO_ERROR);
 
+	//the textures that look bigger are streamed first
+	Texture* texture = material->color_texture.texture;
+	if (texture && texture->loading)
+	{
+		BoundingBox box = transformBoundingBox(model, mesh->box);
+		texture->setScreenSize(camera->getProjectedScale(box.center, box.halfsize.length()));
+	}
+
+	Shader* shader = enableMaterial(model, material, camera);
+	if (!shader)
+		return;
+
+	//do the draw call that renders the mesh into the screen
+	mesh->render(GL_TRIANGLES);
+
+	disableMaterial(shader);
+}
+
+Shader* Renderer::enableMaterial(const Matrix44& model, GTR::Material* material, Camera* camera, unsigned int features)
+{
 	//define locals to simplify coding
 	Shader* shader = NULL;
 	Texture* texture = NULL;
@@ -112,14 +302,16 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
 		glEnable(GL_CULL_FACE);
     assert(glGetError() == GL_NO_ERROR);
 
-	//chose a shader
-	shader = Shader::Get("texture");
+	//chose a shader, the variant with only the code of the features of the material
+	features |= material->getShaderFeatures();
+	shader = material_shaders->get(features);
 
     assert(glGetError() == GL_NO_ERROR);
 
-	//no shader? then nothing to render
+	//no shader? then nothing to render. The fallback while it compiles
+	shader = shader->getReady();
 	if (!shader)
-		return;
+		return NULL;
 	shader->enable();
 
 	//upload uniforms
@@ -129,16 +321,39 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
 	float t = getTime();
 	shader->setUniform("u_time", t );
 
+	//the textures of the features before the color one, so the slot 0 stays active
+	if (features & FEATURE_EMISSIVE)
+	{
+		shader->setUniform("u_emissive_factor", material->emissive_factor);
+		shader->setUniform("u_emissive_texture", material->emissive_texture.texture ? material->emissive_texture.texture : Texture::getWhiteTexture(), 1);
+	}
+	if (features & FEATURE_OCCLUSION)
+		shader->setUniform("u_occlusion_texture", material->occlusion_texture.texture, 2);
+	if (features & FEATURE_NORMALMAP)
+		shader->setUniform("u_normal_texture", material->normal_texture.texture, 3);
+
 	shader->setUniform("u_color", material->color);
 	if(texture)
 		shader->setUniform("u_texture", texture, 0);
 
-	//this is used to say which is the alpha threshold to what we should not paint a pixel on the screen (to cut polygons according to texture alpha)
-	shader->setUniform("u_alpha_cutoff", material->alpha_mode == GTR::eAlphaMode::MASK ? material->alpha_cutoff : 0);
+	//every texture has its own rect, the ones not in an atlas have the identity
+	if (features & FEATURE_ATLAS)
+	{
+		shader->setUniform("u_texture_transform", material->color_texture.texture ? material->color_texture.uv_transform : Vector4(1, 1, 0, 0));
+		if (features & FEATURE_EMISSIVE)
+			shader->setUniform("u_emissive_transform", material->emissive_texture.texture ? material->emissive_texture.uv_transform : Vector4(1, 1, 0, 0));
+		if (features & FEATURE_OCCLUSION)
+			shader->setUniform("u_occlusion_transform", material->occlusion_texture.uv_transform);
+	}
 
-	//do the draw call that renders the mesh into the screen
-	mesh->render(GL_TRIANGLES);
+	//this is used to say which is the alpha threshold to what we should not paint a pixel on the screen (to cut polygons according to texture alpha)
+	if (features & FEATURE_ALPHA_MASK)
+		shader->setUniform("u_alpha_cutoff", material->alpha_cutoff);
+	return shader;
+}
 
+void Renderer::disableMaterial(Shader* shader)
+{
 	//disable shader
 	shader->disable();
 
@@ -3,6 +3,8 @@
 
 //forward declarations
 class Camera;
+class Shader;
+class ShaderVariants;
 
 namespace GTR {
 
@@ -16,6 +18,16 @@ namespace GTR {
 
 	public:
 
+		bool use_static_batching; //render the static batch of the scene instead of the nodes of its entities, to compare
+
+		//the variants of the uber-shader of the materials, indexed by their eMaterialFeature flags
+		ShaderVariants* material_shaders;
+
+		Renderer(); //doesnt compile any shader, it can be used for the CPU work without OpenGL
+
+		//compiles the variants of the registered materials without waiting, call it when a scene is loaded
+		void warmShaders();
+
 		//add here your functions
 		//...
 
@@ -28,8 +40,36 @@ namespace GTR {
 		//to render one node from the prefab and its children
 		void renderNode(const Matrix44& model, GTR::Node* node, Camera* camera);
 
+		//a mesh to render, they are gathered from the nodes so the frustum culling can run in parallel
+		struct sRenderCall {
+			Matrix44 model;
+			Mesh* mesh;
+			GTR::Material* material;
+			bool visible;
+		};
+		std::vector<sRenderCall> render_calls;
+		std::vector<char> entity_clips; //result of culling the entities of the storage of the scene (CLIP_OUTSIDE...)
+
+		//adds the meshes of the flat nodes [start,end) of a prefab to render_calls, its transforms must be updated
+		void gatherNodes(const Matrix44& model, GTR::Prefab* prefab, int start, int end);
+		//same for an instance of a prefab, skipping the subtrees outside the camera
+		void gatherVisibleNodes(const Matrix44& model, GTR::Prefab* prefab, const sInstanceBounds& bounds, Camera* camera, bool inside);
+		//same for a node that is not in a flattened prefab, and its children
+		void gatherNode(const Matrix44& model, GTR::Node* node);
+
+		//culls render_calls against the camera (if cull, otherwise they are already culled) and renders the visible ones in order
+		void renderCalls(Camera* camera, bool cull = true);
+
+		//culls the chunks of every material and renders the visible ones with the buffers and the shader of their material bound once
+		void renderStaticBatch(GTR::StaticBatch* static_batch, Camera* camera);
+
 		//to render one mesh given its material and transformation matrix
-		void renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera);
+		void renderMeshWithMaterial(const Matrix44& model, Mesh* mesh, GTR::Material* material, Camera* camera);
+
+		//sets the render state of a material and enables its shader with the uniforms, NULL if there is no shader.
+		//features are the eMaterialFeature of the draw (skinning, instancing) added to the ones of the material
+		Shader* enableMaterial(const Matrix44& model, GTR::Material* material, Camera* camera, unsigned int features = 0);
+		void disableMaterial(Shader* shader);
 	};
 
 	Texture* CubemapFromHDRE(const char* filename);
@@ -2,37 +2,352 @@
 #include "utils.h"
 
 #include "prefab.h"
+#include "parallel.h"
 #include "extra/cJSON.h"
 
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <algorithm>
+#include <cstring>
+
 GTR::Scene* GTR::Scene::instance = NULL;
 
 GTR::Scene::Scene()
 {
 	instance = this;
-	
+	num_entities_to_load = 0;
+	num_entities_loaded = 0;
+	load_id = 0;
+	bake_static_batch = true;
+	assets_folder = "data/";
 }
 
 void GTR::Scene::clear()
 {
+	static_batch.clear();
 	for (int i = 0; i < entities.size(); ++i)
 	{
 		BaseEntity* ent = entities[i];
 		delete ent;
 	}
 	entities.resize(0);
+	storage.clear(); //the ones still loading
+	num_entities_to_load = 0;
+	num_entities_loaded = 0;
+	load_id++;
 }
 
 
+void GTR::Scene::attachEntity(BaseEntity* entity)
+{
+	assert(!entity->scene && "entity already in a scene");
+	entity->scene = this;
+	entity->id = storage.create(entity);
+}
+
 void GTR::Scene::addEntity(BaseEntity* entity)
 {
-	entities.push_back(entity); entity->scene = this;
+	if (entity->scene != this)
+		attachEntity(entity);
+	storage.flags[storage.getIndex(entity->id)] &= ~ENTITY_LOADING;
+	entities.push_back(entity);
 }
 
-bool GTR::Scene::load(const char* filename)
+void GTR::Scene::updateBounds()
 {
-	std::string content;
+	//the bounds of the entities come from the ones of their prefabs
+	Prefab::UpdateAll();
+	static_batch.update(); //before the MOVED flags are cleared
+	parallelFor(0, storage.size(), [&](int start, int end) { storage.updateBounds(start, end); }, 1024);
+}
 
+void GTR::Scene::addLoadedEntities(const std::vector<BaseEntity*>& loaded_entities, int id)
+{
+	//the scene was cleared while it was loading
+	if (id != load_id)
+	{
+		for (auto ent : loaded_entities)
+			delete ent;
+		return;
+	}
+	for (auto ent : loaded_entities)
+		addEntity(ent);
+	num_entities_loaded += (int)loaded_entities.size();
+}
+
+bool GTR::Scene::load(const char* filename, std::function<void(Scene*)> on_loaded)
+{
 	this->filename = filename;
+	SceneBin bin;
+	if (!bin.open(filename))
+		return false;
+
+	//read global properties
+	background_color = bin.info.background_color;
+	ambient_light = bin.info.ambient_light;
+	main_camera.eye = bin.info.camera_eye;
+	main_camera.center = bin.info.camera_center;
+	main_camera.fov = bin.info.camera_fov;
+
+	//entities
+	int id = load_id;
+	int num_entities = bin.info.num_entities;
+	num_entities_to_load += num_entities;
+	entities.reserve(entities.size() + num_entities);
+
+	//every file is requested once, and the entities waiting for the same event are added together
+	std::vector<Prefab*> prefabs(bin.info.num_assets, (Prefab*)NULL);
+	std::map<TaskEvent*, std::vector<BaseEntity*>> waiting;
+	std::vector<TaskEventRef> entities_added;
+	std::vector<BaseEntity*> ready;
+	for (int i = 0; i < num_entities; ++i)
+	{
+		BaseEntity* ent = createEntity(bin, i, prefabs.size() ? &prefabs[0] : NULL);
+
+		//prefabs loading in the background
+		TaskEventRef ent_loaded = ent->getLoadedEvent();
+		if (!ent_loaded || ent_loaded->isFinished())
+			ready.push_back(ent);
+		else
+		{
+			std::vector<BaseEntity*>& list = waiting[ent_loaded.get()];
+			if (list.empty())
+				entities_added.push_back(ent_loaded);
+			list.push_back(ent);
+		}
+	}
+	addLoadedEntities(ready, id);
+
+	for (auto& event : entities_added)
+	{
+		std::vector<BaseEntity*>& list = waiting[event.get()];
+		event = TaskManager::foreground.run([this, list, id]() { addLoadedEntities(list, id); }, { event });
+	}
+
+	loaded = TaskManager::foreground.run([this, id, on_loaded]() {
+		if (id != load_id)
+			return;
+		if (bake_static_batch)
+		{
+			long start = getTime();
+			static_batch.build(this);
+			if (static_batch.num_nodes)
+				std::cout << " + Static batch: " << static_batch.num_nodes << " nodes of " << static_batch.num_entities << " entities in "
+					<< static_batch.num_chunks << " chunks, " << (getTime() - start) << "ms" << std::endl;
+		}
+		if (on_loaded)
+			on_loaded(this);
+	}, entities_added);
+
+	return true;
+}
+
+GTR::BaseEntity* GTR::Scene::createEntity(SceneBin& bin, int bin_index, Prefab** prefabs)
+{
+	const sSceneBinEntity& bin_ent = bin.entities[bin_index];
+	BaseEntity* ent = createEntity((eEntityType)bin_ent.type);
+	if (!ent)
+	{
+		ent = new BaseEntity();
+		attachEntity(ent);
+	}
+	int index = storage.getIndex(ent->id);
+	storage.models[index] = bin_ent.model;
+	storage.flags[index] |= ENTITY_LOADING;
+	if (bin_ent.flags & SCENE_BIN_ENTITY_STATIC)
+		storage.flags[index] |= ENTITY_STATIC;
+	if (bin_ent.name != -1)
+		ent->name = bin.getString(bin_ent.name);
+
+	//the properties of the JSON that the record doesnt have
+	if (bin_ent.properties != -1)
+	{
+		cJSON* json = cJSON_Parse(bin.getString(bin_ent.properties));
+		if (json)
+			ent->configure(json);
+		cJSON_Delete(json);
+	}
+
+	if (ent->entity_type == PREFAB && bin_ent.asset != -1)
+	{
+		PrefabEntity* pent = (PrefabEntity*)ent;
+		pent->filename = bin.getAsset(bin_ent.asset);
+		Prefab* prefab = prefabs ? prefabs[bin_ent.asset] : NULL;
+		if (!prefab)
+			prefab = GTR::Prefab::GetAsync((assets_folder + pent->filename).c_str());
+		if (prefabs)
+			prefabs[bin_ent.asset] = prefab;
+		pent->setPrefab(prefab);
+	}
+	return ent;
+}
+
+void GTR::Scene::removeEntities(const std::vector<BaseEntity*>& list)
+{
+	std::unordered_set<BaseEntity*> removed(list.begin(), list.end());
+	entities.erase(std::remove_if(entities.begin(), entities.end(), [&](BaseEntity* ent) { return removed.count(ent) != 0; }), entities.end());
+	for (auto ent : list)
+		delete ent;
+}
+
+GTR::BaseEntity* GTR::Scene::createEntity(std::string type)
+{
+	return createEntity(getEntityType(type.c_str()));
+}
+
+GTR::BaseEntity* GTR::Scene::createEntity(eEntityType type)
+{
+	BaseEntity* ent = NULL;
+	if (type == PREFAB)
+		ent = new GTR::PrefabEntity();
+	if (ent)
+		attachEntity(ent);
+	return ent;
+}
+
+GTR::eEntityType GTR::Scene::getEntityType(const char* type)
+{
+	if (strcmp(type, "PREFAB") == 0)
+		return PREFAB;
+	if (strcmp(type, "LIGHT") == 0)
+		return LIGHT;
+	if (strcmp(type, "CAMERA") == 0)
+		return CAMERA;
+	if (strcmp(type, "REFLECTION_PROBE") == 0)
+		return REFLECTION_PROBE;
+	if (strcmp(type, "DECALL") == 0)
+		return DECALL;
+	return NONE;
+}
+
+//*********************
+
+GTR::SceneBin::SceneBin()
+{
+	info = sInfo();
+	entities = NULL;
+	assets = NULL;
+	strings = NULL;
+}
+
+//the entities start 16 bytes aligned after the tag and the header
+static size_t getSceneBinEntitiesOffset()
+{
+	return (4 + sizeof(GTR::SceneBin::sInfo) + 15) & ~(size_t)15;
+}
+
+bool GTR::SceneBin::open(const char* filename)
+{
+	std::string name = filename;
+	std::string ext = name.substr(name.find_last_of(".") + 1);
+	if (ext == "sbin" || ext == "SBIN")
+	{
+		if (!load(filename))
+		{
+			std::cout << "- ERROR: Scene file not found or invalid: " << filename << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	//the JSON is only parsed when its binary is missing or outdated
+	std::string bin_filename = name + ".sbin";
+	if (!load(bin_filename.c_str(), filename))
+	{
+		if (!fromJSON(filename))
+			return false;
+		if (!save(bin_filename.c_str(), filename))
+			std::cout << "[WARN] Scene binary couldnt be saved: " << bin_filename << std::endl;
+	}
+	return true;
+}
+
+bool GTR::SceneBin::load(const char* filename, const char* source_filename)
+{
+	entities_data.clear();
+	assets_data.clear();
+	strings_data.clear();
+	if (!file.open(filename))
+		return false;
+
+	if (file.size < 4 + sizeof(sInfo) || memcmp(file.data, "SBIN", 4) != 0)
+	{
+		std::cout << "[ERROR] loading SBIN: invalid content: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+	memcpy(&info, file.data + 4, sizeof(sInfo));
+
+	if (info.version != SCENE_BIN_VERSION || info.header_bytes != sizeof(sInfo))
+	{
+		std::cout << "[WARN] loading SBIN: old version: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+
+	//outdated if the source was modified after saving it
+	long long source_time, source_size;
+	if (source_filename && getFileInfo(source_filename, source_time, source_size) && (source_time != info.source_time || source_size != info.source_size))
+	{
+		file.close();
+		return false;
+	}
+
+	size_t offset = getSceneBinEntitiesOffset();
+	size_t total = offset + (size_t)info.num_entities * sizeof(sSceneBinEntity) + (size_t)info.num_assets * sizeof(int) + info.strings_bytes;
+	if (info.num_entities < 0 || info.num_assets < 0 || info.strings_bytes <= 0 || total > file.size)
+	{
+		std::cout << "[ERROR] loading SBIN: truncated file: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+	entities = (const sSceneBinEntity*)(file.data + offset);
+	assets = (const int*)(entities + info.num_entities);
+	strings = (const char*)(assets + info.num_assets);
+
+	//the offsets must point inside the strings, which end with a 0
+	bool valid = strings[info.strings_bytes - 1] == 0;
+	for (int i = 0; i < info.num_assets && valid; ++i)
+		valid = assets[i] >= 0 && assets[i] < info.strings_bytes;
+	for (int i = 0; i < info.num_entities && valid; ++i)
+		valid = entities[i].name >= -1 && entities[i].name < info.strings_bytes && entities[i].asset >= -1 && entities[i].asset < info.num_assets &&
+			entities[i].properties >= -1 && entities[i].properties < info.strings_bytes;
+	if (!valid)
+	{
+		std::cout << "[ERROR] loading SBIN: invalid content: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+	return true;
+}
+
+bool GTR::SceneBin::save(const char* filename, const char* source_filename)
+{
+	sInfo header = info;
+	header.version = SCENE_BIN_VERSION;
+	header.header_bytes = sizeof(sInfo);
+	header.source_time = header.source_size = 0;
+	if (source_filename && !getFileInfo(source_filename, header.source_time, header.source_size))
+		return false;
+
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+		return false;
+	char padding[16] = { 0 };
+	fwrite("SBIN", sizeof(char), 4, f);
+	fwrite(&header, sizeof(sInfo), 1, f);
+	fwrite(padding, getSceneBinEntitiesOffset() - 4 - sizeof(sInfo), 1, f);
+	fwrite(entities, sizeof(sSceneBinEntity), info.num_entities, f);
+	fwrite(assets, sizeof(int), info.num_assets, f);
+	fwrite(strings, sizeof(char), info.strings_bytes, f);
+	fclose(f);
+	return true;
+}
+
+bool GTR::SceneBin::fromJSON(const char* filename)
+{
+	std::string content;
 	std::cout << " + Reading scene JSON: " << filename << "..." << std::endl;
 
 	if (!readFile(filename, content))
@@ -49,47 +364,60 @@ bool GTR::Scene::load(const char* filename)
 		return false;
 	}
 
+	file.close();
+	entities_data.clear();
+	assets_data.clear();
+	strings_data.assign(1, 0); //offset 0 is the empty string
+	std::map<std::string, int> string_offsets;
+	std::map<std::string, int> asset_indices;
+	auto addString = [&](const std::string& str) {
+		auto it = string_offsets.find(str);
+		if (it != string_offsets.end())
+			return it->second;
+		int offset = (int)strings_data.size();
+		strings_data.insert(strings_data.end(), str.c_str(), str.c_str() + str.size() + 1);
+		string_offsets[str] = offset;
+		return offset;
+	};
+
 	//read global properties
-	background_color = readJSONVector3(json, "background_color", background_color);
-	ambient_light = readJSONVector3(json, "ambient_light", ambient_light );
-	main_camera.eye = readJSONVector3(json, "camera_position", main_camera.eye);
-	main_camera.center = readJSONVector3(json, "camera_target", main_camera.center);
-	main_camera.fov = readJSONNumber(json, "camera_fov", main_camera.fov);
+	info = sInfo();
+	info.background_color = readJSONVector3(json, "background_color", Vector3());
+	info.ambient_light = readJSONVector3(json, "ambient_light", Vector3());
+	info.camera_eye = readJSONVector3(json, "camera_position", Vector3());
+	info.camera_center = readJSONVector3(json, "camera_target", Vector3(0, 0, -1));
+	info.camera_fov = readJSONNumber(json, "camera_fov", 45.0f);
 
 	//entities
+	std::set<std::string> unknown_types;
 	cJSON* entities_json = cJSON_GetObjectItemCaseSensitive(json, "entities");
 	cJSON* entity_json;
 	cJSON_ArrayForEach(entity_json, entities_json)
 	{
+		sSceneBinEntity ent = {};
+		ent.name = ent.asset = ent.properties = -1;
+
 		std::string type_str = cJSON_GetObjectItem(entity_json, "type")->valuestring;
-		BaseEntity* ent = createEntity(type_str);
-		if (!ent)
-		{
+		ent.type = Scene::getEntityType(type_str.c_str());
+		if (ent.type == NONE && unknown_types.insert(type_str).second)
 			std::cout << " - ENTITY TYPE UNKNOWN: " << type_str << std::endl;
-			//continue;
-			ent = new BaseEntity();
-		}
-
-		addEntity(ent);
 
 		if (cJSON_GetObjectItem(entity_json, "name"))
-		{
-			ent->name = cJSON_GetObjectItem(entity_json, "name")->valuestring;
-			stdlog(std::string(" + entity: ") + ent->name);
-		}
+			ent.name = addString(cJSON_GetObjectItem(entity_json, "name")->valuestring);
 
 		//read transform
+		Matrix44 model;
 		if (cJSON_GetObjectItem(entity_json, "position"))
 		{
-			ent->model.setIdentity();
+			model.setIdentity();
 			Vector3 position = readJSONVector3(entity_json, "position", Vector3());
-			ent->model.translate(position.x, position.y, position.z);
+			model.translate(position.x, position.y, position.z);
 		}
 
 		if (cJSON_GetObjectItem(entity_json, "angle"))
 		{
 			float angle = cJSON_GetObjectItem(entity_json, "angle")->valuedouble;
-			ent->model.rotate(angle * DEG2RAD, Vector3(0, 1, 0));
+			model.rotate(angle * DEG2RAD, Vector3(0, 1, 0));
 		}
 
 		if (cJSON_GetObjectItem(entity_json, "rotation"))
@@ -98,45 +426,117 @@ bool GTR::Scene::load(const char* filename)
 			Quaternion q(rotation.x, rotation.y, rotation.z, rotation.w);
 			Matrix44 R;
 			q.toMatrix(R);
-			ent->model = R * ent->model;
+			model = R * model;
 		}
 
 		if (cJSON_GetObjectItem(entity_json, "target"))
 		{
 			Vector3 target = readJSONVector3(entity_json, "target", Vector3());
-			Vector3 front = target - ent->model.getTranslation();
-			ent->model.setFrontAndOrthonormalize(front);
+			Vector3 front = target - model.getTranslation();
+			model.setFrontAndOrthonormalize(front);
 		}
 
 		if (cJSON_GetObjectItem(entity_json, "scale"))
 		{
 			Vector3 scale = readJSONVector3(entity_json, "scale", Vector3(1, 1, 1));
-			ent->model.scale(scale.x, scale.y, scale.z);
+			model.scale(scale.x, scale.y, scale.z);
+		}
+		ent.model = model;
+
+		if (readJSONBool(entity_json, "static", ent.type == PREFAB))
+			ent.flags |= SCENE_BIN_ENTITY_STATIC;
+
+		//the asset table has every file once
+		if (cJSON_GetObjectItem(entity_json, "filename"))
+		{
+			std::string asset = cJSON_GetObjectItem(entity_json, "filename")->valuestring;
+			auto it = asset_indices.find(asset);
+			if (it == asset_indices.end())
+			{
+				it = asset_indices.insert(std::make_pair(asset, (int)assets_data.size())).first;
+				assets_data.push_back(addString(asset));
+			}
+			ent.asset = it->second;
+		}
+
+		//what is left is for the configure of the entity
+		static const char* stored[] = { "type", "name", "position", "angle", "rotation", "target", "scale", "static", "filename" };
+		cJSON* properties = cJSON_Duplicate(entity_json, true);
+		for (const char* key : stored)
+			cJSON_DeleteItemFromObjectCaseSensitive(properties, key);
+		if (properties->child)
+		{
+			char* str = cJSON_PrintUnformatted(properties);
+			ent.properties = addString(str);
+			cJSON_free(str);
 		}
+		cJSON_Delete(properties);
 
-		ent->configure(entity_json);
+		entities_data.push_back(ent);
 	}
 
 	//free memory
 	cJSON_Delete(json);
 
+	info.num_entities = (int)entities_data.size();
+	info.num_assets = (int)assets_data.size();
+	info.strings_bytes = (int)strings_data.size();
+	entities = entities_data.size() ? &entities_data[0] : NULL;
+	assets = assets_data.size() ? &assets_data[0] : NULL;
+	strings = &strings_data[0];
 	return true;
 }
 
-GTR::BaseEntity* GTR::Scene::createEntity(std::string type)
+GTR::BaseEntity::~BaseEntity()
+{
+	if (!scene)
+		return;
+	if (scene->storage.isValid(id) && (scene->storage.flags[scene->storage.getIndex(id)] & ENTITY_BATCHED))
+		scene->static_batch.removeEntity(id);
+	scene->storage.destroy(id);
+}
+
+const Matrix44& GTR::BaseEntity::getModel() const
 {
-	if (type == "PREFAB")
-		return new GTR::PrefabEntity();
-    return NULL;
+	assert(scene && "entity not in a scene");
+	return scene->storage.models[scene->storage.getIndex(id)];
+}
+
+void GTR::BaseEntity::setModel(const Matrix44& model)
+{
+	assert(scene && "entity not in a scene");
+	//moving it recomputes its bounds and takes it out of the static batch
+	int index = scene->storage.getIndex(id);
+	if (memcmp(&scene->storage.models[index], &model, sizeof(Matrix44)) == 0)
+		return;
+	scene->storage.models[index] = model;
+	scene->storage.flags[index] |= ENTITY_MOVED;
+}
+
+bool GTR::BaseEntity::isVisible()
+{
+	assert(scene && "entity not in a scene");
+	return (scene->storage.flags[scene->storage.getIndex(id)] & ENTITY_VISIBLE) != 0;
+}
+
+void GTR::BaseEntity::setVisible(bool visible)
+{
+	assert(scene && "entity not in a scene");
+	uint8& flags = scene->storage.flags[scene->storage.getIndex(id)];
+	flags = visible ? (flags | ENTITY_VISIBLE) : (flags & ~ENTITY_VISIBLE);
 }
 
 void GTR::BaseEntity::renderInMenu()
 {
 #ifndef SKIP_IMGUI
 	ImGui::Text("Name: %s", name.c_str()); // Edit 3 floats representing a color
-	ImGui::Checkbox("Visible", &visible); // Edit 3 floats representing a color
+	bool visible = isVisible();
+	if (ImGui::Checkbox("Visible", &visible))
+		setVisible(visible);
 	//Model edit
-	ImGuiMatrix44(model, "Model");
+	Matrix44 model = getModel();
+	if (ImGuiMatrix44(model, "Model"))
+		setModel(model);
 #endif
 }
 
@@ -149,21 +549,47 @@ GTR::PrefabEntity::PrefabEntity()
 	prefab = NULL;
 }
 
+GTR::PrefabEntity::~PrefabEntity()
+{
+	if (prefab)
+		prefab->release();
+}
+
+void GTR::PrefabEntity::setPrefab(Prefab* prefab)
+{
+	assert(scene && "entity not in a scene");
+	if (prefab)
+		prefab->addRef();
+	if (this->prefab)
+		this->prefab->release();
+	this->prefab = prefab;
+	int index = scene->storage.getIndex(id);
+	scene->storage.prefabs[index] = prefab;
+	scene->storage.flags[index] |= ENTITY_MOVED;
+}
+
 void GTR::PrefabEntity::configure(cJSON* json)
 {
 	if (cJSON_GetObjectItem(json, "filename"))
 	{
 		filename = cJSON_GetObjectItem(json, "filename")->valuestring;
-		prefab = GTR::Prefab::Get( (std::string("data/") + filename).c_str());
+		setPrefab(GTR::Prefab::GetAsync((scene->assets_folder + filename).c_str()));
 	}
 }
 
+TaskEventRef GTR::PrefabEntity::getLoadedEvent()
+{
+	Prefab* prefab = getPrefab();
+	return prefab ? prefab->loaded : NULL;
+}
+
 void GTR::PrefabEntity::renderInMenu()
 {
 	BaseEntity::renderInMenu();
 
 #ifndef SKIP_IMGUI
 	ImGui::Text("filename: %s", filename.c_str()); // Edit 3 floats representing a color
+	Prefab* prefab = getPrefab();
 	if (prefab && ImGui::TreeNode(prefab, "Prefab Info"))
 	{
 		prefab->root.renderInMenu();
@@ -3,7 +3,14 @@
 
 #include "framework.h"
 #include "camera.h"
+#include "task.h"
+#include "utils.h"
+#include "entity_storage.h"
+#include "static_batch.h"
 #include <string>
+#include <functional>
+
+#define SCENE_BIN_VERSION 3 //this is used to regenerate the .sbin files if the format changes
 
 //forward declaration
 class cJSON; 
@@ -26,19 +33,24 @@ namespace GTR {
 	class Scene;
 	class Prefab;
 
-	//represents one element of the scene (could be lights, prefabs, cameras, etc)
+	//represents one element of the scene (could be lights, prefabs, cameras, etc).
+	//The data used every frame is in the storage of its scene, this object keeps the rest
 	class BaseEntity
 	{
 	public:
 		Scene* scene;
+		EntityID id; //of its data in scene->storage, INVALID_ENTITY_ID till a scene creates or adds it
 		std::string name;
 		eEntityType entity_type;
-		Matrix44 model;
-		bool visible;
-		BaseEntity() { entity_type = NONE; visible = true; }
-		virtual ~BaseEntity() {}
+		BaseEntity() { scene = NULL; id = INVALID_ENTITY_ID; entity_type = NONE; }
+		virtual ~BaseEntity(); //frees its data in the storage
+		const Matrix44& getModel() const; //valid till another entity is created
+		void setModel(const Matrix44& model); //flags it as moved only if it changes
+		bool isVisible();
+		void setVisible(bool visible);
 		virtual void renderInMenu();
 		virtual void configure(cJSON* json) {}
+		virtual TaskEventRef getLoadedEvent() { return NULL; } //the entity is added to the scene once it finishes
 	};
 
 	//represents one prefab in the scene
@@ -46,11 +58,72 @@ namespace GTR {
 	{
 	public:
 		std::string filename;
-		Prefab* prefab;
-		
+
 		PrefabEntity();
+		virtual ~PrefabEntity(); //releases its prefab
+		Prefab* getPrefab() { return prefab; }
+		void setPrefab(Prefab* prefab); //holds a reference to it
 		virtual void renderInMenu();
 		virtual void configure(cJSON* json);
+		virtual TaskEventRef getLoadedEvent();
+
+	private:
+		Prefab* prefab; //also in the storage, here it is still valid when the storage was cleared first
+	};
+
+	enum eSceneBinEntityFlags {
+		SCENE_BIN_ENTITY_STATIC = 1 //"static" in the JSON, true by default for prefabs
+	};
+
+	//one entity of a .sbin, with the transform of the JSON already composed
+	struct sSceneBinEntity {
+		Matrix44 model;
+		int type;	//eEntityType
+		int name;	//offset in the strings, -1 if it has none
+		int asset;	//index in the asset table, -1 if it has none
+		int flags;	//eSceneBinEntityFlags
+		int properties;	//offset in the strings of a JSON object with the rest of its properties (for configure), -1 if none
+	};
+
+	//binary version of a scene JSON: "SBIN", header, entities (16 bytes aligned), offsets of the asset filenames and strings.
+	//It is mapped in memory, so loading it only costs walking the entities
+	class SceneBin
+	{
+	public:
+		struct sInfo {
+			int version;
+			int header_bytes;
+			long long source_time; //of the JSON, to regenerate it when it changes
+			long long source_size;
+			Vector3 background_color;
+			Vector3 ambient_light;
+			Vector3 camera_eye;
+			Vector3 camera_center;
+			float camera_fov;
+			int num_entities;
+			int num_assets;
+			int strings_bytes;
+		};
+
+		sInfo info;
+		const sSceneBinEntity* entities;
+		const int* assets;		//offsets of the asset filenames in strings
+		const char* strings;
+
+		SceneBin();
+		bool open(const char* filename); //a .sbin, or a JSON through its .sbin, that is regenerated if missing or outdated
+		bool load(const char* filename, const char* source_filename = NULL); //fails if the source changed since it was saved
+		bool save(const char* filename, const char* source_filename = NULL);
+		bool fromJSON(const char* filename);
+		const char* getString(int offset) { return offset >= 0 ? strings + offset : NULL; }
+		const char* getAsset(int index) { return index >= 0 ? strings + assets[index] : NULL; }
+
+	private:
+		MappedFile file;
+		//filled by fromJSON
+		std::vector<sSceneBinEntity> entities_data;
+		std::vector<int> assets_data;
+		std::vector<char> strings_data;
 	};
 
 	//contains all entities of the scene
@@ -66,13 +139,39 @@ namespace GTR {
 		Scene();
 
 		std::string filename;
+		std::string assets_folder; //prefix of the filenames of the prefabs, "data/" by default
 		std::vector<BaseEntity*> entities;
-
-		void clear();
-		void addEntity(BaseEntity* entity);
-
-		bool load(const char* filename);
+		EntityStorage storage; //data of the entities, also of the ones still loading
+		StaticBatch static_batch; //nodes of the static entities baked together
+		bool bake_static_batch; //builds static_batch when a load finishes, before on_loaded
+
+		//progress of the last load, entities are counted when added to the scene
+		int num_entities_to_load;
+		int num_entities_loaded;
+		TaskEventRef loaded; //signaled after on_loaded was called
+
+		void clear(); //also discards the entities that are still loading
+		void addEntity(BaseEntity* entity); //creates its data in the storage if it wasnt there
+		void removeEntities(const std::vector<BaseEntity*>& list); //removes them from the scene and deletes them
+		void updateBounds(); //world bounds of all the entities in the storage, in parallel. The moved ones leave the static batch
+
+		//reads the scene (a .sbin, or a JSON through its .sbin, that is regenerated if outdated) and starts loading all the
+		//distinct prefabs at once in the background. Every entity is added to the scene when its prefab is ready,
+		//so the scene can be rendered meanwhile, and on_loaded is called from the main thread when all of them are
+		bool load(const char* filename, std::function<void(Scene*)> on_loaded = nullptr);
+		bool isLoading() { return num_entities_loaded < num_entities_to_load; }
+		float getLoadProgress() { return num_entities_to_load ? num_entities_loaded / (float)num_entities_to_load : 1.0f; }
+		//the entity has its data in the storage but it is not added to the scene
 		BaseEntity* createEntity(std::string type);
+		BaseEntity* createEntity(eEntityType type);
+		//same for entity bin_index of a .sbin, starting to load its prefab (prefabs caches the ones of the asset table, or NULL)
+		BaseEntity* createEntity(SceneBin& bin, int bin_index, Prefab** prefabs = NULL);
+		static eEntityType getEntityType(const char* type); //NONE if unknown
+
+	private:
+		int load_id; //changes with every clear, to drop the entities of a previous load
+		void attachEntity(BaseEntity* entity);
+		void addLoadedEntities(const std::vector<BaseEntity*>& loaded_entities, int id);
 	};
 
 };
@@ -9,6 +9,10 @@
 
 #include "texture.h"
 
+#ifndef GL_COMPLETION_STATUS_KHR
+	#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 std::string Shader::s_shader_atlas_filename;
 std::map<std::string, std::string> Shader::s_shaders_atlas;
 
@@ -56,12 +60,23 @@ std::map<std::string, std::string> Shader::s_shaders_atlas;
 std::map<std::string,Shader*> Shader::s_Shaders;
 bool Shader::s_ready = false;
 Shader* Shader::current = NULL;
+bool Shader::use_binary_cache = true;
+bool Shader::s_binary_supported = false;
+ShaderCache Shader::s_binary_cache;
+ShaderCache Shader::s_used_binaries;
+bool Shader::s_binaries_changed = false;
+Shader::sAtlasStats Shader::s_atlas_stats;
+std::vector<Shader*> Shader::s_pending;
+Shader* Shader::s_fallback = NULL;
+bool Shader::s_parallel_compile = false;
 
 Shader::Shader()
 {
 	if(!Shader::s_ready)
 		Shader::init();
 	program = vs = fs = 0;
+	next_program = next_vs = next_fs = 0;
+	next_binary_key = 0;
 	compiled = false;
 	from_atlas = false;
 
@@ -70,6 +85,9 @@ Shader::Shader()
 Shader::~Shader()
 {
 	release();
+	s_pending.erase(std::remove(s_pending.begin(), s_pending.end(), this), s_pending.end());
+	if (s_fallback == this)
+		s_fallback = NULL;
 }
 
 void Shader::setFilenames(const std::string& vsf, const std::string& psf)
@@ -78,9 +96,9 @@ void Shader::setFilenames(const std::string& vsf, const std::string& psf)
 	ps_filename = psf;
 }
 
-bool Shader::load(const std::string& vsf, const std::string& psf, const char* macros)
+bool Shader::load(const std::string& vsf, const std::string& psf, const char* macros, bool async)
 {
-	assert(	compiled == false );
+	assert(	async || compiled == false );
 	assert (glGetError() == GL_NO_ERROR);
 
 	vs_filename = vsf;
@@ -98,11 +116,16 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	//printf("Fragment shader from memory:\n%s\n", psm.c_str());
 	if (macros)
 	{
-		vsm = macros + vsm;
-		psm = macros + psm;
+		vsm = addMacros(vsm, macros);
+		psm = addMacros(psm, macros);
 		this->macros = macros;
 	}
 
+	if (async)
+	{
+		compileFromMemoryAsync(vsm, psm);
+		return true;
+	}
 	if (!compileFromMemory(vsm,psm))
 		return false;
 
@@ -111,7 +134,37 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	return true;
 }
 
-Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
+bool Shader::loadFromAtlas(const std::string& vsf, const std::string& psf, const char* macros, bool async)
+{
+	assert(async || compiled == false);
+	auto vs_code = s_shaders_atlas.find(vsf);
+	auto fs_code = s_shaders_atlas.find(psf);
+	if (vs_code == s_shaders_atlas.end() || fs_code == s_shaders_atlas.end())
+	{
+		std::cout << " * Error in shader atlas, couldnt find files " << vsf << " " << psf << std::endl;
+		return false;
+	}
+
+	vs_filename = vsf;
+	ps_filename = psf;
+	from_atlas = true;
+	this->macros = macros ? macros : "";
+
+	std::string vsm = addMacros(vs_code->second, this->macros);
+	std::string psm = addMacros(fs_code->second, this->macros);
+	unsigned long long key = ShaderCache::getKey(vsm, psm);
+	if (loadFromCache(key))
+		return true;
+	if (async)
+	{
+		compileFromMemoryAsync(vsm, psm, key);
+		return true;
+	}
+	submitCompile(vsm, psm, key);
+	return finishCompile(true) == 1;
+}
+
+Shader* Shader::Get(const char* vsf, const char* psf, const char* macros, bool async)
 {
 	std::string name;
 	
@@ -127,8 +180,11 @@ Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
 		return NULL;
 
 	Shader* sh = new Shader();
-	if (!sh->load( vsf,psf, macros ))
+	if (!sh->load( vsf,psf, macros, async ))
+	{
+		delete sh;
 		return NULL;
+	}
 	s_Shaders[name] = sh;
 	return sh;
 }
@@ -138,8 +194,29 @@ void Shader::ReloadAll()
 	for( std::map<std::string,Shader*>::iterator it = s_Shaders.begin(); it!=s_Shaders.end();it++)
 		it->second->recompile();
 	if(!s_shader_atlas_filename.empty())
-		LoadAtlas(s_shader_atlas_filename.c_str());
-	std::cout << "Shaders recompiled" << std::endl;
+		LoadAtlas(s_shader_atlas_filename.c_str(), false);
+	for (auto variants : ShaderVariants::s_all)
+		variants->reload();
+	std::cout << "Shaders recompiling: " << s_pending.size() << std::endl;
+}
+
+void Shader::UpdatePending(bool wait)
+{
+	for (size_t i = 0; i < s_pending.size();)
+	{
+		Shader* shader = s_pending[i];
+		int result = shader->finishCompile(wait);
+		if (result == 0)
+		{
+			++i;
+			continue;
+		}
+		if (result < 0)
+			std::cout << " * Compilation error in shader: " << shader->vs_filename << " " << shader->ps_filename << std::endl;
+		s_pending[i] = s_pending.back();
+		s_pending.pop_back();
+	}
+	SaveBinaryCache();
 }
 
 //functions to trim strings
@@ -161,8 +238,22 @@ void Shader::setMacros(const char* macros)
 	this->recompile();
 }
 
-bool Shader::LoadAtlas(const char* filename)
+std::string Shader::addMacros(const std::string& code, const std::string& macros)
 {
+	if (macros.empty())
+		return code;
+	size_t pos = code.find("#version");
+	if (pos == std::string::npos)
+		return macros + "\n" + code;
+	pos = code.find('\n', pos);
+	if (pos == std::string::npos)
+		return code + "\n" + macros + "\n";
+	return code.substr(0, pos + 1) + macros + "\n" + code.substr(pos + 1);
+}
+
+bool Shader::LoadAtlas(const char* filename, bool wait)
+{
+	long start = getTime();
 	std::string content;
 	if (!readFile(filename, content))
 	{
@@ -211,6 +302,21 @@ bool Shader::LoadAtlas(const char* filename)
 	}
 	s_shaders_atlas[ subfile_name ] = subfile_content;
 
+	//programs already linked by this driver come from the cache, the variants also look for theirs in it
+	s_binary_cache.entries.clear();
+	s_used_binaries.entries.clear();
+	s_binaries_changed = false;
+	if (use_binary_cache && s_binary_supported)
+		s_binary_cache.load((s_shader_atlas_filename + ".pbin").c_str());
+	memset(&s_atlas_stats, 0, sizeof(s_atlas_stats));
+
+	//the programs not in the cache are submitted first and checked after all of them
+	struct sCompiling {
+		Shader* shader;
+		std::string name;
+	};
+	std::vector<sCompiling> compiling;
+
 	//compile shaders
 	std::string shaders = s_shaders_atlas[""];
 
@@ -240,8 +346,8 @@ bool Shader::LoadAtlas(const char* filename)
 			continue;
 		}
 
-		vs_code = macros + "\n" + vs_code;
-		fs_code = macros + "\n" + fs_code;
+		vs_code = addMacros(vs_code, macros);
+		fs_code = addMacros(fs_code, macros);
 
 		Shader* shader = NULL;
 		auto it = s_Shaders.find( name );
@@ -253,20 +359,49 @@ bool Shader::LoadAtlas(const char* filename)
 		else
 			shader = it->second;
 	
-		if (!shader->compileFromMemory(vs_code,fs_code))
+		s_atlas_stats.num_programs++;
+		unsigned long long key = ShaderCache::getKey(vs_code, fs_code);
+		bool in_cache = s_binary_cache.entries.count(key) != 0;
+		if (shader->loadFromCache(key))
+			s_atlas_stats.from_cache++;
+		else
 		{
-			delete shader;
-			std::cout << " * Compilation error in shader at atlas: " << name << std::endl;
-            return false; //stop here
-			continue;
+			if (in_cache)
+				s_atlas_stats.rejected++;
+			if (wait)
+			{
+				shader->submitCompile(vs_code, fs_code, key);
+				compiling.push_back({ shader, name });
+			}
+			else
+				shader->compileFromMemoryAsync(vs_code, fs_code, key);
+			s_atlas_stats.compiled++;
 		}
 
 		shader->vs_filename = vs_filename;
 		shader->ps_filename = fs_filename;
 		shader->from_atlas = true;
-		std::cout << " + Shader from atlas: " << name << std::endl;
 	}
 
+	for (auto& it : compiling)
+	{
+		if (it.shader->finishCompile(true) < 0)
+		{
+			std::cout << " * Compilation error in shader at atlas: " << it.name << std::endl;
+			if (!it.shader->compiled)
+			{
+				s_Shaders.erase(it.name);
+				delete it.shader;
+			}
+			return false; //stop here
+		}
+	}
+
+	//the .pbin is written by UpdatePending, once the variants asked for after this are linked too
+
+	s_atlas_stats.time = getTime() - start;
+	std::cout << " + Shader atlas: " << filename << " Programs: " << s_atlas_stats.num_programs << " (" << s_atlas_stats.from_cache << " from cache, "
+		<< s_atlas_stats.compiled << " compiled, " << s_atlas_stats.rejected << " rejected) Time: " << s_atlas_stats.time * 0.001 << "sec" << std::endl;
 	return true;
 }
 
@@ -280,8 +415,8 @@ bool Shader::recompile()
 { 
 	if (from_atlas || !vs_filename.size() || !ps_filename.size() ) //shaders compiled from memory cannot be recompiled
 		return false;
-	release(); //remove old shader
-    return load( vs_filename,ps_filename, macros.size() ? macros.c_str() : NULL );
+	//the old program is used till the new one links, and stays if it fails
+    return load( vs_filename,ps_filename, macros.size() ? macros.c_str() : NULL, true );
 }
 
 std::string Shader::getInfoLog() const
@@ -297,6 +432,32 @@ bool Shader::hasInfoLog() const
 // ******************************************
 
 bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
+{
+	submitCompile(vsm, psm);
+	return finishCompile(true) == 1;
+}
+
+void Shader::compileFromMemoryAsync(const std::string& vsm, const std::string& psm, unsigned long long binary_key)
+{
+	submitCompile(vsm, psm, binary_key);
+	if (std::find(s_pending.begin(), s_pending.end(), this) == s_pending.end())
+		s_pending.push_back(this);
+}
+
+static void deleteProgram(GLuint& program, GLuint& vs, GLuint& fs)
+{
+	if (vs)
+		glDeleteShader(vs);
+	if (fs)
+		glDeleteShader(fs);
+	if (program)
+		glDeleteProgram(program);
+	assert(glGetError() == GL_NO_ERROR);
+	program = vs = fs = 0;
+}
+
+//nothing is asked to the driver here: any query waits for the compilation to finish
+void Shader::submitCompile(const std::string& vsm, const std::string& psm, unsigned long long binary_key)
 {
 	if (glCreateProgram == 0)
 	{
@@ -304,37 +465,65 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 		exit(0);
 	}
 
-	if (program != 0)
-		glDeleteProgram(program);
-	program = glCreateProgram();
+	deleteProgram(next_program, next_vs, next_fs); //a previous compilation still in progress
+	next_program = glCreateProgram();
+	next_vs = createShaderObject(GL_VERTEX_SHADER, vsm);
+	next_fs = createShaderObject(GL_FRAGMENT_SHADER, psm);
+	next_binary_key = binary_key;
+
+	//without the hint some drivers dont keep the binary
+	if (s_binary_supported)
+		glProgramParameteri(next_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(next_program);
 	assert (glGetError() == GL_NO_ERROR);
+}
 
-	if (!createVertexShaderObject(vsm))
+int Shader::finishCompile(bool wait)
+{
+	if (!next_program)
+		return compiled ? 1 : -1;
+
+	if (!wait && s_parallel_compile)
 	{
-		printf("Vertex shader compilation failed\n");
-		return false;
+		GLint done = 0;
+		glGetProgramiv(next_program, GL_COMPLETION_STATUS_KHR, &done);
+		if (!done)
+			return 0;
 	}
 
-	if (!createFragmentShaderObject(psm))
+	GLint linked = 0;
+	if (checkShaderObject(next_vs, "Vertex") && checkShaderObject(next_fs, "Fragment"))
 	{
-		printf("Fragment shader compilation failed\n");
-		return false;
+		glGetProgramiv(next_program, GL_LINK_STATUS, &linked);
+		assert(glGetError() == GL_NO_ERROR);
+		if (!linked)
+			saveProgramInfoLog(next_program);
+	}
+	if (!linked)
+	{
+		deleteProgram(next_program, next_vs, next_fs);
+		next_binary_key = 0;
+		return -1;
 	}
 
-	glLinkProgram(program);
-	assert (glGetError() == GL_NO_ERROR);
-
-	GLint linked=0;
-    
-	glGetProgramiv(program,GL_LINK_STATUS,&linked);
-	assert(glGetError() == GL_NO_ERROR);
+	//replace the old one
+	deleteProgram(program, vs, fs);
+	program = next_program;
+	vs = next_vs;
+	fs = next_fs;
+	next_program = next_vs = next_fs = 0;
+	if (current == this)
+		current = NULL; //so enable binds the new one
 
-	if (!linked)
+	if (next_binary_key && use_binary_cache && s_binary_supported)
 	{
-		saveProgramInfoLog(program);
-		release();
-		return false;
+		ShaderCache::sEntry& entry = s_used_binaries.entries[next_binary_key];
+		if (getBinary(entry.format, entry.data))
+			s_binaries_changed = true;
+		else
+			s_used_binaries.entries.erase(next_binary_key);
 	}
+	next_binary_key = 0;
 
 #ifdef _DEBUG
 	validate();
@@ -343,6 +532,84 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 	compiled = true;
 	locations.clear(); //regenerate table
 
+	return 1;
+}
+
+bool Shader::loadBinary(unsigned int format, const void* data, int size)
+{
+	GLuint binary_program = glCreateProgram();
+	glProgramBinary(binary_program, format, data, size);
+	while (glGetError() != GL_NO_ERROR); //an unknown format is also an error, the link status tells it failed
+
+	GLint linked = 0;
+	glGetProgramiv(binary_program, GL_LINK_STATUS, &linked);
+	if (!linked)
+	{
+		glDeleteProgram(binary_program);
+		return false;
+	}
+
+	//the old program stays if the binary is rejected
+	release();
+	program = binary_program;
+	if (current == this)
+		current = NULL;
+	compiled = true;
+	locations.clear(); //regenerate table
+	return true;
+}
+
+bool Shader::loadFromCache(unsigned long long key)
+{
+	if (!use_binary_cache || !s_binary_supported)
+		return false;
+
+	//the ones used already were moved, the same code can be used by more than one program
+	auto used = s_used_binaries.entries.find(key);
+	if (used != s_used_binaries.entries.end())
+	{
+		if (loadBinary(used->second.format, used->second.data.data(), (int)used->second.data.size()))
+			return true;
+		s_used_binaries.entries.erase(used);
+		return false;
+	}
+
+	auto entry = s_binary_cache.entries.find(key);
+	if (entry == s_binary_cache.entries.end())
+		return false;
+	bool loaded = loadBinary(entry->second.format, entry->second.data.data(), (int)entry->second.data.size());
+	if (loaded)
+		s_used_binaries.entries[key] = std::move(entry->second);
+	s_binary_cache.entries.erase(entry);
+	return loaded;
+}
+
+void Shader::SaveBinaryCache()
+{
+	if (!s_binaries_changed || !s_pending.empty() || !use_binary_cache || s_shader_atlas_filename.empty())
+		return;
+	s_binaries_changed = false;
+	std::string filename = s_shader_atlas_filename + ".pbin";
+	if (!s_used_binaries.save(filename.c_str()))
+		std::cout << "[WARN] cannot write shader cache: " << filename << std::endl;
+}
+
+bool Shader::getBinary(unsigned int& format, std::vector<uint8>& data)
+{
+	if (!program || !s_binary_supported)
+		return false;
+	GLint size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0)
+		return false;
+	data.resize(size);
+	GLsizei written = 0;
+	GLenum binary_format = 0;
+	glGetProgramBinary(program, size, &written, &binary_format, data.data());
+	if (glGetError() != GL_NO_ERROR || written <= 0)
+		return false;
+	data.resize(written);
+	format = binary_format;
 	return true;
 }
 
@@ -365,22 +632,9 @@ bool Shader::validate()
 	return true;
 }
 
-bool Shader::createVertexShaderObject(const std::string& shader)
-{
-	return createShaderObject(GL_VERTEX_SHADER,vs,shader);
-}
-
-bool Shader::createFragmentShaderObject(const std::string& shader)
+GLuint Shader::createShaderObject(unsigned int type, const std::string& code)
 {
-	return createShaderObject(GL_FRAGMENT_SHADER,fs,shader);
-}
-
-bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::string& code)
-{
-	if (handle != 0)
-		glDeleteShader(handle);
-
-	handle = glCreateShader(type);
+	GLuint handle = glCreateShader(type);
 	assert( glGetError() == GL_NO_ERROR );
     
 	std::string prefix = "";//"#define DESKTOP\n";
@@ -393,6 +647,14 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
 	glCompileShader(handle);
 	assert( glGetError() == GL_NO_ERROR );
 
+	glAttachShader(next_program,handle);
+	assert( glGetError() == GL_NO_ERROR );
+
+	return handle;
+}
+
+bool Shader::checkShaderObject(GLuint handle, const char* type)
+{
 	GLint compile=0;
 	glGetShaderiv(handle,GL_COMPILE_STATUS,&compile);
 	assert( glGetError() == GL_NO_ERROR );
@@ -400,7 +662,13 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
 	//we want to see the compile log if we are in debug (to check warnings)
 	if (!compile)
 	{
+		printf("%s shader compilation failed\n", type);
 		saveShaderInfoLog(handle);
+		GLint length = 0;
+		glGetShaderiv(handle, GL_SHADER_SOURCE_LENGTH, &length);
+		std::string fullcode(length, '\0');
+		if (length)
+			glGetShaderSource(handle, length, NULL, &fullcode[0]);
         std::cout << "Shader code:\n " << std::endl;
 		std::vector<std::string> lines = split( fullcode, '\n' );
 		for( size_t i = 0; i < lines.size(); ++i)
@@ -409,35 +677,14 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
 		return false;
 	}
 
-	glAttachShader(program,handle);
-	assert( glGetError() == GL_NO_ERROR );
-
 	return true;
 }
 
 
 void Shader::release()
 {
-	if (vs)
-	{
-		glDeleteShader(vs);
-		assert (glGetError() == GL_NO_ERROR);
-		vs = 0;
-	}
-
-	if (fs)
-	{
-		glDeleteShader(fs);
-		assert (glGetError() == GL_NO_ERROR);
-		fs = 0;
-	}
-
-	if (program)
-	{
-		glDeleteProgram(program);
-		assert (glGetError() == GL_NO_ERROR);
-		program = 0;
-	}
+	deleteProgram(program, vs, fs);
+	deleteProgram(next_program, next_vs, next_fs);
 
 	locations.clear();
 
@@ -571,6 +818,7 @@ int Shader::getUniformLocation(const char* varname)
 
 void Shader::setTexture(const char* varname, Texture* tex, int slot)
 {
+	tex->touch(); //used by the residency manager
 	glActiveTexture(GL_TEXTURE0 + slot);
 	glBindTexture(tex->texture_type, tex->texture_id);
 	setUniform1(varname, slot);
@@ -788,6 +1036,29 @@ void Shader::init()
 		IMPORT_GLEXT( glUniform4fv );
 		IMPORT_GLEXT( glUniformMatrix4fv );
 	#endif
+
+		//old drivers dont know the enum, it is an error and num_formats stays 0
+		GLint num_formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+		while (glGetError() != GL_NO_ERROR);
+		s_binary_supported = num_formats > 0;
+
+		GLint num_extensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+		for (int i = 0; i < num_extensions; ++i)
+		{
+			const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (name && (strcmp(name, "GL_KHR_parallel_shader_compile") == 0 || strcmp(name, "GL_ARB_parallel_shader_compile") == 0))
+				s_parallel_compile = true;
+		}
+
+		//let the driver use as many compiler threads as it wants
+		typedef void (APIENTRY *max_threads_func)(GLuint count);
+		max_threads_func max_threads = (max_threads_func)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsKHR");
+		if (!max_threads)
+			max_threads = (max_threads_func)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsARB");
+		if (s_parallel_compile && max_threads)
+			max_threads(0xFFFFFFFF);
 	}
 	
 	firsttime = false;
@@ -958,3 +1229,157 @@ Shader* Shader::getDefaultShader(std::string name)
 	s_Shaders[name] = sh;
 	return sh;
 }
+
+//*********************
+
+typedef struct
+{
+	int version;
+	int header_bytes;
+	unsigned long long driver_hash;
+	int num_entries;
+	int extra[5]; //for future use
+} sShaderCacheInfo;
+
+typedef struct
+{
+	unsigned long long key;
+	unsigned int format;
+	unsigned int size;
+} sShaderCacheEntryInfo;
+
+unsigned long long ShaderCache::getKey(const std::string& vs_code, const std::string& fs_code)
+{
+	return hashString(fs_code, hashString(vs_code + '\0'));
+}
+
+unsigned long long ShaderCache::getDriverHash()
+{
+	const char* strings[3] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION) };
+	unsigned long long hash = hashString("");
+	for (int i = 0; i < 3; ++i)
+		hash = hashString(std::string(strings[i] ? strings[i] : "") + "\n", hash);
+	return hash;
+}
+
+bool ShaderCache::load(const char* filename)
+{
+	entries.clear();
+	std::vector<unsigned char> buffer;
+	if (!readFileBin(filename, buffer))
+		return false;
+
+	sShaderCacheInfo info;
+	if (buffer.size() < 4 + sizeof(sShaderCacheInfo) || memcmp(buffer.data(), "PBIN", 4) != 0)
+	{
+		std::cout << "[ERROR] loading PBIN: invalid content: " << filename << std::endl;
+		return false;
+	}
+	memcpy(&info, buffer.data() + 4, sizeof(sShaderCacheInfo));
+
+	if (info.version != SHADER_BIN_VERSION || info.header_bytes != sizeof(sShaderCacheInfo))
+	{
+		std::cout << "[WARN] loading PBIN: old version: " << filename << std::endl;
+		return false;
+	}
+	if (info.driver_hash != getDriverHash())
+	{
+		std::cout << "[WARN] loading PBIN: made by another driver: " << filename << std::endl;
+		return false;
+	}
+
+	const unsigned char* pos = buffer.data() + 4 + sizeof(sShaderCacheInfo);
+	const unsigned char* end = buffer.data() + buffer.size();
+	for (int i = 0; i < info.num_entries; ++i)
+	{
+		sShaderCacheEntryInfo entry_info;
+		if (pos + sizeof(sShaderCacheEntryInfo) > end)
+			break;
+		memcpy(&entry_info, pos, sizeof(sShaderCacheEntryInfo));
+		pos += sizeof(sShaderCacheEntryInfo);
+		if (pos + entry_info.size > end)
+			break;
+		sEntry& entry = entries[entry_info.key];
+		entry.format = entry_info.format;
+		entry.data.assign(pos, pos + entry_info.size);
+		pos += entry_info.size;
+	}
+	if ((int)entries.size() != info.num_entries)
+	{
+		std::cout << "[ERROR] loading PBIN: truncated file: " << filename << std::endl;
+		entries.clear();
+		return false;
+	}
+	return true;
+}
+
+bool ShaderCache::save(const char* filename)
+{
+	sShaderCacheInfo info;
+	memset(&info, 0, sizeof(info));
+	info.version = SHADER_BIN_VERSION;
+	info.header_bytes = sizeof(sShaderCacheInfo);
+	info.driver_hash = getDriverHash();
+	info.num_entries = (int)entries.size();
+
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+		return false;
+	fwrite("PBIN", sizeof(char), 4, f);
+	fwrite(&info, sizeof(sShaderCacheInfo), 1, f);
+	for (auto& it : entries)
+	{
+		sShaderCacheEntryInfo entry_info;
+		entry_info.key = it.first;
+		entry_info.format = it.second.format;
+		entry_info.size = (unsigned int)it.second.data.size();
+		fwrite(&entry_info, sizeof(sShaderCacheEntryInfo), 1, f);
+		fwrite(it.second.data.data(), entry_info.size, 1, f);
+	}
+	fclose(f);
+	return true;
+}
+
+std::vector<ShaderVariants*> ShaderVariants::s_all;
+
+ShaderVariants::ShaderVariants(const char* vsf, const char* psf, const std::vector<std::string>& macros)
+{
+	assert(macros.size() <= 16);
+	vs_filename = vsf;
+	ps_filename = psf;
+	this->macros = macros;
+	variants.resize((size_t)1 << macros.size(), NULL);
+	s_all.push_back(this);
+}
+
+ShaderVariants::~ShaderVariants()
+{
+	for (auto shader : variants)
+		delete shader;
+	s_all.erase(std::remove(s_all.begin(), s_all.end(), this), s_all.end());
+}
+
+std::string ShaderVariants::getMacros(unsigned int features)
+{
+	std::string result;
+	for (size_t i = 0; i < macros.size(); ++i)
+		if (features & (1 << i))
+			result += "#define " + macros[i] + "\n";
+	return result;
+}
+
+Shader* ShaderVariants::compileVariant(unsigned int features)
+{
+	//the ones that fail stay without program (so the fallback is drawn) instead of compiling them again every frame
+	Shader* shader = new Shader();
+	shader->loadFromAtlas(vs_filename, ps_filename, getMacros(features).c_str(), true);
+	variants[features] = shader;
+	return shader;
+}
+
+void ShaderVariants::reload()
+{
+	for (size_t i = 0; i < variants.size(); ++i)
+		if (variants[i])
+			variants[i]->loadFromAtlas(vs_filename, ps_filename, getMacros((unsigned int)i).c_str(), true);
+}
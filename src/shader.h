@@ -8,9 +8,12 @@
 #include "includes.h"
 #include <string>
 #include <map>
+#include <vector>
 #include "framework.h"
 #include <cassert>
 
+#define SHADER_BIN_VERSION 1 //this is used to regenerate the .pbin files if the format changes
+
 #ifdef _DEBUG
 	#define CHECK_SHADER_VAR(a,b) if (a == -1) return
 	//#define CHECK_SHADER_VAR(a,b) if (a == -1) { std::cout << "Shader error: Var not found in shader: " << b << std::endl; return; } 
@@ -19,6 +22,7 @@
 #endif
 
 class Texture;
+class ShaderCache;
 
 class Shader
 {
@@ -36,10 +40,15 @@ public:
 	virtual bool compile();
 	virtual bool recompile();
 
-	virtual bool load(const std::string& vsf, const std::string& psf, const char* macros);
+	virtual bool load(const std::string& vsf, const std::string& psf, const char* macros, bool async = false);
+	//same with two files of the atlas (already loaded), false if they are not in it
+	bool loadFromAtlas(const std::string& vsf, const std::string& psf, const char* macros, bool async = false);
 
 	//internal functions
 	virtual bool compileFromMemory(const std::string& vsm, const std::string& psm);
+	//returns without waiting for the driver, UpdatePending links it. The current program (if any) is used till then.
+	//With a key of the cache its binary is stored there when it links
+	void compileFromMemoryAsync(const std::string& vsm, const std::string& psm, unsigned long long binary_key = 0);
 	virtual void release();
 	virtual void enable();
 	virtual void disable();
@@ -107,19 +116,52 @@ public:
 	bool compiled;
 
 	void setMacros(const char * macros);
+	static std::string addMacros(const std::string& code, const std::string& macros); //after the #version line, GLSL requires it first
 
-	static Shader* Get(const char* vsf, const char* psf = NULL, const char* macros = NULL);
-	static void ReloadAll();
+	static Shader* Get(const char* vsf, const char* psf = NULL, const char* macros = NULL, bool async = false);
+	static void ReloadAll(); //doesnt wait, the programs are replaced as they finish compiling
 	static std::map<std::string,Shader*> s_Shaders;
 
+	//asynchronous compilation: all the programs are sent to the driver before asking for the status of any, so it can
+	//compile them in parallel. With GL_KHR_parallel_shader_compile the status is polled without waiting
+	static std::vector<Shader*> s_pending;	//compiling
+	static Shader* s_fallback;				//cheap program drawn instead of the ones without a program yet (like "flat")
+	static bool s_parallel_compile;
+	static void UpdatePending(bool wait = false); //call it once per frame, without the extension it waits for all
+	Shader* getReady() { return compiled ? this : s_fallback; } //the one to draw with, can be NULL
+
 	//this is a way to load a single file that contains all the shaders 
 	//to know more about the file format, it is based in this https://github.com/jagenjo/rendeer.js/tree/master/guides#the-shaders but with tiny differences
-	static bool LoadAtlas(const char* filename);
+	static bool LoadAtlas(const char* filename, bool wait = true); //without wait the errors are reported by UpdatePending
 	static std::string s_shader_atlas_filename;
 	static std::map<std::string, std::string> s_shaders_atlas; //stores strings, no shaders
 
 	static Shader* getDefaultShader(std::string name);
 
+	//program binaries (GL 4.1 or ARB_get_program_binary), used by the cache of the atlas
+	static bool use_binary_cache;	//stores the linked programs of the atlas in a .pbin next to it
+	static bool s_binary_supported;	//the driver has at least one binary format
+	bool loadBinary(unsigned int format, const void* data, int size); //false if the driver rejects it, compile it then
+	bool getBinary(unsigned int& format, std::vector<uint8>& data);
+
+	//the cache of the atlas, shared with the variants: the binaries of the .pbin and the ones loaded or linked since.
+	//Only the used ones are saved back, when something was linked and no program is left compiling
+	static ShaderCache s_binary_cache;		//read from the .pbin
+	static ShaderCache s_used_binaries;		//written to the .pbin
+	static bool s_binaries_changed;
+	bool loadFromCache(unsigned long long key); //false if it is not in the cache or the driver rejects it
+	static void SaveBinaryCache(); //called by UpdatePending
+
+	//what the last LoadAtlas did, printed at the end of it
+	struct sAtlasStats {
+		int num_programs;
+		int from_cache;
+		int compiled;
+		int rejected;	//binaries in the cache the driver didnt accept
+		long time;		//ms
+	};
+	static sAtlasStats s_atlas_stats;
+
 protected:
 
 	std::string info_log;
@@ -128,9 +170,10 @@ protected:
 	std::string macros;
 	bool from_atlas;
 
-	bool createVertexShaderObject(const std::string& shader);
-	bool createFragmentShaderObject(const std::string& shader);
-	bool createShaderObject(unsigned int type, GLuint& handle, const std::string& shader);
+	void submitCompile(const std::string& vsm, const std::string& psm, unsigned long long binary_key = 0);
+	int finishCompile(bool wait); //1 linked, 0 still compiling (only without wait), -1 failed
+	GLuint createShaderObject(unsigned int type, const std::string& shader);
+	bool checkShaderObject(GLuint handle, const char* type);
 	void saveShaderInfoLog(GLuint obj);
 	void saveProgramInfoLog(GLuint obj);
 
@@ -139,6 +182,8 @@ protected:
 	GLuint vs;
 	GLuint fs;
 	GLuint program;
+	GLuint next_vs, next_fs, next_program; //compiling, they replace the others when linked
+	unsigned long long next_binary_key; //stored in the cache when linked, 0 to not store it
 	std::string log;
 
 //this is a hack to speed up shader usage (save info locally)
@@ -158,4 +203,54 @@ public:
 	loctable locations;	
 };
 
+//ShaderCache
+//the binaries of the programs of an atlas, in a .pbin next to it. Every program is keyed by the hash of its final code
+//(with the macros and the includes already in it), so editing a shader only recompiles the programs that use it.
+//Binaries only work with the driver that made them: the file stores the hash of the vendor, renderer and version
+//strings and it is ignored when they change
+class ShaderCache
+{
+public:
+	struct sEntry {
+		unsigned int format;
+		std::vector<uint8> data;
+	};
+	std::map<unsigned long long, sEntry> entries;
+
+	bool load(const char* filename);
+	bool save(const char* filename);
+
+	static unsigned long long getKey(const std::string& vs_code, const std::string& fs_code);
+	static unsigned long long getDriverHash();
+};
+
+//ShaderVariants
+//the permutations of an uber-shader of the atlas, one for every combination of its features. Bit i of the features adds
+//"#define macros[i]" to both files, so every variant has only the code of its features and no branches for the rest.
+//The variants are found indexing an array with the features, and compiled without waiting the first time they are
+//asked for (getReady draws the fallback meanwhile). warm compiles them before, when the features are known at load.
+//They are keyed in the cache of the atlas like its programs, so the ones linked in a previous run come from the .pbin
+class ShaderVariants
+{
+public:
+	std::string vs_filename;	//in the atlas
+	std::string ps_filename;
+	std::vector<std::string> macros;	//one per feature bit
+	std::vector<Shader*> variants;		//1 << macros.size(), NULL till used
+
+	ShaderVariants(const char* vsf, const char* psf, const std::vector<std::string>& macros);
+	~ShaderVariants();
+
+	Shader* get(unsigned int features) { assert(features < variants.size()); return variants[features] ? variants[features] : compileVariant(features); }
+	void warm(unsigned int features) { get(features); }
+	void reload(); //recompiles the used variants from the atlas, called by Shader::ReloadAll
+
+	std::string getMacros(unsigned int features);
+
+	static std::vector<ShaderVariants*> s_all;
+
+protected:
+	Shader* compileVariant(unsigned int features);
+};
+
 #endif
\ No newline at end of file
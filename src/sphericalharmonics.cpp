@@ -1,4 +1,5 @@
 #include "sphericalharmonics.h"
+#include "parallel.h"
 
 //system axis
 Vector3 cubemapFaceNormals[6][3] = {
@@ -46,7 +47,6 @@ SphericalHarmonics computeSH( FloatImage images[], bool degamma ) {
 	assert(images[0].width == images[0].height && images[0].width != 0 && "Image is not square");
     int size = images[0].width;
     int channels = 3;
-    SphericalHarmonics sh;
 
     // generate cube map vectors
     if (cubeMapVecs_size != size)
@@ -74,15 +74,19 @@ SphericalHarmonics computeSH( FloatImage images[], bool degamma ) {
         }
     }
 
-    // generate spherical harmonics
-    float weightAccum = 0;
-
-    for (int index = 0; index < 6; ++index)
-    {
-        FloatImage& face = images[index];
-        float* pixels = face.data;
-        bool gammaCorrect = degamma;
-        for (int y = 0; y < size; y++) {
+    // generate spherical harmonics, the rows of the 6 faces are split between threads
+    struct sPartialSH {
+        SphericalHarmonics sh;
+        float weightAccum = 0;
+    };
+    sPartialSH total = parallelReduce(0, 6 * size, sPartialSH(), [&](int start, int end) {
+        sPartialSH partial;
+        SphericalHarmonics& sh = partial.sh;
+        for (int row = start; row < end; ++row) {
+            int index = row / size;
+            int y = row % size;
+            FloatImage& face = images[index];
+            bool gammaCorrect = degamma;
             for (int x = 0; x < size; x++) {
                 Vector3 texelVect = cubeMapVecs[index][y * size + x];
                 float weight = texelSolidAngle(x, y, size, size);
@@ -113,13 +117,20 @@ SphericalHarmonics computeSH( FloatImage images[], bool degamma ) {
                 sh.coeffs[7] += value * weight3 * dx * dz;
                 sh.coeffs[8] += value * weight5 * (dx * dx - dy * dy);
 
-                weightAccum += weight * 3.0f;
+                partial.weightAccum += weight * 3.0f;
             }
         }
-    };
+        return partial;
+    }, [](const sPartialSH& a, const sPartialSH& b) {
+        sPartialSH result;
+        for (int i = 0; i < sh_length; i++)
+            result.sh.coeffs[i] = a.sh.coeffs[i] + b.sh.coeffs[i];
+        result.weightAccum = a.weightAccum + b.weightAccum;
+        return result;
+    }, 16);
 
     SphericalHarmonics linear_sh;
     for (int i = 0; i < sh_length; i++)
-        linear_sh.coeffs[i] = sh.coeffs[i] * (4 * PI / weightAccum);
+        linear_sh.coeffs[i] = total.sh.coeffs[i] * (4 * PI / total.weightAccum);
     return linear_sh;
 }
@@ -0,0 +1,295 @@
+#include "static_batch.h"
+#include "scene.h"
+#include "prefab.h"
+#include "mesh.h"
+#include "parallel.h"
+#include "transform_kernels.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <tuple>
+
+using namespace GTR;
+
+float StaticBatch::cell_size = 64.0f;
+int StaticBatch::max_chunk_indices = 3 * 65536;
+
+StaticBatch::StaticBatch()
+{
+	storage = NULL;
+	num_entities = num_nodes = num_chunks = 0;
+	uploaded = false;
+}
+
+StaticBatch::~StaticBatch()
+{
+	clear();
+}
+
+void StaticBatch::clear()
+{
+	if (storage)
+		for (auto& it : entity_chunks)
+			if (storage->isValid(it.first))
+				storage->flags[storage->getIndex(it.first)] &= ~ENTITY_BATCHED;
+	for (auto& batch : batches)
+		delete batch.mesh;
+	batches.clear();
+	for (auto& it : prefab_versions)
+		it.first->release();
+	prefab_versions.clear();
+	entity_chunks.clear();
+	dirty_chunks.clear();
+	storage = NULL;
+	num_entities = num_nodes = num_chunks = 0;
+	uploaded = false;
+}
+
+//a node of an entity to bake, and where its vertices and indices go
+struct sStaticItem {
+	int entity;
+	int node;
+	int vertex_start;
+	int index_start;
+};
+
+static int getNumIndices(Mesh* mesh)
+{
+	return mesh->m_indices.size() ? (int)mesh->m_indices.size() : (int)mesh->getNumVertices();
+}
+
+//copies the vertices of the mesh of the node transformed to world space, and its indices moved after the previous ones
+static void bakeItem(EntityStorage& storage, const sStaticItem& item, Mesh* batch_mesh)
+{
+	Prefab* prefab = storage.prefabs[item.entity];
+	Mesh* mesh = prefab->flat_nodes[item.node]->mesh;
+	Matrix44 model = prefab->flat_globals[item.node] * storage.models[item.entity];
+
+	Mesh::tInterleaved* dst = &batch_mesh->interleaved[item.vertex_start];
+	int num_vertices = (int)mesh->getNumVertices();
+	const size_t stride = sizeof(Mesh::tInterleaved);
+	if (mesh->interleaved.size())
+	{
+		const Mesh::tInterleaved* src = &mesh->interleaved[0];
+		TransformKernels::transformPoints(model, &src->vertex, num_vertices, &dst->vertex, stride, stride);
+		TransformKernels::transformNormals(model, &src->normal, num_vertices, &dst->normal, stride, stride);
+		for (int i = 0; i < num_vertices; ++i)
+			dst[i].uv = src[i].uv;
+	}
+	else
+	{
+		bool has_normals = (int)mesh->normals.size() == num_vertices;
+		bool has_uvs = (int)mesh->uvs.size() == num_vertices;
+		TransformKernels::transformPoints(model, &mesh->vertices[0], num_vertices, &dst->vertex, 0, stride);
+		if (has_normals)
+			TransformKernels::transformNormals(model, &mesh->normals[0], num_vertices, &dst->normal, 0, stride);
+		for (int i = 0; i < num_vertices; ++i)
+		{
+			if (!has_normals)
+				dst[i].normal.set(0, 1, 0);
+			dst[i].uv = has_uvs ? mesh->uvs[i] : Vector2(0, 0);
+		}
+	}
+
+	unsigned int* indices = &batch_mesh->m_indices[item.index_start];
+	unsigned int offset = (unsigned int)item.vertex_start;
+	if (mesh->m_indices.size())
+		for (int i = 0; i < (int)mesh->m_indices.size(); ++i)
+			indices[i] = mesh->m_indices[i] + offset;
+	else
+		for (int i = 0; i < num_vertices; ++i)
+			indices[i] = offset + i;
+}
+
+void StaticBatch::bake(Scene* scene)
+{
+	clear();
+	storage = &scene->storage;
+	scene->updateBounds(); //the bounds of the nodes give their cells
+
+	//the nodes grouped by material and cell, the ones of an entity are consecutive in every group
+	typedef std::tuple<int, int, int> tCell;
+	std::map<Material*, std::map<tCell, std::vector<sStaticItem>>> groups;
+	for (int i = 0; i < storage->size(); ++i)
+	{
+		Prefab* prefab = storage->prefabs[i];
+		if ((storage->flags[i] & (ENTITY_STATIC | ENTITY_VISIBLE | ENTITY_LOADING)) != (ENTITY_STATIC | ENTITY_VISIBLE) || !prefab)
+			continue;
+		const sInstanceBounds& bounds = storage->instance_bounds[i];
+		int num_prefab_nodes = (int)prefab->flat_nodes.size();
+		for (int j = 0; j < num_prefab_nodes;)
+		{
+			Node* node = prefab->flat_nodes[j];
+			if (!node->visible)
+			{
+				j = prefab->flat_subtree_ends[j];
+				continue;
+			}
+			Mesh* mesh = node->mesh;
+			if (mesh && node->material && mesh->getNumVertices() && !mesh->bones.size() && !sInstanceBounds::isEmpty(bounds.nodes[j]))
+			{
+				Vector3 center = bounds.nodes[j].center;
+				tCell cell((int)floor(center.x / cell_size), (int)floor(center.y / cell_size), (int)floor(center.z / cell_size));
+				sStaticItem item = { i, j, 0, 0 };
+				groups[node->material][cell].push_back(item);
+			}
+			++j;
+		}
+		if (!prefab_versions.count(prefab))
+			prefab->addRef(); //so it is not unloaded while the batch checks its version
+		prefab_versions[prefab] = prefab->transforms_version;
+	}
+
+	for (auto& material_group : groups)
+	{
+		batches.push_back(sStaticMaterialBatch());
+		sStaticMaterialBatch& batch = batches.back();
+		int batch_index = (int)batches.size() - 1;
+		batch.material = material_group.first;
+		batch.mesh = new Mesh();
+
+		//place the nodes cell by cell, a chunk is closed when a cell ends or it is too big
+		std::vector<sStaticItem> items;
+		int num_vertices = 0;
+		int num_indices = 0;
+		for (auto& cell_group : material_group.second)
+		{
+			sStaticChunk* chunk = NULL;
+			for (sStaticItem& item : cell_group.second)
+			{
+				Mesh* mesh = storage->prefabs[item.entity]->flat_nodes[item.node]->mesh;
+				int item_indices = getNumIndices(mesh);
+				if (!chunk || (chunk->count && chunk->count + item_indices > max_chunk_indices))
+				{
+					batch.chunks.push_back(sStaticChunk());
+					chunk = &batch.chunks.back();
+					chunk->start = num_indices;
+					chunk->count = 0;
+					chunk->box = storage->instance_bounds[item.entity].nodes[item.node];
+				}
+				EntityID id = storage->ids[item.entity];
+				if (chunk->entities.empty() || chunk->entities.back().id != id)
+				{
+					sStaticChunkEntity chunk_entity = { id, num_indices, 0 };
+					chunk->entities.push_back(chunk_entity);
+					entity_chunks[id].push_back(std::make_pair(batch_index, (int)batch.chunks.size() - 1));
+				}
+				chunk->entities.back().count += item_indices;
+				chunk->count += item_indices;
+				chunk->box = mergeBoundingBoxes(chunk->box, storage->instance_bounds[item.entity].nodes[item.node]);
+
+				item.vertex_start = num_vertices;
+				item.index_start = num_indices;
+				num_vertices += (int)mesh->getNumVertices();
+				num_indices += item_indices;
+				items.push_back(item);
+			}
+		}
+
+		//every node writes its own range
+		batch.mesh->interleaved.resize(num_vertices);
+		batch.mesh->m_indices.resize(num_indices);
+		parallelFor(0, (int)items.size(), [&](int start, int end) {
+			for (int i = start; i < end; ++i)
+				bakeItem(*storage, items[i], batch.mesh);
+		}, 16);
+
+		BoundingBox box = batch.chunks[0].box;
+		for (auto& chunk : batch.chunks)
+			box = mergeBoundingBoxes(box, chunk.box);
+		batch.mesh->box = box;
+		batch.mesh->radius = box.halfsize.length();
+		num_nodes += (int)items.size();
+		num_chunks += (int)batch.chunks.size();
+	}
+
+	for (auto& it : entity_chunks)
+		storage->flags[storage->getIndex(it.first)] |= ENTITY_BATCHED;
+	num_entities = (int)entity_chunks.size();
+}
+
+void StaticBatch::upload()
+{
+	for (auto& batch : batches)
+		batch.mesh->uploadToVRAM();
+	dirty_chunks.clear();
+	uploaded = true;
+}
+
+void StaticBatch::update()
+{
+	if (!storage)
+		return;
+
+	if (entity_chunks.size())
+	{
+		//prefabs whose transforms changed take out all their entities
+		std::vector<Prefab*> changed;
+		for (auto it = prefab_versions.begin(); it != prefab_versions.end(); ++it)
+			if (it->first->transforms_version != it->second)
+			{
+				changed.push_back(it->first);
+				it->second = it->first->transforms_version;
+			}
+
+		std::vector<EntityID> removed;
+		for (int i = 0; i < storage->size(); ++i)
+		{
+			uint8 flags = storage->flags[i];
+			if (!(flags & ENTITY_BATCHED))
+				continue;
+			if ((flags & ENTITY_MOVED) || !(flags & ENTITY_VISIBLE) || std::find(changed.begin(), changed.end(), storage->prefabs[i]) != changed.end())
+				removed.push_back(storage->ids[i]);
+		}
+		for (EntityID id : removed)
+			removeEntity(id);
+	}
+
+	//send the indices of the chunks that changed
+	if (!uploaded || dirty_chunks.empty())
+		return;
+	std::sort(dirty_chunks.begin(), dirty_chunks.end());
+	dirty_chunks.erase(std::unique(dirty_chunks.begin(), dirty_chunks.end()), dirty_chunks.end());
+	for (auto& location : dirty_chunks)
+	{
+		sStaticMaterialBatch& batch = batches[location.first];
+		sStaticChunk& chunk = batch.chunks[location.second];
+		batch.mesh->uploadIndicesToVRAM(chunk.start, chunk.count);
+	}
+	dirty_chunks.clear();
+}
+
+void StaticBatch::removeEntity(EntityID id)
+{
+	auto it = entity_chunks.find(id);
+	if (it == entity_chunks.end())
+		return;
+
+	//the indices after the ones of the entity move back, the chunk draws less of them
+	for (auto& location : it->second)
+	{
+		sStaticMaterialBatch& batch = batches[location.first];
+		sStaticChunk& chunk = batch.chunks[location.second];
+		for (int i = 0; i < (int)chunk.entities.size(); ++i)
+		{
+			sStaticChunkEntity& chunk_entity = chunk.entities[i];
+			if (chunk_entity.id != id)
+				continue;
+			unsigned int* indices = &batch.mesh->m_indices[0];
+			int removed = chunk_entity.count;
+			std::copy(indices + chunk_entity.start + removed, indices + chunk.start + chunk.count, indices + chunk_entity.start);
+			for (int j = i + 1; j < (int)chunk.entities.size(); ++j)
+				chunk.entities[j].start -= removed;
+			chunk.count -= removed;
+			chunk.entities.erase(chunk.entities.begin() + i);
+			break;
+		}
+		dirty_chunks.push_back(location);
+	}
+	entity_chunks.erase(it);
+	num_entities = (int)entity_chunks.size();
+
+	if (storage->isValid(id))
+		storage->flags[storage->getIndex(id)] &= ~ENTITY_BATCHED;
+}
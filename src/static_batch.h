@@ -0,0 +1,83 @@
+#ifndef STATIC_BATCH_H
+#define STATIC_BATCH_H
+
+#include "framework.h"
+#include "entity_storage.h"
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+class Mesh;
+
+namespace GTR {
+
+	class Scene;
+	class Prefab;
+	class Material;
+
+	//the indices of the nodes of one entity in a chunk
+	struct sStaticChunkEntity {
+		EntityID id;
+		int start; //in the indices of the mesh
+		int count;
+	};
+
+	//nodes of the same material in the same cell of the grid, one draw call
+	struct sStaticChunk {
+		int start; //in the indices of the mesh
+		int count;
+		BoundingBox box; //in world space, it doesnt shrink when entities leave
+		std::vector<sStaticChunkEntity> entities;
+	};
+
+	//the geometry in world space of all the chunks of a material, in the same buffers
+	struct sStaticMaterialBatch {
+		Material* material;
+		Mesh* mesh;
+		std::vector<sStaticChunk> chunks;
+		std::vector<uint8> chunk_visible; //filled by the renderer
+	};
+
+	//StaticBatch
+	//bakes the nodes of the static entities of a scene (ENTITY_STATIC) into a few big meshes, so they are rendered with one
+	//draw call per chunk instead of one per node. Entities that move, are hidden or whose prefab changes leave the batch
+	//(their indices are removed) and are rendered one by one again.
+
+	class StaticBatch
+	{
+	public:
+		static float cell_size;		//side of the cells of the grid that group the nodes in chunks
+		static int max_chunk_indices;	//bigger cells are split in several chunks
+
+		std::vector<sStaticMaterialBatch> batches;
+		int num_entities;
+		int num_nodes;
+		int num_chunks;
+
+		StaticBatch();
+		~StaticBatch();
+
+		void clear(); //the entities of the batch are rendered one by one again
+
+		//bake fills the meshes in memory (the transforms and bounds of the entities are updated), upload sends them to
+		//the GPU so it must be called from the main thread. build does both
+		void bake(Scene* scene);
+		void upload();
+		void build(Scene* scene) { bake(scene); upload(); }
+
+		//removes the entities that moved, were hidden or whose prefab changed since the bake. It must be called before
+		//the MOVED flags are cleared (see Scene::updateBounds)
+		void update();
+		void removeEntity(EntityID id);
+
+	private:
+		EntityStorage* storage;
+		std::map<Prefab*, int> prefab_versions; //transforms_version of the prefabs when baked, it holds a reference to them
+		std::unordered_map<EntityID, std::vector<std::pair<int, int>>> entity_chunks; //batch and chunk of every entity
+		std::vector<std::pair<int, int>> dirty_chunks; //to upload their indices again
+		bool uploaded;
+	};
+
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "task.h"
+#include "thread_pool.h"
 #include <iostream>       // std::cout
 #include <thread>         // std::thread
 #include <chrono>		  //ms
@@ -7,73 +8,401 @@
 TaskManager TaskManager::foreground;
 TaskManager TaskManager::background;
 
-TaskManager::TaskManager()
+void TaskEvent::wait()
+{
+	if (finished)
+		return;
+	std::unique_lock<std::mutex> lock(mutex);
+	condition.wait(lock, [this]() { return finished.load(); });
+}
+
+void TaskEvent::addSuccessor(Task* task)
 {
-	must_loop = false;
-	_thread = NULL;
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+		if (!finished)
+		{
+			successors.push_back(task);
+			return;
+		}
+	}
+	task->release();
+}
+
+void TaskEvent::signal()
+{
+	std::vector<Task*> ready;
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+		finished = true;
+		ready.swap(successors);
+	}
+	condition.notify_all();
+	for (auto task : ready)
+		task->release();
+}
+
+void Task::dependsOn(const TaskEventRef& event)
+{
+	assert(event);
+	num_predecessors++;
+	event->addSuccessor(this);
+}
+
+TaskEventRef Task::getEvent()
+{
+	if (!event)
+		event = std::make_shared<TaskEvent>();
+	return event;
+}
+
+void Task::execute()
+{
+	//the successors are still released, they usually share the token and get cancelled too
+	if (isCancelled())
+		onCancel();
+	else
+		onExecute();
+	if (event)
+		event->signal();
+}
+
+void Task::release()
+{
+	if (num_predecessors.fetch_sub(1) != 1)
+		return;
+	if (manager)
+	{
+		manager->enqueue(this);
+		return;
+	}
+	//joins have nothing to execute, they finish in the thread that released them
+	execute();
+	delete this;
+}
+
+// TaskAllocator *************************************
+
+namespace {
+	struct sFreeBlock {
+		sFreeBlock* next;
+	};
+
+	struct sBlockBatch {
+		sFreeBlock* first;
+		int count;
+	};
+
+	//shared pool, only touched to exchange whole batches
+	std::mutex allocator_mutex;
+	std::vector<sBlockBatch> free_batches;
+	std::vector<void*> slabs;
+
+	//free blocks of this thread, returned to the shared pool when the thread ends
+	struct sThreadCache {
+		sFreeBlock* first = NULL;
+		int count = 0;
+		~sThreadCache() {
+			if (!count)
+				return;
+			const std::lock_guard<std::mutex> lock(allocator_mutex);
+			free_batches.push_back({ first, count });
+		}
+	};
+	thread_local sThreadCache thread_cache;
 }
 
-void TaskManager::loop()
+void* TaskAllocator::allocate(size_t size)
 {
-	using namespace std::chrono_literals;
-	std::cout << "Starting Task Manager ..." << std::endl;
+	if (size > BLOCK_SIZE)
+		return ::operator new(size);
 
-	while (must_loop)
+	sThreadCache& cache = thread_cache;
+	if (!cache.first)
 	{
-		if (pending_tasks.empty())
+		const std::lock_guard<std::mutex> lock(allocator_mutex);
+		if (free_batches.empty())
 		{
-			std::this_thread::sleep_for(10ms);
-			continue;
+			//new slab, split in batches
+			char* slab = (char*)::operator new((size_t)BLOCK_SIZE * BLOCKS_PER_SLAB);
+			slabs.push_back(slab);
+			for (int i = 0; i < BLOCKS_PER_SLAB; i += BATCH_SIZE)
+			{
+				sFreeBlock* first = NULL;
+				for (int j = i + BATCH_SIZE - 1; j >= i; --j)
+				{
+					sFreeBlock* block = (sFreeBlock*)(slab + (size_t)j * BLOCK_SIZE);
+					block->next = first;
+					first = block;
+				}
+				free_batches.push_back({ first, BATCH_SIZE });
+			}
 		}
+		cache.first = free_batches.back().first;
+		cache.count = free_batches.back().count;
+		free_batches.pop_back();
+	}
 
-		fetchTask();
+	sFreeBlock* block = cache.first;
+	cache.first = block->next;
+	cache.count--;
+	return block;
+}
+
+void TaskAllocator::free(void* ptr, size_t size)
+{
+	if (!ptr)
+		return;
+	if (size > BLOCK_SIZE)
+	{
+		::operator delete(ptr);
+		return;
 	}
 
-	std::cout << "Ending Task Manager" << std::endl;
+	sThreadCache& cache = thread_cache;
+	sFreeBlock* block = (sFreeBlock*)ptr;
+	block->next = cache.first;
+	cache.first = block;
+	cache.count++;
+
+	//threads that only delete tasks give back the blocks in batches
+	if (cache.count >= BATCH_SIZE * 2)
+	{
+		sFreeBlock* first = cache.first;
+		sFreeBlock* last = first;
+		for (int i = 1; i < BATCH_SIZE; ++i)
+			last = last->next;
+		cache.first = last->next;
+		cache.count -= BATCH_SIZE;
+		last->next = NULL;
+		const std::lock_guard<std::mutex> lock(allocator_mutex);
+		free_batches.push_back({ first, BATCH_SIZE });
+	}
 }
 
-void TaskManager::fetchTask()
+size_t TaskAllocator::getNumSlabs()
+{
+	const std::lock_guard<std::mutex> lock(allocator_mutex);
+	return slabs.size();
+}
+
+void* Task::operator new(size_t size)
+{
+	return TaskAllocator::allocate(size);
+}
+
+void Task::operator delete(void* ptr, size_t size)
+{
+	TaskAllocator::free(ptr, size);
+}
+
+// MPSCTaskQueue *************************************
+
+MPSCTaskQueue::MPSCTaskQueue()
+{
+	head.store(&stub);
+	tail = &stub;
+}
+
+void MPSCTaskQueue::push(Task* task)
+{
+	task->next_queued.store(NULL, std::memory_order_relaxed);
+	Task* prev = head.exchange(task, std::memory_order_acq_rel);
+	//between the exchange and this store the consumer cannot reach the task yet
+	prev->next_queued.store(task, std::memory_order_release);
+}
+
+Task* MPSCTaskQueue::pop()
 {
-	Task* task = NULL;
-	try
+	Task* first = tail;
+	Task* next = first->next_queued.load(std::memory_order_acquire);
+	if (first == &stub)
 	{
-		//lock
-		const std::lock_guard<std::mutex> lock(tasks_mutex);
-		if (pending_tasks.empty())
-			return;
-		task = pending_tasks.front();
-		pending_tasks.pop_front();
-		//unlock after finishing scope
+		if (!next)
+			return NULL;
+		tail = next;
+		first = next;
+		next = next->next_queued.load(std::memory_order_acquire);
 	}
-	catch (std::logic_error&) {
-		std::cout << "[exception caught]\n";
+
+	if (next)
+	{
+		tail = next;
+		return first;
 	}
 
-	if (task)
+	//first is the last one, a producer may be linking a new one after it
+	if (first != head.load(std::memory_order_acquire))
+		return NULL;
+
+	//put the stub back at the end so first can be returned
+	push(&stub);
+	next = first->next_queued.load(std::memory_order_acquire);
+	if (next)
 	{
-		task->onExecute();
-		delete task;
-		task = NULL;
+		tail = next;
+		return first;
 	}
+	return NULL;
+}
+
+// TaskList *************************************
+
+void TaskList::push(Task* task)
+{
+	if (task->token || task->priority != 0)
+		num_prioritized++;
+	tasks.push_back(task);
+}
+
+size_t TaskList::pick()
+{
+	assert(!tasks.empty());
+	if (!num_prioritized)
+		return 0;
+
+	size_t best = 0;
+	float best_priority = tasks[0]->getPriority();
+	for (size_t i = 0; i < tasks.size(); ++i)
+	{
+		Task* task = tasks[i];
+		if (task->isCancelled())
+			return i;
+		//strictly greater keeps the order of the ones with the same priority
+		float priority = task->getPriority();
+		if (priority > best_priority)
+		{
+			best = i;
+			best_priority = priority;
+		}
+	}
+	return best;
+}
+
+Task* TaskList::take(size_t index)
+{
+	Task* task = tasks[index];
+	if (index == 0)
+		tasks.pop_front();
+	else
+		tasks.erase(tasks.begin() + index);
+	if (task->token || task->priority != 0)
+		num_prioritized--;
+	return task;
+}
+
+// TaskManager *************************************
+
+TaskManager::TaskManager()
+{
+	pool = NULL;
+	time_budget_ms = 2.0f;
+	bytes_budget = 16 * 1024 * 1024;
+	stats = {};
+}
+
+void TaskManager::collectIncoming()
+{
+	while (Task* task = incoming.pop())
+		pending_tasks.push(task);
 }
 
-void thread_loop_func(TaskManager* manager)
+size_t TaskManager::getNumPending()
 {
-	manager->loop();
-	//join?
+	collectIncoming();
+	return pending_tasks.size();
 }
 
-void TaskManager::startThread()
+void TaskManager::fetchTask()
 {
-	assert(!_thread && "TaskManager already in a thread");
-	must_loop = true;
-	_thread = new std::thread(thread_loop_func, this);
+	collectIncoming();
+	if (pending_tasks.empty())
+		return;
+
+	Task* task = pending_tasks.take(pending_tasks.pick());
+	task->execute();
+	delete task;
+}
+
+void TaskManager::drainTasks()
+{
+	typedef std::chrono::high_resolution_clock clock;
+	clock::time_point start = clock::now();
+	int executed = 0;
+	size_t bytes = 0;
+	float elapsed_ms = 0;
+
+	collectIncoming();
+	while (!pending_tasks.empty())
+	{
+		size_t index = pending_tasks.pick();
+		Task* task = pending_tasks.at(index);
+		size_t cost = task->isCancelled() ? 0 : task->getCost();
+		//the first one is always executed so big tasks still make progress
+		if (executed && !task->isCancelled() && (elapsed_ms >= time_budget_ms || bytes + cost > bytes_budget))
+			break;
+		pending_tasks.take(index);
+
+		task->execute();
+		bytes += cost;
+		executed++;
+		delete task;
+		elapsed_ms = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+
+		//tasks added by the executed ones (or by other threads meanwhile)
+		collectIncoming();
+	}
+
+	stats.executed = executed;
+	stats.deferred = (int)pending_tasks.size();
+	stats.time_ms = elapsed_ms;
+	stats.bytes = bytes;
+}
+
+void TaskManager::startThread(int num_threads)
+{
+	assert(!pool && "TaskManager already in a thread");
+	pool = new ThreadPool();
+	pool->start(num_threads);
+
+	//tasks added before starting
+	collectIncoming();
+	while (!pending_tasks.empty())
+		pool->addTask(pending_tasks.take(0));
 }
 
 void TaskManager::addTask(Task* task)
 {
-	//block pending_tasks
-	const std::lock_guard<std::mutex> lock(tasks_mutex);
-	pending_tasks.push_back(task);
-	//release pending_tasks automatically
-}
\ No newline at end of file
+	assert(task);
+	task->manager = this;
+	task->release(); //the hold it had since it was created
+}
+
+void TaskManager::enqueue(Task* task)
+{
+	if (pool)
+	{
+		pool->addTask(task);
+		return;
+	}
+	incoming.push(task);
+}
+
+TaskEventRef TaskManager::launch(Task* task, const std::vector<TaskEventRef>& after)
+{
+	for (auto& event : after)
+		task->dependsOn(event);
+	TaskEventRef event = task->getEvent();
+	addTask(task);
+	return event;
+}
+
+TaskEventRef TaskManager::whenAll(const std::vector<TaskEventRef>& events)
+{
+	Task* join = new Task();
+	for (auto& event : events)
+		join->dependsOn(event);
+	TaskEventRef event = join->getEvent();
+	join->release();
+	return event;
+}
@@ -5,30 +5,245 @@
 #include <mutex>
 #include <thread>         // std::thread
 #include <functional>
+#include <atomic>
+#include <memory>
+#include <condition_variable>
+#include <deque>
+#include <cstddef>
+#include <new>
+#include <type_traits>
 
-//any task executed in BG should inherit from this one
+class ThreadPool;
+class TaskManager;
+class Task;
+
+//completion of a task, shared by the task, the tasks that depend on it and whoever waits for it
+class TaskEvent {
+public:
+	TaskEvent() { finished = false; }
+	bool isFinished() { return finished; }
+	void wait(); //blocks till it finishes, never wait from a task (or from the main thread for a foreground task)
+	void addSuccessor(Task* task); //the task is released when this finishes (now if it already did)
+	void signal(); //marks it as finished and releases the successors
+
+private:
+	std::atomic<bool> finished;
+	std::mutex mutex; // protects successors
+	std::condition_variable condition;
+	std::vector<Task*> successors;
+};
+
+typedef std::shared_ptr<TaskEvent> TaskEventRef;
+
+//shared by the tasks of a job and whoever launched it, to cancel them or change their priority while they are queued.
+//Cancellation is cooperative: queued tasks are dropped, a running one must check isCancelled by itself
+class TaskToken {
+public:
+	TaskToken(float priority = 0) { cancelled = false; this->priority = priority; }
+	void cancel() { cancelled = true; }
+	bool isCancelled() const { return cancelled; }
+	void setPriority(float priority) { this->priority = priority; }
+	float getPriority() const { return priority; }
+
+private:
+	std::atomic<bool> cancelled;
+	std::atomic<float> priority;
+};
+
+typedef std::shared_ptr<TaskToken> TaskTokenRef;
+
+//result of a task, ready when its event finishes
+template <typename T> class TaskFuture {
+public:
+	std::shared_ptr<T> value;
+	TaskEventRef event;
+
+	bool isReady() const { return event->isFinished(); }
+	void wait() const { event->wait(); }
+	T& get() const { event->wait(); return *value; }
+
+	//runs func(result) in the manager when this is ready, returns the future of func
+	template <typename F> auto then(TaskManager& manager, F func) -> TaskFuture<decltype(func(std::declval<T&>()))>;
+};
+
+//callable stored inside the task when it fits (so creating a task doesnt allocate), like std::function but it cannot be copied
+class TaskFunction {
+public:
+	enum { INLINE_BYTES = 64 };
+
+	TaskFunction() { heap = NULL; invoke_func = NULL; destroy_func = NULL; }
+	TaskFunction(std::nullptr_t) : TaskFunction() {}
+	template <typename F> TaskFunction(F func) : TaskFunction() { assign(std::move(func)); }
+	~TaskFunction() { reset(); }
+
+	TaskFunction& operator = (std::nullptr_t) { reset(); return *this; }
+	template <typename F> TaskFunction& operator = (F func) { reset(); assign(std::move(func)); return *this; }
+	explicit operator bool() const { return invoke_func != NULL; }
+	void operator()() { invoke_func(heap ? heap : storage); }
+
+	void reset() {
+		if (destroy_func)
+			destroy_func(heap ? heap : storage);
+		heap = NULL; invoke_func = NULL; destroy_func = NULL;
+	}
+
+private:
+	alignas(std::max_align_t) unsigned char storage[INLINE_BYTES];
+	void* heap; //only used if it doesnt fit
+	void(*invoke_func)(void*);
+	void(*destroy_func)(void*);
+
+	TaskFunction(const TaskFunction&) = delete;
+	TaskFunction& operator = (const TaskFunction&) = delete;
+
+	//only the overload of where it goes is instantiated, the placement new of a callable that doesnt fit would not compile clean
+	template <typename F> void assign(F&& func) {
+		typedef typename std::decay<F>::type T;
+		assign(std::move(func), std::integral_constant<bool, sizeof(T) <= INLINE_BYTES && alignof(T) <= alignof(std::max_align_t)>());
+		invoke_func = [](void* p) { (*(T*)p)(); };
+	}
+	template <typename T> void assign(T&& func, std::true_type) {
+		new (storage) T(std::move(func));
+		destroy_func = [](void* p) { ((T*)p)->~T(); };
+	}
+	template <typename T> void assign(T&& func, std::false_type) {
+		heap = new T(std::move(func));
+		destroy_func = [](void* p) { delete (T*)p; };
+	}
+};
+
+//any task executed in BG should inherit from this one.
+//Tasks up to TaskAllocator::BLOCK_SIZE bytes come from a pool of fixed size blocks
 class Task {
 public:
-	std::function<void()> callback;
-	Task() { callback = NULL; };
-	Task(std::function<void()> func) { callback = func; };
+	TaskFunction callback;
+	size_t cost; //estimation of the work (in bytes), used to spread tasks between frames
+	TaskManager* manager; //where it is executed when all its predecessors finish
+	std::atomic<int> num_predecessors; //predecessors not finished, plus one till it is added to a manager
+	float priority; //higher ones are executed first, ignored if it has a token
+	TaskTokenRef token; //optional, to cancel it or update its priority
+
+	//the atomics are initialized in the list, assigning them would add a full fence per task
+	Task() : cost(0), manager(NULL), num_predecessors(1), priority(0), next_queued(NULL) {};
+	template <typename F> Task(F func, size_t cost = 0) : callback(std::move(func)), cost(cost), manager(NULL), num_predecessors(1), priority(0), next_queued(NULL) {};
 	virtual ~Task() {};
+
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
 	virtual void onExecute() { if (callback) callback(); }
+	virtual void onCancel() {} //called instead of onExecute when cancelled, to free what it owns
+	virtual size_t getCost() { return cost; } //for tasks that only know it once their predecessors finished
+
+	float getPriority() { return token ? token->getPriority() : priority; }
+	bool isCancelled() { return token && token->isCancelled(); }
+
+	//graph, call them before adding the task to a manager
+	void dependsOn(const TaskEventRef& event);
+	TaskEventRef getEvent(); //signaled when it finishes
+
+	void execute(); //onExecute (or onCancel) and signals the event, called by the managers
+	void release(); //a predecessor finished, it is queued in its manager when none is left
+
+	std::atomic<Task*> next_queued; //used by MPSCTaskQueue
+
+private:
+	TaskEventRef event;
+};
+
+//fixed size blocks for the tasks. Every thread keeps a cache of free blocks and only locks the shared
+//pool to exchange batches of them, so tasks created in one thread and deleted in another stay cheap
+class TaskAllocator {
+public:
+	enum { BLOCK_SIZE = 256, BATCH_SIZE = 64, BLOCKS_PER_SLAB = 1024 };
+
+	static void* allocate(size_t size); //bigger than BLOCK_SIZE goes to the heap
+	static void free(void* ptr, size_t size);
+	static size_t getNumSlabs();
+};
+
+//lock-free queue (Vyukov's intrusive MPSC): any thread can push, only one thread can pop
+class MPSCTaskQueue {
+public:
+	MPSCTaskQueue();
+	void push(Task* task);
+	Task* pop(); //NULL if empty (or a push is half done)
+
+private:
+	std::atomic<Task*> head; //last pushed
+	Task* tail; //next to pop, only touched by the consumer
+	Task stub;
+};
+
+//tasks waiting to be picked by priority, FIFO while none has a priority or a token (the common case)
+class TaskList {
+public:
+	TaskList() { num_prioritized = 0; }
+	void push(Task* task);
+	size_t pick(); //index of the next one: cancelled first (they are only dropped), then the highest priority (FIFO among equals)
+	Task* at(size_t index) { return tasks[index]; }
+	Task* take(size_t index);
+	size_t size() { return tasks.size(); }
+	bool empty() { return tasks.empty(); }
+
+private:
+	std::deque<Task*> tasks;
+	int num_prioritized;
 };
 
 class TaskManager {
 public:
-	std::list<Task*> pending_tasks;
-	std::mutex tasks_mutex;  // protects pending_tasks
-	bool must_loop;
-	std::thread* _thread;
+	ThreadPool* pool; //workers executing the tasks, NULL if they are drained by the main thread
+
+	//budget when draining tasks every frame
+	float time_budget_ms;
+	size_t bytes_budget;
+
+	//stats of the last drainTasks call
+	struct sStats {
+		int executed;
+		int deferred;
+		float time_ms;
+		size_t bytes;
+	} stats;
 
 	static TaskManager foreground;
 	static TaskManager background;
 
 	TaskManager();
-	void addTask(Task* task);
-	void fetchTask();
-	void loop();
-	void startThread();
-};
\ No newline at end of file
+	void addTask(Task* task); //it is executed once all its predecessors finished
+	void enqueue(Task* task); //adds a task ready to be executed
+	//without pool, tasks are only executed by one thread (the main one) with these
+	void fetchTask(); //executes the next pending task in the calling thread
+	void drainTasks(); //executes tasks until the time or bytes budget is used (at least one)
+	size_t getNumPending();
+	void startThread(int num_threads = 0); //executes the tasks in a work stealing pool (0 means one thread per core), call it before other threads add tasks
+
+	//runs func once all the events in after finished
+	template <typename F> TaskEventRef run(F func, const std::vector<TaskEventRef>& after = {}, size_t cost = 0) { return launch(new Task(std::move(func), cost), after); }
+	TaskEventRef launch(Task* task, const std::vector<TaskEventRef>& after); //adds it once all the events finished
+	//same but keeping the value returned by func
+	template <typename F> auto async(F func, const std::vector<TaskEventRef>& after = {}, size_t cost = 0) -> TaskFuture<decltype(func())>
+	{
+		typedef decltype(func()) T;
+		TaskFuture<T> future;
+		future.value = std::make_shared<T>();
+		std::shared_ptr<T> value = future.value;
+		future.event = run([value, func]() { *value = func(); }, after, cost);
+		return future;
+	}
+
+	//an event that finishes when all the events finished (it doesnt use any thread)
+	static TaskEventRef whenAll(const std::vector<TaskEventRef>& events);
+
+private:
+	MPSCTaskQueue incoming; //tasks added from any thread without locks
+	TaskList pending_tasks; //moved from incoming, only touched by the thread that drains
+	void collectIncoming();
+};
+
+template <typename T> template <typename F>
+auto TaskFuture<T>::then(TaskManager& manager, F func) -> TaskFuture<decltype(func(std::declval<T&>()))>
+{
+	std::shared_ptr<T> input = value;
+	return manager.async([input, func]() { return func(*input); }, { event });
+}
@@ -5,9 +5,12 @@
 
 #include <iostream> //to output
 #include <cmath>
+#include <algorithm>
 
 #include "mesh.h"
 #include "shader.h"
+#include "texture_uploader.h"
+#include "image_kernels.h"
 #include "extra/picopng.h"
 #include "extra/jpgd.h"
 #include <cassert>
@@ -62,6 +65,15 @@ std::map<std::string, Texture*> Texture::sTexturesLoaded;
 int Texture::default_mag_filter = GL_LINEAR;
 int Texture::default_min_filter = GL_LINEAR_MIPMAP_LINEAR;
 FBO* Texture::global_fbo = NULL;
+bool Texture::use_cache = true;
+bool Texture::use_compression = true;
+
+size_t Texture::sVRAMBudget = 0; //no budget by default
+size_t Texture::sVRAMUsed = 0;
+int Texture::sResidencyMinSize = 64;
+int Texture::sStreamingCancelFrames = 300;
+long Texture::sCurrentFrame = 0;
+Texture::sResidencyStats Texture::sStats = {};
 
 Texture::Texture()
 {
@@ -74,12 +86,24 @@ Texture::Texture()
 	type = 0;
 	texture_type = GL_TEXTURE_2D;
 	loading = false;
+	last_used_frame = 0;
+	vram_bytes = 0;
+	resident_level = 0;
+	evicted = false;
+	screen_size = 0;
+	usage = TEXTURE_UNKNOWN;
 }
 
 Texture::Texture(unsigned int width, unsigned int height, unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format)
 {
 	loading = false;
 	texture_id = 0;
+	last_used_frame = 0;
+	vram_bytes = 0;
+	resident_level = 0;
+	evicted = false;
+	screen_size = 0;
+	usage = TEXTURE_UNKNOWN;
 	create(width, height, format, type, mipmaps, data, internal_format);
 }
 
@@ -87,6 +111,12 @@ Texture::Texture(Image* img)
 {
 	loading = false;
 	texture_id = 0;
+	last_used_frame = 0;
+	vram_bytes = 0;
+	resident_level = 0;
+	evicted = false;
+	screen_size = 0;
+	usage = TEXTURE_UNKNOWN;
 	create(img->width, img->height, img->num_channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, true, img->data);
 }
 
@@ -106,6 +136,7 @@ void Texture::clear()
 	if(!loading) //when loading the texture of 1x1 is replaced with the new one
 		stdlog("Destroy texture: " + filename );
 	texture_id = 0;
+	updateVRAMBytes();
 
 	if (filename.size())
 	{
@@ -155,8 +186,13 @@ void Texture::create(unsigned int width, unsigned int height, unsigned int forma
 	this->mipmaps = mipmaps && isPowerOfTwo(width) && isPowerOfTwo(height) && format != GL_DEPTH_COMPONENT;
 
 	//Delete previous texture and ensure that previous bounded texture_id is not of another texture type
+	//(it remains registered in the manager, textures streamed in the background replace their storage)
 	if (this->texture_id != 0)
-		clear();
+	{
+		glBindTexture(this->texture_type, 0);
+		glDeleteTextures(1, &texture_id);
+		texture_id = 0;
+	}
 
 	this->texture_type = GL_TEXTURE_2D;
 
@@ -244,29 +280,47 @@ Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
 	return texture;
 }
 
-Texture* Texture::GetAsync(const char* filename, bool mipmaps, bool wrap)
+Texture* Texture::GetAsync(const char* filename, bool mipmaps, bool wrap, eTextureUsage usage)
 {
 	//check if exists
 	Texture* texture = Find(filename);
 	if (texture)
 		return texture;
 
+	//the bg thread cannot query GL to know which formats are available
+	TextureCompressor::checkSupport();
+
 	//create temp texture
 	Texture* temp = new Texture();
 	temp->create(1, 1);
 	//register
 	temp->setName(filename);
 	temp->loading = true;
+	temp->usage = usage;
+	temp->last_used_frame = sCurrentFrame; //so it isnt taken as a stale load right away
+	temp->load_token = std::make_shared<TaskToken>();
 
 	//add action to BG Thread 
-	LoadTextureTask* task = new LoadTextureTask(filename);
-	TaskManager::background.addTask(task);
+	LoadAsync(filename, usage, temp->load_token);
 
 	return temp;
 }
 
 bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int type)
 {
+	//the cache only stores bytes
+	if (type == GL_UNSIGNED_BYTE)
+	{
+		TextureCompressor::checkSupport();
+		TextureBin* bin = LoadBin(filename);
+		if (!bin)
+			return false;
+		loadFromBin(bin, mipmaps, wrap);
+		setName(filename);
+		delete bin;
+		return true;
+	}
+
 	Image* image = new Image();
 	if (!image->load(filename))
 	{
@@ -301,6 +355,149 @@ void Texture::loadFromImage(Image* image, bool mipmaps, bool wrap, unsigned int
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+int Texture::createFromBin(TextureBin* bin, bool mipmaps)
+{
+	assert(bin && bin->levels.size());
+	TextureBin::sLevel& base = bin->levels[0];
+
+	//compressed formats cannot generate the mips in the GPU, they must come in the bin
+	if (bin->compression && bin->levels.size() == 1)
+		mipmaps = false;
+
+	//allocate without data so the GPU doesnt compute the mips, they are already in the bin
+	create(base.width, base.height, bin->getFormat(), GL_UNSIGNED_BYTE, mipmaps, NULL, bin->compression);
+
+	int num_levels = this->mipmaps ? (int)bin->levels.size() : 1;
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	for (int i = 1; i < num_levels; ++i)
+	{
+		TextureBin::sLevel& level = bin->levels[i];
+		if (bin->compression)
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, bin->compression, level.width, level.height, 0, (GLsizei)level.size, NULL);
+		else
+			glTexImage2D(GL_TEXTURE_2D, i, format, level.width, level.height, 0, format, GL_UNSIGNED_BYTE, NULL);
+	}
+	//files may come with an incomplete chain
+	if (num_levels > 1)
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return num_levels;
+}
+
+void Texture::loadFromBin(TextureBin* bin, bool mipmaps, bool wrap)
+{
+	int num_levels = createFromBin(bin, mipmaps);
+
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int i = 0; i < num_levels; ++i)
+	{
+		TextureBin::sLevel& level = bin->levels[i];
+		if (bin->compression)
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, bin->compression, level.width, level.height, 0, (GLsizei)level.size, level.data);
+		else
+			glTexImage2D(GL_TEXTURE_2D, i, format, level.width, level.height, 0, format, GL_UNSIGNED_BYTE, level.data);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (this->mipmaps && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (this->mipmaps && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	if (this->mipmaps && num_levels == 1)
+		generateMipmaps();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	assert(checkGLErrors() && "Error uploading texture bin");
+}
+
+void Texture::takeStorage(Texture* other)
+{
+	assert(other && other != this && other->texture_id);
+	glBindTexture(texture_type, 0);
+	if (texture_id)
+		glDeleteTextures(1, &texture_id);
+
+	texture_id = other->texture_id;
+	width = other->width;
+	height = other->height;
+	depth = other->depth;
+	format = other->format;
+	type = other->type;
+	internal_format = other->internal_format;
+	texture_type = other->texture_type;
+	mipmaps = other->mipmaps;
+	other->texture_id = 0;
+	other->updateVRAMBytes();
+	updateVRAMBytes();
+}
+
+unsigned int Texture::ChooseCompression(eTextureUsage usage, Image* image)
+{
+	if (!use_compression || usage == TEXTURE_UNKNOWN)
+		return 0;
+
+	if (usage == TEXTURE_NORMAL)
+		return GL_COMPRESSED_RG_RGTC2;
+
+	//albedo only needs alpha if some pixel is not opaque
+	bool has_alpha = false;
+	if (image->num_channels == 4)
+		for (size_t i = 3; i < (size_t)image->width * image->height * 4 && !has_alpha; i += 4)
+			has_alpha = image->data[i] != 255;
+	unsigned int format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	if (has_alpha)
+		format = TextureCompressor::supports_bptc ? GL_COMPRESSED_RGBA_BPTC_UNORM : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	return TextureCompressor::isSupported(format) ? format : 0;
+}
+
+TextureBin* Texture::LoadBin(const char* filename, eTextureUsage usage)
+{
+	TextureBin* bin = new TextureBin();
+	std::string str = filename;
+	std::string ext = str.size() > 5 ? str.substr(str.size() - 5, 5) : "";
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+	//already in GPU format
+	if (ext == ".ktx2" || ext.substr(1) == ".dds")
+	{
+		if ((ext == ".ktx2" ? bin->loadKTX2(filename) : bin->loadDDS(filename)) && (!bin->compression || TextureCompressor::isSupported(bin->compression)))
+			return bin;
+		std::cout << "[ERROR] cannot load texture: " << filename << std::endl;
+		delete bin;
+		return NULL;
+	}
+
+	if (!use_compression)
+		usage = TEXTURE_UNKNOWN;
+	std::string binfilename = str + ".tbin";
+
+	//try the cached version first, it must have been compressed for the same usage
+	long time = getTime();
+	if (use_cache && bin->load(binfilename.c_str(), filename) && bin->usage == usage && (!bin->compression || TextureCompressor::isSupported(bin->compression)))
+	{
+		std::cout << " + Image loading: " << filename << " ... [OK BIN] Levels: " << bin->levels.size() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		return bin;
+	}
+
+	Image image;
+	if (!image.load(filename))
+	{
+		delete bin;
+		return NULL;
+	}
+	bin->build(&image, true, usage == TEXTURE_COLOR);
+	bin->usage = usage;
+
+	unsigned int compression = ChooseCompression(usage, &image);
+	if (compression)
+	{
+		time = getTime();
+		bin->compress(compression);
+		std::cout << " + Image compressed: " << filename << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	}
+
+	if (use_cache && !bin->save(binfilename.c_str(), filename))
+		std::cout << "[WARN] cannot write texture cache: " << binfilename << std::endl;
+	return bin;
+}
+
 void Texture::upload(Image* img)
 {
 	create(img->width, img->height, img->num_channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, true, img->data);
@@ -342,6 +539,7 @@ void Texture::upload( unsigned int format, unsigned int type, bool mipmaps, Uint
 
 	glBindTexture(this->texture_type, 0);
 	assert(checkGLErrors() && "Error uploading texture");
+	updateVRAMBytes();
 }
 
 /*
@@ -411,6 +609,7 @@ void Texture::uploadCubemap(unsigned int format, unsigned int t, bool mips, Uint
 		glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);   //set the mag filter
 		//if (data && this->mipmaps && level == 0 && bAllowMips)
 		//	generateMipmaps();
+		updateVRAMBytes();
 	}
 
 	glBindTexture(this->texture_type, 0);
@@ -489,6 +688,8 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 
 	if (num_columns > 1)
 		delete[] data;
+	this->depth = (float)num_textures;
+	updateVRAMBytes();
 	#endif
 }
 
@@ -536,6 +737,200 @@ void Texture::generateMipmaps()
     #endif
 }
 
+//bytes per pixel according to the format and type of the texture
+int getBytesPerPixel(unsigned int format, unsigned int type)
+{
+	int channels = 4;
+	switch (format)
+	{
+		case GL_RED: case GL_ALPHA: case GL_LUMINANCE: case GL_DEPTH_COMPONENT: channels = 1; break;
+		case GL_RG: case GL_LUMINANCE_ALPHA: channels = 2; break;
+		case GL_RGB: case GL_BGR: channels = 3; break;
+	}
+	int channel_size = 1;
+	if (type == GL_FLOAT || type == GL_UNSIGNED_INT || type == GL_INT)
+		channel_size = 4;
+	else if (type == GL_HALF_FLOAT || type == GL_UNSIGNED_SHORT || type == GL_SHORT)
+		channel_size = 2;
+	return channels * channel_size;
+}
+
+size_t Texture::computeVRAMBytes()
+{
+	if (!texture_id || texture_type == GL_TEXTURE_EXTERNAL_OES)
+		return 0;
+	size_t bytes = (size_t)width * (size_t)height * getBytesPerPixel(format, type);
+	if (TextureCompressor::isCompressedFormat(internal_format))
+		bytes = TextureCompressor::getCompressedSize(internal_format, (int)width, (int)height);
+	if (texture_type == GL_TEXTURE_CUBE_MAP)
+		bytes *= 6;
+	else if (texture_type == GL_TEXTURE_2D_ARRAY || texture_type == GL_TEXTURE_3D)
+		bytes *= depth > 1 ? (size_t)depth : 1;
+	if (mipmaps)
+		bytes += bytes / 3; //the whole mip chain is a third of the base level
+	return bytes;
+}
+
+void Texture::updateVRAMBytes()
+{
+	size_t bytes = computeVRAMBytes();
+	sVRAMUsed = sVRAMUsed - vram_bytes + bytes;
+	vram_bytes = bytes;
+}
+
+void Texture::touch()
+{
+	last_used_frame = sCurrentFrame;
+	if ((evicted || resident_level) && !loading)
+		restream();
+}
+
+void Texture::restream()
+{
+	if (loading || !filename.size())
+		return;
+	loading = true;
+	sStats.total_restreams++;
+	load_token = std::make_shared<TaskToken>();
+	LoadAsync(filename.c_str(), usage, load_token);
+}
+
+bool Texture::dropMips(int levels)
+{
+	if (texture_type != GL_TEXTURE_2D || !mipmaps || levels < 1)
+		return false;
+	int w = ((int)width) >> levels;
+	int h = ((int)height) >> levels;
+	if (w < sResidencyMinSize || h < sResidencyMinSize)
+		return false;
+
+	//compressed levels are copied as they are, the GPU cannot generate their mips
+	if (TextureCompressor::isCompressedFormat(internal_format))
+	{
+		glBindTexture(GL_TEXTURE_2D, texture_id);
+		GLint max_level = 0;
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &max_level);
+		int num_levels = std::min(max_level - levels + 1, (int)std::log2(std::max(w, h)) + 1);
+		if (num_levels < 1)
+			return false;
+		std::vector<std::vector<Uint8>> chain(num_levels);
+		for (int i = 0; i < num_levels; ++i)
+		{
+			chain[i].resize(TextureCompressor::getCompressedSize(internal_format, std::max(1, w >> i), std::max(1, h >> i)));
+			glGetCompressedTexImage(GL_TEXTURE_2D, levels + i, &chain[i][0]);
+		}
+
+		this->width = (float)w;
+		this->height = (float)h;
+		upload(format, type, true, NULL, internal_format);
+		glBindTexture(GL_TEXTURE_2D, texture_id);
+		for (int i = 0; i < num_levels; ++i)
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, internal_format, std::max(1, w >> i), std::max(1, h >> i), 0, (GLsizei)chain[i].size(), &chain[i][0]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		resident_level += levels;
+		return true;
+	}
+
+	//read the smaller mip from VRAM and use it as the new base level
+	Uint8* data = new Uint8[w * h * getBytesPerPixel(format, type)];
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D, levels, format, type, data);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	this->width = (float)w;
+	this->height = (float)h;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	upload(format, type, true, data, internal_format);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	delete[] data;
+
+	resident_level += levels;
+	return true;
+}
+
+void Texture::evict()
+{
+	if (evicted || texture_type != GL_TEXTURE_2D)
+		return;
+
+	//keep the average color (the last mip) so it doesnt pop too much
+	Uint8 color[16] = { 128,128,128,255, 128,128,128,255, 128,128,128,255, 128,128,128,255 };
+	if (mipmaps)
+	{
+		int last_level = (int)std::log2(std::max(width, height));
+		GLint max_level = 0;
+		glBindTexture(GL_TEXTURE_2D, texture_id);
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &max_level);
+		last_level = std::min(last_level, (int)max_level);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glGetTexImage(GL_TEXTURE_2D, last_level, format, type, color);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	}
+
+	//filename is kept so it can be restreamed later (the GPU decompressed the color)
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	create(1, 1, format, type, false, color, TextureCompressor::isCompressedFormat(internal_format) ? 0 : internal_format);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	evicted = true;
+}
+
+void Texture::UpdateResidency()
+{
+	long frame = sCurrentFrame++;
+	sStats.dropped_last_frame = 0;
+	sStats.evicted_last_frame = 0;
+
+	if (sVRAMBudget && sVRAMUsed > sVRAMBudget)
+	{
+		//candidates: streamable textures not used in the last frame, least recently used first
+		std::vector<Texture*> candidates;
+		for (auto it : sTexturesLoaded)
+		{
+			Texture* tex = it.second;
+			if (tex->loading || tex->evicted || tex->texture_type != GL_TEXTURE_2D || tex->last_used_frame >= frame)
+				continue;
+			candidates.push_back(tex);
+		}
+		std::sort(candidates.begin(), candidates.end(), [](Texture* a, Texture* b) { return a->last_used_frame < b->last_used_frame; });
+
+		//first try to reduce the resolution, then evict them completely
+		for (size_t i = 0; i < candidates.size() && sVRAMUsed > sVRAMBudget; ++i)
+			if (candidates[i]->dropMips(1))
+				sStats.dropped_last_frame++;
+		for (size_t i = 0; i < candidates.size() && sVRAMUsed > sVRAMBudget; ++i)
+		{
+			candidates[i]->evict();
+			sStats.evicted_last_frame++;
+		}
+	}
+
+	sStats.vram_used = sVRAMUsed;
+	sStats.vram_budget = sVRAMBudget;
+	sStats.num_textures = (int)sTexturesLoaded.size();
+	sStats.num_degraded = sStats.num_evicted = sStats.num_restreaming = 0;
+	for (auto it : sTexturesLoaded)
+	{
+		Texture* tex = it.second;
+
+		//bigger on screen first, and drop the loads nobody is waiting for
+		if (tex->load_token)
+		{
+			tex->load_token->setPriority(tex->screen_size);
+			if (sStreamingCancelFrames && frame - tex->last_used_frame > sStreamingCancelFrames)
+				tex->load_token->cancel();
+		}
+		tex->screen_size = 0;
+
+		if (tex->evicted)
+			sStats.num_evicted++;
+		else if (tex->resident_level)
+			sStats.num_degraded++;
+		if (tex->loading && tex->last_used_frame)
+			sStats.num_restreaming++;
+	}
+}
 
 void Texture::toViewport(Shader* shader)
 {
@@ -649,13 +1044,14 @@ void Image::fromTexture(Texture* texture)
 {
 	assert(texture);
 
-	if(data && (width != texture->width || height != texture->height ))
+	if(data && (width != texture->width || height != texture->height || num_channels != 4))
 		clear();
 
 	if (!data)
 	{
 		width = texture->width;
 		height = texture->height;
+		num_channels = 4;
 		data = new uint8[width * height * 4];
 	}
 	
@@ -945,18 +1341,46 @@ template<typename T>
 void tImage<T>::flipY()
 {
 	assert(data);
-	int row_size = num_channels * width;
-	T* temp_row = new T[row_size];
-#pragma omp simd
-	for (int y = 0; y < height*0.5; y += 1)
+	//swap the rows in place, no temporary buffer needed
+	ImageKernels::flipRows(data, height, (size_t)num_channels * width * sizeof(T));
+}
+
+void Image::setNumChannels(int channels)
+{
+	if (channels == (int)num_channels || !data)
+		return;
+	size_t num_pixels = (size_t)width * height;
+	uint8* new_data = new uint8[num_pixels * channels];
+	if (num_channels == 3 && channels == 4)
+		ImageKernels::expandRGBtoRGBA(data, num_pixels, new_data);
+	else
 	{
-		uint8* pos = data + y*row_size;
-		memcpy(temp_row, pos, row_size);
-		uint8* pos2 = data + (height - y - 1)*row_size;
-		memcpy(pos, pos2, row_size);
-		memcpy(pos2, temp_row, row_size);
+		//grey is replicated to RGB, missing channels are 0 (or opaque alpha)
+		int map[4];
+		for (int c = 0; c < 4; ++c)
+			map[c] = c < (int)num_channels ? c : (c == 3 ? ImageKernels::SWIZZLE_ONE : (num_channels == 1 ? 0 : ImageKernels::SWIZZLE_ZERO));
+		ImageKernels::swizzle(data, num_pixels, num_channels, new_data, channels, map);
 	}
-	delete[] temp_row;
+	delete[] data;
+	data = new_data;
+	num_channels = channels;
+}
+
+void Image::downsample(Image* result, bool srgb, bool kaiser)
+{
+	assert(data && result && result != this);
+	result->resize(std::max(1u, width / 2), std::max(1u, height / 2), num_channels);
+	if (kaiser)
+		ImageKernels::downsampleKaiser(data, width, height, num_channels, result->data, srgb);
+	else
+		ImageKernels::downsampleBox(data, width, height, num_channels, result->data, srgb);
+}
+
+void FloatImage::fromImage(Image* image)
+{
+	assert(image && image->data);
+	resize(image->width, image->height, image->num_channels);
+	ImageKernels::bytesToFloat(image->data, (size_t)width * height * num_channels, data);
 }
 
 struct tImageHeader {
@@ -1019,6 +1443,399 @@ void FloatImage::fromTexture(Texture* texture)
 }
 
 
+//*********************
+
+//TBIN format: watermark, header and the levels one after the other, from the biggest to 1x1
+typedef struct
+{
+	int version;
+	int header_bytes;
+	int width;
+	int height;
+	int num_channels;
+	int num_levels;
+	long long source_time; //to know if the original file changed
+	long long source_size;
+	unsigned int compression;
+	int usage;
+	int extra[6]; //for future use
+} sTextureBinInfo;
+
+unsigned int TextureBin::getFormat()
+{
+	switch (num_channels)
+	{
+		case 1: return GL_RED;
+		case 2: return GL_RG;
+		case 3: return GL_RGB;
+	}
+	return GL_RGBA;
+}
+
+size_t TextureBin::getTotalBytes()
+{
+	size_t bytes = 0;
+	for (auto& level : levels)
+		bytes += level.size;
+	return bytes;
+}
+
+bool TextureBin::load(const char* filename, const char* source_filename)
+{
+	levels.clear();
+	memory.clear();
+	if (!file.open(filename))
+		return false;
+
+	sTextureBinInfo info;
+	if (file.size < 4 + sizeof(sTextureBinInfo) || memcmp(file.data, "TBIN", 4) != 0)
+	{
+		std::cout << "[ERROR] loading TBIN: invalid content: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+	memcpy(&info, file.data + 4, sizeof(sTextureBinInfo));
+
+	if (info.version != TEXTURE_BIN_VERSION || info.header_bytes != sizeof(sTextureBinInfo))
+	{
+		std::cout << "[WARN] loading TBIN: old version: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+
+	//outdated if the source was modified after saving it
+	long long source_time, source_size;
+	if (source_filename && getFileInfo(source_filename, source_time, source_size) && (source_time != info.source_time || source_size != info.source_size))
+	{
+		file.close();
+		return false;
+	}
+
+	num_channels = info.num_channels;
+	compression = info.compression;
+	usage = (eTextureUsage)info.usage;
+	const uint8* pos = file.data + 4 + sizeof(sTextureBinInfo);
+	const uint8* end = file.data + file.size;
+	int w = info.width;
+	int h = info.height;
+	for (int i = 0; i < info.num_levels; ++i)
+	{
+		sLevel level;
+		level.width = w;
+		level.height = h;
+		level.data = pos;
+		level.size = compression ? TextureCompressor::getCompressedSize(compression, w, h) : (size_t)w * h * num_channels;
+		pos += level.size;
+		if (pos > end)
+		{
+			std::cout << "[ERROR] loading TBIN: truncated file: " << filename << std::endl;
+			levels.clear();
+			file.close();
+			return false;
+		}
+		levels.push_back(level);
+		w = std::max(1, w / 2);
+		h = std::max(1, h / 2);
+	}
+	return levels.size() > 0;
+}
+
+bool TextureBin::save(const char* filename, const char* source_filename)
+{
+	assert(levels.size());
+	sTextureBinInfo info;
+	memset(&info, 0, sizeof(info));
+	info.version = TEXTURE_BIN_VERSION;
+	info.header_bytes = sizeof(sTextureBinInfo);
+	info.width = levels[0].width;
+	info.height = levels[0].height;
+	info.num_channels = num_channels;
+	info.num_levels = (int)levels.size();
+	info.compression = compression;
+	info.usage = usage;
+	if (!getFileInfo(source_filename, info.source_time, info.source_size))
+		return false;
+
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+		return false;
+	fwrite("TBIN", sizeof(char), 4, f);
+	fwrite(&info, sizeof(sTextureBinInfo), 1, f);
+	for (auto& level : levels)
+		fwrite(level.data, level.size, 1, f);
+	fclose(f);
+	return true;
+}
+
+void TextureBin::build(Image* image, bool mipmaps, bool srgb)
+{
+	assert(image && image->data);
+	file.close();
+	levels.clear();
+	num_channels = image->num_channels;
+	compression = 0;
+
+	//compute the size of the whole chain first, so the pointers to the levels remain valid
+	int num_levels = 1;
+	size_t total = (size_t)image->width * image->height * num_channels;
+	if (mipmaps && isPowerOfTwo(image->width) && isPowerOfTwo(image->height))
+	{
+		int w = image->width, h = image->height;
+		while (w > 1 || h > 1)
+		{
+			w = std::max(1, w / 2);
+			h = std::max(1, h / 2);
+			total += (size_t)w * h * num_channels;
+			num_levels++;
+		}
+	}
+	memory.resize(total);
+
+	uint8* pos = &memory[0];
+	memcpy(pos, image->data, (size_t)image->width * image->height * num_channels);
+	sLevel level;
+	level.width = image->width;
+	level.height = image->height;
+	level.data = pos;
+	level.size = (size_t)level.width * level.height * num_channels;
+	levels.push_back(level);
+
+	//each level is the 2x2 average of the previous one
+	for (int i = 1; i < num_levels; ++i)
+	{
+		const sLevel& prev = levels[i - 1];
+		pos += prev.size;
+		int w = std::max(1, prev.width / 2);
+		int h = std::max(1, prev.height / 2);
+		ImageKernels::downsampleBox(prev.data, prev.width, prev.height, num_channels, pos, srgb);
+		level.width = w;
+		level.height = h;
+		level.data = pos;
+		level.size = (size_t)w * h * num_channels;
+		levels.push_back(level);
+	}
+}
+
+void TextureBin::compress(unsigned int format)
+{
+	assert(levels.size() && !compression && TextureCompressor::isCompressedFormat(format));
+
+	size_t total = 0;
+	for (auto& level : levels)
+		total += TextureCompressor::getCompressedSize(format, level.width, level.height);
+	std::vector<uint8> compressed(total);
+
+	uint8* pos = &compressed[0];
+	for (auto& level : levels)
+	{
+		size_t size = TextureCompressor::getCompressedSize(format, level.width, level.height);
+		TextureCompressor::compress(format, level.data, level.width, level.height, num_channels, pos);
+		level.data = pos;
+		level.size = size;
+		pos += size;
+	}
+
+	//the levels point to the new memory now
+	memory.swap(compressed);
+	file.close();
+	compression = format;
+	num_channels = TextureCompressor::getNumChannels(format);
+}
+
+//DDS and KTX2 store the top row first, the levels are copied and flipped like the other images so the texture coordinates match
+void TextureBin::flipLevels(const char* filename)
+{
+	size_t total = 0;
+	for (auto& level : levels)
+		total += level.size;
+	std::vector<uint8> flipped(total);
+
+	size_t offset = 0;
+	for (auto& level : levels)
+	{
+		uint8* data = &flipped[offset];
+		memcpy(data, level.data, level.size);
+		offset += level.size;
+		if (!compression)
+			ImageKernels::flipRows(data, level.height, level.size / level.height);
+		else if (!TextureCompressor::flipRows(compression, data, level.width, level.height))
+		{
+			std::cout << "[WARN] BC7 blocks with partitions cannot be flipped, the texture is upside down: " << filename << std::endl;
+			return;
+		}
+	}
+
+	//the levels point to the new memory now
+	offset = 0;
+	for (auto& level : levels)
+	{
+		level.data = &flipped[offset];
+		offset += level.size;
+	}
+	memory.swap(flipped);
+	file.close();
+}
+
+bool TextureBin::loadDDS(const char* filename)
+{
+	levels.clear();
+	memory.clear();
+	if (!file.open(filename))
+		return false;
+
+	const uint8* data = file.data;
+	if (file.size < 128 || memcmp(data, "DDS ", 4) != 0)
+	{
+		std::cout << "[ERROR] loading DDS: invalid content: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+
+	//DDS_HEADER, all fields are 32 bits
+	const uint32* header = (const uint32*)(data + 4);
+	uint32 flags = header[1];
+	int height = header[2];
+	int width = header[3];
+	int num_levels = (flags & 0x20000) ? std::max(1, (int)header[6]) : 1; //DDSD_MIPMAPCOUNT
+	const uint32* pixel_format = header + 18;
+	uint32 pf_flags = pixel_format[1];
+	uint32 fourcc = pixel_format[2];
+	size_t offset = 128;
+
+	unsigned int format = 0;
+	num_channels = 0;
+	if (pf_flags & 0x4) //DDPF_FOURCC
+	{
+		if (!memcmp(&fourcc, "DXT1", 4)) format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		else if (!memcmp(&fourcc, "DXT5", 4)) format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		else if (!memcmp(&fourcc, "ATI1", 4) || !memcmp(&fourcc, "BC4U", 4)) format = GL_COMPRESSED_RED_RGTC1;
+		else if (!memcmp(&fourcc, "ATI2", 4) || !memcmp(&fourcc, "BC5U", 4)) format = GL_COMPRESSED_RG_RGTC2;
+		else if (!memcmp(&fourcc, "DX10", 4) && file.size >= 148)
+		{
+			//DDS_HEADER_DXT10 follows the header, first field is the DXGI_FORMAT
+			switch (*(const uint32*)(data + 128))
+			{
+				case 28: case 29: num_channels = 4; break; //R8G8B8A8
+				case 71: case 72: format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+				case 77: case 78: format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+				case 80: format = GL_COMPRESSED_RED_RGTC1; break;
+				case 83: format = GL_COMPRESSED_RG_RGTC2; break;
+				case 98: case 99: format = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+			}
+			offset += 20;
+		}
+	}
+	else if ((pf_flags & 0x40) && pixel_format[4] == 0xFF && pixel_format[5] == 0xFF00 && pixel_format[6] == 0xFF0000) //DDPF_RGB in RGB order
+		num_channels = pixel_format[3] == 32 ? 4 : (pixel_format[3] == 24 ? 3 : 0);
+
+	if (!format && !num_channels)
+	{
+		std::cout << "[ERROR] loading DDS: unsupported pixel format: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+	compression = format;
+	if (format)
+		num_channels = TextureCompressor::getNumChannels(format);
+
+	const uint8* pos = data + offset;
+	const uint8* end = data + file.size;
+	for (int i = 0; i < num_levels; ++i)
+	{
+		sLevel level;
+		level.width = width;
+		level.height = height;
+		level.data = pos;
+		level.size = format ? TextureCompressor::getCompressedSize(format, width, height) : (size_t)width * height * num_channels;
+		pos += level.size;
+		if (pos > end)
+			break;
+		levels.push_back(level);
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	if (levels.empty())
+		return false;
+	flipLevels(filename);
+	return true;
+}
+
+bool TextureBin::loadKTX2(const char* filename)
+{
+	static const uint8 identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+	levels.clear();
+	memory.clear();
+	if (!file.open(filename))
+		return false;
+
+	const uint8* data = file.data;
+	if (file.size < 80 || memcmp(data, identifier, 12) != 0)
+	{
+		std::cout << "[ERROR] loading KTX2: invalid content: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+
+	//vkFormat, typeSize, pixelWidth, pixelHeight, pixelDepth, layerCount, faceCount, levelCount, supercompressionScheme
+	const uint32* header = (const uint32*)(data + 12);
+	uint32 vk_format = header[0];
+	int width = header[2];
+	int height = header[3];
+	int num_levels = std::max(1, (int)header[7]);
+	if (header[4] > 1 || header[5] > 1 || header[6] != 1 || header[8] != 0 || file.size < 80 + (size_t)num_levels * 24)
+	{
+		std::cout << "[ERROR] loading KTX2: only 2D textures without supercompression are supported: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+
+	unsigned int format = 0;
+	num_channels = 0;
+	switch (vk_format)
+	{
+		case 9: num_channels = 1; break; //R8
+		case 16: num_channels = 2; break; //R8G8
+		case 23: case 29: num_channels = 3; break; //R8G8B8
+		case 37: case 43: num_channels = 4; break; //R8G8B8A8
+		case 131: case 132: format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+		case 133: case 134: format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+		case 137: case 138: format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+		case 139: format = GL_COMPRESSED_RED_RGTC1; break;
+		case 141: format = GL_COMPRESSED_RG_RGTC2; break;
+		case 145: case 146: format = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+	}
+	if (!format && !num_channels)
+	{
+		std::cout << "[ERROR] loading KTX2: unsupported vkFormat " << vk_format << ": " << filename << std::endl;
+		file.close();
+		return false;
+	}
+	compression = format;
+	if (format)
+		num_channels = TextureCompressor::getNumChannels(format);
+
+	//level index after the header and the data format descriptors: byteOffset, byteLength, uncompressedByteLength
+	const uint64_t* level_index = (const uint64_t*)(data + 80);
+	for (int i = 0; i < num_levels; ++i)
+	{
+		sLevel level;
+		level.width = std::max(1, width >> i);
+		level.height = std::max(1, height >> i);
+		level.size = format ? TextureCompressor::getCompressedSize(format, level.width, level.height) : (size_t)level.width * level.height * num_channels;
+		uint64_t offset = level_index[i * 3];
+		if (level_index[i * 3 + 1] < level.size || offset + level.size > file.size)
+			break;
+		level.data = data + offset;
+		levels.push_back(level);
+	}
+	if (levels.empty())
+		return false;
+	flipLevels(filename);
+	return true;
+}
+
+//*********************
+
 bool isPowerOfTwo( int n )
 {
 	return (n & (n - 1)) == 0;
@@ -1026,35 +1843,48 @@ bool isPowerOfTwo( int n )
 
 //*********************
 
-LoadTextureTask::LoadTextureTask(const char* str)
+TaskEventRef Texture::LoadAsync(const char* filename, eTextureUsage usage, TaskTokenRef token)
+{
+	LoadTextureTask* load_task = new LoadTextureTask(filename, usage);
+	UploadTextureTask* upload_task = new UploadTextureTask(filename, load_task->bin);
+	load_task->token = upload_task->token = token;
+	TaskEventRef uploaded = upload_task->getEvent();
+	TaskManager::foreground.addTask(upload_task);
+	TaskManager::background.addTask(load_task);
+	return uploaded;
+}
+
+LoadTextureTask::LoadTextureTask(const char* str, eTextureUsage usage)
 {
 	filename = str;
-	image = NULL;
+	this->usage = usage;
+	bin.value = std::make_shared<TextureBin*>((TextureBin*)NULL);
+	bin.event = getEvent();
 }
 
 void LoadTextureTask::onExecute()
 {
-	image = new Image();
-	if (!image->load(filename.c_str()))
-	{
-		delete image;
-		image = NULL;
-	}
-
-	//image loaded, ready to go back to main thread
-	UploadTextureTask* upload_task = new UploadTextureTask(filename.c_str(), image);
-	TaskManager::foreground.addTask(upload_task);
+	//decoded or mapped from the cache, with all the mips (compressed when the usage is known)
+	*bin.value = Texture::LoadBin(filename.c_str(), usage);
 }
 
-UploadTextureTask::UploadTextureTask(const char* filename, Image* image)
+UploadTextureTask::UploadTextureTask(const char* filename, TaskFuture<TextureBin*> bin)
 {
 	this->filename = filename;
-	this->image = image;
+	this->bin = bin;
+	dependsOn(bin.event);
+}
+
+size_t UploadTextureTask::getCost()
+{
+	TextureBin* data = bin.get();
+	return data ? data->getTotalBytes() : 0;
 }
 
 void UploadTextureTask::onExecute()
 {
 	Texture* texture = NULL;
+	TextureBin* bin = this->bin.get();
 
 	//in case somehow it got loaded while I was loading it in the background
 	auto it = Texture::sTexturesLoaded.find(filename);
@@ -1065,17 +1895,37 @@ void UploadTextureTask::onExecute()
 		if (!texture)
 			texture = new Texture();
 		*/
-		delete image;
+		delete bin;
 		std::cout << "Warning: image loaded in background not found foreground thread" << std::endl;
 		return;
 	}
 
 	texture = it->second;
+	texture->load_token = NULL; //too late to cancel it
 
-	//upload to GPU
-	texture->loadFromImage(image);
-	texture->loading = false;
+	//the file couldnt be loaded, keep the placeholder
+	if (!bin)
+	{
+		texture->loading = false;
+		return;
+	}
 
-	//delete image
-	delete image;
+	//upload to GPU through the PBO ring, it takes ownership of the bin
+	TextureUploader::enqueue(texture, bin);
+}
+
+void UploadTextureTask::onCancel()
+{
+	//the decode could have finished before the cancellation
+	delete bin.get();
+
+	auto it = Texture::sTexturesLoaded.find(filename);
+	if (it == Texture::sTexturesLoaded.end())
+		return;
+	Texture* texture = it->second;
+	texture->loading = false;
+	texture->load_token = NULL;
+	//the placeholder is treated as evicted, so it is streamed again when used
+	if (!texture->resident_level)
+		texture->evicted = true;
 }
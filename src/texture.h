@@ -7,6 +7,8 @@
 #include "includes.h"
 #include "framework.h"
 #include "task.h"
+#include "utils.h"
+#include "texture_compressor.h"
 #include <map>
 #include <set>
 #include <string>
@@ -28,6 +30,15 @@ class Texture;
 	#define GL_TEXTURE_EXTERNAL_OES 0x8D65
 #endif
 
+#define TEXTURE_BIN_VERSION 2 //this is used to regenerate the .tbin files if the format changes
+
+//how the materials use a texture, to choose its compressed format
+enum eTextureUsage {
+	TEXTURE_UNKNOWN,	//kept uncompressed
+	TEXTURE_COLOR,		//albedo, emissive: BC1, or BC7 (BC3 if not supported) when it has alpha
+	TEXTURE_NORMAL		//normalmaps: BC5, only XY are stored so Z must be reconstructed in the shader
+};
+
 //Simple class to handle images (stores RGBA always)
 template <typename T> class tImage
 {
@@ -69,6 +80,9 @@ public:
 
 	bool load(const char* filename);
 
+	void setNumChannels(int num_channels); //expands RGB to RGBA, etc
+	void downsample(Image* result, bool srgb = false, bool kaiser = false); //half resolution
+
 	bool loadTGA(const char* filename);
 	bool loadPNG(const char* filename, bool flip_y = true);
 	bool loadPNG(std::vector<unsigned char>& buffer, bool flip_y = false);
@@ -77,6 +91,43 @@ public:
 	bool saveTGA(const char* filename, bool flip_y = false);
 };
 
+//Decoded texture stored in disk (.tbin) with the rows already flipped and the mips computed in the CPU.
+//Cached files are mapped in memory and the levels are uploaded straight from the mapping.
+class TextureBin
+{
+public:
+	struct sLevel {
+		int width;
+		int height;
+		const uint8* data;
+		size_t size;	//in bytes
+	};
+
+	unsigned int num_channels;
+	unsigned int compression;	//GL compressed internal format, 0 if uncompressed
+	eTextureUsage usage;		//the one used to choose the compression
+	std::vector<sLevel> levels; //level 0 is the full resolution
+
+	TextureBin() { num_channels = 0; compression = 0; usage = TEXTURE_UNKNOWN; }
+
+	bool load(const char* filename, const char* source_filename); //fails if the source changed since it was saved
+	bool save(const char* filename, const char* source_filename);
+	bool loadDDS(const char* filename);
+	bool loadKTX2(const char* filename);
+	void build(Image* image, bool mipmaps = true, bool srgb = false); //copies the image and computes the mips (only power of two), srgb filters them in linear space
+	void compress(unsigned int format); //encodes all the levels in a BCn format
+	unsigned int getFormat();
+	size_t getTotalBytes();
+	//compressed levels are uploaded by rows of blocks
+	int getNumRows(int level) { return compression ? (levels[level].height + 3) / 4 : levels[level].height; }
+	int getRowBytes(int level) { return (int)(levels[level].size / getNumRows(level)); }
+
+private:
+	MappedFile file;
+	std::vector<uint8> memory; //used when built from an image, or flipped
+	void flipLevels(const char* filename);
+};
+
 class FloatImage : public tImage<float>
 {
 public:
@@ -87,7 +138,7 @@ public:
 		int pos = y * width * num_channels + x * num_channels;
 		return Vector4(data[pos], data[pos + 1], data[pos + 2], num_channels == 3 ? 1 : data[pos + 3]);
 	};
-	void setPixel(int x, int y, Vector4 v) {
+	void setPixel(int x, int y, const Vector4& v) {
 		assert(x >= 0 && x < (int)width&& y >= 0 && y < (int)height && "writing of memory");
 		int pos = y * width * num_channels + x * num_channels;
 		data[pos] = v.x; data[pos + 1] = v.y; data[pos + 2] = v.z;
@@ -95,6 +146,7 @@ public:
 			data[pos + 3] = v.w;
 	};
 	void fromTexture(Texture* texture);
+	void fromImage(Image* image); //bytes to 0..1
 	bool loadIBIN(const char* filename);
 	bool saveIBIN(const char* filename);
 };
@@ -107,6 +159,8 @@ public:
 	static int default_mag_filter;
 	static int default_min_filter;
 	static FBO* global_fbo;
+	static bool use_cache; //stores the decoded textures in .tbin files and loads them instead of the originals
+	static bool use_compression; //encodes the textures with a known usage in BCn formats
 
 	//a general struct to store all the information about a TGA file
 
@@ -129,6 +183,16 @@ public:
 	unsigned int wrapS;
 	unsigned int wrapT;
 
+	eTextureUsage usage;	//used to choose the compressed format when streamed
+
+	//residency info, used to keep the VRAM under budget
+	long last_used_frame;	//last frame this texture was bound to a shader
+	size_t vram_bytes;		//bytes used in VRAM (including mipmaps)
+	int resident_level;		//number of top mips dropped to save memory (0 means full resolution)
+	bool evicted;			//storage replaced by a 1x1 texture, it will be streamed again when used
+	float screen_size;		//biggest projected size it was drawn at this frame, the biggest ones are streamed first
+	TaskTokenRef load_token;//of the load in progress, to cancel it or update its priority
+
 	//original data info
 	Image image;
 
@@ -165,10 +229,16 @@ public:
 	//load without using the manager
 	bool load(const char* filename, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
 	void loadFromImage(Image* image, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
+	void loadFromBin(TextureBin* bin, bool mipmaps = true, bool wrap = true);
+	int createFromBin(TextureBin* bin, bool mipmaps = true); //allocates all the levels without data, returns how many
+	void takeStorage(Texture* other); //replaces the GL texture, size and format by the ones of other, that is left empty
+	static TextureBin* LoadBin(const char* filename, eTextureUsage usage = TEXTURE_UNKNOWN); //from the .tbin cache if valid, otherwise decodes the file (can be called from any thread)
+	static unsigned int ChooseCompression(eTextureUsage usage, Image* image);
 
 	//load using the manager (caching loaded ones to avoid reloading them)
 	static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true);
-	static Texture* GetAsync(const char* filename, bool mipmaps = true, bool wrap = true);
+	static Texture* GetAsync(const char* filename, bool mipmaps = true, bool wrap = true, eTextureUsage usage = TEXTURE_UNKNOWN);
+	static TaskEventRef LoadAsync(const char* filename, eTextureUsage usage, TaskTokenRef token = NULL); //decodes in a worker and queues the upload in the main thread, the event is signaled once queued
 	static Texture* Find(const char* filename);
 	void setName(const char* name) {
 		filename = name;
@@ -177,6 +247,34 @@ public:
 
 	void generateMipmaps();
 
+	//residency manager: tracks VRAM usage and evicts the least recently used textures when over budget
+	struct sResidencyStats {
+		size_t vram_used;		//bytes used by all textures
+		size_t vram_budget;		//0 means no budget
+		int num_textures;		//textures registered in the manager
+		int num_degraded;		//textures with some mips dropped
+		int num_evicted;		//textures replaced by a 1x1
+		int num_restreaming;	//textures being loaded again
+		int dropped_last_frame;	//mips dropped in the last update
+		int evicted_last_frame;	//textures evicted in the last update
+		long total_restreams;	//times a texture had to be streamed again
+	};
+	static size_t sVRAMBudget;		//max bytes in VRAM, 0 to disable
+	static size_t sVRAMUsed;		//bytes used by all textures
+	static int sResidencyMinSize;	//textures are never degraded below this size
+	static int sStreamingCancelFrames; //loads of textures not used in this many frames are cancelled, 0 to never cancel
+	static long sCurrentFrame;
+	static sResidencyStats sStats;
+
+	void touch(); //marks it as used this frame, restreams it if it was evicted
+	void setScreenSize(float size) { if (size > screen_size) screen_size = size; }
+	bool dropMips(int levels = 1); //reduces the resolution by removing the top mips
+	void evict(); //replaces the texture by its average color (1x1)
+	void restream(); //loads again the full resolution version in the background
+	size_t computeVRAMBytes();
+	void updateVRAMBytes(); //recomputes vram_bytes and updates the global counter
+	static void UpdateResidency(); //call once per frame, enforces the budget
+
 	//show the texture on the current viewport
 	void toViewport( Shader* shader = NULL );
 	//copy to another texture
@@ -191,24 +289,28 @@ bool isPowerOfTwo(int n);
 
 //When loading textures asyncrhonously, first we load them from the hard drive in a background thread
 //afterwards we pass the data to the main thread as bg threads cannot access opengl, and main thread
-//uploads to GPU. While loading a fake 1x1 texture is created
+//uploads to GPU. While loading a fake 1x1 texture is created.
+//The upload task depends on the load one, so Texture::LoadAsync only has to launch both.
 
 class LoadTextureTask : public Task {
 public:
 	std::string filename;
-	Image* image;
+	eTextureUsage usage;
+	TaskFuture<TextureBin*> bin; //NULL if it couldnt be loaded
 
-	LoadTextureTask(const char* filename);
+	LoadTextureTask(const char* filename, eTextureUsage usage = TEXTURE_UNKNOWN);
 	void onExecute();
 };
 
 class UploadTextureTask : public Task {
 public:
 	std::string filename;
-	Image* image;
+	TaskFuture<TextureBin*> bin;
 
-	UploadTextureTask(const char* filename, Image* image);
+	UploadTextureTask(const char* filename, TaskFuture<TextureBin*> bin); //waits for the bin
 	void onExecute();
+	void onCancel();
+	size_t getCost();
 };
 
 
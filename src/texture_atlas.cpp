@@ -0,0 +1,242 @@
+#include "texture_atlas.h"
+#include "material.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+//imgui_draw.cpp already contains the implementation of stb_rect_pack
+#ifdef SKIP_IMGUI
+	#define STB_RECT_PACK_IMPLEMENTATION
+#endif
+#include "extra/imgui/imstb_rectpack.h"
+
+int TextureAtlas::max_texture_size = 256;
+int TextureAtlas::atlas_size = 2048;
+int TextureAtlas::padding = 8;
+bool TextureAtlas::pack_when_loaded = true;
+std::vector<TextureAtlas*> TextureAtlas::sAtlases;
+unsigned int TextureAtlas::packed_version = 0;
+unsigned int TextureAtlas::released_version = 0;
+
+//the samplers of a material that can point to an atlas, only the ones material.fs reads with SAMPLE() and their u_*_transform.
+//The others would be read with the uvs of the whole atlas
+static void getSamplers(GTR::Material* material, GTR::Sampler** samplers)
+{
+	samplers[0] = &material->color_texture;
+	samplers[1] = &material->emissive_texture;
+	samplers[2] = &material->occlusion_texture;
+}
+#define NUM_SAMPLERS 3
+
+static bool canBePacked(Texture* texture)
+{
+	return texture->texture_type == GL_TEXTURE_2D && texture->type == GL_UNSIGNED_BYTE &&
+		!texture->loading && !texture->evicted && !texture->resident_level &&
+		texture->width <= TextureAtlas::max_texture_size && texture->height <= TextureAtlas::max_texture_size;
+}
+
+static int alignTo(int v, int alignment) { return (v + alignment - 1) / alignment * alignment; }
+
+TextureAtlas::~TextureAtlas()
+{
+	if (texture)
+		delete texture;
+}
+
+TextureAtlas::sEntry* TextureAtlas::find(Texture* source)
+{
+	for (auto& entry : entries)
+		if (entry.source == source)
+			return &entry;
+	return NULL;
+}
+
+int TextureAtlas::PackMaterials()
+{
+	packed_version = GTR::Material::sVersion;
+	GTR::Sampler* samplers[NUM_SAMPLERS];
+
+	//gather the small textures, grouped by usage because the atlas is compressed according to it
+	std::vector<Texture*> candidates[TEXTURE_NORMAL + 1];
+	std::set<Texture*> added;
+	for (auto it : GTR::Material::sMaterials)
+	{
+		getSamplers(it.second, samplers);
+		for (int i = 0; i < NUM_SAMPLERS; ++i)
+		{
+			Texture* texture = samplers[i]->texture;
+			if (!texture || added.count(texture) || !canBePacked(texture))
+				continue;
+			added.insert(texture);
+			candidates[texture->usage].push_back(texture);
+		}
+	}
+
+	int num_atlases = (int)sAtlases.size();
+	for (int i = 0; i <= TEXTURE_NORMAL; ++i)
+		build(candidates[i], (eTextureUsage)i);
+
+	//point the samplers to the atlases
+	int num_packed = 0;
+	for (int i = num_atlases; i < (int)sAtlases.size(); ++i)
+		num_packed += (int)sAtlases[i]->entries.size();
+	for (auto it : GTR::Material::sMaterials)
+	{
+		getSamplers(it.second, samplers);
+		for (int i = 0; i < NUM_SAMPLERS; ++i)
+			for (int j = num_atlases; j < (int)sAtlases.size(); ++j)
+			{
+				sEntry* entry = sAtlases[j]->find(samplers[i]->texture);
+				if (!entry)
+					continue;
+				samplers[i]->texture = sAtlases[j]->texture;
+				samplers[i]->uv_transform = entry->uv_transform;
+				break;
+			}
+	}
+
+	if (num_packed)
+		std::cout << " + Textures packed in atlases: " << num_packed << " in " << (sAtlases.size() - num_atlases) << " atlases" << std::endl;
+	return num_packed;
+}
+
+bool TextureAtlas::build(std::vector<Texture*>& textures, eTextureUsage usage)
+{
+	assert(isPowerOfTwo(padding) && isPowerOfTwo(atlas_size));
+
+	//aligning the rects to the padding keeps the texels of the mips inside their rect
+	std::vector<stbrp_rect> rects(textures.size());
+	for (size_t i = 0; i < textures.size(); ++i)
+	{
+		rects[i].id = (int)i;
+		rects[i].w = alignTo((int)textures[i]->width + padding * 2, padding);
+		rects[i].h = alignTo((int)textures[i]->height + padding * 2, padding);
+	}
+
+	//only the mips whose texels (and their bilinear neighbours) stay inside the padding
+	int num_levels = 0;
+	while ((2 << num_levels) <= padding)
+		num_levels++;
+
+	std::vector<stbrp_node> nodes(atlas_size);
+	bool created = false;
+	while (rects.size() > 1) //a single texture gains nothing
+	{
+		stbrp_context context;
+		stbrp_init_target(&context, atlas_size, atlas_size, &nodes[0], (int)nodes.size());
+		stbrp_pack_rects(&context, &rects[0], (int)rects.size());
+
+		std::vector<stbrp_rect> packed, remaining;
+		for (auto& rect : rects)
+			(rect.was_packed ? packed : remaining).push_back(rect);
+		if (packed.size() < 2)
+			break;
+		rects.swap(remaining);
+
+		TextureAtlas* atlas = new TextureAtlas();
+		atlas->usage = usage;
+
+		//unused space is opaque so it doesnt force a format with alpha
+		Image image;
+		image.resize(atlas_size, atlas_size, 4);
+		memset(image.data, 255, (size_t)atlas_size * atlas_size * 4);
+		Image source;
+		for (auto& rect : packed)
+		{
+			sEntry entry;
+			entry.source = textures[rect.id];
+			source.fromTexture(entry.source);
+			entry.x = rect.x + padding;
+			entry.y = rect.y + padding;
+			entry.width = source.width;
+			entry.height = source.height;
+			entry.uv_transform.set(entry.width / (float)atlas_size, entry.height / (float)atlas_size, entry.x / (float)atlas_size, entry.y / (float)atlas_size);
+
+			//copy it with the border wrapped around
+			int w = entry.width, h = entry.height;
+			for (int y = -padding; y < h + padding; ++y)
+			{
+				const uint8* src = source.data + (size_t)((y + h * padding) % h) * w * 4;
+				uint8* dst = image.data + ((size_t)(entry.y + y) * atlas_size + entry.x - padding) * 4;
+				for (int x = -padding; x < w + padding; ++x, dst += 4)
+					memcpy(dst, src + ((x + w * padding) % w) * 4, 4);
+			}
+			atlas->entries.push_back(entry);
+		}
+
+		TextureBin bin;
+		bin.build(&image, true, usage == TEXTURE_COLOR);
+		bin.levels.resize(std::max(1, std::min(num_levels, (int)bin.levels.size())));
+		unsigned int compression = Texture::ChooseCompression(usage, &image);
+		if (compression)
+			bin.compress(compression);
+
+		atlas->texture = new Texture();
+		atlas->texture->filename = "atlas"; //not registered, it cannot be restreamed from a file
+		atlas->texture->usage = usage;
+		atlas->texture->loadFromBin(&bin, true, true);
+		sAtlases.push_back(atlas);
+		created = true;
+	}
+	return created;
+}
+
+int TextureAtlas::ReleaseUnused()
+{
+	released_version = GTR::Material::sVersion;
+	std::set<Texture*> used;
+	GTR::Sampler* samplers[NUM_SAMPLERS];
+	for (auto it : GTR::Material::sMaterials)
+	{
+		getSamplers(it.second, samplers);
+		for (int i = 0; i < NUM_SAMPLERS; ++i)
+			if (samplers[i]->texture)
+				used.insert(samplers[i]->texture);
+	}
+
+	int num_released = 0;
+	for (size_t i = 0; i < sAtlases.size();)
+	{
+		if (used.count(sAtlases[i]->texture))
+		{
+			++i;
+			continue;
+		}
+		delete sAtlases[i];
+		sAtlases.erase(sAtlases.begin() + i);
+		num_released++;
+	}
+	return num_released;
+}
+
+void TextureAtlas::Update()
+{
+	//materials were deleted (the prefabs unloaded by the streaming) or added
+	if (GTR::Material::sVersion != released_version)
+		ReleaseUnused();
+	if (!pack_when_loaded || GTR::Material::sVersion == packed_version)
+		return;
+
+	//wait till the textures of the materials are loaded
+	GTR::Sampler* samplers[NUM_SAMPLERS];
+	for (auto it : GTR::Material::sMaterials)
+	{
+		getSamplers(it.second, samplers);
+		for (int i = 0; i < NUM_SAMPLERS; ++i)
+			if (samplers[i]->texture && samplers[i]->texture->loading)
+				return;
+	}
+
+	PackMaterials();
+}
+
+void TextureAtlas::Release()
+{
+	for (auto atlas : sAtlases)
+		delete atlas;
+	sAtlases.clear();
+	packed_version = released_version = GTR::Material::sVersion;
+}
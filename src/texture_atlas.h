@@ -0,0 +1,53 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include "framework.h"
+#include "texture.h"
+#include <vector>
+
+//TextureAtlas
+//packs the small textures of the materials in big shared textures, so materials that only differ in
+//their small textures end using the same one. Every texture is surrounded by a border of padding texels
+//(copied from the opposite side, so repeating uvs still filter right) and the rects are aligned to the padding,
+//this way the first log2(padding) mips never mix texels of different textures. The samplers are rewritten
+//to point to the atlas with the scale and offset of their rect in uv_transform, only the color, emissive and
+//occlusion ones because they are the ones the material shader maps to the rect.
+
+class TextureAtlas {
+public:
+	struct sEntry {
+		Texture* source;		//original texture, still in the manager
+		int x, y;				//position in the atlas (without the padding)
+		int width, height;
+		Vector4 uv_transform;	//scale (xy) and offset (zw) to apply to the uvs
+	};
+
+	static int max_texture_size;	//textures bigger than this in any side are not packed
+	static int atlas_size;			//width and height of every atlas (power of two)
+	static int padding;				//texels around every texture, power of two
+	static bool pack_when_loaded;	//packs the materials automatically once their textures finished loading
+	static std::vector<TextureAtlas*> sAtlases;
+
+	Texture* texture;
+	eTextureUsage usage;
+	std::vector<sEntry> entries;
+
+	TextureAtlas() { texture = NULL; usage = TEXTURE_UNKNOWN; }
+	~TextureAtlas();
+
+	sEntry* find(Texture* source);
+
+	//packs the textures of all the registered materials, returns how many were packed
+	static int PackMaterials();
+	//deletes the atlases no sampler of a registered material points to anymore, returns how many
+	static int ReleaseUnused();
+	static void Update(); //call once per frame, packs new materials when pack_when_loaded and releases the unused atlases
+	static void Release(); //call it after releasing the materials
+
+private:
+	static unsigned int packed_version;		//GTR::Material::sVersion when the materials were packed
+	static unsigned int released_version;	//and when the unused atlases were released
+	static bool build(std::vector<Texture*>& textures, eTextureUsage usage);
+};
+
+#endif
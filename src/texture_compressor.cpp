@@ -0,0 +1,658 @@
+#include "texture_compressor.h"
+#include "includes.h"
+#include "parallel.h"
+#include "image_kernels.h"
+
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+bool TextureCompressor::supports_s3tc = false;
+bool TextureCompressor::supports_bptc = false;
+
+//BC7 interpolation weights for 4 bits indices
+static const int bc7_weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+void TextureCompressor::checkSupport()
+{
+	static bool checked = false;
+	if (checked)
+		return;
+	checked = true;
+
+	GLint num_extensions = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+	for (int i = 0; i < num_extensions; ++i)
+	{
+		const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (!name)
+			continue;
+		if (strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+			supports_s3tc = true;
+		else if (strcmp(name, "GL_ARB_texture_compression_bptc") == 0)
+			supports_bptc = true;
+	}
+
+	//BPTC is core since 4.2
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major > 4 || (major == 4 && minor >= 2))
+		supports_bptc = true;
+}
+
+bool TextureCompressor::isSupported(unsigned int format)
+{
+	switch (format)
+	{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return supports_s3tc;
+		case GL_COMPRESSED_RED_RGTC1: case GL_COMPRESSED_RG_RGTC2: return true;
+		case GL_COMPRESSED_RGBA_BPTC_UNORM: return supports_bptc;
+	}
+	return false;
+}
+
+bool TextureCompressor::isCompressedFormat(unsigned int format)
+{
+	return getBlockBytes(format) != 0;
+}
+
+int TextureCompressor::getBlockBytes(unsigned int format)
+{
+	switch (format)
+	{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: case GL_COMPRESSED_RED_RGTC1: return 8;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: case GL_COMPRESSED_RG_RGTC2: case GL_COMPRESSED_RGBA_BPTC_UNORM: return 16;
+	}
+	return 0;
+}
+
+int TextureCompressor::getNumChannels(unsigned int format)
+{
+	switch (format)
+	{
+		case GL_COMPRESSED_RED_RGTC1: return 1;
+		case GL_COMPRESSED_RG_RGTC2: return 2;
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return 3;
+	}
+	return 4;
+}
+
+size_t TextureCompressor::getCompressedSize(unsigned int format, int width, int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * getBlockBytes(format);
+}
+
+void TextureCompressor::compress(unsigned int format, const uint8* data, int width, int height, int num_channels, uint8* out, int num_threads)
+{
+	assert(data && out && isCompressedFormat(format));
+	int blocks_x = (width + 3) / 4;
+	int blocks_y = (height + 3) / 4;
+	int block_bytes = getBlockBytes(format);
+
+	auto compressRows = [=](int start, int end) {
+		uint8 block[64];
+		for (int by = start; by < end; ++by)
+			for (int bx = 0; bx < blocks_x; ++bx)
+			{
+				//expand to RGBA, clamping to the border
+				for (int y = 0; y < 4; ++y)
+				{
+					int sy = std::min(by * 4 + y, height - 1);
+					for (int x = 0; x < 4; ++x)
+					{
+						int sx = std::min(bx * 4 + x, width - 1);
+						const uint8* src = data + ((size_t)sy * width + sx) * num_channels;
+						uint8* dst = block + (y * 4 + x) * 4;
+						dst[0] = src[0];
+						dst[1] = num_channels > 1 ? src[1] : src[0];
+						dst[2] = num_channels > 2 ? src[2] : (num_channels == 1 ? src[0] : 0);
+						dst[3] = num_channels == 4 ? src[3] : 255;
+					}
+				}
+				compressBlock(format, block, out + ((size_t)by * blocks_x + bx) * block_bytes);
+			}
+	};
+
+	//small images are not worth the threads
+	if (blocks_x * blocks_y < 1024)
+		num_threads = 1;
+	if (num_threads == 1)
+	{
+		compressRows(0, blocks_y);
+		return;
+	}
+
+	//chunks of at least 1024 blocks, and no more chunks than num_threads when it is set
+	int rows_per_chunk = std::max(1, 1024 / blocks_x);
+	if (num_threads > 0)
+		rows_per_chunk = std::max(rows_per_chunk, (blocks_y + num_threads - 1) / num_threads);
+	parallelFor(0, blocks_y, compressRows, rows_per_chunk);
+}
+
+void TextureCompressor::compressBlock(unsigned int format, const uint8* rgba, uint8* out)
+{
+	switch (format)
+	{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: compressBlockBC1(rgba, out); break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: compressBlockBC3(rgba, out); break;
+		case GL_COMPRESSED_RED_RGTC1: compressBlockBC4(rgba, 0, out); break;
+		case GL_COMPRESSED_RG_RGTC2: compressBlockBC5(rgba, out); break;
+		case GL_COMPRESSED_RGBA_BPTC_UNORM: compressBlockBC7(rgba, out); break;
+		default: assert(0 && "unknown compressed format");
+	}
+}
+
+//*********************
+
+//endpoints are the extremes of the texels projected on the principal axis of the block.
+//Every texel is a simd vector, the components not used are 0 so they dont change the axis
+static void findEndpoints(const uint8* rgba, int num_components, float* e0, float* e1)
+{
+	const simd::vec mask = simd::set(1.0f, num_components > 1 ? 1.0f : 0.0f, num_components > 2 ? 1.0f : 0.0f, num_components > 3 ? 1.0f : 0.0f);
+	simd::vec d[16];
+	simd::vec mean = simd::splat(0.0f);
+	for (int i = 0; i < 16; ++i)
+	{
+		const uint8* texel = rgba + i * 4;
+		d[i] = simd::mul(simd::set(texel[0], texel[1], texel[2], texel[3]), mask);
+		mean = simd::add(mean, d[i]);
+	}
+	mean = simd::mul(mean, simd::splat(1.0f / 16.0f));
+
+	//rows of the covariance matrix
+	simd::vec cov[4] = { simd::splat(0.0f), simd::splat(0.0f), simd::splat(0.0f), simd::splat(0.0f) };
+	for (int i = 0; i < 16; ++i)
+	{
+		d[i] = simd::sub(d[i], mean);
+		cov[0] = simd::madd(d[i], simd::lane<0>(d[i]), cov[0]);
+		cov[1] = simd::madd(d[i], simd::lane<1>(d[i]), cov[1]);
+		cov[2] = simd::madd(d[i], simd::lane<2>(d[i]), cov[2]);
+		cov[3] = simd::madd(d[i], simd::lane<3>(d[i]), cov[3]);
+	}
+
+	//power iteration, a few steps are enough (the matrix is symmetric, so the rows are the columns)
+	simd::vec axis = mask;
+	for (int it = 0; it < 8; ++it)
+	{
+		simd::vec v = simd::mul(cov[0], simd::lane<0>(axis));
+		v = simd::madd(cov[1], simd::lane<1>(axis), v);
+		v = simd::madd(cov[2], simd::lane<2>(axis), v);
+		v = simd::madd(cov[3], simd::lane<3>(axis), v);
+		float abs_v[4];
+		simd::store(abs_v, simd::abs(v));
+		float max_v = std::max(std::max(abs_v[0], abs_v[1]), std::max(abs_v[2], abs_v[3]));
+		if (max_v == 0)
+			break;
+		axis = simd::mul(v, simd::splat(1.0f / max_v));
+	}
+
+	float tmin = 0, tmax = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		float t = simd::dot(d[i], axis);
+		tmin = std::min(tmin, t);
+		tmax = std::max(tmax, t);
+	}
+
+	float len2 = simd::dot(axis, axis);
+	simd::vec dir = simd::mul(axis, simd::splat(len2 > 0 ? 1.0f / len2 : 0.0f));
+	simd::vec lo = simd::splat(0.0f), hi = simd::splat(255.0f);
+	float v0[4], v1[4];
+	simd::store(v0, simd::min(hi, simd::max(lo, simd::madd(dir, simd::splat(tmax), mean))));
+	simd::store(v1, simd::min(hi, simd::max(lo, simd::madd(dir, simd::splat(tmin), mean))));
+	for (int c = 0; c < num_components; ++c)
+	{
+		e0[c] = v0[c];
+		e1[c] = v1[c];
+	}
+}
+
+//index of the closest palette entry for every texel, comparing the components [first, first + num_components).
+//Four texels at a time: the squared distance is an exact integer in a float, it is scaled by 16 and the entry added,
+//so the minimum gives the closest entry, and the first one on ties like a scalar search
+static void fitIndices(const uint8* rgba, int first, int num_components, const int (*palette)[4], int num_entries, int* indices)
+{
+	for (int i = 0; i < 16; i += 4)
+	{
+		simd::vec texels[4];
+		for (int c = 0; c < num_components; ++c)
+		{
+			const uint8* t = rgba + i * 4 + first + c;
+			texels[c] = simd::set(t[0], t[4], t[8], t[12]);
+		}
+		simd::vec best = simd::splat(1e30f);
+		for (int j = 0; j < num_entries; ++j)
+		{
+			simd::vec dist = simd::splat(0.0f);
+			for (int c = 0; c < num_components; ++c)
+			{
+				simd::vec diff = simd::sub(texels[c], simd::splat((float)palette[j][c]));
+				dist = simd::madd(diff, diff, dist);
+			}
+			best = simd::min(best, simd::madd(dist, simd::splat(16.0f), simd::splat((float)j)));
+		}
+		float keys[4];
+		simd::store(keys, best);
+		for (int k = 0; k < 4; ++k)
+			indices[i + k] = (int)keys[k] & 15;
+	}
+}
+
+static inline uint16 packRGB565(const float* c)
+{
+	int r = (int)(c[0] * 31.0f / 255.0f + 0.5f);
+	int g = (int)(c[1] * 63.0f / 255.0f + 0.5f);
+	int b = (int)(c[2] * 31.0f / 255.0f + 0.5f);
+	return (uint16)((r << 11) | (g << 5) | b);
+}
+
+static inline void unpackRGB565(uint16 v, int* c)
+{
+	int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+}
+
+//writes bits LSB first, as BC7 expects
+struct sBitWriter {
+	uint8* out;
+	int pos;
+	void put(unsigned int value, int bits) {
+		for (int b = 0; b < bits; ++b, ++pos)
+			if ((value >> b) & 1)
+				out[pos >> 3] |= 1 << (pos & 7);
+	}
+};
+
+struct sBitReader {
+	const uint8* data;
+	int pos;
+	unsigned int get(int bits) {
+		unsigned int v = 0;
+		for (int b = 0; b < bits; ++b, ++pos)
+			v |= ((data[pos >> 3] >> (pos & 7)) & 1) << b;
+		return v;
+	}
+};
+
+void TextureCompressor::compressBlockBC1(const uint8* rgba, uint8* out)
+{
+	float e0[4], e1[4];
+	findEndpoints(rgba, 3, e0, e1);
+	uint16 c0 = packRGB565(e0);
+	uint16 c1 = packRGB565(e1);
+	if (c0 < c1)
+		std::swap(c0, c1);
+
+	//c0 > c1 selects the 4 colors mode, if they are equal all indices are 0
+	uint32 indices = 0;
+	if (c0 != c1)
+	{
+		int palette[4][4];
+		unpackRGB565(c0, palette[0]);
+		unpackRGB565(c1, palette[1]);
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		int best[16];
+		fitIndices(rgba, 0, 3, palette, 4, best);
+		for (int i = 0; i < 16; ++i)
+			indices |= (uint32)best[i] << (2 * i);
+	}
+
+	out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+	out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+	for (int i = 0; i < 4; ++i)
+		out[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+void TextureCompressor::compressBlockBC4(const uint8* rgba, int channel, uint8* out)
+{
+	int min_v = 255, max_v = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		min_v = std::min(min_v, (int)rgba[i * 4 + channel]);
+		max_v = std::max(max_v, (int)rgba[i * 4 + channel]);
+	}
+
+	//max > min selects the 8 values mode, if they are equal all indices are 0
+	out[0] = (uint8)max_v;
+	out[1] = (uint8)min_v;
+	uint64_t bits = 0;
+	if (max_v != min_v)
+	{
+		int palette[8][4];
+		palette[0][0] = max_v;
+		palette[1][0] = min_v;
+		for (int j = 2; j < 8; ++j)
+			palette[j][0] = ((8 - j) * max_v + (j - 1) * min_v) / 7;
+		int best[16];
+		fitIndices(rgba, channel, 1, palette, 8, best);
+		for (int i = 0; i < 16; ++i)
+			bits |= (uint64_t)best[i] << (3 * i);
+	}
+	for (int i = 0; i < 6; ++i)
+		out[2 + i] = (bits >> (8 * i)) & 0xFF;
+}
+
+void TextureCompressor::compressBlockBC3(const uint8* rgba, uint8* out)
+{
+	compressBlockBC4(rgba, 3, out); //alpha
+	compressBlockBC1(rgba, out + 8);
+}
+
+void TextureCompressor::compressBlockBC5(const uint8* rgba, uint8* out)
+{
+	compressBlockBC4(rgba, 0, out);
+	compressBlockBC4(rgba, 1, out + 8);
+}
+
+//mode 6: one subset, RGBA endpoints of 7 bits plus a p-bit each, 4 bits indices
+void TextureCompressor::compressBlockBC7(const uint8* rgba, uint8* out)
+{
+	float e[2][4];
+	findEndpoints(rgba, 4, e[0], e[1]);
+
+	//choose the p-bit that gives the smallest error for every endpoint
+	int q[2][4];
+	int p[2];
+	for (int k = 0; k < 2; ++k)
+	{
+		float best_err = 1e10f;
+		for (int pbit = 0; pbit < 2; ++pbit)
+		{
+			int tq[4];
+			float err = 0;
+			for (int c = 0; c < 4; ++c)
+			{
+				tq[c] = std::min(127, std::max(0, (int)std::floor((e[k][c] - pbit) * 0.5f + 0.5f)));
+				float d = (tq[c] * 2 + pbit) - e[k][c];
+				err += d * d;
+			}
+			if (err < best_err)
+			{
+				best_err = err;
+				p[k] = pbit;
+				memcpy(q[k], tq, sizeof(tq));
+			}
+		}
+	}
+
+	int palette[16][4];
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < 4; ++c)
+		{
+			int v0 = q[0][c] * 2 + p[0], v1 = q[1][c] * 2 + p[1];
+			palette[i][c] = ((64 - bc7_weights4[i]) * v0 + bc7_weights4[i] * v1 + 32) >> 6;
+		}
+
+	int indices[16];
+	fitIndices(rgba, 0, 4, palette, 16, indices);
+
+	//the MSB of the first index is implicit 0, swap the endpoints if needed (weights are symmetric)
+	if (indices[0] & 8)
+	{
+		for (int c = 0; c < 4; ++c)
+			std::swap(q[0][c], q[1][c]);
+		std::swap(p[0], p[1]);
+		for (int i = 0; i < 16; ++i)
+			indices[i] = 15 - indices[i];
+	}
+
+	memset(out, 0, 16);
+	sBitWriter writer = { out, 0 };
+	writer.put(1 << 6, 7); //mode 6
+	for (int c = 0; c < 4; ++c)
+	{
+		writer.put(q[0][c], 7);
+		writer.put(q[1][c], 7);
+	}
+	writer.put(p[0], 1);
+	writer.put(p[1], 1);
+	writer.put(indices[0], 3);
+	for (int i = 1; i < 16; ++i)
+		writer.put(indices[i], 4);
+}
+
+//*********************
+
+static void decompressBC1(const uint8* block, uint8* rgba, bool four_colors)
+{
+	uint16 c0 = block[0] | (block[1] << 8);
+	uint16 c1 = block[2] | (block[3] << 8);
+	int palette[4][4];
+	unpackRGB565(c0, palette[0]);
+	unpackRGB565(c1, palette[1]);
+	palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+	for (int c = 0; c < 3; ++c)
+	{
+		if (c0 > c1 || four_colors)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	if (c0 <= c1 && !four_colors)
+		palette[3][3] = 0;
+
+	uint32 indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32)block[7] << 24);
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < 4; ++c)
+			rgba[i * 4 + c] = (uint8)palette[(indices >> (2 * i)) & 3][c];
+}
+
+static void decompressBC4(const uint8* block, uint8* rgba, int channel)
+{
+	int palette[8];
+	palette[0] = block[0];
+	palette[1] = block[1];
+	if (palette[0] > palette[1])
+		for (int j = 2; j < 8; ++j)
+			palette[j] = ((8 - j) * palette[0] + (j - 1) * palette[1]) / 7;
+	else
+	{
+		for (int j = 2; j < 6; ++j)
+			palette[j] = ((6 - j) * palette[0] + (j - 1) * palette[1]) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	uint64_t bits = 0;
+	for (int i = 0; i < 6; ++i)
+		bits |= (uint64_t)block[2 + i] << (8 * i);
+	for (int i = 0; i < 16; ++i)
+		rgba[i * 4 + channel] = (uint8)palette[(bits >> (3 * i)) & 7];
+}
+
+static void decompressBC7(const uint8* block, uint8* rgba)
+{
+	sBitReader reader = { block, 0 };
+	if (reader.get(7) != (1 << 6))
+	{
+		//other modes are not supported, show them in magenta
+		for (int i = 0; i < 16; ++i)
+		{
+			rgba[i * 4] = 255; rgba[i * 4 + 1] = 0; rgba[i * 4 + 2] = 255; rgba[i * 4 + 3] = 255;
+		}
+		return;
+	}
+	int q[2][4];
+	for (int c = 0; c < 4; ++c)
+	{
+		q[0][c] = reader.get(7);
+		q[1][c] = reader.get(7);
+	}
+	int p0 = reader.get(1), p1 = reader.get(1);
+	for (int i = 0; i < 16; ++i)
+	{
+		int index = reader.get(i == 0 ? 3 : 4);
+		for (int c = 0; c < 4; ++c)
+		{
+			int v0 = q[0][c] * 2 + p0, v1 = q[1][c] * 2 + p1;
+			rgba[i * 4 + c] = (uint8)(((64 - bc7_weights4[index]) * v0 + bc7_weights4[index] * v1 + 32) >> 6);
+		}
+	}
+}
+
+void TextureCompressor::decompressBlock(unsigned int format, const uint8* block, uint8* rgba)
+{
+	for (int i = 0; i < 16; ++i)
+	{
+		rgba[i * 4] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = 0;
+		rgba[i * 4 + 3] = 255;
+	}
+	switch (format)
+	{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: decompressBC1(block, rgba, false); break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: decompressBC1(block + 8, rgba, true); decompressBC4(block, rgba, 3); break;
+		case GL_COMPRESSED_RED_RGTC1: decompressBC4(block, rgba, 0); break;
+		case GL_COMPRESSED_RG_RGTC2: decompressBC4(block, rgba, 0); decompressBC4(block + 8, rgba, 1); break;
+		case GL_COMPRESSED_RGBA_BPTC_UNORM: decompressBC7(block, rgba); break;
+	}
+}
+
+//*********************
+
+//reverse the first num_rows rows of texels of a block
+static void flipBlockBC1(uint8* block, int num_rows)
+{
+	std::reverse(block + 4, block + 4 + num_rows); //a byte of indices per row
+}
+
+static void flipBlockBC4(uint8* block, int num_rows)
+{
+	uint64_t bits = 0;
+	for (int i = 0; i < 6; ++i)
+		bits |= (uint64_t)block[2 + i] << (8 * i);
+	uint64_t flipped = bits;
+	for (int y = 0; y < num_rows; ++y)
+	{
+		uint64_t row = (bits >> (12 * (num_rows - 1 - y))) & 0xFFF; //12 bits of indices per row
+		flipped = (flipped & ~((uint64_t)0xFFF << (12 * y))) | (row << (12 * y));
+	}
+	for (int i = 0; i < 6; ++i)
+		block[2 + i] = (flipped >> (8 * i)) & 0xFF;
+}
+
+static void setBits(uint8* block, int pos, int bits, unsigned int value)
+{
+	for (int b = 0; b < bits; ++b, ++pos)
+		block[pos >> 3] = (uint8)((block[pos >> 3] & ~(1 << (pos & 7))) | (((value >> b) & 1) << (pos & 7)));
+}
+
+//pair of endpoint fields of the same size, the second right after the first
+struct sBC7Endpoints {
+	int offset;
+	int bits;
+};
+
+//flips the indices of a single subset BC7 block. The first index has an implicit 0 MSB, if the texel that takes
+//its place needs it the indices are inverted and the endpoints swapped, which gives the same colors (weights are symmetric)
+static void flipBC7Indices(uint8* block, int offset, int index_bits, int num_rows, const sBC7Endpoints* endpoints, int num_endpoints)
+{
+	int indices[16];
+	sBitReader reader = { block, offset };
+	for (int i = 0; i < 16; ++i)
+		indices[i] = reader.get(i == 0 ? index_bits - 1 : index_bits);
+	for (int y = 0; y < num_rows / 2; ++y)
+		for (int x = 0; x < 4; ++x)
+			std::swap(indices[y * 4 + x], indices[(num_rows - 1 - y) * 4 + x]);
+
+	int max_index = (1 << index_bits) - 1;
+	if (indices[0] & (1 << (index_bits - 1)))
+	{
+		for (auto& index : indices)
+			index = max_index - index;
+		for (int k = 0; k < num_endpoints; ++k)
+		{
+			const sBC7Endpoints& e = endpoints[k];
+			sBitReader fields = { block, e.offset };
+			unsigned int e0 = fields.get(e.bits);
+			unsigned int e1 = fields.get(e.bits);
+			setBits(block, e.offset, e.bits, e1);
+			setBits(block, e.offset + e.bits, e.bits, e0);
+		}
+	}
+
+	int pos = offset;
+	for (int i = 0; i < 16; ++i)
+	{
+		int bits = i == 0 ? index_bits - 1 : index_bits;
+		setBits(block, pos, bits, indices[i]);
+		pos += bits;
+	}
+}
+
+//only the modes of one subset: 4 and 5 (color and alpha with their own indices) and 6
+static void flipBlockBC7(uint8* block, int num_rows)
+{
+	int mode = 4; //flipRows checked it is 4, 5 or 6
+	while (!(block[0] & (1 << mode)))
+		mode++;
+	if (mode == 6)
+	{
+		const sBC7Endpoints endpoints[] = { { 7, 7 }, { 21, 7 }, { 35, 7 }, { 49, 7 }, { 63, 1 } }; //RGBA and the p-bits
+		flipBC7Indices(block, 65, 4, num_rows, endpoints, 5);
+	}
+	else if (mode == 5)
+	{
+		const sBC7Endpoints color[] = { { 8, 7 }, { 22, 7 }, { 36, 7 } };
+		const sBC7Endpoints alpha[] = { { 50, 8 } };
+		flipBC7Indices(block, 66, 2, num_rows, color, 3);
+		flipBC7Indices(block, 97, 2, num_rows, alpha, 1);
+	}
+	else
+	{
+		//mode 4, the index mode bit chooses which indices (2 or 3 bits) are for the color
+		const sBC7Endpoints color[] = { { 8, 5 }, { 18, 5 }, { 28, 5 } };
+		const sBC7Endpoints alpha[] = { { 38, 6 } };
+		bool swapped = (block[0] >> 7) & 1;
+		flipBC7Indices(block, 50, 2, num_rows, swapped ? alpha : color, swapped ? 1 : 3);
+		flipBC7Indices(block, 81, 3, num_rows, swapped ? color : alpha, swapped ? 3 : 1);
+	}
+}
+
+bool TextureCompressor::flipRows(unsigned int format, uint8* data, int width, int height)
+{
+	assert(data && isCompressedFormat(format));
+	int blocks_x = (width + 3) / 4;
+	int blocks_y = (height + 3) / 4;
+	int block_bytes = getBlockBytes(format);
+	size_t num_blocks = (size_t)blocks_x * blocks_y;
+
+	//the mode is the lowest bit set of the first byte, flipping a partition would need another one
+	if (format == GL_COMPRESSED_RGBA_BPTC_UNORM)
+		for (size_t i = 0; i < num_blocks; ++i)
+		{
+			uint8 mode_bits = data[i * 16];
+			if ((mode_bits & 0x0F) || !(mode_bits & 0x70))
+				return false;
+		}
+
+	ImageKernels::flipRows(data, blocks_y, (size_t)blocks_x * block_bytes);
+	int num_rows = std::min(4, height); //images of 1 or 2 texels of height only have those rows
+	for (size_t i = 0; i < num_blocks; ++i)
+	{
+		uint8* block = data + i * block_bytes;
+		switch (format)
+		{
+			case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: flipBlockBC1(block, num_rows); break;
+			case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: flipBlockBC4(block, num_rows); flipBlockBC1(block + 8, num_rows); break;
+			case GL_COMPRESSED_RED_RGTC1: flipBlockBC4(block, num_rows); break;
+			case GL_COMPRESSED_RG_RGTC2: flipBlockBC4(block, num_rows); flipBlockBC4(block + 8, num_rows); break;
+			case GL_COMPRESSED_RGBA_BPTC_UNORM: flipBlockBC7(block, num_rows); break;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,59 @@
+#ifndef TEXTURE_COMPRESSOR_H
+#define TEXTURE_COMPRESSOR_H
+
+#include "framework.h"
+#include <cstddef>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+	#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+	#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+	#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RED_RGTC1
+	#define GL_COMPRESSED_RED_RGTC1 0x8DBB
+	#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+	#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+//TextureCompressor
+//CPU encoder of the BCn block compressed formats, every block stores 4x4 texels:
+//BC1 (RGB, 8 bytes), BC3 (RGBA, 16 bytes), BC4 (R, 8 bytes), BC5 (RG, 16 bytes) and BC7 (RGBA, 16 bytes, only mode 6).
+//Formats are identified by their GL internal format. It doesnt call OpenGL, so it can run in any thread.
+//The endpoint search and the index fit use the simd helpers of math_simd.h.
+
+class TextureCompressor {
+public:
+	static bool supports_s3tc; //BC1 and BC3
+	static bool supports_bptc; //BC7 (RGTC is core since GL 3.0)
+	static void checkSupport(); //reads the GL extensions, call it from the main thread
+	static bool isSupported(unsigned int format);
+
+	static bool isCompressedFormat(unsigned int format);
+	static int getBlockBytes(unsigned int format);
+	static int getNumChannels(unsigned int format);
+	static size_t getCompressedSize(unsigned int format, int width, int height);
+
+	//compresses a whole image splitting the rows of blocks with parallelFor (num_threads 0 means as many as Parallel allows),
+	//blocks outside the image repeat the border. out must have getCompressedSize bytes
+	static void compress(unsigned int format, const uint8* data, int width, int height, int num_channels, uint8* out, int num_threads = 0);
+
+	//encode one block of 4x4 RGBA texels
+	static void compressBlock(unsigned int format, const uint8* rgba, uint8* out);
+	static void compressBlockBC1(const uint8* rgba, uint8* out);
+	static void compressBlockBC3(const uint8* rgba, uint8* out);
+	static void compressBlockBC4(const uint8* rgba, int channel, uint8* out);
+	static void compressBlockBC5(const uint8* rgba, uint8* out);
+	static void compressBlockBC7(const uint8* rgba, uint8* out);
+
+	//decodes one block to 4x4 RGBA texels, to measure the error of the encoder (BC7 only mode 6)
+	static void decompressBlock(unsigned int format, const uint8* block, uint8* rgba);
+
+	//flips a compressed image in place like Image::flipY, reversing the rows of blocks and the rows inside every block.
+	//BC7 blocks with partitions (modes 0-3 and 7) cannot be flipped, then it returns false without changing the data.
+	//Heights above 4 that are not multiple of 4 move the image by the rows of padding of the last blocks
+	static bool flipRows(unsigned int format, uint8* data, int width, int height);
+};
+
+#endif
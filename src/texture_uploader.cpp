@@ -0,0 +1,234 @@
+#include "texture_uploader.h"
+#include "task.h"
+#include "utils.h"
+
+#include <cassert>
+#include <algorithm>
+
+bool TextureUploader::enabled = true;
+int TextureUploader::num_slots = 4;
+size_t TextureUploader::slot_size = 4 * 1024 * 1024;
+size_t TextureUploader::max_bytes_per_frame = 8 * 1024 * 1024;
+size_t TextureUploader::bytes_uploaded_last_frame = 0;
+int TextureUploader::num_pending_jobs = 0;
+
+TextureUploader::sSlot* TextureUploader::slots = NULL;
+std::list<TextureUploader::sJob*> TextureUploader::jobs;
+
+void TextureUploader::init()
+{
+	if (slots)
+		return;
+
+	//the PBOs are created once and reused for every upload
+	slots = new sSlot[num_slots];
+	for (int i = 0; i < num_slots; ++i)
+	{
+		sSlot& slot = slots[i];
+		glGenBuffers(1, &slot.pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, slot_size, NULL, GL_STREAM_DRAW);
+		slot.mapped = NULL;
+		slot.fence = 0;
+		slot.state = SLOT_FREE;
+		slot.job = NULL;
+		slot.level = slot.start_row = slot.num_rows = 0;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	assert(checkGLErrors() && "Error creating PBOs");
+}
+
+void TextureUploader::enqueue(Texture* texture, TextureBin* bin)
+{
+	assert(texture && bin && bin->levels.size());
+	int row_bytes = bin->getRowBytes(0);
+
+	//rows must fit in a slot, otherwise upload it the old way
+	if (!enabled || row_bytes > (int)slot_size)
+	{
+		texture->loadFromBin(bin);
+		texture->loading = false;
+		texture->evicted = false;
+		texture->resident_level = 0;
+		delete bin;
+		return;
+	}
+
+	init();
+
+	//allocate the storage of every level apart, the rows will arrive in the next frames
+	Texture* staging = new Texture();
+	staging->loading = true;
+	int num_levels = staging->createFromBin(bin);
+	glBindTexture(GL_TEXTURE_2D, staging->texture_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, staging->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, staging->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	texture->loading = true;
+
+	sJob* job = new sJob();
+	job->filename = texture->filename;
+	job->bin = bin;
+	job->staging = staging;
+	job->num_levels = num_levels;
+	job->next_level = 0;
+	job->next_row = 0;
+	job->rows_uploaded = 0;
+	job->total_rows = 0;
+	for (int i = 0; i < num_levels; ++i)
+		job->total_rows += bin->getNumRows(i);
+	job->pending_slots = 0;
+	job->cancelled = false;
+	jobs.push_back(job);
+}
+
+void TextureUploader::finishJob(sJob* job)
+{
+	Texture* texture = job->cancelled ? NULL : Texture::Find(job->filename.c_str());
+	if (texture)
+	{
+		//only when the bin didnt have the mips
+		if (job->staging->mipmaps && job->num_levels == 1 && !job->bin->compression)
+			job->staging->generateMipmaps();
+		glBindTexture(GL_TEXTURE_2D, 0);
+		texture->takeStorage(job->staging);
+		texture->loading = false;
+		texture->evicted = false;
+		texture->resident_level = 0;
+	}
+
+	jobs.remove(job);
+	delete job->staging; //only has a GL texture if the job was cancelled
+	delete job->bin;
+	delete job;
+}
+
+void TextureUploader::update()
+{
+	bytes_uploaded_last_frame = 0;
+	num_pending_jobs = (int)jobs.size();
+	if (!slots)
+		return;
+
+	//textures destroyed while streaming
+	for (auto job : jobs)
+		if (!job->cancelled && !Texture::Find(job->filename.c_str()))
+			job->cancelled = true;
+
+	//recycle the slots the GPU is done with
+	for (int i = 0; i < num_slots; ++i)
+	{
+		sSlot& slot = slots[i];
+		if (slot.state != SLOT_IN_FLIGHT)
+			continue;
+		GLenum result = glClientWaitSync(slot.fence, 0, 0);
+		if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+			continue;
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+		slot.state = SLOT_FREE;
+	}
+
+	//upload the filled slots until the budget is exhausted
+	std::vector<sJob*> finished;
+	for (int i = 0; i < num_slots && bytes_uploaded_last_frame < max_bytes_per_frame; ++i)
+	{
+		sSlot& slot = slots[i];
+		if (slot.state.load(std::memory_order_acquire) != SLOT_FILLED)
+			continue;
+		sJob* job = slot.job;
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		slot.mapped = NULL;
+		slot.state = SLOT_FREE;
+
+		if (!job->cancelled)
+		{
+			TextureBin* bin = job->bin;
+			TextureBin::sLevel& level = bin->levels[slot.level];
+			size_t bytes = (size_t)slot.num_rows * bin->getRowBytes(slot.level);
+			glBindTexture(GL_TEXTURE_2D, job->staging->texture_id);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			//reads from the PBO, compressed rows are rows of 4x4 blocks
+			if (bin->compression)
+			{
+				int y = slot.start_row * 4;
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, slot.level, 0, y, level.width, std::min(slot.num_rows * 4, level.height - y), bin->compression, (GLsizei)bytes, (void*)0);
+			}
+			else
+				glTexSubImage2D(GL_TEXTURE_2D, slot.level, 0, slot.start_row, level.width, slot.num_rows, job->staging->format, GL_UNSIGNED_BYTE, (void*)0);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			slot.state = SLOT_IN_FLIGHT;
+			bytes_uploaded_last_frame += bytes;
+			job->rows_uploaded += slot.num_rows;
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		slot.job = NULL;
+		job->pending_slots--;
+		if (job->pending_slots == 0 && (job->cancelled || job->rows_uploaded == job->total_rows))
+			finished.push_back(job);
+	}
+
+	//cancelled jobs that no slot is using
+	for (auto job : jobs)
+		if (job->cancelled && job->pending_slots == 0 && std::find(finished.begin(), finished.end(), job) == finished.end())
+			finished.push_back(job);
+	for (auto job : finished)
+		finishJob(job);
+
+	//map the free slots and let the background thread fill them
+	for (int i = 0; i < num_slots; ++i)
+	{
+		sSlot& slot = slots[i];
+		if (slot.state != SLOT_FREE)
+			continue;
+
+		sJob* job = NULL;
+		for (auto it : jobs)
+			if (!it->cancelled && it->next_level < it->num_levels)
+			{
+				job = it;
+				break;
+			}
+		if (!job)
+			break;
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+		//unsynchronized is safe, the fence of this slot was already signaled
+		slot.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slot_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (!slot.mapped)
+			break;
+		slot.state = SLOT_MAPPED;
+
+		//a slot only holds rows of one level
+		TextureBin::sLevel& level = job->bin->levels[job->next_level];
+		int row_bytes = job->bin->getRowBytes(job->next_level);
+		int num_rows = job->bin->getNumRows(job->next_level);
+		slot.job = job;
+		slot.level = job->next_level;
+		slot.start_row = job->next_row;
+		slot.num_rows = std::min((int)(slot_size / row_bytes), num_rows - job->next_row);
+		job->next_row += slot.num_rows;
+		if (job->next_row == num_rows)
+		{
+			job->next_level++;
+			job->next_row = 0;
+		}
+		job->pending_slots++;
+		slot.state = SLOT_FILLING;
+
+		sSlot* slot_ptr = &slot;
+		const uint8* src = level.data + (size_t)slot.start_row * row_bytes;
+		size_t bytes = (size_t)slot.num_rows * row_bytes;
+		TaskManager::background.addTask(new Task([slot_ptr, src, bytes]() {
+			memcpy(slot_ptr->mapped, src, bytes);
+			slot_ptr->state.store(SLOT_FILLED, std::memory_order_release);
+		}));
+	}
+
+	num_pending_jobs = (int)jobs.size();
+}
@@ -0,0 +1,78 @@
+#ifndef TEXTURE_UPLOADER_H
+#define TEXTURE_UPLOADER_H
+
+#include "includes.h"
+#include "texture.h"
+#include <atomic>
+#include <list>
+#include <string>
+
+//TextureUploader
+//streams pixels to VRAM through a ring of Pixel Buffer Objects (PBOs) that are reused all the time.
+//A background task copies the decoded rows of every mip level to a mapped PBO, and the main thread only issues
+//glTexSubImage2D from the PBO, limited by a byte budget per frame. A fence per slot tells
+//when the GPU finished reading it so it can be mapped again.
+//The rows go to a separate GL texture that replaces the storage of the texture once all of them arrived, so it is
+//drawn with what it had (the 1x1 placeholder or the dropped mips) and never with levels not uploaded yet.
+
+class TextureUploader {
+public:
+	enum eSlotState {
+		SLOT_FREE,		//unmapped, ready to be mapped
+		SLOT_MAPPED,	//mapped, waiting for data
+		SLOT_FILLING,	//a worker is copying rows into it
+		SLOT_FILLED,	//rows copied, waiting for the main thread to upload them
+		SLOT_IN_FLIGHT	//glTexSubImage2D issued, waiting for the fence
+	};
+
+	struct sJob;
+
+	struct sSlot {
+		GLuint pbo;
+		void* mapped;	//PBO memory while mapped
+		GLsync fence;	//signaled when the GPU finished reading from the PBO
+		std::atomic<int> state;
+		sJob* job;		//image that is being copied
+		int level;		//mip level of the rows
+		int start_row;
+		int num_rows;
+	};
+
+	//the levels of a texture waiting to be uploaded
+	struct sJob {
+		std::string filename; //textures are found by name, in case they are destroyed while streaming
+		TextureBin* bin;
+		Texture* staging;	//not in the manager, its storage is given to the texture when finished
+		int num_levels;		//levels to upload, the rest are generated by the GPU
+		int next_level;		//level of next_row
+		int next_row;		//first row not assigned to any slot (rows of blocks when compressed)
+		int rows_uploaded;	//of all the levels
+		int total_rows;
+		int pending_slots;	//slots still using the bin
+		bool cancelled;
+	};
+
+	static bool enabled;					//false to upload synchronously using Texture::loadFromBin
+	static int num_slots;					//PBOs in the ring
+	static size_t slot_size;				//bytes per PBO
+	static size_t max_bytes_per_frame;	//upload budget per frame
+
+	//stats of the last update
+	static size_t bytes_uploaded_last_frame;
+	static int num_pending_jobs;
+
+	//takes ownership of the bin, the texture keeps its storage till all the levels are uploaded
+	static void enqueue(Texture* texture, TextureBin* bin);
+
+	//call once per frame from the main thread
+	static void update();
+
+private:
+	static sSlot* slots;
+	static std::list<sJob*> jobs;
+
+	static void init();
+	static void finishJob(sJob* job);
+};
+
+#endif
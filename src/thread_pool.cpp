@@ -0,0 +1,232 @@
+#include "thread_pool.h"
+#include "task.h"
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+
+//worker of the calling thread, to push the tasks it adds to its own deque
+static thread_local int current_worker_index = -1;
+static thread_local ThreadPool* current_pool = NULL;
+
+// WorkStealingDeque *************************************
+//based on "Correct and Efficient Work-Stealing for Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli, 2013)
+
+WorkStealingDeque::WorkStealingDeque(int capacity)
+{
+	assert(capacity > 0 && (capacity & (capacity - 1)) == 0 && "capacity must be power of two");
+	top.store(0);
+	bottom.store(0);
+	buffer.store(new sBuffer(capacity));
+}
+
+WorkStealingDeque::~WorkStealingDeque()
+{
+	delete buffer.load();
+	for (auto old : old_buffers)
+		delete old;
+}
+
+void WorkStealingDeque::push(Task* task)
+{
+	int64_t b = bottom.load(std::memory_order_relaxed);
+	int64_t t = top.load(std::memory_order_acquire);
+	sBuffer* buf = buffer.load(std::memory_order_relaxed);
+	if (b - t > buf->capacity - 1)
+	{
+		//full, copy to a bigger one
+		sBuffer* bigger = new sBuffer(buf->capacity * 2);
+		for (int64_t i = t; i < b; ++i)
+			bigger->put(i, buf->get(i));
+		old_buffers.push_back(buf);
+		buffer.store(bigger, std::memory_order_release);
+		buf = bigger;
+	}
+	buf->put(b, task);
+	bottom.store(b + 1, std::memory_order_release); //publishes the task to the thieves
+}
+
+Task* WorkStealingDeque::pop()
+{
+	int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	sBuffer* buf = buffer.load(std::memory_order_relaxed);
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
+
+	if (t > b) //empty
+	{
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return NULL;
+	}
+
+	Task* task = buf->get(b);
+	if (t == b)
+	{
+		//last one, race against the thieves
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			task = NULL;
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return task;
+}
+
+Task* WorkStealingDeque::steal()
+{
+	int64_t t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = bottom.load(std::memory_order_acquire);
+	if (t >= b)
+		return NULL;
+
+	sBuffer* buf = buffer.load(std::memory_order_acquire);
+	Task* task = buf->get(t);
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return NULL;
+	return task;
+}
+
+bool WorkStealingDeque::empty() const
+{
+	return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+}
+
+// ThreadPool *************************************
+
+ThreadPool::ThreadPool()
+{
+	num_pending.store(0);
+	num_executed.store(0);
+	num_stolen.store(0);
+	num_sleeping.store(0);
+	must_stop.store(false);
+}
+
+ThreadPool::~ThreadPool()
+{
+	stop();
+}
+
+int ThreadPool::getWorkerIndex()
+{
+	return current_worker_index;
+}
+
+void ThreadPool::start(int num_threads)
+{
+	assert(workers.empty() && "ThreadPool already started");
+	if (num_threads <= 0)
+		num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+	must_stop = false;
+	//all the deques must exist before any worker tries to steal
+	for (int i = 0; i < num_threads; ++i)
+		workers.push_back(new sWorker());
+	for (int i = 0; i < num_threads; ++i)
+		workers[i]->thread = std::thread(&ThreadPool::workerLoop, this, i);
+	std::cout << "Starting Thread Pool with " << num_threads << " workers" << std::endl;
+}
+
+void ThreadPool::stop()
+{
+	if (workers.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		must_stop = true;
+	}
+	wake_condition.notify_all();
+	for (auto worker : workers)
+		worker->thread.join();
+
+	//discard the tasks that didnt start
+	for (auto worker : workers)
+	{
+		while (Task* task = worker->deque.pop())
+			delete task;
+		delete worker;
+	}
+	workers.clear();
+	while (!injector.empty())
+		delete injector.take(0);
+	num_pending = 0;
+	std::cout << "Ending Thread Pool" << std::endl;
+}
+
+void ThreadPool::addTask(Task* task)
+{
+	assert(task);
+	if (current_pool == this)
+		workers[current_worker_index]->deque.push(task);
+	else
+	{
+		std::lock_guard<std::mutex> lock(injector_mutex);
+		injector.push(task);
+	}
+
+	//a worker increases num_sleeping before checking num_pending, so one of both sees the change of the other
+	num_pending++;
+	if (num_sleeping > 0)
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		wake_condition.notify_one();
+	}
+}
+
+Task* ThreadPool::findTask(int index)
+{
+	//own tasks first, the last one added is the most likely to be in cache
+	Task* task = workers[index]->deque.pop();
+
+	if (!task)
+	{
+		std::lock_guard<std::mutex> lock(injector_mutex);
+		if (!injector.empty())
+			task = injector.take(injector.pick());
+	}
+
+	//steal starting from the next worker, so thieves dont all go to the same one
+	int num_workers = (int)workers.size();
+	for (int i = 1; i < num_workers && !task; ++i)
+	{
+		task = workers[(index + i) % num_workers]->deque.steal();
+		if (task)
+			num_stolen++;
+	}
+
+	if (task)
+		num_pending--;
+	return task;
+}
+
+void ThreadPool::execute(Task* task)
+{
+	task->execute();
+	delete task;
+	num_executed++;
+}
+
+void ThreadPool::workerLoop(int index)
+{
+	current_worker_index = index;
+	current_pool = this;
+
+	while (!must_stop)
+	{
+		Task* task = findTask(index);
+		if (task)
+		{
+			execute(task);
+			continue;
+		}
+
+		//nothing to do, park till a task is added (another thief may be taking it, then just try again)
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		num_sleeping++;
+		wake_condition.wait(lock, [this]() { return must_stop || num_pending > 0; });
+		num_sleeping--;
+	}
+
+	current_worker_index = -1;
+	current_pool = NULL;
+}
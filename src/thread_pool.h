@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include "task.h"
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Chase-Lev deque: the owner thread pushes and pops at the bottom (LIFO), other threads steal from the top (FIFO).
+//Only the owner can push or pop, any thread can steal. The buffer grows when full, old buffers are kept
+//until destruction because a thief may still be reading them.
+class WorkStealingDeque {
+public:
+	WorkStealingDeque(int capacity = 256);
+	~WorkStealingDeque();
+
+	void push(Task* task);	//owner only
+	Task* pop();			//owner only, NULL if empty
+	Task* steal();			//any thread, NULL if empty or another thread won the race
+	bool empty() const;
+
+private:
+	struct sBuffer {
+		int64_t capacity; //power of two
+		std::atomic<Task*>* items;
+		sBuffer(int64_t capacity) { this->capacity = capacity; items = new std::atomic<Task*>[capacity]; }
+		~sBuffer() { delete[] items; }
+		Task* get(int64_t i) { return items[i & (capacity - 1)].load(std::memory_order_relaxed); }
+		void put(int64_t i, Task* task) { items[i & (capacity - 1)].store(task, std::memory_order_relaxed); }
+	};
+
+	std::atomic<int64_t> top;
+	std::atomic<int64_t> bottom;
+	std::atomic<sBuffer*> buffer;
+	std::vector<sBuffer*> old_buffers;
+};
+
+//ThreadPool
+//a worker per core, each one with its own deque. Tasks added from a worker go to its deque (so tasks that spawn
+//tasks dont contend), tasks added from other threads go to a shared injector queue. Idle workers steal from
+//the others and, when there is nothing left, park on a condition variable until a task is added.
+//Priorities and cancellation apply to the injector, tasks spawned by workers are executed as they come.
+class ThreadPool {
+public:
+	ThreadPool();
+	~ThreadPool();
+
+	void start(int num_threads = 0); //0 means one per core
+	void stop(); //waits for the tasks being executed, pending ones are discarded
+	void addTask(Task* task); //can be called from any thread
+	int getNumThreads() { return (int)workers.size(); }
+	static int getWorkerIndex(); //-1 if the calling thread is not a worker
+
+	//stats
+	std::atomic<int> num_pending;	//tasks added and not started yet
+	std::atomic<long> num_executed;
+	std::atomic<long> num_stolen;
+
+private:
+	struct sWorker {
+		WorkStealingDeque deque;
+		std::thread thread;
+	};
+
+	std::vector<sWorker*> workers;
+	TaskList injector; //tasks added from outside the pool
+	std::mutex injector_mutex;
+
+	std::mutex sleep_mutex;
+	std::condition_variable wake_condition;
+	std::atomic<int> num_sleeping;
+	std::atomic<bool> must_stop;
+
+	void workerLoop(int index);
+	Task* findTask(int index);
+	void execute(Task* task);
+};
@@ -0,0 +1,128 @@
+#include "transform_kernels.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+//the rows of the matrix stay in registers for the whole array
+struct sMatrixRows {
+	simd::vec r0, r1, r2, r3;
+	sMatrixRows(const Matrix44& m) : r0(simd::load(m.m)), r1(simd::load(m.m + 4)), r2(simd::load(m.m + 8)), r3(simd::load(m.m + 12)) {}
+};
+
+static inline const float* element(const Vector3* array, int i, size_t stride)
+{
+	return (const float*)((const char*)array + i * stride);
+}
+
+static inline float* element(Vector3* array, int i, size_t stride)
+{
+	return (float*)((char*)array + i * stride);
+}
+
+static inline void transformBox(const sMatrixRows& m, const BoundingBox& box, BoundingBox& dst)
+{
+	const float* c = box.center.v;
+	const float* h = box.halfsize.v;
+	simd::vec center = simd::madd(simd::splat(c[0]), m.r0, m.r3);
+	center = simd::madd(simd::splat(c[1]), m.r1, center);
+	center = simd::madd(simd::splat(c[2]), m.r2, center);
+	simd::vec halfsize = simd::mul(simd::splat(h[0]), simd::abs(m.r0));
+	halfsize = simd::madd(simd::splat(h[1]), simd::abs(m.r1), halfsize);
+	halfsize = simd::madd(simd::splat(h[2]), simd::abs(m.r2), halfsize);
+	simd::store3(dst.center.v, center);
+	simd::store3(dst.halfsize.v, halfsize);
+}
+
+void TransformKernels::transformPoints(const Matrix44& m, const Vector3* src, int count, Vector3* dst, size_t src_stride, size_t dst_stride)
+{
+	src_stride = src_stride ? src_stride : sizeof(Vector3);
+	dst_stride = dst_stride ? dst_stride : sizeof(Vector3);
+	sMatrixRows rows(m);
+	for (int i = 0; i < count; ++i)
+	{
+		const float* p = element(src, i, src_stride);
+		simd::vec r = simd::madd(simd::splat(p[0]), rows.r0, rows.r3);
+		r = simd::madd(simd::splat(p[1]), rows.r1, r);
+		r = simd::madd(simd::splat(p[2]), rows.r2, r);
+		simd::store3(element(dst, i, dst_stride), r);
+	}
+}
+
+void TransformKernels::transformNormals(const Matrix44& m, const Vector3* src, int count, Vector3* dst, size_t src_stride, size_t dst_stride, bool normalize)
+{
+	src_stride = src_stride ? src_stride : sizeof(Vector3);
+	dst_stride = dst_stride ? dst_stride : sizeof(Vector3);
+	sMatrixRows rows(m);
+	for (int i = 0; i < count; ++i)
+	{
+		const float* n = element(src, i, src_stride);
+		simd::vec r = simd::mul(simd::splat(n[0]), rows.r0);
+		r = simd::madd(simd::splat(n[1]), rows.r1, r);
+		r = simd::madd(simd::splat(n[2]), rows.r2, r);
+		if (normalize)
+		{
+			float length2 = simd::dot(r, simd::mul(r, simd::set(1.0f, 1.0f, 1.0f, 0.0f)));
+			if (length2 > 0.0f)
+				r = simd::mul(r, simd::splat(1.0f / sqrtf(length2)));
+		}
+		simd::store3(element(dst, i, dst_stride), r);
+	}
+}
+
+void TransformKernels::transformBoxes(const Matrix44* matrices, const BoundingBox* boxes, int count, BoundingBox* dst)
+{
+	for (int i = 0; i < count; ++i)
+		transformBox(sMatrixRows(matrices[i]), boxes[i], dst[i]);
+}
+
+void TransformKernels::transformBoxes(const Matrix44& m, const BoundingBox* boxes, int count, BoundingBox* dst)
+{
+	sMatrixRows rows(m);
+	for (int i = 0; i < count; ++i)
+		transformBox(rows, boxes[i], dst[i]);
+}
+
+void TransformKernels::computeMinMax(const Vector3* points, int count, Vector3& min, Vector3& max, size_t stride)
+{
+	assert(count > 0);
+	stride = stride ? stride : sizeof(Vector3);
+	int i = 0;
+	simd::vec vmin = simd::load3(points->v);
+	simd::vec vmax = vmin;
+
+	//packed points: 4 of them are 3 registers, whose lanes keep the same component in every iteration
+	if (stride == sizeof(Vector3) && count >= 4)
+	{
+		const float* p = points->v;
+		simd::vec min0 = simd::load(p), min1 = simd::load(p + 4), min2 = simd::load(p + 8);
+		simd::vec max0 = min0, max1 = min1, max2 = min2;
+		for (i = 4; i + 4 <= count; i += 4)
+		{
+			const float* group = p + i * 3;
+			simd::vec a = simd::load(group), b = simd::load(group + 4), c = simd::load(group + 8);
+			min0 = simd::min(min0, a); min1 = simd::min(min1, b); min2 = simd::min(min2, c);
+			max0 = simd::max(max0, a); max1 = simd::max(max1, b); max2 = simd::max(max2, c);
+		}
+		//the registers store like the 4 points, component c of point k is at 3*k+c
+		float mins[12], maxs[12];
+		simd::store(mins, min0); simd::store(mins + 4, min1); simd::store(mins + 8, min2);
+		simd::store(maxs, max0); simd::store(maxs + 4, max1); simd::store(maxs + 8, max2);
+		vmin = simd::load3(mins);
+		vmax = simd::load3(maxs);
+		for (int k = 1; k < 4; ++k)
+		{
+			vmin = simd::min(vmin, simd::load3(mins + k * 3));
+			vmax = simd::max(vmax, simd::load3(maxs + k * 3));
+		}
+	}
+
+	for (; i < count; ++i)
+	{
+		simd::vec p = simd::load3(element(points, i, stride));
+		vmin = simd::min(vmin, p);
+		vmax = simd::max(vmax, p);
+	}
+	simd::store3(min.v, vmin);
+	simd::store3(max.v, vmax);
+}
@@ -0,0 +1,28 @@
+#ifndef TRANSFORM_KERNELS_H
+#define TRANSFORM_KERNELS_H
+
+#include "framework.h"
+#include <cstddef>
+
+//TransformKernels
+//bulk versions of the transforms of framework.h for arrays of points, normals and boxes, with the SIMD helpers of
+//math_simd.h. Strides are in bytes and 0 means consecutive Vector3, so they also work on the vertices of interleaved
+//meshes. They run in the calling thread, split big arrays with parallelFor.
+
+class TransformKernels {
+public:
+	//dst[i] = m * src[i], src and dst can be the same array
+	static void transformPoints(const Matrix44& m, const Vector3* src, int count, Vector3* dst, size_t src_stride = 0, size_t dst_stride = 0);
+	//only rotation and scale, like Matrix44::rotateVector. With normalize the results have length 1 (for scaled matrices)
+	static void transformNormals(const Matrix44& m, const Vector3* src, int count, Vector3* dst, size_t src_stride = 0, size_t dst_stride = 0, bool normalize = false);
+
+	//dst[i] = transformBoundingBox(matrices[i], boxes[i]). Arvo's method: the center is transformed and the halfsize
+	//projected on the absolute value of the axes, the same box as the eight corners but without transforming them
+	static void transformBoxes(const Matrix44* matrices, const BoundingBox* boxes, int count, BoundingBox* dst);
+	static void transformBoxes(const Matrix44& m, const BoundingBox* boxes, int count, BoundingBox* dst);
+
+	//count must be bigger than 0
+	static void computeMinMax(const Vector3* points, int count, Vector3& min, Vector3& max, size_t stride = 0);
+};
+
+#endif
@@ -4,7 +4,11 @@
 	#include <windows.h>
 #else
 	#include <sys/time.h>
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
 #endif
+#include <sys/stat.h>
 
 #include "includes.h"
 
@@ -137,6 +141,83 @@ bool readFileBin(const std::string& filename, std::vector<unsigned char>& buffer
 	return true;
 }
 
+bool getFileInfo(const std::string& filename, long long& modification_time, long long& size)
+{
+	struct stat stbuffer;
+	if (stat(filename.c_str(), &stbuffer) != 0)
+		return false;
+	modification_time = (long long)stbuffer.st_mtime;
+	size = (long long)stbuffer.st_size;
+	return true;
+}
+
+unsigned long long hashString(const std::string& str, unsigned long long seed)
+{
+	unsigned long long hash = seed;
+	for (size_t i = 0; i < str.size(); ++i)
+	{
+		hash ^= (unsigned char)str[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+#ifdef WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	HANDLE mapping = file_size.QuadPart ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	CloseHandle(file); //the mapping keeps it open
+	if (!mapping)
+		return false;
+	data = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+	{
+		CloseHandle(mapping);
+		return false;
+	}
+	handle = mapping;
+	size = (size_t)file_size.QuadPart;
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat stbuffer;
+	if (fstat(fd, &stbuffer) != 0 || stbuffer.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* ptr = mmap(NULL, stbuffer.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //the mapping keeps it open
+	if (ptr == MAP_FAILED)
+		return false;
+	data = (unsigned char*)ptr;
+	size = (size_t)stbuffer.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (!data)
+		return;
+#ifdef WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)handle);
+#else
+	munmap(data, size);
+#endif
+	data = NULL;
+	size = 0;
+	handle = NULL;
+}
+
 bool checkGLErrors()
 {
 	#ifndef _DEBUG
@@ -341,20 +422,24 @@ void drawGrid()
 	grid_shader->disable();
 }
 
-void ImGuiMatrix44(Matrix44& matrix, const char* text)
+bool ImGuiMatrix44(Matrix44& matrix, const char* text)
 {
+	bool edited = false;
 	#ifndef SKIP_IMGUI
 	if (ImGui::TreeNode((void*)&matrix, "Model"))
 	{
 		float matrixTranslation[3], matrixRotation[3], matrixScale[3];
 		ImGuizmo::DecomposeMatrixToComponents(matrix.m, matrixTranslation, matrixRotation, matrixScale);
-		ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
-		ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
-		ImGui::DragFloat3("Scale", matrixScale, 0.1f);
-		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, matrix.m);
+		edited |= ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
+		edited |= ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
+		edited |= ImGui::DragFloat3("Scale", matrixScale, 0.1f);
+		//recomposing it changes the last bits even if nothing was edited
+		if (edited)
+			ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, matrix.m);
 		ImGui::TreePop();
 	}
 	#endif
+	return edited;
 }
 
 char* fetchWord(char* data, char* word)
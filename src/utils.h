@@ -18,6 +18,21 @@ long getTime();
 float * snapshot();
 bool readFile(const std::string& filename, std::string& content);
 bool readFileBin(const std::string& filename, std::vector<unsigned char>& buffer);
+bool getFileInfo(const std::string& filename, long long& modification_time, long long& size); //false if not found
+unsigned long long hashString(const std::string& str, unsigned long long seed = 14695981039346656037ULL); //FNV-1a, chain them with seed
+
+//read-only file mapped in memory, pages are loaded by the OS when accessed
+class MappedFile {
+public:
+	unsigned char* data;
+	size_t size;
+	MappedFile() { data = NULL; size = 0; handle = NULL; }
+	~MappedFile() { close(); }
+	bool open(const char* filename);
+	void close();
+private:
+	void* handle;
+};
 
 //generic purposes fuctions
 void drawGrid();
@@ -36,7 +51,7 @@ std::vector<std::string>& split(const std::string &s, char delim, std::vector<st
 std::vector<std::string> split(const std::string &s, char delim);
 std::string join(std::vector<std::string>& strings, const char* delim);
 
-void ImGuiMatrix44(Matrix44& matrix, const char* text);
+bool ImGuiMatrix44(Matrix44& matrix, const char* text); //true if it was edited
 
 std::string getGPUStats();
 void drawGrid();
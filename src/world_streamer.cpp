@@ -0,0 +1,230 @@
+#include "world_streamer.h"
+#include "prefab.h"
+#include "task.h"
+
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <iostream>
+
+using namespace GTR;
+
+WorldStreamer::WorldStreamer(Scene* scene)
+{
+	this->scene = scene;
+	cell_size = 100.0f;
+	load_radius = 500.0f;
+	unload_radius = 650.0f;
+	memory_budget = (size_t)512 * 1024 * 1024;
+	max_loading_cells = 8;
+	num_loaded_cells = num_loading_cells = num_entities = 0;
+	total_cells_loaded = total_cells_released = total_prefabs_unloaded = 0;
+	over_budget = false;
+	num_pending_tasks = 0;
+}
+
+WorldStreamer::~WorldStreamer()
+{
+	releaseAll();
+	waitPendingTasks();
+}
+
+//the tasks of the loads in progress point to the cells, they must run before the cells are destroyed
+void WorldStreamer::waitPendingTasks()
+{
+	while (num_pending_tasks)
+	{
+		TaskManager::foreground.drainTasks();
+		std::this_thread::yield();
+	}
+}
+
+bool WorldStreamer::open(const char* filename)
+{
+	releaseAll();
+	waitPendingTasks(); //they delete the entities of the released cells
+	cells.clear();
+	if (!bin.open(filename))
+		return false;
+
+	scene->background_color = bin.info.background_color;
+	scene->ambient_light = bin.info.ambient_light;
+	scene->main_camera.eye = bin.info.camera_eye;
+	scene->main_camera.center = bin.info.camera_center;
+	scene->main_camera.fov = bin.info.camera_fov;
+
+	for (int i = 0; i < bin.info.num_entities; ++i)
+	{
+		const Matrix44& model = bin.entities[i].model;
+		Vector3 position(model.m[12], model.m[13], model.m[14]);
+		int x = (int)floor(position.x / cell_size);
+		int z = (int)floor(position.z / cell_size);
+		sWorldCell& cell = cells[getCellKey(x, z)];
+		if (cell.bin_entities.empty())
+		{
+			cell.x = x;
+			cell.z = z;
+			cell.state = CELL_UNLOADED;
+			cell.pending = 0;
+			cell.request = 0;
+		}
+		cell.bin_entities.push_back(i);
+	}
+	std::cout << " + World: " << bin.info.num_entities << " entities in " << cells.size() << " cells" << std::endl;
+	return true;
+}
+
+float WorldStreamer::getCellDistance(const sWorldCell& cell, const Vector3& position)
+{
+	float min_x = cell.x * cell_size;
+	float min_z = cell.z * cell_size;
+	float dx = std::max(std::max(min_x - position.x, position.x - (min_x + cell_size)), 0.0f);
+	float dz = std::max(std::max(min_z - position.z, position.z - (min_z + cell_size)), 0.0f);
+	return sqrtf(dx * dx + dz * dz);
+}
+
+void WorldStreamer::update(const Vector3& camera_position)
+{
+	assert(unload_radius >= load_radius);
+
+	//release the cells that went too far
+	for (int i = 0; i < (int)active_cells.size();)
+	{
+		sWorldCell* cell = active_cells[i];
+		if (getCellDistance(*cell, camera_position) <= unload_radius)
+		{
+			++i;
+			continue;
+		}
+		releaseCell(cell);
+		active_cells[i] = active_cells.back();
+		active_cells.pop_back();
+	}
+
+	//the prefabs nobody uses are a cache, till the budget needs their memory
+	total_prefabs_unloaded += Prefab::UnloadUnused(memory_budget);
+
+	//still over budget: the cells kept by the hysteresis go first, the farthest before
+	over_budget = Prefab::sMemoryUsed > memory_budget;
+	if (over_budget)
+	{
+		std::sort(active_cells.begin(), active_cells.end(), [&](sWorldCell* a, sWorldCell* b) {
+			return getCellDistance(*a, camera_position) > getCellDistance(*b, camera_position);
+		});
+		while (active_cells.size() && Prefab::sMemoryUsed > memory_budget && getCellDistance(*active_cells[0], camera_position) > load_radius)
+		{
+			releaseCell(active_cells[0]);
+			active_cells.erase(active_cells.begin());
+			total_prefabs_unloaded += Prefab::UnloadUnused(memory_budget);
+		}
+		over_budget = Prefab::sMemoryUsed > memory_budget;
+	}
+
+	//cells to load, nearest first
+	if (!over_budget && num_loading_cells < max_loading_cells)
+	{
+		std::vector<std::pair<float, sWorldCell*>> candidates;
+		int min_x = (int)floor((camera_position.x - load_radius) / cell_size);
+		int max_x = (int)floor((camera_position.x + load_radius) / cell_size);
+		int min_z = (int)floor((camera_position.z - load_radius) / cell_size);
+		int max_z = (int)floor((camera_position.z + load_radius) / cell_size);
+		for (int z = min_z; z <= max_z; ++z)
+			for (int x = min_x; x <= max_x; ++x)
+			{
+				auto it = cells.find(getCellKey(x, z));
+				if (it == cells.end() || it->second.state != CELL_UNLOADED)
+					continue;
+				float distance = getCellDistance(it->second, camera_position);
+				if (distance <= load_radius)
+					candidates.push_back(std::make_pair(distance, &it->second));
+			}
+		std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, sWorldCell*>& a, const std::pair<float, sWorldCell*>& b) { return a.first < b.first; });
+		for (auto& candidate : candidates)
+		{
+			if (num_loading_cells >= max_loading_cells)
+				break;
+			loadCell(candidate.second);
+			active_cells.push_back(candidate.second);
+		}
+	}
+}
+
+void WorldStreamer::releaseAll()
+{
+	for (auto cell : active_cells)
+		releaseCell(cell);
+	active_cells.clear();
+}
+
+void WorldStreamer::loadCell(sWorldCell* cell)
+{
+	assert(cell->state == CELL_UNLOADED);
+	cell->state = CELL_LOADING;
+	cell->request++;
+	num_loading_cells++;
+	total_cells_loaded++;
+
+	//same as Scene::load, the entities waiting for the same prefab are added together
+	std::map<TaskEvent*, std::vector<BaseEntity*>> waiting;
+	std::vector<BaseEntity*> ready;
+	for (int index : cell->bin_entities)
+	{
+		BaseEntity* ent = scene->createEntity(bin, index);
+		TaskEventRef ent_loaded = ent->getLoadedEvent();
+		if (!ent_loaded || ent_loaded->isFinished())
+			ready.push_back(ent);
+		else
+			waiting[ent_loaded.get()].push_back(ent);
+	}
+
+	cell->pending = (int)waiting.size() + 1;
+	addCellEntities(cell, ready, cell->request);
+	int request = cell->request;
+	for (auto& it : waiting)
+	{
+		std::vector<BaseEntity*>& list = it.second;
+		TaskEventRef event = list[0]->getLoadedEvent();
+		num_pending_tasks++;
+		TaskManager::foreground.run([this, cell, list, request]() {
+			num_pending_tasks--;
+			addCellEntities(cell, list, request);
+		}, { event });
+	}
+}
+
+void WorldStreamer::addCellEntities(sWorldCell* cell, const std::vector<BaseEntity*>& list, int request)
+{
+	//the cell was released while they were loading
+	if (request != cell->request)
+	{
+		for (auto ent : list)
+			delete ent;
+		return;
+	}
+	for (auto ent : list)
+		scene->addEntity(ent);
+	cell->entities.insert(cell->entities.end(), list.begin(), list.end());
+	num_entities += (int)list.size();
+	if (--cell->pending == 0)
+	{
+		cell->state = CELL_LOADED;
+		num_loading_cells--;
+		num_loaded_cells++;
+	}
+}
+
+void WorldStreamer::releaseCell(sWorldCell* cell)
+{
+	if (cell->state == CELL_LOADING)
+		num_loading_cells--;
+	else if (cell->state == CELL_LOADED)
+		num_loaded_cells--;
+	cell->state = CELL_UNLOADED;
+	cell->request++; //the entities still loading are deleted when their prefab finishes
+	cell->pending = 0;
+	num_entities -= (int)cell->entities.size();
+	scene->removeEntities(cell->entities);
+	cell->entities.clear();
+	total_cells_released++;
+}
@@ -0,0 +1,79 @@
+#ifndef WORLD_STREAMER_H
+#define WORLD_STREAMER_H
+
+#include "framework.h"
+#include "scene.h"
+#include <vector>
+#include <unordered_map>
+
+namespace GTR {
+
+	enum eWorldCellState {
+		CELL_UNLOADED = 0,
+		CELL_LOADING = 1, //its entities are waiting for their prefabs
+		CELL_LOADED = 2
+	};
+
+	//a square of the grid (in the XZ plane) and the entities of the world whose position is inside
+	struct sWorldCell {
+		int x, z;
+		eWorldCellState state;
+		std::vector<int> bin_entities;		//indices in the .sbin of the world
+		std::vector<BaseEntity*> entities;	//added to the scene
+		int pending;	//groups of entities still waiting for their prefabs
+		int request;	//changes every time the cell is loaded or released, to drop the entities of an old request
+	};
+
+	//WorldStreamer
+	//keeps in the scene only the entities of the cells near the camera. The world is a .sbin (mapped, so its size doesnt
+	//matter) whose entities are assigned to a grid of cells. The cells inside load_radius are loaded, nearest first, and
+	//the ones farther than unload_radius are released, the distance between both radii avoids loading and releasing
+	//the same cells while the camera moves around a border. The entities hold references to their prefabs, the unused
+	//ones are kept as a cache till the memory of the prefabs goes over memory_budget (textures have their own budget).
+
+	class WorldStreamer
+	{
+	public:
+		float cell_size;
+		float load_radius;
+		float unload_radius;		//bigger than load_radius
+		size_t memory_budget;		//for the meshes of the prefabs, no more cells are loaded while it is exceeded
+		int max_loading_cells;		//cells waiting for their prefabs at the same time
+
+		Scene* scene;
+		SceneBin bin;
+		std::unordered_map<long long, sWorldCell> cells; //only the ones with entities
+
+		//stats
+		int num_loaded_cells;
+		int num_loading_cells;
+		int num_entities;			//in the scene
+		long total_cells_loaded;
+		long total_cells_released;
+		long total_prefabs_unloaded;
+		bool over_budget;			//in the last update, even after unloading the unused prefabs
+
+		WorldStreamer(Scene* scene);
+		~WorldStreamer(); //releases all the cells, it waits for the loads in progress
+
+		//maps the world (a .sbin, or a JSON through its .sbin like Scene::load) and assigns its entities to cells.
+		//The global properties of the scene are read from it
+		bool open(const char* filename);
+		void update(const Vector3& camera_position); //call it every frame from the main thread
+		void releaseAll(); //call it before clearing the scene
+
+		long long getCellKey(int x, int z) { return ((long long)x << 32) | (unsigned int)z; }
+		float getCellDistance(const sWorldCell& cell, const Vector3& position); //to the nearest point of the cell, in XZ
+
+	private:
+		std::vector<sWorldCell*> active_cells; //loading or loaded
+		int num_pending_tasks;
+		void waitPendingTasks();
+		void loadCell(sWorldCell* cell);
+		void releaseCell(sWorldCell* cell);
+		void addCellEntities(sWorldCell* cell, const std::vector<BaseEntity*>& list, int request);
+	};
+
+};
+
+#endif